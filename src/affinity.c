@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+
+#include "affinity.h"
+#include "mmalloc.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+#define CPU_ONLINE            "/sys/devices/system/cpu/online"
+#define CPU_DIR               "/sys/devices/system/cpu/cpu%d"
+#define NODE_DIR              "/sys/devices/system/node"
+#define CPU_LIST_SIZE         1024
+#define CPU_LIST_CAPACITY     16
+
+/* Flags of get_mempolicy(2): return the node of the page at an address. */
+#define MPOL_F_NODE           (1 << 0)
+#define MPOL_F_ADDR           (1 << 1)
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+struct CpuList {
+  int *cpus;                                  /* The CPUs, in the order threads are placed on them. */
+  unsigned int length;                        /* The number of CPUs. */
+  unsigned int capacity;                      /* The number of CPUs allocated. */
+};
+
+
+/**********************************************************************
+ *                              Parsing.
+ **********************************************************************/
+
+/*
+ * @param list: The list to add to.
+ * @param cpu: The CPU to add.
+ */
+static void cpuListAppend(CpuList *list, int cpu) {
+  if (list->length == list->capacity) {
+    list->capacity *= 2;
+    list->cpus = mrealloc(list->cpus, sizeof(int) * list->capacity);
+  }
+  list->cpus[list->length++] = cpu;
+}
+
+/*
+ * Read a CPU number off the front of a string.
+ *
+ * @param spec: The string.
+ * @param cpu: Where to store the number.
+ * @return The rest of the string, or NULL if it does not start with a valid CPU.
+ */
+static const char *parseCpu(const char *spec, int *cpu) {
+  char *end;
+  long value;
+
+  if (!isdigit((unsigned char) *spec))
+    return NULL;
+  value = strtol(spec, &end, 10);
+  if (value >= CPU_SETSIZE)
+    return NULL;
+
+  *cpu = value;
+  return end;
+}
+
+/*
+ * Add the CPUs of a list in the kernel's format to a list.
+ *
+ * @param list: The list to add to.
+ * @param spec: Ranges and single CPUs separated by commas, such as "0-3,8".
+ * @return Whether the format was valid.
+ */
+static bool cpuListAppendSpec(CpuList *list, const char *spec) {
+  int first, last;
+
+  do {
+    if ((spec = parseCpu(spec, &first)) == NULL)
+      return false;
+    last = first;
+    if (*spec == '-' && ((spec = parseCpu(spec + 1, &last)) == NULL || last < first))
+      return false;
+
+    for (int cpu = first; cpu <= last; cpu++)
+      cpuListAppend(list, cpu);
+  } while (*spec++ == ',');
+
+  /* Sysfs ends its lists with a newline. */
+  return spec[-1] == '\0' || (spec[-1] == '\n' && *spec == '\0');
+}
+
+/*
+ * Add every online CPU to a list, node by node.
+ *
+ * @param list: The list to add to.
+ * @return Whether the online CPUs could be found out.
+ */
+static bool cpuListAppendOnline(CpuList *list) {
+  char online[CPU_LIST_SIZE];
+  FILE *file = fopen(CPU_ONLINE, "r");
+  bool read = file != NULL && fgets(online, sizeof(online), file) != NULL;
+  int cpu;
+
+  if (file != NULL)
+    fclose(file);
+  if (!read || !cpuListAppendSpec(list, online)) {
+    list->length = 0;
+    for (long i = 0; i < sysconf(_SC_NPROCESSORS_ONLN); i++)
+      cpuListAppend(list, i);
+  }
+
+  /* Insertion sort by node keeps the CPUs of a node in order. */
+  for (unsigned int i = 1; i < list->length; i++) {
+    unsigned int j = i;
+    cpu = list->cpus[i];
+    for (; j > 0 && affinityNode(list->cpus[j - 1]) > affinityNode(cpu); j--)
+      list->cpus[j] = list->cpus[j - 1];
+    list->cpus[j] = cpu;
+  }
+
+  return list->length > 0;
+}
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Parse a list of CPUs.
+ *
+ * @param spec: Ranges and single CPUs separated by commas, such as "0-3,8",
+ *              or "all" for every online CPU.
+ * @return The newly created list, or NULL if the list is invalid or empty.
+ */
+CpuList *cpuListParse(const char *spec) {
+  assert(spec != NULL);
+
+  CpuList *list = mmalloc(sizeof(CpuList));
+  bool valid;
+
+  list->length = 0;
+  list->capacity = CPU_LIST_CAPACITY;
+  list->cpus = mmalloc(sizeof(int) * list->capacity);
+
+  if (strcmp(spec, "all") == 0)
+    valid = cpuListAppendOnline(list);
+  else
+    valid = cpuListAppendSpec(list, spec);
+
+  if (!valid) {
+    cpuListFree(list);
+    return NULL;
+  }
+  return list;
+}
+
+/*
+ * Free an existing CPU list.
+ *
+ * @param list: The list to free.
+ */
+void cpuListFree(CpuList *list) {
+  assert(list != NULL);
+  mfree(list->cpus);
+  mfree(list);
+}
+
+
+/**********************************************************************
+ *                       CPU list information.
+ **********************************************************************/
+
+/*
+ * @param list: The list to examine.
+ * @return The number of CPUs in the list.
+ */
+unsigned int cpuListLength(const CpuList *list) {
+  assert(list != NULL);
+  return list->length;
+}
+
+/*
+ * Find the CPU to place a thread on. There may be more threads than CPUs, in
+ * which case they go around the list again.
+ *
+ * @param list: The list to examine.
+ * @param index: The index of the thread.
+ * @return The CPU.
+ */
+int cpuListGet(const CpuList *list, unsigned int index) {
+  assert(list != NULL);
+  return list->cpus[index % list->length];
+}
+
+
+/**********************************************************************
+ *                              Topology.
+ **********************************************************************/
+
+/*
+ * @return The number of NUMA nodes, at least 1.
+ */
+unsigned int affinityNodes(void) {
+  DIR *dir = opendir(NODE_DIR);
+  struct dirent *entry;
+  unsigned int nodes = 0, node;
+
+  if (dir == NULL)
+    return 1;
+  while ((entry = readdir(dir)) != NULL)
+    if (sscanf(entry->d_name, "node%u", &node) == 1)
+      nodes++;
+  closedir(dir);
+
+  return nodes > 0 ? nodes : 1;
+}
+
+/*
+ * @param cpu: A CPU.
+ * @return The NUMA node the CPU belongs to, 0 if the machine reports none.
+ */
+int affinityNode(int cpu) {
+  char path[64];
+  DIR *dir;
+  struct dirent *entry;
+  int node = 0;
+
+  snprintf(path, sizeof(path), CPU_DIR, cpu);
+  if ((dir = opendir(path)) == NULL)
+    return 0;
+  while ((entry = readdir(dir)) != NULL)
+    if (sscanf(entry->d_name, "node%d", &node) == 1)
+      break;
+  closedir(dir);
+
+  return node;
+}
+
+/*
+ * @param address: An address in a page that was already touched.
+ * @return The NUMA node the page is on, or -1 if it could not be found out.
+ */
+int affinityMemoryNode(const void *address) {
+  int node;
+
+  if (syscall(SYS_get_mempolicy, &node, NULL, 0, address, MPOL_F_NODE | MPOL_F_ADDR) < 0)
+    return -1;
+  return node;
+}
+
+
+/**********************************************************************
+ *                          Affinity methods.
+ **********************************************************************/
+
+/*
+ * Pin the calling thread to a CPU.
+ *
+ * @param cpu: The CPU to run on.
+ * @return Whether the thread was pinned.
+ */
+bool affinityPin(int cpu) {
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
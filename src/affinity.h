@@ -0,0 +1,37 @@
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+#include <stdbool.h>
+
+
+/*
+ * CPU affinity and NUMA placement.
+ *
+ * A CPU list names the CPUs a group of threads runs on, in the kernel's own
+ * format ("0-3,8,10-11"), or "all" for every online CPU, ordered node by node.
+ * The topology comes from sysfs, so no NUMA library is needed; a machine that
+ * does not report one is a single node.
+ *
+ * Linux places a page on the node of the CPU that first touches it, so memory a
+ * pinned thread allocates for itself stays local to it without asking.
+ */
+
+typedef struct CpuList CpuList;
+
+/* Memory management. */
+CpuList *cpuListParse(const char *spec);
+void cpuListFree(CpuList *list);
+
+/* CPU list information. */
+unsigned int cpuListLength(const CpuList *list);
+int cpuListGet(const CpuList *list, unsigned int index);
+
+/* Topology. */
+unsigned int affinityNodes(void);
+int affinityNode(int cpu);
+int affinityMemoryNode(const void *address);
+
+/* Affinity methods. */
+bool affinityPin(int cpu);
+
+#endif
@@ -0,0 +1,554 @@
+#include "buffer.h"
+#include "event.h"
+#include "histogram.h"
+#include "mmalloc.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+ * Load generator for a running server, modeled on redis-benchmark.
+ *
+ * A number of connections each keep `pipeline` requests in flight, picking every
+ * request from a weighted mix of commands over random keys, until the requested
+ * number of requests has completed. The latency of each request, from the moment
+ * it is queued to the moment its reply arrives, is recorded in a histogram per
+ * command. Requests use the binary protocol, so replies are framed by their length.
+ * Every key is added before the run starts, so reads find a document.
+ *
+ *   rtdoc-benchmark [-h host] [-p port] [-c clients] [-n requests] [-P pipeline]
+ *                   [-r keyspace] [-d document size] [-t command[:weight],...]
+ */
+
+#define BENCH_DEFAULT_HOST      "localhost"
+#define BENCH_DEFAULT_PORT      7890
+#define BENCH_DEFAULT_CLIENTS   50
+#define BENCH_DEFAULT_REQUESTS  100000
+#define BENCH_DEFAULT_PIPELINE  1
+#define BENCH_DEFAULT_KEYSPACE  1000
+#define BENCH_DEFAULT_DOC_SIZE  64
+#define BENCH_DEFAULT_MIX       "get"
+#define BUFFER_SIZE             4096
+#define MAX_EVENTS              256
+#define POPULATE_BATCH          256
+#define ARG_SIZE                32
+
+typedef enum BenchCommand {
+  BENCH_PING,
+  BENCH_ADD,
+  BENCH_GET,
+  BENCH_START,
+  BENCH_END,
+  BENCH_MODIFY,
+  NUM_BENCH_COMMANDS
+} BenchCommand;
+
+static const char *commandNames[NUM_BENCH_COMMANDS] = {
+  [BENCH_PING]    = "ping",
+  [BENCH_ADD]     = "add",
+  [BENCH_GET]     = "get",
+  [BENCH_START]   = "start",
+  [BENCH_END]     = "end",
+  [BENCH_MODIFY]  = "modify"
+};
+
+
+/********************************************************************************
+ *                              Struct declarations.
+ *******************************************************************************/
+
+typedef struct Connection {
+  int fd;                                     /* The socket connected to the server. */
+  unsigned int id;                            /* The index of the connection, which names its user. */
+  Buffer *input;                              /* Replies received but not yet counted. */
+  Buffer *output;                             /* Requests queued but not yet written. */
+  uint64_t *sent;                             /* When each request in flight was queued, oldest first. */
+  BenchCommand *commands;                     /* The command of each request in flight. */
+  unsigned int oldest;                        /* Where the oldest request in flight is in the ring. */
+  unsigned int inFlight;                      /* The number of requests awaiting a reply. */
+} Connection;
+
+typedef struct Benchmark {
+  char *host;                                 /* The host the server runs on. */
+  unsigned int port;                          /* The port the server listens on. */
+  unsigned int clients;                       /* The number of connections. */
+  unsigned long requests;                     /* The number of requests to complete. */
+  unsigned int pipeline;                      /* The number of requests each connection keeps in flight. */
+  unsigned int keyspace;                      /* The number of keys to pick from. */
+  unsigned int docSize;                       /* The size of each document added. */
+  unsigned int weights[NUM_BENCH_COMMANDS];   /* How often each command is picked. */
+  unsigned int totalWeight;                   /* The sum of the weights. */
+  char *document;                             /* The document that is added. */
+  uint64_t seed;                              /* The state of the random number generator. */
+  unsigned long issued;                       /* The number of requests queued so far. */
+  unsigned long completed;                    /* The number of replies received so far. */
+  Histogram *latency[NUM_BENCH_COMMANDS];     /* The latency of each command, in microseconds. */
+  EventLoop *loop;                            /* Readiness notifications for every connection. */
+  Connection *connections;                    /* The connections. */
+} Benchmark;
+
+Benchmark bench;                              /* Global benchmark struct. */
+
+
+/********************************************************************************
+ *                              Utility functions.
+ *******************************************************************************/
+
+/*
+ * @return The current monotonic time in nanoseconds.
+ */
+static uint64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * @return A pseudo-random number (xorshift64*).
+ */
+static uint64_t benchRandom(void) {
+  bench.seed ^= bench.seed >> 12;
+  bench.seed ^= bench.seed << 25;
+  bench.seed ^= bench.seed >> 27;
+  return bench.seed * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * Print how to run the benchmark, and exit.
+ */
+static void benchUsage(void) {
+  fprintf(stderr,
+          "Usage: rtdoc-benchmark [-h host] [-p port] [-c clients] [-n requests] [-P pipeline]\n"
+          "                       [-r keyspace] [-d document size] [-t command[:weight],...]\n"
+          "Commands: ping, add, get, start, end, modify (default " BENCH_DEFAULT_MIX ").\n");
+  exit(1);
+}
+
+/*
+ * Parse the command mix, such as "get:8,add:1,modify:1". A command without a weight gets 1.
+ *
+ * @param mix: The command mix; it is modified.
+ */
+static void benchParseMix(char *mix) {
+  char *command, *weight;
+  int i;
+
+  memset(bench.weights, 0, sizeof(bench.weights));
+  bench.totalWeight = 0;
+
+  for (command = strtok(mix, ","); command != NULL; command = strtok(NULL, ",")) {
+    if ((weight = strchr(command, ':')) != NULL)
+      *weight++ = '\0';
+    for (i = 0; i < NUM_BENCH_COMMANDS && strcmp(command, commandNames[i]); i++);
+    if (i == NUM_BENCH_COMMANDS) {
+      fprintf(stderr, "Unknown command %s.\n", command);
+      benchUsage();
+    }
+    bench.weights[i] += weight != NULL ? atoi(weight) : 1;
+  }
+
+  for (i = 0; i < NUM_BENCH_COMMANDS; i++)
+    bench.totalWeight += bench.weights[i];
+  if (bench.totalWeight == 0)
+    benchUsage();
+}
+
+/*
+ * Connect to the server.
+ *
+ * @return The connected socket.
+ */
+static int benchConnect(void) {
+  struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM }, *addr;
+  char port[ARG_SIZE];
+  int fd;
+
+  snprintf(port, sizeof(port), "%u", bench.port);
+  if (getaddrinfo(bench.host, port, &hints, &addr) != 0) {
+    fprintf(stderr, "Could not find host %s.\n", bench.host);
+    exit(1);
+  }
+
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 || connect(fd, addr->ai_addr, addr->ai_addrlen) < 0) {
+    fprintf(stderr, "Could not connect to %s on port %u.\n", bench.host, bench.port);
+    exit(1);
+  }
+
+  freeaddrinfo(addr);
+  return fd;
+}
+
+
+/********************************************************************************
+ *                             Requests and replies.
+ *******************************************************************************/
+
+/*
+ * Queue a binary request.
+ *
+ * @param output: Where to queue the request.
+ * @param argc: The number of arguments, including the command.
+ * @param argv: The arguments.
+ */
+static void benchAppendRequest(Buffer *output, int argc, const char **argv) {
+  bufferFormat(output, "*%d\r\n", argc);
+  for (int i = 0; i < argc; i++) {
+    bufferFormat(output, "$%zu\r\n", strlen(argv[i]));
+    bufferAppend(output, argv[i], strlen(argv[i]));
+    bufferAppend(output, "\r\n", 2);
+  }
+}
+
+/*
+ * Queue a request for a command on a key.
+ *
+ * @param output: Where to queue the request.
+ * @param command: The command to send.
+ * @param key: The index of the key.
+ * @param user: The index of the user sending it.
+ */
+static void benchAppendCommand(Buffer *output, BenchCommand command, unsigned int key, unsigned int user) {
+  char keyName[ARG_SIZE], userName[ARG_SIZE];
+  const char *argv[4] = { commandNames[command], keyName, userName, NULL };
+  int argc;
+
+  snprintf(keyName, sizeof(keyName), "key:%u", key);
+  snprintf(userName, sizeof(userName), "user:%u", user);
+
+  switch (command) {
+    case BENCH_PING: argc = 1; break;
+    case BENCH_GET: argc = 2; break;
+    case BENCH_ADD: argc = 3; argv[2] = bench.document; break;
+    case BENCH_START: case BENCH_END: argc = 3; break;
+    case BENCH_MODIFY: argc = 4; argv[3] = "{\"op\":\"insert\",\"at\":0,\"text\":\"x\"}"; break;
+    default: return;
+  }
+
+  benchAppendRequest(output, argc, argv);
+}
+
+/*
+ * Measure the reply at the start of the received bytes.
+ *
+ * @param data: The received bytes.
+ * @param length: The number of bytes received.
+ * @return The length of the reply, 0 if it has not fully arrived, or -1 if it is malformed.
+ */
+static long benchReplyLength(const char *data, size_t length) {
+  long size = 0;
+  size_t i = 1;
+
+  if (length == 0)
+    return 0;
+  if (data[0] != '$')
+    return -1;
+
+  for (; i < length && data[i] >= '0' && data[i] <= '9'; i++)
+    size = size * 10 + data[i] - '0';
+  if (i + 1 >= length)
+    return 0;
+  if (data[i] != '\r' || data[i + 1] != '\n')
+    return -1;
+
+  return i + 2 + size + 2 <= length ? (long) (i + 2 + size + 2) : 0;
+}
+
+/*
+ * Pick a command from the mix.
+ *
+ * @return The command.
+ */
+static BenchCommand benchPick(void) {
+  unsigned int pick = benchRandom() % bench.totalWeight;
+  BenchCommand command = 0;
+
+  while (pick >= bench.weights[command])
+    pick -= bench.weights[command++];
+  return command;
+}
+
+/*
+ * Queue requests on a connection until its pipeline is full or every request is issued.
+ *
+ * @param conn: The connection to queue on.
+ */
+static void benchFill(Connection *conn) {
+  unsigned int slot;
+
+  while (conn->inFlight < bench.pipeline && bench.issued < bench.requests) {
+    slot = (conn->oldest + conn->inFlight++) % bench.pipeline;
+    conn->commands[slot] = benchPick();
+    conn->sent[slot] = now();
+    benchAppendCommand(conn->output, conn->commands[slot], benchRandom() % bench.keyspace, conn->id);
+    bench.issued++;
+  }
+}
+
+
+/********************************************************************************
+ *                                 Connections.
+ *******************************************************************************/
+
+/*
+ * Write as much of a connection's queued requests as the socket takes.
+ *
+ * @param conn: The connection to write.
+ */
+static void benchFlush(Connection *conn) {
+  ssize_t n;
+
+  while (bufferLength(conn->output) > 0) {
+    if ((n = write(conn->fd, bufferData(conn->output), bufferLength(conn->output))) > 0) {
+      bufferConsume(conn->output, n);
+    } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+      return;
+    } else {
+      fprintf(stderr, "Error writing to connection %u.\n", conn->id);
+      exit(1);
+    }
+  }
+}
+
+/*
+ * Read every reply that arrived on a connection, record the latency of each,
+ * and queue a new request in its place.
+ * Connections are edge-triggered, so keep reading until the socket is empty.
+ *
+ * @param conn: The readable connection.
+ */
+static void benchRead(Connection *conn) {
+  uint64_t received;
+  long length;
+  ssize_t n;
+
+  while ((n = read(conn->fd, bufferReserve(conn->input, BUFFER_SIZE), BUFFER_SIZE)) > 0)
+    bufferCommit(conn->input, n);
+  if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+    fprintf(stderr, "Server closed connection %u.\n", conn->id);
+    exit(1);
+  }
+
+  received = now();
+  while ((length = benchReplyLength(bufferData(conn->input), bufferLength(conn->input))) != 0) {
+    if (length < 0 || conn->inFlight == 0) {
+      fprintf(stderr, "Unexpected reply on connection %u.\n", conn->id);
+      exit(1);
+    }
+
+    histogramRecord(bench.latency[conn->commands[conn->oldest]], (received - conn->sent[conn->oldest]) / 1000);
+    conn->oldest = (conn->oldest + 1) % bench.pipeline;
+    conn->inFlight--;
+    bench.completed++;
+    bufferConsume(conn->input, length);
+  }
+}
+
+/*
+ * Open a connection to the server and register it with the loop.
+ *
+ * @param conn: The connection to open.
+ * @param id: The index of the connection.
+ */
+static void connectionCreate(Connection *conn, unsigned int id) {
+  conn->fd = benchConnect();
+  conn->id = id;
+  conn->input = bufferCreate(BUFFER_SIZE);
+  conn->output = bufferCreate(BUFFER_SIZE);
+  conn->sent = mmalloc(sizeof(uint64_t) * bench.pipeline);
+  conn->commands = mmalloc(sizeof(BenchCommand) * bench.pipeline);
+  conn->oldest = 0;
+  conn->inFlight = 0;
+
+  if (setNonBlocking(conn->fd) < 0 ||
+      eventLoopAdd(bench.loop, conn->fd, EVENT_READABLE | EVENT_WRITABLE, conn) < 0) {
+    fprintf(stderr, "Could not register connection %u.\n", id);
+    exit(1);
+  }
+}
+
+/*
+ * Close a connection and free it.
+ *
+ * @param conn: The connection to close.
+ */
+static void connectionFree(Connection *conn) {
+  close(conn->fd);
+  bufferFree(conn->input);
+  bufferFree(conn->output);
+  mfree(conn->sent);
+  mfree(conn->commands);
+}
+
+
+/********************************************************************************
+ *                              Run the benchmark.
+ *******************************************************************************/
+
+/*
+ * Add every key in the key space, a batch of pipelined requests at a time.
+ */
+static void benchPopulate(void) {
+  Buffer *output = bufferCreate(BUFFER_SIZE), *input = bufferCreate(BUFFER_SIZE);
+  int fd = benchConnect();
+  unsigned int batch, replies;
+  long length;
+  ssize_t n;
+
+  for (unsigned int key = 0; key < bench.keyspace; key += batch) {
+    batch = bench.keyspace - key < POPULATE_BATCH ? bench.keyspace - key : POPULATE_BATCH;
+    for (unsigned int i = 0; i < batch; i++)
+      benchAppendCommand(output, BENCH_ADD, key + i, 0);
+
+    while (bufferLength(output) > 0 && (n = write(fd, bufferData(output), bufferLength(output))) > 0)
+      bufferConsume(output, n);
+
+    for (replies = 0; replies < batch; ) {
+      if ((length = benchReplyLength(bufferData(input), bufferLength(input))) > 0) {
+        bufferConsume(input, length);
+        replies++;
+      } else if (length < 0 || (n = read(fd, bufferReserve(input, BUFFER_SIZE), BUFFER_SIZE)) <= 0) {
+        fprintf(stderr, "Could not add the documents.\n");
+        exit(1);
+      } else {
+        bufferCommit(input, n);
+      }
+    }
+  }
+
+  close(fd);
+  bufferFree(input);
+  bufferFree(output);
+}
+
+/*
+ * Keep every connection's pipeline full until every request has completed.
+ *
+ * @return How long the run took, in nanoseconds.
+ */
+static uint64_t benchRun(void) {
+  uint64_t start;
+  Connection *conn;
+  int fired;
+
+  bench.loop = eventLoopCreate(MAX_EVENTS);
+  bench.connections = mmalloc(sizeof(Connection) * bench.clients);
+  for (unsigned int i = 0; i < bench.clients; i++)
+    connectionCreate(&bench.connections[i], i);
+
+  start = now();
+  for (unsigned int i = 0; i < bench.clients; i++) {
+    benchFill(&bench.connections[i]);
+    benchFlush(&bench.connections[i]);
+  }
+
+  while (bench.completed < bench.requests) {
+    if ((fired = eventLoopWait(bench.loop, -1)) < 0)
+      continue;
+    for (int i = 0; i < fired; i++) {
+      conn = eventLoopFiredData(bench.loop, i);
+      if (eventLoopFiredMask(bench.loop, i) & EVENT_READABLE)
+        benchRead(conn);
+      benchFill(conn);
+      benchFlush(conn);
+    }
+  }
+
+  for (unsigned int i = 0; i < bench.clients; i++)
+    connectionFree(&bench.connections[i]);
+  mfree(bench.connections);
+  eventLoopFree(bench.loop);
+
+  return now() - start;
+}
+
+/*
+ * Print the throughput, and the latency percentiles of each command and of every request.
+ *
+ * @param elapsed: How long the run took, in nanoseconds.
+ */
+static void benchReport(uint64_t elapsed) {
+  Histogram *all = histogramCreate();
+  double seconds = elapsed / 1e9;
+
+  printf("====== rtdoc-benchmark ======\n");
+  printf("  %lu requests completed in %.2f seconds\n", bench.completed, seconds);
+  printf("  %u parallel clients, pipeline %u, %u keys, %u byte documents\n",
+         bench.clients, bench.pipeline, bench.keyspace, bench.docSize);
+  printf("  %.2f requests per second\n\n", bench.completed / seconds);
+
+  printf("  %-8s %10s %10s %10s %10s %10s   (usec)\n", "command", "requests", "p50", "p99", "p99.9", "max");
+  for (int i = 0; i <= NUM_BENCH_COMMANDS; i++) {
+    Histogram *latency = i < NUM_BENCH_COMMANDS ? bench.latency[i] : all;
+    if (i < NUM_BENCH_COMMANDS && bench.weights[i] == 0)
+      continue;
+    if (i < NUM_BENCH_COMMANDS)
+      histogramMerge(all, latency);
+
+    printf("  %-8s %10lu %10lu %10lu %10lu %10lu\n", i < NUM_BENCH_COMMANDS ? commandNames[i] : "all",
+           (unsigned long) histogramCount(latency),
+           (unsigned long) histogramPercentile(latency, 50),
+           (unsigned long) histogramPercentile(latency, 99),
+           (unsigned long) histogramPercentile(latency, 99.9),
+           (unsigned long) histogramMax(latency));
+  }
+
+  histogramFree(all);
+}
+
+int main(int argc, char **argv) {
+  /* Default settings. */
+  char mix[BUFFER_SIZE] = BENCH_DEFAULT_MIX;
+  int opt;
+
+  bench.host = BENCH_DEFAULT_HOST;
+  bench.port = BENCH_DEFAULT_PORT;
+  bench.clients = BENCH_DEFAULT_CLIENTS;
+  bench.requests = BENCH_DEFAULT_REQUESTS;
+  bench.pipeline = BENCH_DEFAULT_PIPELINE;
+  bench.keyspace = BENCH_DEFAULT_KEYSPACE;
+  bench.docSize = BENCH_DEFAULT_DOC_SIZE;
+  bench.seed = now() | 1;
+
+  /* Custom command line options. */
+  while ((opt = getopt(argc, argv, "c:d:h:n:p:P:r:t:")) != -1) {
+    switch (opt) {
+      case 'c': bench.clients = atoi(optarg); break;
+      case 'd': bench.docSize = atoi(optarg); break;
+      case 'h': bench.host = optarg; break;
+      case 'n': bench.requests = atol(optarg); break;
+      case 'p': bench.port = atoi(optarg); break;
+      case 'P': bench.pipeline = atoi(optarg); break;
+      case 'r': bench.keyspace = atoi(optarg); break;
+      case 't': snprintf(mix, sizeof(mix), "%s", optarg); break;
+      default: benchUsage();
+    }
+  }
+
+  if (bench.clients == 0 || bench.pipeline == 0 || bench.keyspace == 0)
+    benchUsage();
+  benchParseMix(mix);
+
+  /* A document of the requested size: {"data":"xx...x"}. */
+  bench.document = mmalloc(bench.docSize + ARG_SIZE);
+  sprintf(bench.document, "{\"data\":\"%0*d\"}", bench.docSize > 11 ? bench.docSize - 11 : 0, 0);
+  for (int i = 0; i < NUM_BENCH_COMMANDS; i++)
+    bench.latency[i] = histogramCreate();
+
+  benchPopulate();
+  benchReport(benchRun());
+
+  for (int i = 0; i < NUM_BENCH_COMMANDS; i++)
+    histogramFree(bench.latency[i]);
+  mfree(bench.document);
+  return 0;
+}
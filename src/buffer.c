@@ -0,0 +1,241 @@
+#include "buffer.h"
+#include "mmalloc.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+/*
+ * The bytes in use are data[start, end). Consuming from the front only moves
+ * `start`; the bytes are moved back to the front lazily, when room is needed.
+ */
+struct Buffer {
+  char *data;                                 /* The storage. */
+  size_t start;                               /* The offset of the first unconsumed byte. */
+  size_t end;                                 /* The offset just past the last byte. */
+  size_t capacity;                            /* The size of the storage. */
+};
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Create a new, empty buffer.
+ *
+ * @param capacity: The initial size of the storage.
+ * @return The newly created buffer.
+ */
+Buffer *bufferCreate(size_t capacity) {
+  assert(capacity > 0);
+
+  Buffer *buffer = mmalloc(sizeof(Buffer));
+  buffer->data = mmalloc(capacity);
+  buffer->start = 0;
+  buffer->end = 0;
+  buffer->capacity = capacity;
+
+  return buffer;
+}
+
+/*
+ * Free an existing buffer.
+ *
+ * @param buffer: The buffer to free.
+ */
+void bufferFree(Buffer *buffer) {
+  assert(buffer != NULL);
+  mfree(buffer->data);
+  mfree(buffer);
+}
+
+/*
+ * Free an existing buffer but keep its storage, which the caller takes over, with
+ * the unconsumed bytes moved to its front.
+ *
+ * @param buffer: The buffer to free.
+ * @return The storage, to free with `mfree`.
+ */
+char *bufferRelease(Buffer *buffer) {
+  assert(buffer != NULL);
+
+  char *data = buffer->data;
+
+  if (buffer->start > 0)
+    memmove(data, data + buffer->start, buffer->end - buffer->start);
+  mfree(buffer);
+  return data;
+}
+
+
+/**********************************************************************
+ *                         Buffer information.
+ **********************************************************************/
+
+/*
+ * @param buffer: The buffer to examine.
+ * @return A pointer to the first unconsumed byte.
+ */
+char *bufferData(const Buffer *buffer) {
+  assert(buffer != NULL);
+  return buffer->data + buffer->start;
+}
+
+/*
+ * @param buffer: The buffer to examine.
+ * @return The number of unconsumed bytes.
+ */
+size_t bufferLength(const Buffer *buffer) {
+  assert(buffer != NULL);
+  return buffer->end - buffer->start;
+}
+
+/*
+ * @param buffer: The buffer to examine.
+ * @return The size of the storage.
+ */
+size_t bufferCapacity(const Buffer *buffer) {
+  assert(buffer != NULL);
+  return buffer->capacity;
+}
+
+
+/**********************************************************************
+ *                           Buffer methods.
+ **********************************************************************/
+
+/*
+ * Make room to write at least the given number of bytes at the back of the buffer.
+ * Consumed bytes are reclaimed first; the storage only grows if that is not enough.
+ * Pointers previously returned by `bufferData` are invalidated.
+ *
+ * @param buffer: The buffer to write to.
+ * @param length: The number of bytes about to be written.
+ * @return Where to write them; call `bufferCommit` once they are written.
+ */
+char *bufferReserve(Buffer *buffer, size_t length) {
+  assert(buffer != NULL);
+
+  size_t used = buffer->end - buffer->start;
+
+  if (buffer->capacity - buffer->end >= length)
+    return buffer->data + buffer->end;
+
+  if (buffer->start > 0) {
+    memmove(buffer->data, buffer->data + buffer->start, used);
+    buffer->start = 0;
+    buffer->end = used;
+  }
+
+  if (buffer->capacity - used < length) {
+    while (buffer->capacity - used < length)
+      buffer->capacity *= 2;
+    buffer->data = mrealloc(buffer->data, buffer->capacity);
+  }
+
+  return buffer->data + buffer->end;
+}
+
+/*
+ * Add bytes written into reserved room to the buffer.
+ *
+ * @param buffer: The buffer that was written.
+ * @param length: The number of bytes written.
+ */
+void bufferCommit(Buffer *buffer, size_t length) {
+  assert(buffer != NULL);
+  assert(buffer->end + length <= buffer->capacity);
+  buffer->end += length;
+}
+
+/*
+ * Copy bytes to the back of the buffer.
+ *
+ * @param buffer: The buffer to append to.
+ * @param data: The bytes to copy.
+ * @param length: The number of bytes.
+ */
+void bufferAppend(Buffer *buffer, const char *data, size_t length) {
+  assert(buffer != NULL);
+  memcpy(bufferReserve(buffer, length), data, length);
+  buffer->end += length;
+}
+
+/*
+ * Format a string onto the back of the buffer, as printf would.
+ *
+ * @param buffer: The buffer to append to.
+ * @param format: The format string.
+ * @return The number of bytes appended.
+ */
+int bufferFormat(Buffer *buffer, const char *format, ...) {
+  assert(buffer != NULL);
+
+  size_t room = buffer->capacity - buffer->end;
+  va_list args;
+  int length;
+
+  /* Usually the string fits in the room that is left; otherwise make room and format it again. */
+  va_start(args, format);
+  length = vsnprintf(buffer->data + buffer->end, room, format, args);
+  va_end(args);
+
+  if (length >= room) {
+    va_start(args, format);
+    vsnprintf(bufferReserve(buffer, length + 1), length + 1, format, args);
+    va_end(args);
+  }
+
+  buffer->end += length;
+  return length;
+}
+
+/*
+ * Drop bytes from the front of the buffer.
+ *
+ * @param buffer: The buffer to consume from.
+ * @param length: The number of bytes to drop.
+ */
+void bufferConsume(Buffer *buffer, size_t length) {
+  assert(buffer != NULL);
+  assert(length <= buffer->end - buffer->start);
+
+  buffer->start += length;
+  if (buffer->start == buffer->end)
+    buffer->start = buffer->end = 0;
+}
+
+/*
+ * Give back the storage of an empty buffer that grew beyond a given size.
+ *
+ * @param buffer: The buffer to shrink.
+ * @param capacity: The largest storage an empty buffer may keep.
+ */
+void bufferShrink(Buffer *buffer, size_t capacity) {
+  assert(buffer != NULL);
+  assert(capacity > 0);
+
+  if (buffer->start != buffer->end || buffer->capacity <= capacity)
+    return;
+
+  buffer->data = mrealloc(buffer->data, capacity);
+  buffer->capacity = capacity;
+  buffer->start = buffer->end = 0;
+}
+
+/*
+ * Drop every byte in the buffer, keeping its storage.
+ *
+ * @param buffer: The buffer to empty.
+ */
+void bufferClear(Buffer *buffer) {
+  assert(buffer != NULL);
+  buffer->start = buffer->end = 0;
+}
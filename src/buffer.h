@@ -0,0 +1,32 @@
+#ifndef __BUFFER_H__
+#define __BUFFER_H__
+
+#include <stddef.h>
+
+
+/*
+ * A growable byte buffer, written at the back and consumed from the front.
+ */
+
+typedef struct Buffer Buffer;
+
+/* Memory management. */
+Buffer *bufferCreate(size_t capacity);
+void bufferFree(Buffer *buffer);
+char *bufferRelease(Buffer *buffer);
+
+/* Buffer information. */
+char *bufferData(const Buffer *buffer);
+size_t bufferLength(const Buffer *buffer);
+size_t bufferCapacity(const Buffer *buffer);
+
+/* Buffer methods. */
+char *bufferReserve(Buffer *buffer, size_t length);
+void bufferCommit(Buffer *buffer, size_t length);
+void bufferAppend(Buffer *buffer, const char *data, size_t length);
+int bufferFormat(Buffer *buffer, const char *format, ...);
+void bufferConsume(Buffer *buffer, size_t length);
+void bufferShrink(Buffer *buffer, size_t capacity);
+void bufferClear(Buffer *buffer);
+
+#endif
@@ -0,0 +1,190 @@
+#include "deque.h"
+#include "mmalloc.h"
+
+#include <assert.h>
+
+
+#define CACHE_LINE            64
+
+#define loadRelaxed(p)        (__atomic_load_n(p, __ATOMIC_RELAXED))
+#define loadAcquire(p)        (__atomic_load_n(p, __ATOMIC_ACQUIRE))
+#define storeRelaxed(p,v)     (__atomic_store_n(p, v, __ATOMIC_RELAXED))
+#define compareSwap(p,e,v)    (__atomic_compare_exchange_n(p, e, v, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+#define releaseFence()        (__atomic_thread_fence(__ATOMIC_RELEASE))
+#define fence()               (__atomic_thread_fence(__ATOMIC_SEQ_CST))
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+/*
+ * A fixed ring of slots indexed by two ever-growing counters.
+ *
+ * The owner pushes and pops at `bottom` like a stack, which keeps recently
+ * queued work hot in its cache. Thieves take the oldest value at `top`.
+ * The only contended case is the last value, which the owner and the thieves
+ * race for with a compare-and-swap on `top`. This follows Lê et al.,
+ * "Correct and Efficient Work-Stealing for Weak Memory Models".
+ */
+struct Deque {
+  long mask;                                  /* The capacity minus one. */
+  void **values;                              /* The ring of slots. */
+  char pad1[CACHE_LINE];
+  long top;                                   /* The next position to steal from. */
+  char pad2[CACHE_LINE];
+  long bottom;                                /* The next position the owner pushes into. */
+  char pad3[CACHE_LINE];
+};
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Create a new deque.
+ *
+ * @param capacity: The minimum number of values the deque can hold; rounded up to a power of two.
+ * @return The newly created deque.
+ */
+Deque *dequeCreate(unsigned int capacity) {
+  assert(capacity > 0);
+
+  long size = 2;
+  while (size < capacity)
+    size <<= 1;
+
+  Deque *deque = mcalloc(sizeof(Deque));
+  deque->mask = size - 1;
+  deque->values = mcalloc(sizeof(void*) * size);
+
+  return deque;
+}
+
+/*
+ * Free an existing deque. The values still in the deque are not freed.
+ *
+ * @param deque: The deque to free.
+ */
+void dequeFree(Deque *deque) {
+  assert(deque != NULL);
+  mfree(deque->values);
+  mfree(deque);
+}
+
+
+/**********************************************************************
+ *                         Deque information.
+ **********************************************************************/
+
+/*
+ * @param deque: The deque to examine.
+ * @return The most values the deque can hold.
+ */
+unsigned int dequeCapacity(const Deque *deque) {
+  assert(deque != NULL);
+  return deque->mask + 1;
+}
+
+/*
+ * Get the number of values in the deque.
+ * Under concurrent use this is only a snapshot.
+ *
+ * @param deque: The deque to examine.
+ * @return The number of values in the deque.
+ */
+unsigned int dequeLength(const Deque *deque) {
+  assert(deque != NULL);
+
+  long top = loadRelaxed(&deque->top),
+       bottom = loadRelaxed(&deque->bottom);
+
+  return bottom > top ? bottom - top : 0;
+}
+
+
+/**********************************************************************
+ *                           Deque methods.
+ **********************************************************************/
+
+/*
+ * Add a value to the bottom of the deque. Only the owner may call this.
+ *
+ * @param deque: The deque to push onto.
+ * @param value: The value to add; must not be NULL.
+ * @return False if the deque is full.
+ */
+bool dequePush(Deque *deque, void *value) {
+  assert(deque != NULL);
+  assert(value != NULL);
+
+  long bottom = loadRelaxed(&deque->bottom),
+       top = loadAcquire(&deque->top);
+
+  if (bottom - top > deque->mask)
+    return false;
+
+  storeRelaxed(&deque->values[bottom & deque->mask], value);
+  /* Publish the value before a thief can see the new bottom. */
+  releaseFence();
+  storeRelaxed(&deque->bottom, bottom + 1);
+
+  return true;
+}
+
+/*
+ * Take the most recently pushed value. Only the owner may call this.
+ *
+ * @param deque: The deque to pop from.
+ * @return The value, or NULL if the deque is empty or a thief took the last value.
+ */
+void *dequePop(Deque *deque) {
+  assert(deque != NULL);
+
+  long bottom = loadRelaxed(&deque->bottom) - 1, top;
+  void *value = NULL;
+
+  /* Reserve the bottom slot before looking at what thieves have taken. */
+  storeRelaxed(&deque->bottom, bottom);
+  fence();
+  top = loadRelaxed(&deque->top);
+
+  if (top <= bottom) {
+    value = loadRelaxed(&deque->values[bottom & deque->mask]);
+    if (top == bottom) {
+      /* The last value: race the thieves for it. */
+      if (!compareSwap(&deque->top, &top, top + 1))
+        value = NULL;
+      storeRelaxed(&deque->bottom, bottom + 1);
+    }
+  } else {
+    storeRelaxed(&deque->bottom, bottom + 1);
+  }
+
+  return value;
+}
+
+/*
+ * Take the oldest value. Any thread may call this.
+ *
+ * @param deque: The deque to steal from.
+ * @return The value, or NULL if the deque is empty or another thread won the race for it.
+ */
+void *dequeSteal(Deque *deque) {
+  assert(deque != NULL);
+
+  long top = loadAcquire(&deque->top), bottom;
+  void *value;
+
+  fence();
+  bottom = loadAcquire(&deque->bottom);
+  if (top >= bottom)
+    return NULL;
+
+  value = loadRelaxed(&deque->values[top & deque->mask]);
+  if (!compareSwap(&deque->top, &top, top + 1))
+    return NULL;
+
+  return value;
+}
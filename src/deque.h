@@ -0,0 +1,28 @@
+#ifndef __DEQUE_H__
+#define __DEQUE_H__
+
+#include <stdbool.h>
+
+
+/*
+ * A bounded, lock-free work-stealing deque of pointers (Chase-Lev).
+ *
+ * Only the owning thread may push and pop at the bottom; any thread may steal from the top.
+ */
+
+typedef struct Deque Deque;
+
+/* Memory management. */
+Deque *dequeCreate(unsigned int capacity);
+void dequeFree(Deque *deque);
+
+/* Deque information. */
+unsigned int dequeCapacity(const Deque *deque);
+unsigned int dequeLength(const Deque *deque);
+
+/* Deque methods. */
+bool dequePush(Deque *deque, void *value);
+void *dequePop(Deque *deque);
+void *dequeSteal(Deque *deque);
+
+#endif
@@ -1,7 +1,9 @@
+#include "buffer.h"
 #include "doc.h"
 #include "json.h"
 #include "list.h"
 #include "mmalloc.h"
+#include "trace.h"
 
 #include <assert.h>
 #include <pthread.h>
@@ -10,11 +12,17 @@
 
 
 #define mutexInit(x,y)   (pthread_mutex_init(x,y))
-#define mutexLock(x)     (pthread_mutex_lock(x))
-#define mutexUnlock(x)   (pthread_mutex_unlock(x))
+#define mutexLock(x)     do { trace1(doc__lock__wait, x);  \
+                              pthread_mutex_lock(x);         \
+                              trace1(doc__lock__acquire, x); } while (0)
+#define mutexUnlock(x)   do { pthread_mutex_unlock(x);       \
+                              trace1(doc__lock__release, x); } while (0)
 
 typedef pthread_mutex_t   Mutex;
 
+#define loadAcquire(p)   (__atomic_load_n(p, __ATOMIC_ACQUIRE))
+#define storeRelease(p,v) (__atomic_store_n(p, v, __ATOMIC_RELEASE))
+
 
 /**********************************************************************
  *                         Struct definitions.
@@ -22,13 +30,25 @@ typedef pthread_mutex_t   Mutex;
 
 struct Document {
   char *key;            /* The unique identifier for the document. */
-  Json *contents;       /* The contents of the document. */
+  Json *contents;       /* The current version of the contents, never changed in place. */
+  Serialized *cache;    /* The contents serialized, once read and until they change, or NULL. */
   List *collaborators;  /* All users working currently modifying the document. */
-  Mutex mutex;          /* Lock to access the document. */
+  Mutex mutex;          /* Lock to access the collaborators. */
+  Mutex writer;         /* Lock for writers of the contents. */
+  int references;       /* The number of holders of the document; it is freed when none are left. */
+  bool heartbeat;       /* Whether something is expiring the collaborators who went quiet. */
+};
+
+struct Serialized {
+  int references;       /* The number of holders of the string; it is freed when none are left. */
+  size_t length;        /* The length of the string. */
+  char *data;           /* The serialized contents. */
+  const Json *root;     /* The version of the contents it was serialized from. */
 };
 
 struct Collaborator {
   char *userId;         /* Identifier for the user. */
+  uint64_t lastSeen;    /* When the user last started or modified the document. */
 };
 
 
@@ -51,14 +71,31 @@ Document *documentCreate(char *key, Json *contents) {
   doc->key = mmalloc(strlen(key) + 1);
   strcpy(doc->key, key);
   doc->contents = contents;
+  doc->cache = NULL;
   doc->collaborators = listCreate(LIST_TYPE_ARRAY, &collaboratorFree);
   mutexInit(&doc->mutex, NULL);
+  mutexInit(&doc->writer, NULL);
+  doc->references = 1;
+  doc->heartbeat = false;
+
+  return doc;
+}
 
+/*
+ * Take another reference to a document, which keeps it alive until it is released
+ * with `documentFree`, even once it is removed from the store.
+ *
+ * @param doc: The document to hold on to.
+ * @return The document.
+ */
+Document *documentRetain(Document *doc) {
+  assert(doc != NULL);
+  __atomic_add_fetch(&doc->references, 1, __ATOMIC_RELAXED);
   return doc;
 }
 
 /*
- * Free an existing document.
+ * Release a reference to a document, and free it if it was the last one.
  *
  * @param doc: The document to free.
  */
@@ -66,12 +103,47 @@ void documentFree(void *doc) {
   assert(doc != NULL);
 
   Document *document = (Document*) doc;
+  if (__atomic_sub_fetch(&document->references, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+
   mfree(document->key);
   jsonFree(document->contents);
+  if (document->cache != NULL)
+    serializedFree(document->cache);
   listFree(document->collaborators);
+  pthread_mutex_destroy(&document->mutex);
+  pthread_mutex_destroy(&document->writer);
   mfree(document);
 }
 
+/*
+ * Take another reference to serialized contents.
+ *
+ * @param serialized: The serialized contents to hold on to.
+ * @return The serialized contents.
+ */
+Serialized *serializedRetain(Serialized *serialized) {
+  assert(serialized != NULL);
+  __atomic_add_fetch(&serialized->references, 1, __ATOMIC_RELAXED);
+  return serialized;
+}
+
+/*
+ * Release a reference to serialized contents, and free them if it was the last one.
+ *
+ * @param serialized: The serialized contents to free.
+ */
+void serializedFree(void *serialized) {
+  assert(serialized != NULL);
+
+  Serialized *ser = (Serialized*) serialized;
+  if (__atomic_sub_fetch(&ser->references, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+
+  mfree(ser->data);
+  mfree(ser);
+}
+
 /*
  * Create a new collaborator.
  *
@@ -84,6 +156,7 @@ Collaborator *collaboratorCreate(char *userId) {
   Collaborator *user = mmalloc(sizeof(Collaborator));
   user->userId = mmalloc(strlen(userId) + 1);
   strcpy(user->userId, userId);
+  user->lastSeen = 0;
 
   return user;
 }
@@ -106,14 +179,88 @@ void collaboratorFree(void *user) {
  *******************************************************************************/
 
 /*
- * Get the Json contents of a document.
+ * Get the current version of the contents of a document. Versions are never
+ * changed in place, so it stays consistent however the document changes, but it
+ * is only borrowed: it is freed once replaced and every thread online in the epoch
+ * writers retire into has moved on. Retain it with `jsonRetain` to keep it longer.
  *
  * @param doc: The document to get the contents for.
  * @return The contents of the document.
  */
 Json *documentGetContents(Document *doc) {
   assert(doc != NULL);
-  return doc->contents;
+  return loadAcquire(&doc->contents);
+}
+
+/*
+ * Get the contents of a document serialized, as `get` replies with them. They are
+ * serialized by the first reader of each version, and shared by every reader until
+ * the next one, so a read-mostly document costs a copy rather than a walk of its tree.
+ * Like the contents, the cached string is borrowed from the epoch until retained.
+ *
+ * @param doc: The document to serialize.
+ * @param epoch: The epoch the calling thread is online in, which a replaced string is retired into.
+ * @return A reference to the serialized contents, to release with `serializedFree`.
+ *         They stay valid after the document changes.
+ */
+Serialized *documentSerialize(Document *doc, Epoch *epoch) {
+  assert(doc != NULL);
+  assert(epoch != NULL);
+
+  Json *contents = loadAcquire(&doc->contents);
+  Serialized *cache = loadAcquire(&doc->cache), *fresh;
+  JsonWriter *writer;
+  Buffer *buffer;
+
+  if (cache != NULL && cache->root == contents)
+    return serializedRetain(cache);
+
+  /*
+   * Measure once, and write straight into storage of that size, which the string
+   * keeps; the extra byte leaves formatted writes room for their terminator.
+   */
+  fresh = mmalloc(sizeof(Serialized));
+  fresh->references = 1;
+  fresh->length = jsonStringifyLength(contents);
+  fresh->root = contents;
+
+  buffer = bufferCreate(fresh->length + 1);
+  writer = jsonWriterCreate(contents);
+  jsonWriterNext(writer, buffer, SIZE_MAX);
+  jsonWriterFree(writer);
+  assert(bufferLength(buffer) == fresh->length && bufferCapacity(buffer) == fresh->length + 1);
+  fresh->data = bufferRelease(buffer);
+
+  /*
+   * Cache the string unless another reader got there first. A string for a version
+   * that is already replaced may be cached for a while, but never mistaken for a
+   * later version: writers drop the cache before they publish.
+   */
+  if (__atomic_compare_exchange_n(&doc->cache, &cache, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    serializedRetain(fresh);
+    if (cache != NULL)
+      epochRetire(epoch, cache, &serializedFree);
+  }
+
+  return fresh;
+}
+
+/*
+ * @param serialized: The serialized contents.
+ * @return The serialized string, which is not null-terminated.
+ */
+const char *serializedData(const Serialized *serialized) {
+  assert(serialized != NULL);
+  return serialized->data;
+}
+
+/*
+ * @param serialized: The serialized contents.
+ * @return The length of the serialized string.
+ */
+size_t serializedLength(const Serialized *serialized) {
+  assert(serialized != NULL);
+  return serialized->length;
 }
 
 /*
@@ -143,18 +290,91 @@ char *collaboratorGetKey(Collaborator *user) {
  *                           Update documents.
  *******************************************************************************/
 
+/*
+ * Publish a new version of the contents of a document. Readers of the old version
+ * carry on with it, and it is freed once they are done.
+ *
+ * @param doc: The document being changed, with its writer lock held.
+ * @param contents: The new version.
+ * @param epoch: The epoch readers read the document in.
+ */
+static void documentPublish(Document *doc, Json *contents, Epoch *epoch) {
+  Json *old = doc->contents;
+  Serialized *stale = __atomic_exchange_n(&doc->cache, NULL, __ATOMIC_ACQ_REL);
+
+  storeRelease(&doc->contents, contents);
+  if (stale != NULL)
+    epochRetire(epoch, stale, &serializedFree);
+  epochRetire(epoch, old, &jsonFree);
+}
+
+/*
+ * Replace the contents of a document.
+ *
+ * @param doc: The document to change.
+ * @param contents: The new contents, which the document takes over.
+ * @param epoch: The epoch readers read the document in.
+ */
+void documentSetContents(Document *doc, Json *contents, Epoch *epoch) {
+  assert(doc != NULL);
+  assert(contents != NULL);
+  assert(epoch != NULL);
+
+  mutexLock(&doc->writer);
+  documentPublish(doc, contents, epoch);
+  mutexUnlock(&doc->writer);
+}
+
+/*
+ * Set a value inside the contents of a document. The new version shares all but
+ * the path to the value with the old one, see `jsonSet`.
+ *
+ * @param doc: The document to change.
+ * @param path: The object keys and array indexes leading to the value.
+ * @param depth: The length of the path.
+ * @param value: The value to set, which the document takes over if the path is valid.
+ * @param epoch: The epoch readers read the document in.
+ * @return Whether the path led somewhere, and the value was set.
+ */
+bool documentUpdateContents(Document *doc, const char **path, unsigned int depth, Json *value, Epoch *epoch) {
+  assert(doc != NULL);
+  assert(value != NULL);
+  assert(epoch != NULL);
+
+  Json *contents;
+
+  mutexLock(&doc->writer);
+  if ((contents = jsonSet(doc->contents, path, depth, value)) != NULL)
+    documentPublish(doc, contents, epoch);
+  mutexUnlock(&doc->writer);
+
+  return contents != NULL;
+}
+
 /*
  * Add a new collaborator to a document.
+ * The first collaborator to join also asks the caller to start the heartbeat
+ * that expires the collaborators, which lasts until none are left.
  *
  * @param doc: The document being modified.
  * @param user: The user beginning the editing session.
+ * @param now: The current time.
+ * @return Whether the caller should start the heartbeat.
  */
-void documentAddCollaborator(Document *doc, Collaborator *user) {
+bool documentAddCollaborator(Document *doc, Collaborator *user, uint64_t now) {
   assert(doc != NULL);
   assert(user != NULL);
+
+  bool start;
+
   mutexLock(&doc->mutex);
+  user->lastSeen = now;
   listAppend(doc->collaborators, user);
+  if ((start = !doc->heartbeat))
+    doc->heartbeat = true;
   mutexUnlock(&doc->mutex);
+
+  return start;
 }
 
 static int getCollaborator(List *list, char *key, Collaborator **user) {
@@ -211,3 +431,58 @@ void documentRemoveCollaborator(Document *doc, char *userId) {
 
   mutexUnlock(&doc->mutex);
 }
+
+/*
+ * Record that a collaborator is still working on the document.
+ *
+ * @param doc: The document being modified.
+ * @param userId: The identifier for the user.
+ * @param now: The current time.
+ * @return Whether the user is a collaborator on the document.
+ */
+bool documentTouchCollaborator(Document *doc, char *userId, uint64_t now) {
+  assert(doc != NULL);
+  assert(userId != NULL);
+  mutexLock(&doc->mutex);
+
+  Collaborator *user;
+  int index;
+
+  if ((index = getCollaborator(doc->collaborators, userId, &user)) >= 0)
+    user->lastSeen = now;
+
+  mutexUnlock(&doc->mutex);
+  return index >= 0;
+}
+
+/*
+ * Remove every collaborator that has not been seen after a given time, as if
+ * they had ended their session. The heartbeat stops once none are left.
+ *
+ * @param doc: The document being modified.
+ * @param before: Collaborators last seen at or before this time are removed.
+ * @param oldest: Set to when the longest quiet remaining collaborator was last seen.
+ * @return The number of collaborators left.
+ */
+unsigned int documentExpireCollaborators(Document *doc, uint64_t before, uint64_t *oldest) {
+  assert(doc != NULL);
+  assert(oldest != NULL);
+  mutexLock(&doc->mutex);
+
+  Collaborator *user;
+  unsigned int length;
+
+  *oldest = UINT64_MAX;
+  for (int i = listLength(doc->collaborators) - 1; i >= 0; i--) {
+    user = listGet(doc->collaborators, i);
+    if (user->lastSeen <= before)
+      listRemove(doc->collaborators, i);
+    else if (user->lastSeen < *oldest)
+      *oldest = user->lastSeen;
+  }
+  if ((length = listLength(doc->collaborators)) == 0)
+    doc->heartbeat = false;
+
+  mutexUnlock(&doc->mutex);
+  return length;
+}
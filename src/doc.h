@@ -1,29 +1,55 @@
 #ifndef __DOCUMENT_H__
 #define __DOCUMENT_H__
 
+#include "epoch.h"
 #include "json.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 
 /*
  * Documents stored in the database.
+ *
+ * The contents are persistent: a change publishes a new version, which shares
+ * what did not change with the old one, with one atomic pointer swap. Readers take
+ * no lock and see whichever version was current when they looked, for as long as
+ * they hold it; replaced versions are retired into the epoch readers are online in.
+ * Writers to the same document take turns, and the collaborators have a mutex of
+ * their own.
+ *
+ * The contents are also kept serialized once read, shared by reference between
+ * every reply that sends them, until they next change.
  */
 
 typedef struct Document Document;
 typedef struct Collaborator Collaborator;
+typedef struct Serialized Serialized;
 
 /* Memory management. */
 Document *documentCreate(char *key, Json *contents);
+Document *documentRetain(Document *doc);
 void documentFree(void *doc);
 Collaborator *collaboratorCreate(char *userId);
 void collaboratorFree(void *user);
+Serialized *serializedRetain(Serialized *serialized);
+void serializedFree(void *serialized);
 
 /* Get information on documents. */
 Json *documentGetContents(Document *doc);
+Serialized *documentSerialize(Document *doc, Epoch *epoch);
+const char *serializedData(const Serialized *serialized);
+size_t serializedLength(const Serialized *serialized);
 List *documentGetCollaborators(Document *doc);
 char *collaboratorGetKey(Collaborator *user);
 
 /* Modify documents. */
-void documentAddCollaborator(Document *doc, Collaborator *user);
+void documentSetContents(Document *doc, Json *contents, Epoch *epoch);
+bool documentUpdateContents(Document *doc, const char **path, unsigned int depth, Json *value, Epoch *epoch);
+bool documentAddCollaborator(Document *doc, Collaborator *user, uint64_t now);
 void documentRemoveCollaborator(Document *doc, char *user);
+bool documentTouchCollaborator(Document *doc, char *userId, uint64_t now);
+unsigned int documentExpireCollaborators(Document *doc, uint64_t before, uint64_t *oldest);
 
 #endif
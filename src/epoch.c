@@ -0,0 +1,296 @@
+#include "epoch.h"
+#include "mmalloc.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define CACHE_LINE            64
+#define OFFLINE               0
+#define RECLAIM_BATCH         32            /* Retirements between attempts to reclaim. */
+
+#define loadRelaxed(p)        (__atomic_load_n(p, __ATOMIC_RELAXED))
+#define loadAcquire(p)        (__atomic_load_n(p, __ATOMIC_ACQUIRE))
+#define storeRelaxed(p,v)     (__atomic_store_n(p, v, __ATOMIC_RELAXED))
+#define storeRelease(p,v)     (__atomic_store_n(p, v, __ATOMIC_RELEASE))
+#define fetchAdd(p,v)         (__atomic_fetch_add(p, v, __ATOMIC_SEQ_CST))
+#define fence()               (__atomic_thread_fence(__ATOMIC_SEQ_CST))
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+/*
+ * The state of one reader thread, on its own cache lines since the thread writes
+ * it after every batch of reads.
+ */
+typedef struct EpochThread {
+  pthread_t owner;                            /* The reading thread. */
+  struct EpochThread *next;                   /* The next reader of the same epoch. */
+  char pad1[CACHE_LINE];
+  uint64_t local;                             /* The epoch the thread last saw, or OFFLINE. */
+  char pad2[CACHE_LINE];
+} EpochThread;
+
+/*
+ * An object waiting for the readers that may hold it to move on.
+ */
+typedef struct Retired {
+  struct Retired *next;                       /* The object retired before this one. */
+  uint64_t epoch;                             /* The epoch it was retired in. */
+  void *object;                               /* The object. */
+  void (*free)(void *object);                 /* How to free it. */
+} Retired;
+
+/*
+ * Every retirement moves the global epoch on. An object retired in epoch `e` can
+ * be freed once every online thread has seen an epoch after `e`, since a reader
+ * only sees a later epoch after it let go of everything it read before.
+ */
+struct Epoch {
+  unsigned long id;                           /* Tells epochs apart in each thread's cached state. */
+  char pad1[CACHE_LINE];
+  uint64_t global;                            /* The current epoch. */
+  char pad2[CACHE_LINE];
+  EpochThread *threads;                       /* Every reader thread, newest first. */
+  Retired *retired;                           /* The objects waiting to be freed, newest first. */
+  unsigned int pending;                       /* The number of those. */
+  pthread_mutex_t mutex;                      /* Lock to add a reader or touch the retired objects. */
+};
+
+static unsigned long epochIds;                /* The id of the most recent epoch. */
+static __thread unsigned long localEpoch;     /* The epoch the calling thread last read in. */
+static __thread EpochThread *localThread;     /* The calling thread's state in that epoch. */
+
+
+/**********************************************************************
+ *                            Reader state.
+ **********************************************************************/
+
+/*
+ * Find the calling thread's state, creating it the first time the thread reads.
+ * Only this slow path takes the lock; afterwards the state is cached in the thread.
+ *
+ * @param epoch: The epoch being read in.
+ * @return The calling thread's state.
+ */
+static EpochThread *epochThread(Epoch *epoch) {
+  pthread_t self = pthread_self();
+  EpochThread *thread;
+
+  if (localEpoch == epoch->id)
+    return localThread;
+
+  pthread_mutex_lock(&epoch->mutex);
+  for (thread = epoch->threads; thread != NULL && !pthread_equal(thread->owner, self); thread = thread->next);
+
+  if (thread == NULL) {
+    thread = mcalloc(sizeof(EpochThread));
+    thread->owner = self;
+    thread->next = epoch->threads;
+    storeRelease(&epoch->threads, thread);
+  }
+  pthread_mutex_unlock(&epoch->mutex);
+
+  localEpoch = epoch->id;
+  localThread = thread;
+  return thread;
+}
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Create a new epoch, with no readers and nothing retired.
+ *
+ * @return The newly created epoch.
+ */
+Epoch *epochCreate(void) {
+  Epoch *epoch = mmalloc(sizeof(Epoch));
+  epoch->id = fetchAdd(&epochIds, 1) + 1;
+  epoch->global = 1;
+  epoch->threads = NULL;
+  epoch->retired = NULL;
+  epoch->pending = 0;
+  pthread_mutex_init(&epoch->mutex, NULL);
+  return epoch;
+}
+
+/*
+ * Free an existing epoch, and every object still waiting in it.
+ * No thread may be reading.
+ *
+ * @param epoch: The epoch to free.
+ */
+void epochFree(Epoch *epoch) {
+  assert(epoch != NULL);
+
+  EpochThread *thread, *nextThread;
+  Retired *retired, *next;
+
+  /* Free in the order of retirement, as reclamation would have. */
+  for (retired = epoch->retired, epoch->retired = NULL; retired != NULL; retired = next) {
+    next = retired->next;
+    retired->next = epoch->retired;
+    epoch->retired = retired;
+  }
+  for (retired = epoch->retired; retired != NULL; retired = next) {
+    next = retired->next;
+    retired->free(retired->object);
+    mfree(retired);
+  }
+
+  for (thread = epoch->threads; thread != NULL; thread = nextThread) {
+    nextThread = thread->next;
+    mfree(thread);
+  }
+  pthread_mutex_destroy(&epoch->mutex);
+  mfree(epoch);
+}
+
+
+/**********************************************************************
+ *                         Epoch information.
+ **********************************************************************/
+
+/*
+ * @param epoch: The epoch to examine.
+ * @return The number of objects retired but not yet freed.
+ */
+unsigned int epochPending(Epoch *epoch) {
+  assert(epoch != NULL);
+  return loadRelaxed(&epoch->pending);
+}
+
+
+/**********************************************************************
+ *                               Readers.
+ **********************************************************************/
+
+/*
+ * Start reading. The fence pairs with the one in `epochReclaim`, so a reclaimer
+ * that scans after it sees this thread online before it could free anything the
+ * thread reads.
+ *
+ * @param epoch: The epoch to read in.
+ */
+void epochOnline(Epoch *epoch) {
+  assert(epoch != NULL);
+
+  EpochThread *thread = epochThread(epoch);
+
+  storeRelaxed(&thread->local, loadAcquire(&epoch->global));
+  fence();
+}
+
+/*
+ * Announce that the calling thread holds nothing it read so far, while staying online.
+ *
+ * @param epoch: The epoch being read in.
+ */
+void epochQuiescent(Epoch *epoch) {
+  assert(epoch != NULL);
+  storeRelease(&epochThread(epoch)->local, loadAcquire(&epoch->global));
+}
+
+/*
+ * Stop reading, until the next `epochOnline`.
+ *
+ * @param epoch: The epoch being read in.
+ */
+void epochOffline(Epoch *epoch) {
+  assert(epoch != NULL);
+  storeRelease(&epochThread(epoch)->local, OFFLINE);
+}
+
+
+/**********************************************************************
+ *                               Writers.
+ **********************************************************************/
+
+/*
+ * Free an object once no reader can hold it any more. The object must already be
+ * unreachable for new readers. Every RECLAIM_BATCH retirements, whatever is safe
+ * by then is freed along the way.
+ *
+ * @param epoch: The epoch readers read the object in.
+ * @param object: The object.
+ * @param freeFn: How to free the object.
+ */
+void epochRetire(Epoch *epoch, void *object, void (*freeFn)(void *object)) {
+  assert(epoch != NULL);
+  assert(freeFn != NULL);
+
+  Retired *retired = mmalloc(sizeof(Retired));
+  bool reclaim;
+
+  retired->object = object;
+  retired->free = freeFn;
+
+  pthread_mutex_lock(&epoch->mutex);
+  retired->epoch = fetchAdd(&epoch->global, 1);
+  retired->next = epoch->retired;
+  epoch->retired = retired;
+  storeRelaxed(&epoch->pending, epoch->pending + 1);
+  reclaim = epoch->pending % RECLAIM_BATCH == 0;
+  pthread_mutex_unlock(&epoch->mutex);
+
+  if (reclaim)
+    epochReclaim(epoch);
+}
+
+/*
+ * Free every retired object that no reader can hold any more.
+ *
+ * @param epoch: The epoch to reclaim in.
+ * @return The number of objects freed.
+ */
+unsigned int epochReclaim(Epoch *epoch) {
+  assert(epoch != NULL);
+
+  uint64_t safe = UINT64_MAX, local;
+  Retired **link, *retired, *freed = NULL, *next;
+  unsigned int count = 0;
+
+  pthread_mutex_lock(&epoch->mutex);
+
+  /*
+   * Pairs with the fence in `epochOnline`: either this scan sees the reader online,
+   * or the reader's loads after its fence see the objects already unlinked.
+   */
+  fence();
+
+  /* Everything retired before the oldest epoch an online reader saw is safe. */
+  for (EpochThread *thread = epoch->threads; thread != NULL; thread = thread->next)
+    if ((local = loadAcquire(&thread->local)) != OFFLINE && local < safe)
+      safe = local;
+
+  /* The list is newest first, so the safe objects are its tail. */
+  for (link = &epoch->retired; *link != NULL && (*link)->epoch >= safe; link = &(*link)->next);
+  freed = *link;
+  *link = NULL;
+  for (retired = freed; retired != NULL; retired = retired->next)
+    count++;
+  storeRelaxed(&epoch->pending, epoch->pending - count);
+
+  pthread_mutex_unlock(&epoch->mutex);
+
+  /* Free outside the lock, oldest first. */
+  for (retired = NULL; freed != NULL; freed = next) {
+    next = freed->next;
+    freed->next = retired;
+    retired = freed;
+  }
+  for (; retired != NULL; retired = next) {
+    next = retired->next;
+    retired->free(retired->object);
+    mfree(retired);
+  }
+
+  return count;
+}
@@ -0,0 +1,38 @@
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+
+/*
+ * Epoch-based reclamation, in its quiescent-state form.
+ *
+ * Readers follow shared pointers with plain loads, taking no lock and making no
+ * atomic read-modify-write. A writer that unlinks an object retires it rather than
+ * freeing it, and it is freed once every reader has been through a quiescent
+ * state: a point where it holds no pointer it found before.
+ *
+ * A thread goes online before it reads and offline when it is done or about to
+ * block, and may announce quiescent states in between to let reclamation move
+ * along without going offline. Going online costs a fence; reading and announcing
+ * a quiescent state cost a plain store at most. Threads that are offline never
+ * hold up reclamation.
+ */
+
+typedef struct Epoch Epoch;
+
+/* Memory management. */
+Epoch *epochCreate(void);
+void epochFree(Epoch *epoch);
+
+/* Epoch information. */
+unsigned int epochPending(Epoch *epoch);
+
+/* Readers. */
+void epochOnline(Epoch *epoch);
+void epochQuiescent(Epoch *epoch);
+void epochOffline(Epoch *epoch);
+
+/* Writers. */
+void epochRetire(Epoch *epoch, void *object, void (*freeFn)(void *object));
+unsigned int epochReclaim(Epoch *epoch);
+
+#endif
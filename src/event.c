@@ -0,0 +1,220 @@
+#include "event.h"
+#include "mmalloc.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+/*
+ * A thin wrapper around an epoll instance.
+ *
+ * Every descriptor is registered edge-triggered, so a handler must either drain
+ * the descriptor until it would block, or register it as one-shot and rearm it
+ * once it is done; rearming a descriptor that is still ready fires it again.
+ */
+struct EventLoop {
+  int fd;                       /* The epoll file descriptor. */
+  unsigned int maxEvents;       /* The most events returned from a single wait. */
+  struct epoll_event *fired;    /* The events returned from the last wait. */
+};
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Create a new event loop.
+ *
+ * @param maxEvents: The maximum number of events to return per wait.
+ * @return The event loop, or NULL if the kernel refused to create one.
+ */
+EventLoop *eventLoopCreate(unsigned int maxEvents) {
+  assert(maxEvents > 0);
+
+  EventLoop *loop = mmalloc(sizeof(EventLoop));
+
+  if ((loop->fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    mfree(loop);
+    return NULL;
+  }
+
+  loop->maxEvents = maxEvents;
+  loop->fired = mcalloc(sizeof(struct epoll_event) * maxEvents);
+
+  return loop;
+}
+
+/*
+ * Free an existing event loop.
+ * Registered descriptors are not closed.
+ *
+ * @param loop: The loop to free.
+ */
+void eventLoopFree(EventLoop *loop) {
+  assert(loop != NULL);
+  close(loop->fd);
+  mfree(loop->fired);
+  mfree(loop);
+}
+
+
+/**********************************************************************
+ *                      Registering descriptors.
+ **********************************************************************/
+
+/*
+ * Convert an event mask to the matching epoll flags.
+ *
+ * @param mask: The combination of EVENT_* flags.
+ * @return The epoll flags.
+ */
+static uint32_t toEpoll(int mask) {
+  uint32_t events = EPOLLET | EPOLLRDHUP;
+
+  if (mask & EVENT_READABLE)
+    events |= EPOLLIN;
+  if (mask & EVENT_WRITABLE)
+    events |= EPOLLOUT;
+  if (mask & EVENT_ONESHOT)
+    events |= EPOLLONESHOT;
+
+  return events;
+}
+
+/*
+ * Convert fired epoll flags back to an event mask.
+ *
+ * @param events: The epoll flags.
+ * @return The combination of EVENT_* flags.
+ */
+static int fromEpoll(uint32_t events) {
+  int mask = EVENT_NONE;
+
+  if (events & EPOLLIN)
+    mask |= EVENT_READABLE;
+  if (events & EPOLLOUT)
+    mask |= EVENT_WRITABLE;
+  if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+    mask |= EVENT_CLOSED;
+
+  return mask;
+}
+
+/*
+ * Start watching a descriptor.
+ *
+ * @param loop: The loop to register with.
+ * @param fd: The descriptor to watch.
+ * @param mask: The events to watch for.
+ * @param data: The value handed back when the descriptor fires.
+ * @return 0 on success, -1 on error.
+ */
+int eventLoopAdd(EventLoop *loop, int fd, int mask, void *data) {
+  assert(loop != NULL);
+
+  struct epoll_event event = { .events = toEpoll(mask), .data.ptr = data };
+  return epoll_ctl(loop->fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/*
+ * Change the events watched on a descriptor, rearming it if it was one-shot.
+ * This may be called from any thread.
+ *
+ * @param loop: The loop the descriptor is registered with.
+ * @param fd: The descriptor to modify.
+ * @param mask: The new events to watch for.
+ * @param data: The value handed back when the descriptor fires.
+ * @return 0 on success, -1 on error.
+ */
+int eventLoopRearm(EventLoop *loop, int fd, int mask, void *data) {
+  assert(loop != NULL);
+
+  struct epoll_event event = { .events = toEpoll(mask), .data.ptr = data };
+  return epoll_ctl(loop->fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+/*
+ * Stop watching a descriptor.
+ *
+ * @param loop: The loop the descriptor is registered with.
+ * @param fd: The descriptor to remove.
+ * @return 0 on success, -1 on error.
+ */
+int eventLoopRemove(EventLoop *loop, int fd) {
+  assert(loop != NULL);
+  return epoll_ctl(loop->fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+
+/**********************************************************************
+ *                         Waiting for events.
+ **********************************************************************/
+
+/*
+ * Block until at least one descriptor is ready.
+ *
+ * @param loop: The loop to wait on.
+ * @param timeout: The maximum milliseconds to wait, or -1 to wait forever.
+ * @return The number of fired events, 0 on timeout or -1 on error.
+ */
+int eventLoopWait(EventLoop *loop, int timeout) {
+  assert(loop != NULL);
+
+  int fired;
+
+  do {
+    fired = epoll_wait(loop->fd, loop->fired, loop->maxEvents, timeout);
+  } while (fired < 0 && errno == EINTR);
+
+  return fired;
+}
+
+/*
+ * @param loop: The loop that was waited on.
+ * @param index: The fired event, less than the count returned by `eventLoopWait`.
+ * @return The data the descriptor was registered with.
+ */
+void *eventLoopFiredData(const EventLoop *loop, unsigned int index) {
+  assert(loop != NULL);
+  assert(index < loop->maxEvents);
+  return loop->fired[index].data.ptr;
+}
+
+/*
+ * @param loop: The loop that was waited on.
+ * @param index: The fired event, less than the count returned by `eventLoopWait`.
+ * @return The EVENT_* flags that fired.
+ */
+int eventLoopFiredMask(const EventLoop *loop, unsigned int index) {
+  assert(loop != NULL);
+  assert(index < loop->maxEvents);
+  return fromEpoll(loop->fired[index].events);
+}
+
+
+/**********************************************************************
+ *                         Descriptor helpers.
+ **********************************************************************/
+
+/*
+ * Put a descriptor into non-blocking mode.
+ *
+ * @param fd: The descriptor to modify.
+ * @return 0 on success, -1 on error.
+ */
+int setNonBlocking(int fd) {
+  int flags;
+
+  if ((flags = fcntl(fd, F_GETFL, 0)) < 0)
+    return -1;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
@@ -0,0 +1,36 @@
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include <stdbool.h>
+
+
+/*
+ * Edge-triggered readiness notifications for a set of file descriptors.
+ */
+
+#define EVENT_NONE      0
+#define EVENT_READABLE  1   /* The descriptor has data to read (or a connection to accept). */
+#define EVENT_WRITABLE  2   /* The descriptor can accept more output. */
+#define EVENT_CLOSED    4   /* The peer hung up or the descriptor is in an error state. */
+#define EVENT_ONESHOT   8   /* Disarm the descriptor after it fires once, until it is rearmed. */
+
+typedef struct EventLoop EventLoop;
+
+/* Memory management. */
+EventLoop *eventLoopCreate(unsigned int maxEvents);
+void eventLoopFree(EventLoop *loop);
+
+/* Registering descriptors. */
+int eventLoopAdd(EventLoop *loop, int fd, int mask, void *data);
+int eventLoopRearm(EventLoop *loop, int fd, int mask, void *data);
+int eventLoopRemove(EventLoop *loop, int fd);
+
+/* Waiting for events. */
+int eventLoopWait(EventLoop *loop, int timeout);
+void *eventLoopFiredData(const EventLoop *loop, unsigned int index);
+int eventLoopFiredMask(const EventLoop *loop, unsigned int index);
+
+/* Descriptor helpers. */
+int setNonBlocking(int fd);
+
+#endif
@@ -0,0 +1,245 @@
+#include "histogram.h"
+#include "mmalloc.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+
+#define SUB_COUNT             (1 << HISTOGRAM_SUB_BITS)
+#define HALF_COUNT            (SUB_COUNT / 2)
+#define NUM_BUCKETS           ((64 - HISTOGRAM_SUB_BITS + 1) * HALF_COUNT + HALF_COUNT)
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+/*
+ * Values below SUB_COUNT each get their own bucket. Above that, every power of
+ * two is split into HALF_COUNT buckets of equal width, so a bucket is never
+ * wider than 1 / HALF_COUNT of the values in it.
+ */
+struct Histogram {
+  uint64_t count;                             /* The number of values recorded. */
+  uint64_t min;                               /* The smallest value recorded. */
+  uint64_t max;                               /* The largest value recorded. */
+  double sum;                                 /* The sum of every value recorded. */
+  uint64_t buckets[NUM_BUCKETS];              /* The number of values recorded in each bucket. */
+};
+
+
+/**********************************************************************
+ *                              Buckets.
+ **********************************************************************/
+
+/*
+ * @param value: A value to record.
+ * @return The index of the bucket that counts the value.
+ */
+static unsigned int bucketIndex(uint64_t value) {
+  unsigned int shift;
+
+  if (value < SUB_COUNT)
+    return value;
+
+  /* Keep the HISTOGRAM_SUB_BITS most significant bits of the value. */
+  shift = 63 - __builtin_clzll(value) - (HISTOGRAM_SUB_BITS - 1);
+  return shift * HALF_COUNT + (value >> shift);
+}
+
+/*
+ * @param index: The index of a bucket.
+ * @return The largest value the bucket counts.
+ */
+static uint64_t bucketHighest(unsigned int index) {
+  unsigned int shift;
+
+  if (index < SUB_COUNT)
+    return index;
+
+  shift = index / HALF_COUNT - 1;
+  return ((uint64_t) (index % HALF_COUNT + HALF_COUNT) << shift) + ((uint64_t) 1 << shift) - 1;
+}
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Create a new, empty histogram.
+ *
+ * @return The newly created histogram.
+ */
+Histogram *histogramCreate(void) {
+  Histogram *histogram = mmalloc(sizeof(Histogram));
+  histogramReset(histogram);
+  return histogram;
+}
+
+/*
+ * Free an existing histogram.
+ *
+ * @param histogram: The histogram to free.
+ */
+void histogramFree(Histogram *histogram) {
+  assert(histogram != NULL);
+  mfree(histogram);
+}
+
+
+/**********************************************************************
+ *                       Histogram information.
+ **********************************************************************/
+
+/*
+ * @param histogram: The histogram to examine.
+ * @return The number of values recorded.
+ */
+uint64_t histogramCount(const Histogram *histogram) {
+  assert(histogram != NULL);
+  return histogram->count;
+}
+
+/*
+ * @param histogram: The histogram to examine.
+ * @return The smallest value recorded, or 0 if there is none.
+ */
+uint64_t histogramMin(const Histogram *histogram) {
+  assert(histogram != NULL);
+  return histogram->count > 0 ? histogram->min : 0;
+}
+
+/*
+ * @param histogram: The histogram to examine.
+ * @return The largest value recorded, or 0 if there is none.
+ */
+uint64_t histogramMax(const Histogram *histogram) {
+  assert(histogram != NULL);
+  return histogram->max;
+}
+
+/*
+ * @param histogram: The histogram to examine.
+ * @return The mean of the values recorded, or 0 if there is none.
+ */
+double histogramMean(const Histogram *histogram) {
+  assert(histogram != NULL);
+  return histogram->count > 0 ? histogram->sum / histogram->count : 0;
+}
+
+/*
+ * Find the value below which a given percentage of the recorded values fall.
+ * It is reported as the largest value of its bucket, but never above the maximum.
+ *
+ * @param histogram: The histogram to examine.
+ * @param percentile: The percentage, from 0 to 100.
+ * @return The value at the percentile, or 0 if there is none.
+ */
+uint64_t histogramPercentile(const Histogram *histogram, double percentile) {
+  assert(histogram != NULL);
+  assert(percentile >= 0 && percentile <= 100);
+
+  uint64_t target = ceil(percentile / 100 * histogram->count), seen = 0, value;
+
+  if (histogram->count == 0)
+    return 0;
+  if (target == 0)
+    target = 1;
+
+  for (unsigned int i = 0; i < NUM_BUCKETS; i++) {
+    if ((seen += histogram->buckets[i]) >= target) {
+      value = bucketHighest(i);
+      return value < histogram->max ? value : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+/*
+ * Count the recorded values up to a given value, as needed for cumulative buckets.
+ * Only buckets that lie entirely at or below the value are counted, so the count
+ * is exact for a value that ends a bucket and otherwise within the histogram's
+ * precision.
+ *
+ * @param histogram: The histogram to examine.
+ * @param value: The largest value to count.
+ * @return The number of values recorded up to the value.
+ */
+uint64_t histogramCountAtMost(const Histogram *histogram, uint64_t value) {
+  assert(histogram != NULL);
+
+  uint64_t count = 0;
+
+  if (value >= histogram->max)
+    return histogram->count;
+
+  for (unsigned int i = 0; i < NUM_BUCKETS && bucketHighest(i) <= value; i++)
+    count += histogram->buckets[i];
+  return count;
+}
+
+/*
+ * @param histogram: The histogram to examine.
+ * @return The sum of the values recorded.
+ */
+double histogramSum(const Histogram *histogram) {
+  assert(histogram != NULL);
+  return histogram->sum;
+}
+
+
+/**********************************************************************
+ *                         Histogram methods.
+ **********************************************************************/
+
+/*
+ * Record a value.
+ *
+ * @param histogram: The histogram to record into.
+ * @param value: The value.
+ */
+void histogramRecord(Histogram *histogram, uint64_t value) {
+  assert(histogram != NULL);
+
+  histogram->buckets[bucketIndex(value)]++;
+  if (histogram->count++ == 0 || value < histogram->min)
+    histogram->min = value;
+  if (value > histogram->max)
+    histogram->max = value;
+  histogram->sum += value;
+}
+
+/*
+ * Add every value recorded in another histogram.
+ *
+ * @param histogram: The histogram to record into.
+ * @param other: The histogram whose values to add.
+ */
+void histogramMerge(Histogram *histogram, const Histogram *other) {
+  assert(histogram != NULL);
+  assert(other != NULL);
+
+  if (other->count == 0)
+    return;
+
+  for (unsigned int i = 0; i < NUM_BUCKETS; i++)
+    histogram->buckets[i] += other->buckets[i];
+  if (histogram->count == 0 || other->min < histogram->min)
+    histogram->min = other->min;
+  if (other->max > histogram->max)
+    histogram->max = other->max;
+  histogram->count += other->count;
+  histogram->sum += other->sum;
+}
+
+/*
+ * Forget every value recorded.
+ *
+ * @param histogram: The histogram to empty.
+ */
+void histogramReset(Histogram *histogram) {
+  assert(histogram != NULL);
+  memset(histogram, 0, sizeof(Histogram));
+}
@@ -0,0 +1,38 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdint.h>
+
+
+/*
+ * A log-linear histogram of non-negative integers, in the style of HdrHistogram.
+ *
+ * Values are counted in buckets whose width grows with the value, so any value
+ * up to 2^64 is recorded in constant time and space, and every percentile is
+ * reported to within HISTOGRAM_PRECISION of the true value.
+ */
+
+#define HISTOGRAM_SUB_BITS    7
+#define HISTOGRAM_PRECISION   (1.0 / (1 << (HISTOGRAM_SUB_BITS - 1)))
+
+typedef struct Histogram Histogram;
+
+/* Memory management. */
+Histogram *histogramCreate(void);
+void histogramFree(Histogram *histogram);
+
+/* Histogram information. */
+uint64_t histogramCount(const Histogram *histogram);
+uint64_t histogramMin(const Histogram *histogram);
+uint64_t histogramMax(const Histogram *histogram);
+double histogramMean(const Histogram *histogram);
+uint64_t histogramPercentile(const Histogram *histogram, double percentile);
+uint64_t histogramCountAtMost(const Histogram *histogram, uint64_t value);
+double histogramSum(const Histogram *histogram);
+
+/* Histogram methods. */
+void histogramRecord(Histogram *histogram, uint64_t value);
+void histogramMerge(Histogram *histogram, const Histogram *other);
+void histogramReset(Histogram *histogram);
+
+#endif
@@ -1,12 +1,16 @@
+#include "buffer.h"
 #include "dict.h"
 #include "json.h"
 #include "list.h"
 #include "mmalloc.h"
+#include "trace.h"
 
 #include <assert.h>
 #include <ctype.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -19,6 +23,7 @@
  */
 Json *jsonCreate(void) {
   Json *json = mmalloc(sizeof(Json));
+  json->references = 1;
   return json;
 }
 
@@ -113,7 +118,20 @@ Json *jsonCreateObject(Dict *dict) {
 }
 
 /*
- * Free the memory of an existing Json object.
+ * Take another reference to a Json object, which keeps it and everything in it
+ * alive until it is released with `jsonFree`.
+ *
+ * @param json: The object to hold on to.
+ * @return The object.
+ */
+Json *jsonRetain(Json *json) {
+  assert(json != NULL);
+  __atomic_add_fetch(&json->references, 1, __ATOMIC_RELAXED);
+  return json;
+}
+
+/*
+ * Release a reference to a Json object, and free its memory if it was the last one.
  *
  * @param json: The object to free.
  */
@@ -121,6 +139,9 @@ void jsonFree(void *json) {
   assert(json != NULL);
 
   Json *js = (Json*) json;
+  if (__atomic_sub_fetch(&js->references, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+
   switch (js->type) {
     case JSON_STRING:   mfree(js->stringValue); break;
     case JSON_ARRAY:    listFree(js->arrayValue); break;
@@ -132,6 +153,106 @@ void jsonFree(void *json) {
 }
 
 
+/**********************************************************************
+ *                         Persistent updates.
+ **********************************************************************/
+
+/*
+ * Copy an array or object, sharing its values with the original.
+ *
+ * @param json: The array or object to copy.
+ * @return The copy.
+ */
+static Json *jsonCopyShallow(const Json *json) {
+  ListIter *values;
+  DictIter *keys;
+  Json *value;
+  Dict *dict;
+  List *list;
+  char *key;
+
+  if (json->type == JSON_ARRAY) {
+    list = listCreate(LIST_TYPE_ARRAY, &jsonFree);
+    values = listIter(json->arrayValue);
+    while ((value = listIterNext(values)) != NULL)
+      listAppend(list, jsonRetain(value));
+    listIterFree(values);
+    return jsonCreateArray(list);
+  }
+
+  dict = dictCreate(&jsonFree);
+  keys = dictIter(json->objectValue);
+  while ((key = dictIterNext(keys)) != NULL)
+    dictSet(dict, key, jsonRetain(dictGet(json->objectValue, key)));
+  dictIterFree(keys);
+  return jsonCreateObject(dict);
+}
+
+/*
+ * Set a value inside a Json object, leaving the object itself as it is. Only the
+ * arrays and objects on the path to the value are copied, and the new version
+ * shares everything else with the old one, so either can be read or freed while
+ * the other is in use.
+ *
+ * @param json: The object to update.
+ * @param path: The object keys and array indexes leading to the value. A missing
+ *              last key is added, and the last index may be one past the end of
+ *              its array to append to it.
+ * @param depth: The length of the path; 0 replaces the whole object.
+ * @param value: The value to set, taken over by the new version.
+ * @return The new version, or NULL if the path leads nowhere, leaving the value
+ *         to the caller.
+ */
+Json *jsonSet(const Json *json, const char **path, unsigned int depth, Json *value) {
+  assert(json != NULL);
+  assert(value != NULL);
+  assert(depth == 0 || path != NULL);
+
+  Json *child = NULL, *updated, *copy;
+  long index = 0;
+  char *end;
+
+  if (depth == 0)
+    return value;
+
+  switch (json->type) {
+    case JSON_OBJECT:
+      child = dictGet(json->objectValue, path[0]);
+      break;
+    case JSON_ARRAY:
+      index = strtol(path[0], &end, 10);
+      if (*path[0] == '\0' || *end != '\0' || index < 0 || index > listLength(json->arrayValue))
+        return NULL;
+      if (index < listLength(json->arrayValue))
+        child = listGet(json->arrayValue, index);
+      break;
+    default:
+      return NULL;
+  }
+
+  if (child != NULL)
+    updated = jsonSet(child, path + 1, depth - 1, value);
+  else
+    updated = depth == 1 ? value : NULL;
+  if (updated == NULL)
+    return NULL;
+
+  copy = jsonCopyShallow(json);
+  if (json->type == JSON_OBJECT) {
+    /* Sets append to a dict, so the old value goes first. */
+    if (child != NULL)
+      dictRemove(copy->objectValue, path[0]);
+    dictSet(copy->objectValue, path[0], updated);
+  } else if (child != NULL) {
+    listInsert(copy->arrayValue, index, updated);
+    listRemove(copy->arrayValue, index + 1);
+  } else {
+    listAppend(copy->arrayValue, updated);
+  }
+  return copy;
+}
+
+
 /**********************************************************************
  *               Parse Json string to binary struct.
  **********************************************************************/
@@ -402,16 +523,20 @@ static const char *parseNext(Json *json, const char *content, char **err) {
  * @return The parsed Json object.
  */
 Json *jsonParse(const char *content, char **err) {
+  trace1(json__parse__start, content);
+
   Json *json = jsonCreate();
   const char *end = parseNext(json, skip(content), err);
 
   if (!end) {
     /* Parsing error. */
     jsonFree(json);
+    trace1(json__parse__done, NULL);
     return false;
   }
 
   /* Success! */
+  trace1(json__parse__done, json);
   return json;
 }
 
@@ -420,164 +545,251 @@ Json *jsonParse(const char *content, char **err) {
  *                    Stringify a Json object
  **********************************************************************/
 
-#define JSON_STRING_INITIAL_SIZE  128
-#define JSON_STRING_MAX_SIZE      4096
-#define JSON_INT_MAX_SIZE         64
-#define JSON_DOUBLE_MAX_SIZE      64
-#define JSON_DICT_KEY_MAX_SIZE    256
+#define JSON_WRITER_DEPTH         8
+#define JSON_NUMBER_MAX_SIZE      64
+
+/*
+ * An array or object the writer is in the middle of.
+ */
+typedef struct JsonFrame {
+  const Json *json;         /* The array or object. */
+  union {
+    ListIter *values;       /* The array values not yet written. */
+    DictIter *keys;         /* The object keys not yet written. */
+  };
+  bool first;               /* Whether no member has been written yet. */
+} JsonFrame;
 
+/*
+ * Writes a Json object out a piece at a time. Instead of recursing, the writer
+ * keeps a stack of the arrays and objects it is inside of, so it can stop after
+ * any value and carry on later.
+ */
+struct JsonWriter {
+  const Json *root;         /* The object being written. */
+  bool started;             /* Whether anything has been written yet. */
+  JsonFrame *frames;        /* The arrays and objects being written, innermost last. */
+  unsigned int depth;       /* The number of frames in use. */
+  unsigned int capacity;    /* The number of frames allocated. */
+};
 
-static void stringifyNext(const Json *json, char **content);
 
 /*
- * Concatenate a value to the end of a string without worrying about buffer overflows.
+ * Create a writer for a Json object.
+ * The object must not change or be freed until the writer is done with it.
  *
- * @param content: The string to update.
- * @param value: The string to append.
+ * @param json: The object to write.
+ * @return The newly created writer.
  */
-static void concat(char **content, const char *value) {
-  int offset  = strlen(*content),
-      size    = strlen(value),
-      oldSize = msize(*content),
-      newSize = oldSize;
-
-  /* Check how much room to allocate. */
-  while (offset + size > newSize)
-    newSize = newSize * 2 + 1;
-  if (newSize > oldSize)
-    *content = mrealloc(*content, newSize);
-
-  strcat(*content, value);
-}
+JsonWriter *jsonWriterCreate(const Json *json) {
+  assert(json != NULL);
 
-static void stringifyNull(const Json *json, char **content) {
-  assert(json->type == JSON_NULL);
-  concat(content, NULL_LITERAL);
+  JsonWriter *writer = mmalloc(sizeof(JsonWriter));
+  writer->root = json;
+  writer->started = false;
+  writer->frames = mmalloc(sizeof(JsonFrame) * JSON_WRITER_DEPTH);
+  writer->depth = 0;
+  writer->capacity = JSON_WRITER_DEPTH;
+  return writer;
 }
 
-static void stringifyBool(const Json *json, char **content) {
-  assert(json->type == JSON_BOOL);
-
-  if (json->boolValue)
-    concat(content, TRUE_LITERAL);
-  else
-    concat(content, FALSE_LITERAL);
-}
+/*
+ * Free a writer, whether or not it is done.
+ *
+ * @param writer: The writer to free.
+ */
+void jsonWriterFree(JsonWriter *writer) {
+  assert(writer != NULL);
 
-static void stringifyInt(const Json *json, char **content) {
-  assert(json->type == JSON_INT);
+  JsonFrame *frame;
 
-  char value[JSON_INT_MAX_SIZE];
-  sprintf(value, "%d", json->intValue);
-  concat(content, value);
+  while (writer->depth > 0) {
+    frame = &writer->frames[--writer->depth];
+    if (frame->json->type == JSON_ARRAY)
+      listIterFree(frame->values);
+    else
+      dictIterFree(frame->keys);
+  }
+  mfree(writer->frames);
+  mfree(writer);
 }
 
-static void stringifyDouble(const Json *json, char **content) {
-  assert(json->type == JSON_DOUBLE);
+/*
+ * Write a value; an array or object is only opened, and its members are left to the caller.
+ *
+ * @param writer: The writer to write with.
+ * @param json: The value to write.
+ * @param output: The buffer to write to.
+ */
+static void writeValue(JsonWriter *writer, const Json *json, Buffer *output) {
+  JsonFrame *frame;
 
-  char value[JSON_DOUBLE_MAX_SIZE];
-  sprintf(value, "%g", json->doubleValue);
-  concat(content, value);
-}
+  switch (json->type) {
+    case JSON_NULL:   bufferAppend(output, NULL_LITERAL, NULL_LEN); return;
+    case JSON_BOOL:
+      if (json->boolValue)
+        bufferAppend(output, TRUE_LITERAL, TRUE_LEN);
+      else
+        bufferAppend(output, FALSE_LITERAL, FALSE_LEN);
+      return;
+    case JSON_INT:    bufferFormat(output, "%d", json->intValue); return;
+    case JSON_DOUBLE: bufferFormat(output, "%g", json->doubleValue); return;
+    case JSON_STRING:
+      bufferFormat(output, "%c%s%c", STRING_SEP, json->stringValue, STRING_SEP);
+      return;
+    case JSON_ARRAY:
+    case JSON_OBJECT:
+      break;
+  }
 
-static void stringifyString(const Json *json, char **content) {
-  assert(json->type == JSON_STRING);
+  if (writer->depth == writer->capacity) {
+    writer->capacity *= 2;
+    writer->frames = mrealloc(writer->frames, sizeof(JsonFrame) * writer->capacity);
+  }
 
-  char value[JSON_STRING_MAX_SIZE];
-  sprintf(value, "%c%s%c", STRING_SEP, json->stringValue, STRING_SEP);
-  concat(content, value);
+  frame = &writer->frames[writer->depth++];
+  frame->json = json;
+  frame->first = true;
+  if (json->type == JSON_ARRAY) {
+    bufferFormat(output, "%c", ARRAY_BEGIN);
+    frame->values = listIter(json->arrayValue);
+  } else {
+    bufferFormat(output, "%c", OBJECT_BEGIN);
+    frame->keys = dictIter(json->objectValue);
+  }
 }
 
-static void stringifyArray(const Json *json, char **content) {
-  assert(json->type == JSON_ARRAY);
-
-  char buffer[2];
-
-  /* Opening bracket. */
-  sprintf(buffer, "%c", ARRAY_BEGIN);
-  concat(content, buffer);
-
-  /* Inner values. */
-  ListIter *iter = listIter(json->arrayValue);
-  Json *entry;
-  bool first = true;
+/*
+ * Write the next member of the innermost array or object, or close it.
+ *
+ * @param writer: The writer to write with.
+ * @param output: The buffer to write to.
+ */
+static void writeMember(JsonWriter *writer, Buffer *output) {
+  JsonFrame *frame = &writer->frames[writer->depth - 1];
+  const Json *json = frame->json;
+  Json *value;
+  char *key;
 
-  while ((entry = listIterNext(iter)) != NULL) {
-    if (!first) {
-      sprintf(buffer, "%c", VALUE_SEP);
-      concat(content, buffer);
+  if (json->type == JSON_ARRAY) {
+    if ((value = listIterNext(frame->values)) == NULL) {
+      listIterFree(frame->values);
+      bufferFormat(output, "%c", ARRAY_END);
+      writer->depth--;
+      return;
+    }
+    if (!frame->first)
+      bufferFormat(output, "%c", VALUE_SEP);
+  } else {
+    if ((key = dictIterNext(frame->keys)) == NULL) {
+      dictIterFree(frame->keys);
+      bufferFormat(output, "%c", OBJECT_END);
+      writer->depth--;
+      return;
     }
-    first = false;
-    stringifyNext(entry, content);
+    if (!frame->first)
+      bufferFormat(output, "%c", VALUE_SEP);
+    bufferFormat(output, "%c%s%c%c", STRING_SEP, key, STRING_SEP, KEY_SEP);
+    value = dictGet(json->objectValue, key);
   }
 
-  listIterFree(iter);
-
-  /* Closing bracket. */
-  sprintf(buffer, "%c", ARRAY_END);
-  concat(content, buffer);
+  frame->first = false;
+  writeValue(writer, value, output);
 }
 
-static void stringifyObject(const Json *json, char **content) {
-  assert(json->type == JSON_OBJECT);
-
-  char buffer[2], keyBuffer[JSON_DICT_KEY_MAX_SIZE];
-
-  /* Opening brace. */
-  sprintf(buffer, "%c", OBJECT_BEGIN);
-  concat(content, buffer);
-
-  /* Inner values. */
-  DictIter *iter = dictIter(json->objectValue);
-  char *key;
-  Json *value;
-  bool first = true;
+/*
+ * Write the next piece of a Json object.
+ * Writing stops after the first value that brings the piece to the given size,
+ * so a piece only goes over it by at most one number or string.
+ *
+ * @param writer: The writer to write with.
+ * @param output: The buffer to append the piece to.
+ * @param limit: The size of the piece.
+ * @return Whether there is more to write.
+ */
+bool jsonWriterNext(JsonWriter *writer, Buffer *output, size_t limit) {
+  assert(writer != NULL);
+  assert(output != NULL);
 
-  while ((key = dictIterNext(iter)) != NULL) {
-    if (!first) {
-      sprintf(buffer, "%c", VALUE_SEP);
-      concat(content, buffer);
-    }
-    first = false;
+  size_t start = bufferLength(output);
 
-    /* Write the key. */
-    sprintf(keyBuffer, "%c%s%c%c", STRING_SEP, key, STRING_SEP, KEY_SEP);
-    concat(content, keyBuffer);
+  trace1(json__write__start, writer);
 
-    /* Write the value. */
-    value = dictGet(json->objectValue, key);
-    stringifyNext(value, content);
+  if (!writer->started) {
+    writer->started = true;
+    writeValue(writer, writer->root, output);
   }
 
-  dictIterFree(iter);
+  while (writer->depth > 0 && bufferLength(output) - start < limit)
+    writeMember(writer, output);
 
-  /* Closing brace. */
-  sprintf(buffer, "%c", OBJECT_END);
-  concat(content, buffer);
+  trace2(json__write__done, writer, bufferLength(output) - start);
+  return writer->depth > 0;
 }
 
-static void stringifyNext(const Json *json, char **content) {
+/*
+ * Measure how long a Json object is as a string, without converting it.
+ *
+ * @param json: The object to measure.
+ * @return The length of the object represented as a string.
+ */
+size_t jsonStringifyLength(const Json *json) {
+  assert(json != NULL);
+
+  char number[JSON_NUMBER_MAX_SIZE];
+  size_t length;
+  ListIter *values;
+  DictIter *keys;
+  Json *value;
+  char *key;
+
   switch (json->type) {
-    case JSON_NULL:   stringifyNull(json, content); break;
-    case JSON_BOOL:   stringifyBool(json, content); break;
-    case JSON_INT:    stringifyInt(json, content); break;
-    case JSON_DOUBLE: stringifyDouble(json, content); break;
-    case JSON_STRING: stringifyString(json, content); break;
-    case JSON_ARRAY:  stringifyArray(json, content); break;
-    case JSON_OBJECT: stringifyObject(json, content); break;
+    case JSON_NULL:   return NULL_LEN;
+    case JSON_BOOL:   return json->boolValue ? TRUE_LEN : FALSE_LEN;
+    case JSON_INT:    return snprintf(number, sizeof(number), "%d", json->intValue);
+    case JSON_DOUBLE: return snprintf(number, sizeof(number), "%g", json->doubleValue);
+    case JSON_STRING: return strlen(json->stringValue) + 2;
+    case JSON_ARRAY:
+      /* The brackets and a separator between every two values. */
+      length = listLength(json->arrayValue) > 0 ? listLength(json->arrayValue) + 1 : 2;
+      values = listIter(json->arrayValue);
+      while ((value = listIterNext(values)) != NULL)
+        length += jsonStringifyLength(value);
+      listIterFree(values);
+      return length;
+    case JSON_OBJECT:
+      /* The braces, a separator between every two members, and every key's quotes and colon. */
+      length = dictSize(json->objectValue) > 0 ? dictSize(json->objectValue) + 1 : 2;
+      keys = dictIter(json->objectValue);
+      while ((key = dictIterNext(keys)) != NULL)
+        length += strlen(key) + 3 + jsonStringifyLength(dictGet(json->objectValue, key));
+      dictIterFree(keys);
+      return length;
   }
+  return 0;
 }
 
 /*
  * Convert an object into a string.
+ * The string is written straight into storage of its exact size, which the
+ * caller takes over, so it is never held twice.
  *
  * @param json: The object to convert.
  * @return The object represented as a string.
  */
 char *jsonStringify(const Json *json) {
   assert(json != NULL);
+  trace1(json__stringify__start, json);
 
-  char *content = mcalloc(JSON_STRING_INITIAL_SIZE);
-  stringifyNext(json, &content);
-  return content;
+  size_t length = jsonStringifyLength(json);
+  Buffer *buffer = bufferCreate(length + 1);
+  JsonWriter *writer = jsonWriterCreate(json);
+
+  jsonWriterNext(writer, buffer, SIZE_MAX);
+  bufferAppend(buffer, "", 1);
+  assert(bufferCapacity(buffer) == length + 1);
+
+  jsonWriterFree(writer);
+  trace2(json__stringify__done, json, length);
+  return bufferRelease(buffer);
 }
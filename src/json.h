@@ -1,14 +1,22 @@
 #ifndef __JSON_H__
 #define __JSON_H__
 
+#include "buffer.h"
 #include "list.h"
 #include "dict.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+
 
 #define JSON_OBJECT_KEY_LIMIT 256
 
 /*
  * Converting to and from JSON strings and C objects.
+ *
+ * Json objects are reference counted, so that a new version of an object made
+ * with `jsonSet` can share every part it did not change with the old one. Shared
+ * objects must not be changed in place.
  */
 
 typedef enum JsonType {
@@ -23,6 +31,7 @@ typedef enum JsonType {
 
 typedef struct Json {
   JsonType type;
+  int references;
   union {
     bool boolValue;
     int intValue;
@@ -44,10 +53,22 @@ Json *jsonCreateDouble(double value);
 Json *jsonCreateString(char *value);
 Json *jsonCreateArray(List *list);
 Json *jsonCreateObject(Dict *dict);
+Json *jsonRetain(Json *json);
 void jsonFree(void *json);
 
+typedef struct JsonWriter JsonWriter;
+
 /* Conversions. */
 Json *jsonParse(const char *content, char **err);
 char *jsonStringify(const Json *json);
+size_t jsonStringifyLength(const Json *json);
+
+/* Persistent updates. */
+Json *jsonSet(const Json *json, const char **path, unsigned int depth, Json *value);
+
+/* Writing a Json object in pieces. */
+JsonWriter *jsonWriterCreate(const Json *json);
+void jsonWriterFree(JsonWriter *writer);
+bool jsonWriterNext(JsonWriter *writer, Buffer *output, size_t limit);
 
 #endif
@@ -0,0 +1,446 @@
+#include "log.h"
+#include "mmalloc.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define CACHE_LINE            64
+#define LOG_MESSAGE_SIZE      1024
+#define LOG_BATCH_SIZE        (64 * 1024)
+#define TRUNCATED             "...\n"
+
+#define loadRelaxed(p)        (__atomic_load_n(p, __ATOMIC_RELAXED))
+#define loadAcquire(p)        (__atomic_load_n(p, __ATOMIC_ACQUIRE))
+#define storeRelaxed(p,v)     (__atomic_store_n(p, v, __ATOMIC_RELAXED))
+#define storeRelease(p,v)     (__atomic_store_n(p, v, __ATOMIC_RELEASE))
+#define fetchAdd(p,v)         (__atomic_fetch_add(p, v, __ATOMIC_RELAXED))
+#define fence()               (__atomic_thread_fence(__ATOMIC_SEQ_CST))
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+/*
+ * The messages logged by one thread, waiting for the writer.
+ *
+ * A single-producer single-consumer byte ring: the owning thread appends whole
+ * messages and publishes them by moving `head`, and the writer consumes them by
+ * moving `tail`. Both only ever grow; their difference is the number of bytes
+ * waiting. Each side's counters sit on their own cache line.
+ */
+typedef struct LogRing {
+  char *data;                                 /* The storage. */
+  unsigned long mask;                         /* The size of the storage minus one. */
+  pthread_t owner;                            /* The thread that logs into the ring. */
+  struct LogRing *next;                       /* The next ring of the same logger. */
+  char pad1[CACHE_LINE];
+  unsigned long head;                         /* Where the next message goes; moved by the owner. */
+  unsigned long dropped;                      /* The number of messages that did not fit. */
+  char pad2[CACHE_LINE];
+  unsigned long tail;                         /* The first byte not yet taken; moved by the writer. */
+  unsigned long reported;                     /* The number of dropped messages already reported. */
+  char pad3[CACHE_LINE];
+} LogRing;
+
+struct Logger {
+  unsigned long id;                           /* Tells loggers apart in each thread's cached ring. */
+  int fd;                                     /* The file descriptor the log goes to. */
+  unsigned long ringSize;                     /* The size of each thread's ring. */
+  LogRing *rings;                             /* Every ring, newest first. */
+  pthread_mutex_t mutex;                      /* Lock to add a ring, or to park or wake the writer. */
+  pthread_cond_t wake;                        /* Signaled to wake the parked writer. */
+  pthread_cond_t drained;                     /* Signaled after each pass while a flush waits. */
+  pthread_t thread;                           /* The writer thread. */
+  bool stop;                                  /* Set to have the writer drain the rings one last time and exit. */
+  bool parked;                                /* Whether the writer is parked, or about to. */
+  unsigned int flushing;                      /* The number of threads waiting in `loggerFlush`. */
+  unsigned long passes;                       /* The number of times the writer drained every ring. */
+  char *batch;                                /* Where the writer gathers bytes for one write. */
+  size_t batchLength;                         /* The number of bytes gathered. */
+};
+
+static unsigned long loggerIds;               /* The id of the most recent logger. */
+static __thread unsigned long localLogger;    /* The logger the calling thread last logged to. */
+static __thread LogRing *localRing;           /* The calling thread's ring in that logger. */
+
+
+/**********************************************************************
+ *                            Log rings.
+ **********************************************************************/
+
+/*
+ * Copy bytes into a ring, wrapping around its end.
+ *
+ * @param ring: The ring to write.
+ * @param position: Where to write, as a count of bytes since the ring was created.
+ * @param data: The bytes to copy.
+ * @param length: The number of bytes.
+ */
+static void ringStore(LogRing *ring, unsigned long position, const char *data, size_t length) {
+  size_t offset = position & ring->mask, first = ring->mask + 1 - offset;
+
+  if (first > length)
+    first = length;
+  memcpy(ring->data + offset, data, first);
+  memcpy(ring->data, data + first, length - first);
+}
+
+/*
+ * Copy bytes out of a ring, wrapping around its end.
+ *
+ * @param ring: The ring to read.
+ * @param position: Where to read, as a count of bytes since the ring was created.
+ * @param data: Where to copy the bytes.
+ * @param length: The number of bytes.
+ */
+static void ringLoad(const LogRing *ring, unsigned long position, char *data, size_t length) {
+  size_t offset = position & ring->mask, first = ring->mask + 1 - offset;
+
+  if (first > length)
+    first = length;
+  memcpy(data, ring->data + offset, first);
+  memcpy(data + first, ring->data, length - first);
+}
+
+/*
+ * Find the calling thread's ring, creating it the first time the thread logs.
+ * Only this slow path takes the lock; afterwards the ring is cached in the thread.
+ *
+ * @param logger: The logger being logged to.
+ * @return The calling thread's ring.
+ */
+static LogRing *loggerRing(Logger *logger) {
+  pthread_t self = pthread_self();
+  LogRing *ring;
+
+  if (localLogger == logger->id)
+    return localRing;
+
+  pthread_mutex_lock(&logger->mutex);
+  for (ring = logger->rings; ring != NULL && !pthread_equal(ring->owner, self); ring = ring->next);
+
+  if (ring == NULL) {
+    ring = mcalloc(sizeof(LogRing));
+    ring->data = mmalloc(logger->ringSize);
+    ring->mask = logger->ringSize - 1;
+    ring->owner = self;
+    ring->next = logger->rings;
+    storeRelease(&logger->rings, ring);
+  }
+  pthread_mutex_unlock(&logger->mutex);
+
+  localLogger = logger->id;
+  localRing = ring;
+  return ring;
+}
+
+
+/**********************************************************************
+ *                           Writer thread.
+ **********************************************************************/
+
+/*
+ * Write out the bytes gathered in the batch.
+ * A failed write is not retried: the log is not worth stalling the writer for.
+ *
+ * @param logger: The logger whose batch to write.
+ */
+static void loggerWriteBatch(Logger *logger) {
+  size_t written = 0;
+  ssize_t n;
+
+  while (written < logger->batchLength) {
+    if ((n = write(logger->fd, logger->batch + written, logger->batchLength - written)) > 0)
+      written += n;
+    else if (n < 0 && errno == EINTR)
+      continue;
+    else
+      break;
+  }
+
+  logger->batchLength = 0;
+}
+
+/*
+ * Move every message waiting in the rings into batches and write them out.
+ * A full batch is written before taking more from the same ring, so a message
+ * never has another thread's message written into its middle.
+ *
+ * @param logger: The logger to drain.
+ * @return The number of bytes written.
+ */
+static size_t loggerDrain(Logger *logger) {
+  unsigned long head, tail, dropped;
+  size_t length, total = 0;
+
+  for (LogRing *ring = loadAcquire(&logger->rings); ring != NULL; ring = ring->next) {
+    tail = ring->tail;
+    head = loadAcquire(&ring->head);
+
+    while (tail < head) {
+      if ((length = LOG_BATCH_SIZE - logger->batchLength) > head - tail)
+        length = head - tail;
+      ringLoad(ring, tail, logger->batch + logger->batchLength, length);
+      logger->batchLength += length;
+      total += length;
+
+      tail += length;
+      storeRelease(&ring->tail, tail);
+      if (logger->batchLength == LOG_BATCH_SIZE)
+        loggerWriteBatch(logger);
+    }
+
+    if ((dropped = loadRelaxed(&ring->dropped)) != ring->reported) {
+      if (LOG_BATCH_SIZE - logger->batchLength < LOG_MESSAGE_SIZE)
+        loggerWriteBatch(logger);
+      length = snprintf(logger->batch + logger->batchLength, LOG_MESSAGE_SIZE,
+                        "Dropped %lu log messages.\n", dropped - ring->reported);
+      logger->batchLength += length;
+      total += length;
+      ring->reported = dropped;
+    }
+  }
+
+  loggerWriteBatch(logger);
+  return total;
+}
+
+/*
+ * @param logger: The logger to examine.
+ * @return Whether any ring has a message or a drop the writer has not taken yet.
+ */
+static bool loggerPending(Logger *logger) {
+  for (LogRing *ring = loadAcquire(&logger->rings); ring != NULL; ring = ring->next)
+    if (loadAcquire(&ring->head) != ring->tail || loadRelaxed(&ring->dropped) != ring->reported)
+      return true;
+  return false;
+}
+
+/*
+ * Park the writer until a thread logs, a flush waits or the logger is freed.
+ *
+ * The writer announces it is parked before it looks at the rings one last time,
+ * while a thread that logs publishes its message before it looks whether the
+ * writer is parked. With a fence on both sides between the two, at least one of
+ * them sees the other: either the writer finds the message, or the thread finds
+ * the writer parked and wakes it.
+ *
+ * @param logger: The logger whose writer to park.
+ */
+static void loggerPark(Logger *logger) {
+  pthread_mutex_lock(&logger->mutex);
+  storeRelaxed(&logger->parked, true);
+  fence();
+  if (!loggerPending(logger) && !loadRelaxed(&logger->stop) && logger->flushing == 0)
+    pthread_cond_wait(&logger->wake, &logger->mutex);
+  storeRelaxed(&logger->parked, false);
+  pthread_mutex_unlock(&logger->mutex);
+}
+
+/*
+ * Wake the writer if it is parked, once a message was published.
+ *
+ * @param logger: The logger whose writer to wake.
+ */
+static void loggerWake(Logger *logger) {
+  fence();
+  if (!loadRelaxed(&logger->parked))
+    return;
+
+  pthread_mutex_lock(&logger->mutex);
+  pthread_cond_signal(&logger->wake);
+  pthread_mutex_unlock(&logger->mutex);
+}
+
+/*
+ * The procedure the writer thread runs: drain the rings, and park whenever they
+ * were empty, until the logger is freed.
+ *
+ * @param arg: The logger.
+ */
+static void *loggerRun(void *arg) {
+  Logger *logger = (Logger*) arg;
+  bool stop;
+
+  do {
+    /* Check before draining, so whatever was logged before the logger was freed is written. */
+    stop = loadAcquire(&logger->stop);
+    if (loggerDrain(logger) == 0 && !stop)
+      loggerPark(logger);
+    storeRelease(&logger->passes, logger->passes + 1);
+
+    if (loadRelaxed(&logger->flushing) > 0) {
+      pthread_mutex_lock(&logger->mutex);
+      pthread_cond_broadcast(&logger->drained);
+      pthread_mutex_unlock(&logger->mutex);
+    }
+  } while (!stop);
+
+  return NULL;
+}
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Create a new logger, and start its writer thread.
+ *
+ * @param fd: The file descriptor to write the log to.
+ * @param ringSize: The number of bytes each thread can have waiting; rounded up to a power of two.
+ * @return The newly created logger.
+ */
+Logger *loggerCreate(int fd, unsigned int ringSize) {
+  assert(fd >= 0);
+  assert(ringSize > 0);
+
+  Logger *logger = mcalloc(sizeof(Logger));
+  logger->id = fetchAdd(&loggerIds, 1) + 1;
+  logger->fd = fd;
+  for (logger->ringSize = 1; logger->ringSize < ringSize; logger->ringSize *= 2);
+  logger->batch = mmalloc(LOG_BATCH_SIZE);
+  pthread_mutex_init(&logger->mutex, NULL);
+  pthread_cond_init(&logger->wake, NULL);
+  pthread_cond_init(&logger->drained, NULL);
+  pthread_create(&logger->thread, NULL, loggerRun, logger);
+
+  return logger;
+}
+
+/*
+ * Write out every message logged so far, stop the writer thread and free the logger.
+ * No thread may log to it any more.
+ *
+ * @param logger: The logger to free.
+ */
+void loggerFree(Logger *logger) {
+  assert(logger != NULL);
+
+  LogRing *ring, *next;
+
+  pthread_mutex_lock(&logger->mutex);
+  storeRelease(&logger->stop, true);
+  pthread_cond_signal(&logger->wake);
+  pthread_mutex_unlock(&logger->mutex);
+  pthread_join(logger->thread, NULL);
+
+  for (ring = logger->rings; ring != NULL; ring = next) {
+    next = ring->next;
+    mfree(ring->data);
+    mfree(ring);
+  }
+
+  pthread_mutex_destroy(&logger->mutex);
+  pthread_cond_destroy(&logger->wake);
+  pthread_cond_destroy(&logger->drained);
+  mfree(logger->batch);
+  mfree(logger);
+}
+
+
+/**********************************************************************
+ *                         Logger information.
+ **********************************************************************/
+
+/*
+ * @param logger: The logger to examine.
+ * @return The number of messages dropped because their thread's ring was full.
+ */
+unsigned long loggerDropped(Logger *logger) {
+  assert(logger != NULL);
+
+  unsigned long dropped = 0;
+
+  for (LogRing *ring = loadAcquire(&logger->rings); ring != NULL; ring = ring->next)
+    dropped += loadRelaxed(&ring->dropped);
+  return dropped;
+}
+
+
+/**********************************************************************
+ *                           Logger methods.
+ **********************************************************************/
+
+/*
+ * Log a message, as vprintf would, without waiting for it to be written.
+ * Messages longer than LOG_MESSAGE_SIZE are cut short and end in "...".
+ *
+ * @param logger: The logger to log to.
+ * @param format: The format string.
+ * @param args: The values to format.
+ * @return Whether the message was logged, rather than dropped because the ring was full.
+ */
+bool loggerWrite(Logger *logger, const char *format, va_list args) {
+  assert(logger != NULL);
+  assert(format != NULL);
+
+  char message[LOG_MESSAGE_SIZE];
+  LogRing *ring = loggerRing(logger);
+  unsigned long head = ring->head;
+  int length;
+
+  if ((length = vsnprintf(message, LOG_MESSAGE_SIZE, format, args)) < 0)
+    return false;
+  if (length >= LOG_MESSAGE_SIZE) {
+    length = LOG_MESSAGE_SIZE - 1;
+    memcpy(message + length - (sizeof(TRUNCATED) - 1), TRUNCATED, sizeof(TRUNCATED) - 1);
+  }
+
+  if (ring->mask + 1 - (head - loadAcquire(&ring->tail)) < length) {
+    fetchAdd(&ring->dropped, 1);
+    loggerWake(logger);
+    return false;
+  }
+
+  ringStore(ring, head, message, length);
+  storeRelease(&ring->head, head + length);
+  loggerWake(logger);
+  return true;
+}
+
+/*
+ * Log a message, as printf would, without waiting for it to be written.
+ *
+ * @param logger: The logger to log to.
+ * @param format: The format string.
+ * @return Whether the message was logged, rather than dropped because the ring was full.
+ */
+bool loggerPrint(Logger *logger, const char *format, ...) {
+  va_list args;
+  bool logged;
+
+  va_start(args, format);
+  logged = loggerWrite(logger, format, args);
+  va_end(args);
+
+  return logged;
+}
+
+/*
+ * Wait until every message logged before the call, and every drop before it, is written.
+ * The writer must start and finish a whole pass over the rings after the call, so
+ * it does not park while a flush waits.
+ *
+ * @param logger: The logger to flush.
+ */
+void loggerFlush(Logger *logger) {
+  assert(logger != NULL);
+
+  unsigned long passes;
+
+  pthread_mutex_lock(&logger->mutex);
+  passes = loadAcquire(&logger->passes);
+  storeRelaxed(&logger->flushing, logger->flushing + 1);
+  pthread_cond_signal(&logger->wake);
+  while (loadAcquire(&logger->passes) < passes + 2)
+    pthread_cond_wait(&logger->drained, &logger->mutex);
+  storeRelaxed(&logger->flushing, logger->flushing - 1);
+  pthread_mutex_unlock(&logger->mutex);
+}
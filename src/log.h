@@ -0,0 +1,33 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+
+/*
+ * An asynchronous logger.
+ *
+ * Every thread that logs gets its own ring, which only it writes and only the
+ * logger's writer thread reads, so logging takes no lock and makes no system
+ * call. The writer thread drains every ring in batches, with one write per batch,
+ * and parks once they are empty until a thread logs again.
+ * A message that does not fit in its thread's ring is dropped and counted rather
+ * than waited for, and the writer reports the count in the log.
+ */
+
+typedef struct Logger Logger;
+
+/* Memory management. */
+Logger *loggerCreate(int fd, unsigned int ringSize);
+void loggerFree(Logger *logger);
+
+/* Logger information. */
+unsigned long loggerDropped(Logger *logger);
+
+/* Logger methods. */
+bool loggerWrite(Logger *logger, const char *format, va_list args);
+bool loggerPrint(Logger *logger, const char *format, ...);
+void loggerFlush(Logger *logger);
+
+#endif
@@ -8,35 +8,72 @@
 #include <unistd.h>
 
 
-#define SERVER_DEFAULT_PORT 7890
-#define SERVER_MAX_CLIENTS  16
+#define SERVER_DEFAULT_PORT     7890
+#define SERVER_WORKERS          16
+#define SERVER_MAX_CONNECTIONS  10000
+#define SERVER_BACKLOG          511
+#define SERVER_SHARDS           1
+#define SERVER_IDLE_TIMEOUT     300
+#define SERVER_SESSION_TIMEOUT  60
+#define SERVER_COMMAND_TIMEOUT  30
+#define SERVER_SLOWLOG_USEC     10000
+#define SERVER_METRICS_PORT     0
 
 
 int main(int argc, char **argv) {
   /* Default settings. */
   bool client;
   int port = SERVER_DEFAULT_PORT,
-      maxClients = SERVER_MAX_CLIENTS;
+      workers = SERVER_WORKERS,
+      maxConnections = SERVER_MAX_CONNECTIONS,
+      backlog = SERVER_BACKLOG,
+      shards = SERVER_SHARDS,
+      idleTimeout = SERVER_IDLE_TIMEOUT,
+      sessionTimeout = SERVER_SESSION_TIMEOUT,
+      commandTimeout = SERVER_COMMAND_TIMEOUT,
+      slowlogThreshold = SERVER_SLOWLOG_USEC,
+      metricsPort = SERVER_METRICS_PORT;
   char logFile[128] = "";
   char host[64] = "localhost";
+  char workerCpus[128] = "", shardCpus[128] = "";
   LogLevel verbosity = LOG_LEVEL_INFO;
+  IoEngine engine = IO_ENGINE_EPOLL;
   char opt;
 
   /* Custom command line options. */
-  while ((opt = getopt(argc, argv, "cdh:l:n:p:")) != -1) {
+  while ((opt = getopt(argc, argv, "A:a:b:cde:h:i:l:m:n:p:s:t:uw:x:")) != -1) {
     switch (opt) {
+      case 'A': strncpy(shardCpus, optarg, sizeof(shardCpus) - 1); break;
+      case 'a': strncpy(workerCpus, optarg, sizeof(workerCpus) - 1); break;
+      case 'b': backlog = atoi(optarg); break;
       case 'c': client = true; break;
       case 'd': verbosity = LOG_LEVEL_DEBUG; break;
+      case 'e': sessionTimeout = atoi(optarg); break;
       case 'h': strcpy(host, optarg); break;
+      case 'i': idleTimeout = atoi(optarg); break;
       case 'l': strcpy(logFile, optarg); break;
-      case 'n': maxClients = atoi(optarg); break;
+      case 'm': maxConnections = atoi(optarg); break;
+      case 'n': workers = atoi(optarg); break;
       case 'p': port = atoi(optarg); break;
+      case 's': shards = atoi(optarg); break;
+      case 't': commandTimeout = atoi(optarg); break;
+      case 'u': engine = IO_ENGINE_URING; break;
+      case 'w': slowlogThreshold = atoi(optarg); break;
+      case 'x': metricsPort = atoi(optarg); break;
     }
   }
 
   /* Run the program. */
-  if (client)
+  if (client) {
     clientStart(host, port);
-  else
-    serverStart(port, verbosity, logFile, maxClients);
+  } else {
+    serverSetTimeouts(idleTimeout, sessionTimeout, commandTimeout);
+    serverSetSlowlog(slowlogThreshold);
+    serverSetMetricsPort(metricsPort);
+    if (!serverSetAffinity(workerCpus, shardCpus)) {
+      fprintf(stderr, "Invalid CPU list\n");
+      return 1;
+    }
+    serverStart(port, verbosity, logFile, workers, maxConnections, backlog, engine, shards);
+  }
 }
@@ -0,0 +1,123 @@
+#include "protocol.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+
+#define BINARY_PREFIX     '*'
+#define LENGTH_PREFIX     '$'
+#define MAX_DIGITS        12
+
+#define PARSE_MALFORMED   -1
+#define PARSE_INCOMPLETE  0
+#define PARSE_COMPLETE    1
+
+
+/**********************************************************************
+ *                              Requests.
+ **********************************************************************/
+
+/*
+ * @param data: The start of a request.
+ * @param length: The number of bytes of the request that have arrived.
+ * @return Whether the request uses the binary protocol, which only its first byte tells.
+ */
+bool protocolIsBinary(const char *data, size_t length) {
+  assert(data != NULL);
+  return length > 0 && data[0] == BINARY_PREFIX;
+}
+
+/*
+ * Parse a header line: a prefix character, a decimal number and a "\r\n".
+ *
+ * @param data: The request being parsed.
+ * @param length: The number of bytes of the request that have arrived.
+ * @param offset: Where the line starts; moved past it once parsed.
+ * @param prefix: The character the line must start with.
+ * @param value: Set to the number.
+ * @return Whether the line is complete, incomplete or malformed.
+ */
+static int protocolNumber(const char *data, size_t length, size_t *offset, char prefix, long *value) {
+  size_t i = *offset, digits = 0;
+
+  if (i >= length)
+    return PARSE_INCOMPLETE;
+  if (data[i++] != prefix)
+    return PARSE_MALFORMED;
+
+  *value = 0;
+  for (; i < length && data[i] >= '0' && data[i] <= '9'; i++, digits++) {
+    if (digits == MAX_DIGITS)
+      return PARSE_MALFORMED;
+    *value = *value * 10 + data[i] - '0';
+  }
+
+  if (i == length)
+    return PARSE_INCOMPLETE;
+  if (digits == 0 || data[i++] != '\r')
+    return PARSE_MALFORMED;
+  if (i == length)
+    return PARSE_INCOMPLETE;
+  if (data[i++] != '\n')
+    return PARSE_MALFORMED;
+
+  *offset = i;
+  return PARSE_COMPLETE;
+}
+
+/*
+ * Locate the arguments of the binary request at the start of the data.
+ * Nothing is copied: the arguments point into the data, and are followed by
+ * the "\r\n" that ends them rather than by a null byte.
+ *
+ * @param data: The received bytes, starting with a binary request.
+ * @param length: The number of bytes received.
+ * @param request: Filled with the arguments once the request is complete.
+ * @return The length of the request, 0 if it has not fully arrived, or -1 if it is malformed.
+ */
+long protocolParse(char *data, size_t length, Request *request) {
+  assert(data != NULL);
+  assert(request != NULL);
+
+  size_t offset = 0;
+  long count, size;
+  int status;
+
+  if ((status = protocolNumber(data, length, &offset, BINARY_PREFIX, &count)) != PARSE_COMPLETE)
+    return status;
+  if (count < 1 || count > PROTOCOL_MAX_ARGS)
+    return PARSE_MALFORMED;
+
+  for (int i = 0; i < count; i++) {
+    if ((status = protocolNumber(data, length, &offset, LENGTH_PREFIX, &size)) != PARSE_COMPLETE)
+      return status;
+    if (length - offset < size + 2)
+      return PARSE_INCOMPLETE;
+    if (data[offset + size] != '\r' || data[offset + size + 1] != '\n')
+      return PARSE_MALFORMED;
+
+    request->argv[i].data = data + offset;
+    request->argv[i].length = size;
+    offset += size + 2;
+  }
+
+  request->argc = count;
+  return offset;
+}
+
+
+/**********************************************************************
+ *                              Replies.
+ **********************************************************************/
+
+/*
+ * Write the header that goes before a binary reply.
+ *
+ * @param header: Where to write it, with room for PROTOCOL_HEADER_SIZE bytes.
+ * @param length: The length of the reply.
+ * @return The length of the header.
+ */
+int protocolReplyHeader(char *header, size_t length) {
+  assert(header != NULL);
+  return sprintf(header, "%c%zu\r\n", LENGTH_PREFIX, length);
+}
@@ -0,0 +1,39 @@
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+#define PROTOCOL_MAX_ARGS     8
+#define PROTOCOL_HEADER_SIZE  24
+
+/*
+ * The binary wire protocol, a subset of RESP.
+ *
+ * A binary request starts with '*' and is an array of length-prefixed arguments:
+ *
+ *   *<count>\r\n$<length>\r\n<bytes>\r\n ... $<length>\r\n<bytes>\r\n
+ *
+ * so arguments may hold any bytes and are located without scanning them.
+ * Each reply is sent back as `$<length>\r\n<bytes>\r\n`.
+ */
+
+typedef struct Arg {
+  char *data;                                 /* Where the argument starts, inside the request. */
+  size_t length;                              /* The length of the argument. */
+} Arg;
+
+typedef struct Request {
+  unsigned int argc;                          /* The number of arguments, including the command. */
+  Arg argv[PROTOCOL_MAX_ARGS];                /* The arguments. */
+} Request;
+
+/* Requests. */
+bool protocolIsBinary(const char *data, size_t length);
+long protocolParse(char *data, size_t length, Request *request);
+
+/* Replies. */
+int protocolReplyHeader(char *header, size_t length);
+
+#endif
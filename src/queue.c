@@ -0,0 +1,289 @@
+#include "mmalloc.h"
+#include "queue.h"
+
+#include <assert.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+#define CACHE_LINE            64
+#define QUEUE_SPINS           128
+
+#define loadRelaxed(p)        (__atomic_load_n(p, __ATOMIC_RELAXED))
+#define loadAcquire(p)        (__atomic_load_n(p, __ATOMIC_ACQUIRE))
+#define storeRelease(p,v)     (__atomic_store_n(p, v, __ATOMIC_RELEASE))
+#define compareSwap(p,e,v)    (__atomic_compare_exchange_n(p, e, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+#define fetchAdd(p,v)         (__atomic_fetch_add(p, v, __ATOMIC_SEQ_CST))
+#define exchange(p,v)         (__atomic_exchange_n(p, v, __ATOMIC_SEQ_CST))
+#define loadSeqCst(p)         (__atomic_load_n(p, __ATOMIC_SEQ_CST))
+#define fence()               (__atomic_thread_fence(__ATOMIC_SEQ_CST))
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpuRelax()            (__builtin_ia32_pause())
+#else
+#define cpuRelax()            (__asm__ __volatile__("" ::: "memory"))
+#endif
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+/*
+ * A slot in the ring.
+ *
+ * The sequence number says whose turn it is: a producer may fill the slot at
+ * position `pos` once the sequence equals `pos`, and a consumer may empty it
+ * once the sequence equals `pos + 1`.
+ */
+typedef struct QueueCell {
+  unsigned long sequence;     /* The position this slot is waiting for. */
+  void *value;                /* The value stored in the slot. */
+} QueueCell;
+
+/*
+ * A bounded ring of slots (Vyukov's MPMC queue).
+ *
+ * Producers and consumers each claim positions with a single compare-and-swap,
+ * and never allocate. The hot counters are padded onto their own cache lines,
+ * so producers and consumers do not invalidate each other's lines.
+ * Consumers that find the queue empty park on a futex. Producers only make a
+ * system call when somebody is parked and no wakeup is already on its way.
+ */
+struct Queue {
+  unsigned long mask;                         /* The capacity minus one. */
+  QueueCell *cells;                           /* The ring of slots. */
+  char pad1[CACHE_LINE];
+  unsigned long enqueuePos;                   /* The next position to produce into. */
+  char pad2[CACHE_LINE];
+  unsigned long dequeuePos;                   /* The next position to consume from. */
+  char pad3[CACHE_LINE];
+  unsigned int futex;                         /* Bumped whenever a parked consumer should wake. */
+  unsigned int sleepers;                      /* The number of consumers parked or about to park. */
+  unsigned int waking;                        /* Set while a woken consumer has not run yet. */
+  char pad4[CACHE_LINE];
+};
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Create a new queue.
+ *
+ * @param capacity: The minimum number of values the queue can hold; rounded up to a power of two.
+ * @return The newly created queue.
+ */
+Queue *queueCreate(unsigned int capacity) {
+  assert(capacity > 0);
+
+  unsigned long size = 2;
+  while (size < capacity)
+    size <<= 1;
+
+  Queue *queue = mcalloc(sizeof(Queue));
+  queue->mask = size - 1;
+  queue->cells = mmalloc(sizeof(QueueCell) * size);
+  for (unsigned long i = 0; i < size; i++)
+    queue->cells[i].sequence = i;
+
+  return queue;
+}
+
+/*
+ * Free an existing queue. The values still in the queue are not freed.
+ *
+ * @param queue: The queue to free.
+ */
+void queueFree(Queue *queue) {
+  assert(queue != NULL);
+  mfree(queue->cells);
+  mfree(queue);
+}
+
+
+/**********************************************************************
+ *                         Queue information.
+ **********************************************************************/
+
+/*
+ * @param queue: The queue to examine.
+ * @return The most values the queue can hold.
+ */
+unsigned int queueCapacity(const Queue *queue) {
+  assert(queue != NULL);
+  return queue->mask + 1;
+}
+
+/*
+ * Get the number of values in the queue.
+ * Under concurrent use this is only a snapshot.
+ *
+ * @param queue: The queue to examine.
+ * @return The number of values in the queue.
+ */
+unsigned int queueLength(const Queue *queue) {
+  assert(queue != NULL);
+
+  unsigned long dequeued = loadRelaxed(&queue->dequeuePos),
+                enqueued = loadRelaxed(&queue->enqueuePos);
+
+  return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+
+/**********************************************************************
+ *                           Queue methods.
+ **********************************************************************/
+
+static long futexWait(unsigned int *address, unsigned int expected) {
+  return syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static long futexWake(unsigned int *address, int count) {
+  return syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/*
+ * Wake a parked consumer after a value was added, unless none is parked.
+ *
+ * Every call bumps the futex, so a consumer that is about to park notices and looks
+ * again instead. Only one wakeup is in flight at a time: while `waking` is set, later
+ * producers rely on the woken consumer to find their values. If a wakeup finds nobody
+ * asleep, the producer clears the flag itself, and tries again if another producer
+ * relied on it in the meantime.
+ *
+ * @param queue: The queue a value was added to.
+ */
+static void queueNotify(Queue *queue) {
+  unsigned int futex;
+
+  /* Pairs with the fence in `queuePopWait`: either we see the sleeper, or it sees the value. */
+  fence();
+  if (loadRelaxed(&queue->sleepers) == 0)
+    return;
+
+  while (true) {
+    futex = fetchAdd(&queue->futex, 1) + 1;
+    if (exchange(&queue->waking, 1) || futexWake(&queue->futex, 1) > 0)
+      return;
+    exchange(&queue->waking, 0);
+    if (loadSeqCst(&queue->futex) == futex)
+      return;
+  }
+}
+
+/*
+ * Add a value to the back of the queue, waking a parked consumer if there is one.
+ *
+ * @param queue: The queue to push onto.
+ * @param value: The value to add; must not be NULL.
+ * @return False if the queue is full.
+ */
+bool queuePush(Queue *queue, void *value) {
+  assert(queue != NULL);
+  assert(value != NULL);
+
+  QueueCell *cell;
+  unsigned long pos = loadRelaxed(&queue->enqueuePos);
+  long turn;
+
+  while (true) {
+    cell = &queue->cells[pos & queue->mask];
+    turn = (long) (loadAcquire(&cell->sequence) - pos);
+    if (turn == 0) {
+      if (compareSwap(&queue->enqueuePos, &pos, pos + 1))
+        break;
+    } else if (turn < 0) {
+      /* The slot still holds a value from the previous lap. */
+      return false;
+    } else {
+      pos = loadRelaxed(&queue->enqueuePos);
+    }
+  }
+
+  cell->value = value;
+  storeRelease(&cell->sequence, pos + 1);
+  queueNotify(queue);
+
+  return true;
+}
+
+/*
+ * Take the value at the front of the queue without blocking.
+ *
+ * @param queue: The queue to pop from.
+ * @return The value, or NULL if the queue is empty.
+ */
+void *queuePop(Queue *queue) {
+  assert(queue != NULL);
+
+  QueueCell *cell;
+  unsigned long pos = loadRelaxed(&queue->dequeuePos);
+  long turn;
+  void *value;
+
+  while (true) {
+    cell = &queue->cells[pos & queue->mask];
+    turn = (long) (loadAcquire(&cell->sequence) - (pos + 1));
+    if (turn == 0) {
+      if (compareSwap(&queue->dequeuePos, &pos, pos + 1))
+        break;
+    } else if (turn < 0) {
+      /* Nothing has been produced into the slot yet. */
+      return NULL;
+    } else {
+      pos = loadRelaxed(&queue->dequeuePos);
+    }
+  }
+
+  value = cell->value;
+  storeRelease(&cell->sequence, pos + queue->mask + 1);
+
+  return value;
+}
+
+/*
+ * Take the value at the front of the queue, parking the thread until one arrives.
+ * The thread spins briefly first, since under load a value usually arrives soon.
+ *
+ * @param queue: The queue to pop from.
+ * @return The value.
+ */
+void *queuePopWait(Queue *queue) {
+  assert(queue != NULL);
+
+  unsigned int seen;
+  bool woken = false;
+  void *value;
+
+  while (true) {
+    for (int i = 0; i < QUEUE_SPINS; i++) {
+      if ((value = queuePop(queue)) != NULL) {
+        /* Producers that skipped their wakeup may have relied on us; pass it on. */
+        if (woken && queueLength(queue) > 0)
+          queueNotify(queue);
+        return value;
+      }
+      cpuRelax();
+    }
+
+    /* Announce that we are going to sleep, then check one last time. */
+    fetchAdd(&queue->sleepers, 1);
+    fence();
+    seen = loadAcquire(&queue->futex);
+
+    if ((value = queuePop(queue)) == NULL) {
+      futexWait(&queue->futex, seen);
+      exchange(&queue->waking, 0);
+      woken = true;
+    }
+
+    fetchAdd(&queue->sleepers, -1);
+    if (value != NULL)
+      return value;
+  }
+}
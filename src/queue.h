@@ -0,0 +1,26 @@
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
+#include <stdbool.h>
+
+
+/*
+ * A bounded, lock-free, multi-producer multi-consumer queue of pointers.
+ */
+
+typedef struct Queue Queue;
+
+/* Memory management. */
+Queue *queueCreate(unsigned int capacity);
+void queueFree(Queue *queue);
+
+/* Queue information. */
+unsigned int queueCapacity(const Queue *queue);
+unsigned int queueLength(const Queue *queue);
+
+/* Queue methods. */
+bool queuePush(Queue *queue, void *value);
+void *queuePop(Queue *queue);
+void *queuePopWait(Queue *queue);
+
+#endif
@@ -0,0 +1,405 @@
+#include "deque.h"
+#include "mmalloc.h"
+#include "queue.h"
+#include "scheduler.h"
+
+#include <assert.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+#define CACHE_LINE            64
+#define SCHEDULER_DEQUE_SIZE  256
+#define SCHEDULER_BATCH       32
+#define SCHEDULER_SPINS       128
+
+#define loadRelaxed(p)        (__atomic_load_n(p, __ATOMIC_RELAXED))
+#define loadAcquire(p)        (__atomic_load_n(p, __ATOMIC_ACQUIRE))
+#define bump(p)               (__atomic_store_n(p, *(p) + 1, __ATOMIC_RELAXED))
+#define fetchAdd(p,v)         (__atomic_fetch_add(p, v, __ATOMIC_SEQ_CST))
+#define compareSwap(p,e,v)    (__atomic_compare_exchange_n(p, e, v, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+#define storeSeqCst(p,v)      (__atomic_store_n(p, v, __ATOMIC_SEQ_CST))
+#define fence()               (__atomic_thread_fence(__ATOMIC_SEQ_CST))
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpuRelax()            (__builtin_ia32_pause())
+#else
+#define cpuRelax()            (__asm__ __volatile__("" ::: "memory"))
+#endif
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+/*
+ * The state owned by one worker thread.
+ * Only the owner writes the counters; they are read relaxed for statistics.
+ * Each worker sits on its own cache lines, so they do not slow each other down.
+ */
+typedef struct Worker {
+  Deque *deque;                               /* Tasks this worker took on, stealable by the others. */
+  unsigned long steals;                       /* The number of tasks stolen from other workers. */
+  unsigned long runs;                         /* The number of tasks handed to this worker. */
+  unsigned int seed;                          /* State for picking a random victim to steal from. */
+  int node;                                   /* The NUMA node the worker runs on. */
+  unsigned int parked;                        /* Set while the worker sleeps; cleared by whoever wakes it. */
+} __attribute__((aligned(CACHE_LINE))) Worker;
+
+/*
+ * The shared queue tasks are submitted to, and every worker's deque.
+ *
+ * Workers looking for a task count themselves as searching; those that find none
+ * park on their own futex. New work only wakes a parked worker when nobody is
+ * searching, since a searching worker is bound to find it. Whoever wakes a worker
+ * claims it first and counts it as searching, so each wakeup reaches a thread that
+ * is really asleep and a burst of work wakes one worker at a time. A worker that
+ * stops searching while work is still waiting wakes the next one.
+ */
+struct Scheduler {
+  Queue *injector;                            /* Tasks submitted by other threads. */
+  Worker *workers;                            /* The state of each worker. */
+  unsigned int numWorkers;                    /* The number of workers. */
+  char pad1[CACHE_LINE];
+  unsigned int searching;                     /* The number of workers looking for a task. */
+  unsigned int sleepers;                      /* The number of workers parked or about to park. */
+  char pad2[CACHE_LINE];
+};
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Create a new scheduler.
+ *
+ * @param workers: The number of worker threads that will take tasks.
+ * @param capacity: The minimum number of submitted tasks that can wait at once.
+ * @return The newly created scheduler.
+ */
+Scheduler *schedulerCreate(unsigned int workers, unsigned int capacity) {
+  assert(workers > 0);
+
+  Scheduler *scheduler = mcalloc(sizeof(Scheduler));
+  scheduler->injector = queueCreate(capacity);
+  scheduler->numWorkers = workers;
+  scheduler->workers = mmalloc(sizeof(Worker) * workers);
+  for (unsigned int i = 0; i < workers; i++) {
+    scheduler->workers[i].deque = dequeCreate(SCHEDULER_DEQUE_SIZE);
+    scheduler->workers[i].steals = 0;
+    scheduler->workers[i].runs = 0;
+    scheduler->workers[i].seed = i + 1;
+    scheduler->workers[i].parked = 0;
+    scheduler->workers[i].node = 0;
+  }
+
+  return scheduler;
+}
+
+/*
+ * Free an existing scheduler. Tasks that were never run are not freed.
+ *
+ * @param scheduler: The scheduler to free.
+ */
+void schedulerFree(Scheduler *scheduler) {
+  assert(scheduler != NULL);
+  for (unsigned int i = 0; i < scheduler->numWorkers; i++)
+    dequeFree(scheduler->workers[i].deque);
+  mfree(scheduler->workers);
+  queueFree(scheduler->injector);
+  mfree(scheduler);
+}
+
+
+/**********************************************************************
+ *                        Scheduler information.
+ **********************************************************************/
+
+/*
+ * @param scheduler: The scheduler to examine.
+ * @return The number of workers.
+ */
+unsigned int schedulerWorkers(const Scheduler *scheduler) {
+  assert(scheduler != NULL);
+  return scheduler->numWorkers;
+}
+
+/*
+ * @param scheduler: The scheduler to examine.
+ * @return The number of submitted tasks no worker has taken yet.
+ */
+unsigned int schedulerPending(const Scheduler *scheduler) {
+  assert(scheduler != NULL);
+  return queueLength(scheduler->injector);
+}
+
+/*
+ * @param scheduler: The scheduler to examine.
+ * @param worker: The index of the worker.
+ * @return The number of tasks waiting in the worker's deque.
+ */
+unsigned int schedulerDepth(const Scheduler *scheduler, unsigned int worker) {
+  assert(scheduler != NULL);
+  assert(worker < scheduler->numWorkers);
+  return dequeLength(scheduler->workers[worker].deque);
+}
+
+/*
+ * @param scheduler: The scheduler to examine.
+ * @param worker: The index of the worker.
+ * @return The number of tasks the worker has stolen from the others.
+ */
+unsigned long schedulerSteals(const Scheduler *scheduler, unsigned int worker) {
+  assert(scheduler != NULL);
+  assert(worker < scheduler->numWorkers);
+  return loadRelaxed(&scheduler->workers[worker].steals);
+}
+
+/*
+ * @param scheduler: The scheduler to examine.
+ * @param worker: The index of the worker.
+ * @return The number of tasks the worker has been given.
+ */
+unsigned long schedulerRuns(const Scheduler *scheduler, unsigned int worker) {
+  assert(scheduler != NULL);
+  assert(worker < scheduler->numWorkers);
+  return loadRelaxed(&scheduler->workers[worker].runs);
+}
+
+
+/**********************************************************************
+ *                         Scheduler methods.
+ **********************************************************************/
+
+static long futexWait(unsigned int *address, unsigned int expected) {
+  return syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static long futexWake(unsigned int *address, int count) {
+  return syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/*
+ * Claim a parked worker, so that no one else wakes it too.
+ *
+ * @return Whether the worker was parked and is now ours to wake.
+ */
+static bool workerClaim(Worker *worker) {
+  unsigned int parked = 1;
+  return loadRelaxed(&worker->parked) == 1 && compareSwap(&worker->parked, &parked, 0);
+}
+
+/*
+ * Wake a parked worker to look for new work, unless some worker is already searching.
+ *
+ * @param scheduler: The scheduler with new work.
+ */
+static void schedulerNotify(Scheduler *scheduler) {
+  unsigned int idle = 0;
+
+  /* Pairs with the fences in `schedulerNext`: either we see the worker, or it sees the work. */
+  fence();
+  if (loadRelaxed(&scheduler->sleepers) == 0 || loadRelaxed(&scheduler->searching) > 0)
+    return;
+
+  /* The worker we wake starts out searching. */
+  if (!compareSwap(&scheduler->searching, &idle, 1))
+    return;
+
+  for (unsigned int i = 0; i < scheduler->numWorkers; i++) {
+    Worker *worker = &scheduler->workers[i];
+    if (workerClaim(worker)) {
+      futexWake(&worker->parked, 1);
+      return;
+    }
+  }
+
+  /* Everyone counted as a sleeper is already on their way back. */
+  fetchAdd(&scheduler->searching, -1);
+}
+
+/*
+ * @return Whether the shared queue or any deque holds a task.
+ */
+static bool schedulerHasWork(Scheduler *scheduler) {
+  if (queueLength(scheduler->injector) > 0)
+    return true;
+  for (unsigned int i = 0; i < scheduler->numWorkers; i++)
+    if (dequeLength(scheduler->workers[i].deque) > 0)
+      return true;
+  return false;
+}
+
+/*
+ * Pick a pseudo-random worker to start stealing from (xorshift).
+ */
+static unsigned int schedulerVictim(Scheduler *scheduler, Worker *worker) {
+  worker->seed ^= worker->seed << 13;
+  worker->seed ^= worker->seed >> 17;
+  worker->seed ^= worker->seed << 5;
+  return worker->seed % scheduler->numWorkers;
+}
+
+/*
+ * Take a task from the shared queue. If many are waiting, move this worker's fair
+ * share of them into its deque too, where idle workers can steal them.
+ *
+ * @param scheduler: The scheduler to take from.
+ * @param worker: The worker taking the task.
+ * @return The task, or NULL if none was submitted.
+ */
+static void *schedulerTakeSubmitted(Scheduler *scheduler, Worker *worker) {
+  void *task, *extra;
+  unsigned int batch;
+
+  if ((task = queuePop(scheduler->injector)) == NULL)
+    return NULL;
+
+  batch = queueLength(scheduler->injector) / scheduler->numWorkers;
+  if (batch > SCHEDULER_BATCH)
+    batch = SCHEDULER_BATCH;
+
+  for (unsigned int i = 0; i < batch && (extra = queuePop(scheduler->injector)) != NULL; i++) {
+    /* The deque was empty and holds more than a batch, so there is always room. */
+    bool pushed = dequePush(worker->deque, extra);
+    assert(pushed);
+    (void) pushed;
+  }
+  if (batch > 0)
+    schedulerNotify(scheduler);
+
+  return task;
+}
+
+/*
+ * Steal the oldest task from another worker, trying each in turn from a random one.
+ * Workers on the same node are tried first: a task that moves across nodes takes
+ * its client's memory with it.
+ *
+ * @param scheduler: The scheduler to steal within.
+ * @param self: The index of the stealing worker.
+ * @return The task, or NULL if no other worker had any.
+ */
+static void *schedulerSteal(Scheduler *scheduler, unsigned int self) {
+  Worker *worker = &scheduler->workers[self], *victim;
+  unsigned int start = schedulerVictim(scheduler, worker);
+  void *task;
+
+  for (unsigned int i = 0; i < 2 * scheduler->numWorkers; i++) {
+    unsigned int v = (start + i) % scheduler->numWorkers;
+    victim = &scheduler->workers[v];
+    if (v == self || (victim->node == worker->node) != (i < scheduler->numWorkers))
+      continue;
+
+    if ((task = dequeSteal(victim->deque)) != NULL) {
+      bump(&worker->steals);
+      /* Pass the word on if the victim still has a backlog. */
+      if (dequeLength(victim->deque) > 0)
+        schedulerNotify(scheduler);
+      return task;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Find a task for a worker: its own deque first, then the shared queue, then the other workers.
+ */
+static void *schedulerFind(Scheduler *scheduler, unsigned int self) {
+  Worker *worker = &scheduler->workers[self];
+  void *task;
+
+  if ((task = dequePop(worker->deque)) != NULL)
+    return task;
+  if ((task = schedulerTakeSubmitted(scheduler, worker)) != NULL)
+    return task;
+  return schedulerSteal(scheduler, self);
+}
+
+/*
+ * Tell the scheduler which NUMA node a worker runs on, before the worker starts.
+ *
+ * @param scheduler: The scheduler.
+ * @param worker: The index of the worker.
+ * @param node: The node.
+ */
+void schedulerSetNode(Scheduler *scheduler, unsigned int worker, int node) {
+  assert(scheduler != NULL);
+  assert(worker < scheduler->numWorkers);
+  scheduler->workers[worker].node = node;
+}
+
+/*
+ * Submit a task to be run by any worker, waking a parked worker if there is one.
+ *
+ * @param scheduler: The scheduler to submit to.
+ * @param task: The task; must not be NULL.
+ * @return False if the shared queue is full.
+ */
+bool schedulerSubmit(Scheduler *scheduler, void *task) {
+  assert(scheduler != NULL);
+
+  if (!queuePush(scheduler->injector, task))
+    return false;
+
+  schedulerNotify(scheduler);
+  return true;
+}
+
+/*
+ * Get the next task for a worker, parking the thread until there is one.
+ * The worker spins briefly first, since under load a task usually arrives soon.
+ *
+ * @param scheduler: The scheduler to take from.
+ * @param worker: The index of the calling worker; each worker thread must use its own.
+ * @return The task.
+ */
+void *schedulerNext(Scheduler *scheduler, unsigned int worker) {
+  assert(scheduler != NULL);
+  assert(worker < scheduler->numWorkers);
+
+  Worker *self = &scheduler->workers[worker];
+  bool searching = true;
+  void *task = NULL;
+
+  fetchAdd(&scheduler->searching, 1);
+
+  while (task == NULL) {
+    for (int i = 0; i < SCHEDULER_SPINS && task == NULL; i++) {
+      if ((task = schedulerFind(scheduler, worker)) == NULL)
+        cpuRelax();
+    }
+    if (task != NULL)
+      break;
+
+    /* Stop searching and announce that we are going to sleep, then look one last time. */
+    storeSeqCst(&self->parked, 1);
+    fetchAdd(&scheduler->sleepers, 1);
+    fetchAdd(&scheduler->searching, -1);
+    fence();
+
+    if ((task = schedulerFind(scheduler, worker)) == NULL) {
+      while (loadAcquire(&self->parked) == 1)
+        futexWait(&self->parked, 1);
+    } else if (workerClaim(self)) {
+      searching = false;
+    }
+    /* Whoever claimed us counted us as searching again. */
+
+    fetchAdd(&scheduler->sleepers, -1);
+  }
+
+  /* If nobody else is searching, make sure any work left behind gets a worker. */
+  if (searching)
+    fetchAdd(&scheduler->searching, -1);
+  fence();
+  if (loadRelaxed(&scheduler->searching) == 0 && loadRelaxed(&scheduler->sleepers) > 0 &&
+      schedulerHasWork(scheduler))
+    schedulerNotify(scheduler);
+
+  bump(&self->runs);
+  return task;
+}
@@ -0,0 +1,32 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stdbool.h>
+
+
+/*
+ * A work-stealing scheduler for a fixed pool of worker threads.
+ *
+ * Other threads submit tasks to a shared queue. Each worker moves tasks from it into
+ * its own deque in batches, and idle workers steal from the deques of busy ones.
+ */
+
+typedef struct Scheduler Scheduler;
+
+/* Memory management. */
+Scheduler *schedulerCreate(unsigned int workers, unsigned int capacity);
+void schedulerFree(Scheduler *scheduler);
+
+/* Scheduler information. */
+unsigned int schedulerWorkers(const Scheduler *scheduler);
+unsigned int schedulerPending(const Scheduler *scheduler);
+unsigned int schedulerDepth(const Scheduler *scheduler, unsigned int worker);
+unsigned long schedulerSteals(const Scheduler *scheduler, unsigned int worker);
+unsigned long schedulerRuns(const Scheduler *scheduler, unsigned int worker);
+
+/* Scheduler methods. */
+void schedulerSetNode(Scheduler *scheduler, unsigned int worker, int node);
+bool schedulerSubmit(Scheduler *scheduler, void *task);
+void *schedulerNext(Scheduler *scheduler, unsigned int worker);
+
+#endif
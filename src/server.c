@@ -1,86 +1,381 @@
-#include "dict.h"
+#include "affinity.h"
+#include "buffer.h"
 #include "doc.h"
+#include "epoch.h"
+#include "event.h"
+#include "histogram.h"
 #include "list.h"
+#include "log.h"
 #include "mmalloc.h"
+#include "protocol.h"
+#include "scheduler.h"
 #include "server.h"
+#include "slowlog.h"
+#include "stats.h"
+#include "store.h"
+#include "timer.h"
+#include "trace.h"
+#include "uring.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include <unistd.h>
 
 
 #define BUFFER_SIZE             4096
+#define MAX_REQUEST_SIZE        (64 * 1024 * 1024)
+#define LOG_RING_SIZE           (64 * 1024)
+#define TOO_MANY_CONNECTIONS    "Too many connections\n"
+#define TIMER_TICK              100           /* Milliseconds between checks for expired timers. */
+#define SLOWLOG_SIZE            128
+#define STORE_SHARDS            64
+#define METRICS_REQUEST_SIZE    4096
+#define METRICS_READ_TIMEOUT    1             /* Seconds to wait for a scrape request. */
+#define REPLY_BATCH             256
+#define OUTPUT_BATCH_SIZE       (16 * BUFFER_SIZE)
+
+#define FLUSH_DONE              0
+#define FLUSH_BLOCKED           1
+#define FLUSH_ERROR             -1
+#define MAX_EVENTS              256
+#define RING_ENTRIES            4096
+#define RING_BUFFERS            1024
+#define RING_BUFFER_GROUP       0
 #define UNUSED(x)               (void)(x)
-#define threadCreate(x,y)       (pthread_create(x,NULL,y,NULL))
+#define threadCreate(x,y,z)     (pthread_create(x,NULL,y,z))
 #define mutexInit(x,y)          (pthread_mutex_init(x,y))
 #define mutexLock(x)            (pthread_mutex_lock(x))
 #define mutexUnlock(x)          (pthread_mutex_unlock(x))
-#define condWait(x,y)           (pthread_cond_wait(x,y))
-#define condSignal(x)           (pthread_cond_signal(x))
+#define threadJoin(x)           (pthread_join(x,NULL))
+#define atomicInc(x)            (__atomic_add_fetch(x,1,__ATOMIC_RELAXED))
+#define atomicDec(x)            (__atomic_sub_fetch(x,1,__ATOMIC_RELAXED))
+#define atomicGet(x)            (__atomic_load_n(x,__ATOMIC_RELAXED))
+#define atomicSet(x,y)          (__atomic_store_n(x,y,__ATOMIC_RELAXED))
 
 typedef struct sockaddr_in      SockAddr;
 typedef pthread_t               Thread;
 typedef pthread_mutex_t         Mutex;
-typedef pthread_cond_t          CondVar;
 
 
 /********************************************************************************
  *                              Struct declarations.
  *******************************************************************************/
 
+typedef struct Shard Shard;
+
 typedef struct Client {
   int fd;                                     /* The file descriptor of the client. */
+  Shard *shard;                               /* The listener shard that accepted the client. */
+  Buffer *input;                              /* Bytes received from the client but not yet run. */
+  size_t scanned;                             /* How much of a text request is known to hold no newline. */
+  Buffer *output;                             /* Replies not yet written, in request order. */
+  bool binary;                                /* Whether the request being run uses the binary protocol. */
+  bool failed;                                /* Whether the command being run replied with a failure. */
+  Serialized *stream;                         /* The document being sent a chunk at a time, if any. */
+  size_t streamed;                            /* How much of it is in the output already. */
+  bool sending;                               /* Whether the operation in flight is a send or a receive. */
+  Timer timer;                                /* Expires the client once it idles or overruns too long. */
+  uint64_t active;                            /* When the client last sent anything. */
+  uint64_t deadline;                          /* When the requests being run must be done by, or 0 if idle. */
 } Client;
 
-typedef struct WorkQueue {
-  List *clients;                              /* Clients waiting to be run. */
-  Mutex mutex;                                /* Lock to access the queue. */
-  CondVar cv;                                 /* Condition variable to wait for list to fill. */
-} WorkQueue;
+typedef struct RingEngine {
+  Ring *ring;                                 /* The io_uring submission and completion queues. */
+  char *buffers;                              /* The pool of buffers the kernel receives into. */
+  int wakeFd;                                 /* Event descriptor signalled when a reply is queued. */
+  uint64_t wakeCount;                         /* Where the loop reads the wakeup counter into. */
+  List *replies;                              /* Clients with a reply waiting to be sent. */
+  Mutex mutex;                                /* Lock to access the reply list. */
+} RingEngine;
+
+struct Shard {
+  unsigned int id;                            /* The index of the shard. */
+  int fd;                                     /* The shard's own SO_REUSEPORT listening socket. */
+  IoEngine engine;                            /* How the shard accepts, reads from and writes to clients. */
+  EventLoop *loop;                            /* Readiness notifications for the epoll engine. */
+  RingEngine *ring;                           /* Queued operations for the io_uring engine. */
+  Thread thread;                              /* The thread running the shard's loop. */
+  unsigned long connected;                    /* The number of clients currently connected. */
+  unsigned long accepted;                     /* The number of clients accepted since startup. */
+  unsigned long rejected;                     /* The number of clients turned away at the connection limit. */
+  TimerWheel *timers;                         /* Client and session timeouts, if any are enabled. */
+  int timerFd;                                /* Timer descriptor that ticks the wheel. */
+  uint64_t timerTicks;                        /* Where the io_uring loop reads the tick count into. */
+};
 
 typedef struct Server {
   pid_t pid;                                  /* The id of the main server process. */
   unsigned int port;                          /* The port the server listens to. */
-  int fd;                                     /* The file descriptor of the server. */
   SockAddr *addr;                             /* The address of the server. */
   LogLevel verbosity;                         /* How verbose the logging should be. */
   FILE *logFile;                              /* The file descriptor to log activity to. */
   char *logFileName;                          /* The name of the log file. */
-  unsigned int maxClients;                    /* The maximum number of clients the server can handle concurrently. */
-  Dict *documents;                            /* The hashmap of keys to documents. */
-  WorkQueue *workQueue;                       /* The list of workers waiting to be run. */
+  Logger *logger;                             /* Writes the log from its own thread. */
+  unsigned int workers;                       /* The number of worker threads running requests. */
+  unsigned int maxConnections;                /* The maximum number of clients connected at once. */
+  unsigned int backlog;                       /* The length of each listener's queue of pending connections. */
+  unsigned long connections;                  /* The number of clients connected, across every shard. */
+  uint64_t idleTimeout;                       /* Milliseconds a client may wait between requests (0 for ever). */
+  uint64_t sessionTimeout;                    /* Milliseconds a collaborator may go without an op (0 for ever). */
+  uint64_t commandTimeout;                    /* Milliseconds a batch of requests may take to run and reply to. */
+  Store *documents;                           /* The documents, by key. */
+  Epoch *epoch;                               /* What workers read documents in. */
+  Scheduler *scheduler;                       /* Hands clients with a request waiting to the workers. */
+  Shard *shards;                              /* The listeners, each with its own socket and loop. */
+  unsigned int numShards;                     /* The number of listener shards. */
+  Stats *stats;                               /* Per-thread counters of commands run and bytes moved. */
+  uint64_t started;                           /* When the server was created, in milliseconds. */
+  uint64_t sampled;                           /* When `info` last sampled the number of commands run. */
+  uint64_t sampledCalls;                      /* The number of commands run by then. */
+  Mutex sampleMutex;                          /* Lock to take a sample. */
+  Slowlog *slowlog;                           /* The most recent commands that ran too long. */
+  uint64_t slowlogThreshold;                  /* Microseconds above which a command is logged (0 for never). */
+  unsigned int metricsPort;                   /* The port metrics are served on (0 for none). */
+  int metricsFd;                              /* The socket metrics are served on. */
+  Thread metricsThread;                       /* The thread answering scrapes. */
+  CpuList *workerCpus;                        /* The CPUs to pin workers to (NULL to leave them be). */
+  CpuList *shardCpus;                         /* The CPUs to pin shard loops to (NULL to leave them be). */
 } Server;
 
+/* What a command touches. */
+#define COMMAND_READ            (1 << 0)      /* Reads documents. */
+#define COMMAND_WRITE           (1 << 1)      /* Modifies documents. */
+#define COMMAND_ADMIN           (1 << 2)      /* Inspects or controls the server itself. */
+
+/* How the time a command takes grows. */
+typedef enum CommandCost {
+  COMMAND_COST_CONSTANT,                      /* Independent of any size. */
+  COMMAND_COST_DOCUMENT,                      /* With the size of the document it touches. */
+  COMMAND_COST_SERVER                         /* With the number of documents, clients or workers. */
+} CommandCost;
+
+/* The position of every command in the command table. */
+typedef enum CommandId {
+  COMMAND_ADD,
+  COMMAND_COMMANDS,
+  COMMAND_CLIENT_LIST,
+  COMMAND_CLIENT_KILL,
+  COMMAND_END,
+  COMMAND_EXISTS,
+  COMMAND_GET,
+  COMMAND_INFO,
+  COMMAND_KEYS,
+  COMMAND_LATENCY,
+  COMMAND_MODIFY,
+  COMMAND_PAUSE,
+  COMMAND_PING,
+  COMMAND_REMOVE,
+  COMMAND_SHARDS,
+  COMMAND_SIZE,
+  COMMAND_SLOWLOG,
+  COMMAND_START,
+  COMMAND_SAVE,
+  COMMAND_UPDATE,
+  COMMAND_WORKERS,
+  NUM_COMMANDS
+} CommandId;
+
 typedef struct Command {
   char *name;                                 /* The name of the command. */
   unsigned int argc;                          /* The number of arguments the command takes. */
-  char *(*fn)(char *a1, char *a2, char *a3);  /* The function that implements the command. */
+  unsigned int flags;                         /* What the command touches. */
+  CommandCost cost;                           /* How the time the command takes grows. */
+  void (*fn)(Client *client, Arg a1, Arg a2, Arg a3);  /* Implements the command, writing its reply to the client's output. */
 } Command;
 
 Server server;                               /* Global server pointer. */
+extern Command commandTable[NUM_COMMANDS];   /* All commands supported by the server. */
+
+
+/********************************************************************************
+ *                              Client timeouts.
+ *
+ * Each shard keeps a timer wheel, ticked by its loop thread, with a timer embedded
+ * in every client. Timers are not moved as clients come and go: when one fires, it
+ * checks whether the client really expired and, if not, when to check again. An
+ * expired client is only shut down, so that whichever thread owns it sees the
+ * connection end and closes it as usual.
+ *******************************************************************************/
+
+static void serverLog(LogLevel level, const char *message, ...);
+
+/*
+ * @return The current time in milliseconds, from a clock that never jumps.
+ */
+static uint64_t serverNow(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * @return The current time in microseconds, precise enough to time a single command.
+ */
+static uint64_t serverMicros(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Check whether a client overran its command deadline or sat idle for too long.
+ *
+ * @param timer: The client's timer.
+ * @param now: The current time.
+ * @return When to check the client again, or 0 once it is shut down or has nothing to time.
+ */
+static uint64_t clientExpire(Timer *timer, uint64_t now) {
+  Client *client = timer->data;
+  uint64_t deadline = atomicGet(&client->deadline), idle;
+
+  if (deadline != 0) {
+    if (now < deadline)
+      return deadline;
+    serverLog(LOG_LEVEL_WARNING, "Client %d missed its command deadline, disconnecting.\n", client->fd);
+  } else if (server.idleTimeout == 0) {
+    return 0;
+  } else if (now < (idle = atomicGet(&client->active) + server.idleTimeout)) {
+    return idle;
+  } else {
+    serverLog(LOG_LEVEL_INFO, "Client %d idle for too long, disconnecting.\n", client->fd);
+  }
+
+  shutdown(client->fd, SHUT_RDWR);
+  return 0;
+}
+
+/*
+ * Start timing a client, if idle clients time out.
+ *
+ * @param client: The newly connected client.
+ */
+static void clientTimerStart(Client *client) {
+  timerInit(&client->timer, &clientExpire, client);
+  client->active = serverNow();
+  if (server.idleTimeout > 0)
+    timerWheelAdd(client->shard->timers, &client->timer, client->active + server.idleTimeout);
+}
+
+/*
+ * Give a client's next batch of requests until the command deadline to run and reply.
+ *
+ * @param client: The client about to be handed to a worker.
+ */
+static void clientBusy(Client *client) {
+  uint64_t now = serverNow();
+
+  atomicSet(&client->active, now);
+  if (server.commandTimeout > 0) {
+    atomicSet(&client->deadline, now + server.commandTimeout);
+    timerWheelAdd(client->shard->timers, &client->timer, now + server.commandTimeout);
+  }
+}
+
+/*
+ * Mark a client as waiting for its next request; its idle time starts now.
+ * Its timer is left to fire at the old deadline and then wait out the idle timeout,
+ * unless the deadline is further off than the client may idle.
+ *
+ * @param client: The client about to wait for input.
+ */
+static void clientIdle(Client *client) {
+  uint64_t now = serverNow(), deadline = atomicGet(&client->deadline);
+
+  atomicSet(&client->deadline, 0);
+  atomicSet(&client->active, now);
+  if (server.idleTimeout > 0 && deadline > now + server.idleTimeout)
+    timerWheelAdd(client->shard->timers, &client->timer, now + server.idleTimeout);
+}
+
+/*
+ * Expire the collaborators on a document who went without an op for too long,
+ * as if they had ended their session. The heartbeat stops with the last of them.
+ *
+ * @param timer: The document's heartbeat, which holds a reference to the document.
+ * @param now: The current time.
+ * @return When the next collaborator would expire, or 0 once none are left.
+ */
+static uint64_t documentHeartbeat(Timer *timer, uint64_t now) {
+  Document *doc = timer->data;
+  uint64_t before = now > server.sessionTimeout ? now - server.sessionTimeout : 0, oldest;
+
+  if (documentExpireCollaborators(doc, before, &oldest) > 0)
+    return oldest + server.sessionTimeout;
+
+  serverLog(LOG_LEVEL_DEBUG, "No collaborators left on a document, stopping its heartbeat.\n");
+  documentFree(doc);
+  mfree(timer);
+  return 0;
+}
+
+/*
+ * Run the timers of a shard whose tick came.
+ *
+ * @param shard: The shard to tick.
+ */
+static void serverTick(Shard *shard) {
+  timerWheelAdvance(shard->timers, serverNow());
+}
 
 
 /********************************************************************************
  *                                Worker queue.
  *******************************************************************************/
 
+/*
+ * Admit a newly accepted connection, unless the server is at its connection limit.
+ * A connection turned away is told why before it is closed, rather than left
+ * waiting for replies that never come.
+ *
+ * @param shard: The shard that accepted the connection.
+ * @param fd: The file descriptor of the connection.
+ * @return Whether the connection was admitted; if not, it is closed.
+ */
+static bool serverAdmit(Shard *shard, int fd) {
+  if (atomicInc(&server.connections) <= server.maxConnections)
+    return true;
+
+  atomicDec(&server.connections);
+  atomicInc(&shard->rejected);
+  serverLog(LOG_LEVEL_WARNING, "Connection limit reached, rejecting client %d.\n", fd);
+  send(fd, TOO_MANY_CONNECTIONS, sizeof(TOO_MANY_CONNECTIONS) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+  close(fd);
+  return false;
+}
+
 /*
  * Create a new client.
+ * The client must already have been admitted.
  *
  * @param fd: The file descriptor of the client.
+ * @param shard: The shard that accepted the client.
  * @return The newly created client instance.
  */
-static Client *clientCreate(int fd) {
-  Client *client = mmalloc(sizeof(Client));
+static Client *clientCreate(int fd, Shard *shard) {
+  Client *client = mcalloc(sizeof(Client));
   client->fd = fd;
+  client->shard = shard;
+  client->input = bufferCreate(BUFFER_SIZE);
+  client->output = bufferCreate(BUFFER_SIZE);
+  atomicInc(&shard->connected);
+  atomicInc(&shard->accepted);
+  if (shard->timers != NULL)
+    clientTimerStart(client);
   return client;
 }
 
@@ -92,72 +387,76 @@ static Client *clientCreate(int fd) {
 static void clientFree(void *client) {
   assert(client != NULL);
   Client *cli = (Client*) client;
+  if (cli->stream != NULL)
+    serializedFree(cli->stream);
+  bufferFree(cli->input);
+  bufferFree(cli->output);
   mfree(cli);
 }
 
 /*
- * Create a copy of a client.
+ * Disconnect a client and free it.
+ * Closing the descriptor also removes it from the event loop.
  *
- * @param client: The client to copy.
+ * @param client: The client to disconnect.
  */
-static Client *clientCopy(Client *client) {
+static void clientClose(Client *client) {
   assert(client != NULL);
-  return clientCreate(client->fd);
+  atomicDec(&client->shard->connected);
+  atomicDec(&server.connections);
+  if (client->shard->timers != NULL)
+    timerWheelRemove(client->shard->timers, &client->timer);
+  close(client->fd);
+  clientFree(client);
+}
+
+/*
+ * Lists of clients only borrow them; whoever removes a client owns it.
+ */
+static void clientBorrowed(void *client) {
+  UNUSED(client);
 }
 
 /*
- * Initialize the server's work queue.
+ * Initialize the scheduler that hands clients to the worker pool.
+ * A client is queued at most once at a time, so the queue holds every connection.
  */
 static void workQueueCreate(void) {
-  server.workQueue = mmalloc(sizeof(WorkQueue));
-  server.workQueue->clients = listCreate(LIST_TYPE_LINKED, &clientFree);
-  mutexInit(&server.workQueue->mutex, NULL);
+  server.scheduler = schedulerCreate(server.workers, server.maxConnections);
 }
 
 /*
- * Free the server's work queue.
+ * Free the server's scheduler.
  */
 static void workQueueFree(void) {
-  assert(server.workQueue != NULL);
-  listFree(server.workQueue->clients);
-  mfree(server.workQueue);
+  assert(server.scheduler != NULL);
+  schedulerFree(server.scheduler);
 }
 
 /*
  * Add a new client to the work queue.
+ * The queue has room for every connection, so this only yields if the shared queue
+ * is momentarily contended.
  *
  * @param client: The client to add.
  */
 static void workQueuePush(Client *client) {
-  assert(server.workQueue != NULL);
+  assert(server.scheduler != NULL);
 
-  WorkQueue *queue = server.workQueue;
-  mutexLock(&queue->mutex);
-
-  listAppend(queue->clients, client);
-  condSignal(&queue->cv);
-  mutexUnlock(&queue->mutex);
+  while (!schedulerSubmit(server.scheduler, client))
+    sched_yield();
 }
 
 /*
- * Get the next client to service.
+ * Get the next client for a worker to service, parking the worker while there is none.
+ * The worker takes from its own deque first, then from the shared queue, then steals.
  *
- * @return The next client from the queue.
+ * @param worker: The index of the calling worker.
+ * @return The next client to service.
  */
-static Client *workQueuePop(void) {
-  assert(server.workQueue != NULL);
-
-  WorkQueue *queue = server.workQueue;
-  mutexLock(&queue->mutex);
-
-  while (listLength(queue->clients) == 0)
-    condWait(&queue->cv, &queue->mutex);
-
-  Client *client = clientCopy(listGet(queue->clients, 0));
-  listRemove(queue->clients, 0);
-  mutexUnlock(&queue->mutex);
-
-  return client;
+static Client *workQueuePop(unsigned int worker) {
+  assert(server.scheduler != NULL);
+  return schedulerNext(server.scheduler, worker);
 }
 
 
@@ -170,6 +469,7 @@ static Client *workQueuePop(void) {
  /*
   * Log the message to the server's log file,
   * if its level is above the server's verbosity level.
+  * The message is only queued; the logger's own thread writes it.
   *
   * @param level: The debug level of the message.
   * @param message: The message to log.
@@ -178,7 +478,7 @@ static void serverLog(LogLevel level, const char *message, ...) {
   va_list args;
   va_start(args, message);
   if (server.verbosity >= level)
-    vfprintf(server.logFile, message, args);
+    loggerWrite(server.logger, message, args);
   va_end(args);
 }
 
@@ -219,9 +519,11 @@ static char *jump(char *string) {
  * @param port: The port to run the server on.
  * @param verbosity: The amount of output to the log file.
  * @param logFile: The name of the file to log to (empty for stdout).
- * @param maxClients: The maximum concurrent clients to handle.
+ * @param workers: The number of worker threads to run requests on.
+ * @param maxConnections: The maximum number of clients connected at once.
  */
-void serverCreate(unsigned int port, LogLevel verbosity, char *logFile, unsigned int maxClients) {
+void serverCreate(unsigned int port, LogLevel verbosity, char *logFile, unsigned int workers,
+                  unsigned int maxConnections) {
   /* Passed in properties. */
   server.pid = getpid();
   server.port = port;
@@ -235,13 +537,9 @@ void serverCreate(unsigned int port, LogLevel verbosity, char *logFile, unsigned
     strcpy(server.logFileName, "stdout");
     server.logFile = stdout;
   }
-  server.maxClients =  maxClients;
-
-  /* Initialize socket. */
-  if ((server.fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-    fprintf(stderr, "Could not open socket connection.\n");
-    abort();
-  }
+  server.logger = loggerCreate(fileno(server.logFile), LOG_RING_SIZE);
+  server.workers = workers;
+  server.maxConnections = maxConnections;
 
   /* Network configuration. */
   server.addr = mcalloc(sizeof(SockAddr));
@@ -250,23 +548,137 @@ void serverCreate(unsigned int port, LogLevel verbosity, char *logFile, unsigned
   server.addr->sin_port = htons(server.port);
 
   /* Key value store setup. */
-  server.documents = dictCreate(&documentFree);
+  server.epoch = epochCreate();
+  server.documents = storeCreate(STORE_SHARDS, server.epoch);
+
+  /* Statistics. */
+  server.stats = statsCreate(NUM_COMMANDS);
+  server.started = server.sampled = serverNow();
+  server.sampledCalls = 0;
+  mutexInit(&server.sampleMutex, NULL);
+  server.slowlog = slowlogCreate(SLOWLOG_SIZE);
 
   /* Work queue. */
   workQueueCreate();
 
-  /* Start accepting connections. */
-  if ((bind(server.fd, (struct sockaddr*) server.addr, sizeof(SockAddr))) < 0) {
-    fprintf(stderr, "Could not bind to socket.\n");
-    abort();
-  }
-  listen(server.fd, server.maxClients);
-
   serverLog(LOG_LEVEL_INFO, "Starting RTDoc server on port %d\n", server.port);
   serverLog(LOG_LEVEL_DEBUG, "Debug mode on\n");
   serverLog(LOG_LEVEL_DEBUG, "PID: %d\n", server.pid);
   serverLog(LOG_LEVEL_DEBUG, "Logging to %s\n", server.logFileName);
-  serverLog(LOG_LEVEL_DEBUG, "Maximum clients: %d\n", server.maxClients);
+  serverLog(LOG_LEVEL_DEBUG, "Workers: %u\n", server.workers);
+  serverLog(LOG_LEVEL_DEBUG, "Maximum connections: %u\n", server.maxConnections);
+}
+
+/*
+ * Set how long clients and collaborators may go quiet, and how long requests may take.
+ * Until this is called, nothing times out.
+ *
+ * @param idle: Seconds a client may wait between requests before it is disconnected.
+ * @param session: Seconds a collaborator may go without an op before their session ends.
+ * @param command: Seconds a batch of requests may take to run and reply to before the client is disconnected.
+ */
+void serverSetTimeouts(unsigned int idle, unsigned int session, unsigned int command) {
+  server.idleTimeout = (uint64_t) idle * 1000;
+  server.sessionTimeout = (uint64_t) session * 1000;
+  server.commandTimeout = (uint64_t) command * 1000;
+}
+
+/*
+ * Set how long a command may take before it is recorded in the slowlog.
+ * Until this is called, nothing is recorded.
+ *
+ * @param threshold: Microseconds above which a command is slow (0 to record nothing).
+ */
+void serverSetSlowlog(unsigned int threshold) {
+  server.slowlogThreshold = threshold;
+}
+
+/*
+ * Serve metrics in the Prometheus text format over HTTP on a second port.
+ * Until this is called, metrics are only available through commands.
+ *
+ * @param port: The port to serve metrics on (0 for none).
+ */
+void serverSetMetricsPort(unsigned int port) {
+  server.metricsPort = port;
+}
+
+/*
+ * Pin the worker and shard threads to CPUs. Each thread takes the next CPU of its
+ * list, going around again if there are more threads than CPUs, and allocates its
+ * own memory on that CPU's node. Until this is called, threads run anywhere.
+ *
+ * @param workers: The CPUs for the workers, such as "0-7" or "all" (NULL or empty to leave them be).
+ * @param shards: The CPUs for the shard loops, in the same format.
+ * @return False if a list is invalid.
+ */
+bool serverSetAffinity(const char *workers, const char *shards) {
+  if (workers != NULL && *workers != '\0' && (server.workerCpus = cpuListParse(workers)) == NULL)
+    return false;
+  if (shards != NULL && *shards != '\0' && (server.shardCpus = cpuListParse(shards)) == NULL)
+    return false;
+  return true;
+}
+
+static void ringEngineFree(Shard *shard);
+
+/*
+ * Open a shard's listening socket.
+ * Every shard binds the same port with SO_REUSEPORT, so the kernel spreads
+ * incoming connections across the shards.
+ *
+ * @param shard: The shard to create.
+ * @param id: The index of the shard.
+ */
+static void shardCreate(Shard *shard, unsigned int id) {
+  int on = 1;
+
+  memset(shard, 0, sizeof(Shard));
+  shard->id = id;
+
+  if ((shard->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    fprintf(stderr, "Could not open socket connection.\n");
+    abort();
+  }
+
+  if (setsockopt(shard->fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 ||
+      bind(shard->fd, (struct sockaddr*) server.addr, sizeof(SockAddr)) < 0) {
+    fprintf(stderr, "Could not bind to socket.\n");
+    abort();
+  }
+  listen(shard->fd, server.backlog);
+
+  /* Tick the timer wheel, if anything times out. */
+  if (server.idleTimeout > 0 || server.sessionTimeout > 0 || server.commandTimeout > 0) {
+    struct itimerspec tick = {
+      .it_interval = {0, TIMER_TICK * 1000000},
+      .it_value = {0, TIMER_TICK * 1000000}
+    };
+
+    shard->timers = timerWheelCreate(serverNow(), TIMER_TICK);
+    if ((shard->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+        timerfd_settime(shard->timerFd, 0, &tick, NULL) < 0) {
+      fprintf(stderr, "Could not create timer.\n");
+      abort();
+    }
+  }
+}
+
+/*
+ * Close a shard's listener and free its loop.
+ *
+ * @param shard: The shard to free.
+ */
+static void shardFree(Shard *shard) {
+  if (shard->loop != NULL)
+    eventLoopFree(shard->loop);
+  if (shard->ring != NULL)
+    ringEngineFree(shard);
+  if (shard->timers != NULL) {
+    close(shard->timerFd);
+    timerWheelFree(shard->timers);
+  }
+  close(shard->fd);
 }
 
 /*
@@ -275,10 +687,22 @@ void serverCreate(unsigned int port, LogLevel verbosity, char *logFile, unsigned
  * @param server: The server to free.
  */
 void serverFree(void) {
-  close(server.fd);
+  for (int i = 0; i < server.numShards; i++)
+    shardFree(&server.shards[i]);
+  mfree(server.shards);
   mfree(server.addr);
+  loggerFree(server.logger);
   mfree(server.logFileName);
-  dictFree(server.documents);
+  storeFree(server.documents);
+  epochFree(server.epoch);
+  statsFree(server.stats);
+  slowlogFree(server.slowlog);
+  if (server.metricsPort > 0)
+    close(server.metricsFd);
+  if (server.workerCpus != NULL)
+    cpuListFree(server.workerCpus);
+  if (server.shardCpus != NULL)
+    cpuListFree(server.shardCpus);
   workQueueFree();
 }
 
@@ -287,54 +711,67 @@ void serverFree(void) {
  *                           Server information commands.
  *******************************************************************************/
 
-#define OK          "ok\n"
-#define NIL         "nil\n"
+#define OK                  "ok\n"
+#define NIL                 "nil\n"
+#define PONG                "pong\n"
+#define NOT_IMPLEMENTED     "not implemented\n"
 
 
 /*
- * @return The success string.
+ * Replies that never change are shared constants, copied into the output as is.
+ */
+#define reply(client,x)     (bufferAppend((client)->output, x, sizeof(x) - 1))
+
+/*
+ * Reply with the success string.
+ *
+ * @param client: The client to reply to.
  */
-static char *ok(void) {
-  char *output = mmalloc(4);
-  strcpy(output, OK);
-  return output;
+static void ok(Client *client) {
+  reply(client, OK);
 }
 
 /*
- * @return The null object string represntation.
+ * Reply with the null object string representation.
+ *
+ * @param client: The client to reply to.
  */
-static char *nil(void) {
-  char *output = mmalloc(5);
-  strcpy(output, NIL);
-  return output;
+static void nil(Client *client) {
+  client->failed = true;
+  reply(client, NIL);
 }
 
 /*
- * @return A message that the function is not yet implemented
+ * Reply with a message that the function is not yet implemented.
+ *
+ * @param client: The client to reply to.
  */
-static char *notImplemented(void) {
-  char *output = mmalloc(17);
-  strcpy(output, "not implemented\n");
-  return output;
+static void notImplemented(Client *client) {
+  client->failed = true;
+  reply(client, NOT_IMPLEMENTED);
 }
 
 /*
  * Called on an invalid command to the server.
  *
+ * @param client: The client to reply to with a message indicating the command is invalid.
  * @param command: The command attempted to be executed.
- * @return A message indicating the command is invalid.
  */
-static char *serverInvalidCommand(char *command, char *unused1, char *unused2) {
-  assert(command != NULL);
-  UNUSED(unused1); UNUSED(unused2);
-
-  int commandLength = jump(command) - command;
+static void serverInvalidCommand(Client *client, Arg command) {
+  assert(command.data != NULL);
+  bufferFormat(client->output, "Invalid command %.*s\n", (int) command.length, command.data);
+}
 
-  char *output = mmalloc(17 + commandLength);
-  sprintf(output, "Invalid command ");
-  strncat(output, command, commandLength);
-  strcat(output, "\n");
-  return output;
+/*
+ * Called when a command is sent the wrong number of arguments, which counts as a failed call.
+ *
+ * @param client: The client to reply to with a message indicating the arguments are invalid.
+ * @param command: The command.
+ */
+static void serverWrongArguments(Client *client, Command *command) {
+  assert(command != NULL);
+  bufferFormat(client->output, "Wrong number of arguments for %s\n", command->name);
+  statsRecordCommand(server.stats, command - commandTable, 0, true);
 }
 
 /*
@@ -342,11 +779,9 @@ static char *serverInvalidCommand(char *command, char *unused1, char *unused2) {
  *
  * @return 'pong' on success.
  */
-static char *serverPing(char *unused1, char *unused2, char *unused3) {
+static void serverPing(Client *client, Arg unused1, Arg unused2, Arg unused3) {
   UNUSED(unused1); UNUSED(unused2); UNUSED(unused3);
-  char *output = mmalloc(6);
-  sprintf(output, "pong\n");
-  return output;
+  reply(client, PONG);
 }
 
 /*
@@ -354,17 +789,161 @@ static char *serverPing(char *unused1, char *unused2, char *unused3) {
  *
  * @return The status of the operation.
  */
-static char *serverSave(char *unused1, char *unused2, char *unused3) {
+static void serverSave(Client *client, Arg unused1, Arg unused2, Arg unused3) {
   UNUSED(unused1); UNUSED(unused2); UNUSED(unused3);
-  return notImplemented();
+  notImplemented(client);
 }
 
 /*
  * @return The number of documents stored in the databse.
  */
-static char *serverNumDocuments(char *unused1, char *unused2, char *unused3) {
+static void serverNumDocuments(Client *client, Arg unused1, Arg unused2, Arg unused3) {
+  UNUSED(unused1); UNUSED(unused2); UNUSED(unused3);
+  bufferFormat(client->output, "%u\n", storeSize(server.documents));
+}
+
+/*
+ * @return The number of connected, accepted and rejected clients on each listener shard.
+ */
+static void serverShardList(Client *client, Arg unused1, Arg unused2, Arg unused3) {
+  UNUSED(unused1); UNUSED(unused2); UNUSED(unused3);
+
+  if (server.numShards == 0) {
+    nil(client);
+    return;
+  }
+
+  for (int i = 0; i < server.numShards; i++)
+    bufferFormat(client->output, "shard %u: connected %lu accepted %lu rejected %lu\n", server.shards[i].id,
+                 atomicGet(&server.shards[i].connected), atomicGet(&server.shards[i].accepted),
+                 atomicGet(&server.shards[i].rejected));
+}
+
+
+/*
+ * @return The queue depth, steal count and number of requests run by each worker,
+ *         followed by the number of requests no worker has taken yet.
+ */
+static void serverWorkerList(Client *client, Arg unused1, Arg unused2, Arg unused3) {
+  UNUSED(unused1); UNUSED(unused2); UNUSED(unused3);
+
+  unsigned int workers = schedulerWorkers(server.scheduler);
+
+  for (int i = 0; i < workers; i++)
+    bufferFormat(client->output, "worker %u: depth %u steals %lu runs %lu\n", i,
+                 schedulerDepth(server.scheduler, i), schedulerSteals(server.scheduler, i),
+                 schedulerRuns(server.scheduler, i));
+  bufferFormat(client->output, "pending %u\n", schedulerPending(server.scheduler));
+}
+
+/*
+ * Sample the rate at which commands are run.
+ *
+ * @param calls: The number of commands run so far.
+ * @return The number of commands run per second since the last sample.
+ */
+static double serverSampleOps(uint64_t calls) {
+  uint64_t now = serverNow(), elapsed;
+  double ops;
+
+  mutexLock(&server.sampleMutex);
+  elapsed = now - server.sampled;
+  ops = elapsed > 0 ? (double) (calls - server.sampledCalls) * 1000 / elapsed : 0;
+  server.sampled = now;
+  server.sampledCalls = calls;
+  mutexUnlock(&server.sampleMutex);
+
+  return ops;
+}
+
+/*
+ * Every counter is added up from each thread's own, so this never slows down
+ * the threads running commands.
+ *
+ * @return The uptime, connected clients, documents, memory in use, bytes read and
+ *         written, commands run and commands per second since the last `info`,
+ *         followed by the calls, time and failures of each command that ran.
+ */
+static void serverInfo(Client *client, Arg unused1, Arg unused2, Arg unused3) {
+  UNUSED(unused1); UNUSED(unused2); UNUSED(unused3);
+
+  uint64_t calls = statsCalls(server.stats);
+  CommandStats command;
+
+  bufferFormat(client->output, "uptime %lu\n", (serverNow() - server.started) / 1000);
+  bufferFormat(client->output, "connected_clients %lu\n", atomicGet(&server.connections));
+  bufferFormat(client->output, "documents %u\n", storeSize(server.documents));
+  bufferFormat(client->output, "used_memory %zu\n", memoryUsage());
+  bufferFormat(client->output, "bytes_in %lu\n", statsBytesIn(server.stats));
+  bufferFormat(client->output, "bytes_out %lu\n", statsBytesOut(server.stats));
+  bufferFormat(client->output, "commands_run %lu\n", calls);
+  bufferFormat(client->output, "ops_per_sec %.2f\n", serverSampleOps(calls));
+
+  for (int i = 0; i < NUM_COMMANDS; i++) {
+    statsCommand(server.stats, i, &command);
+    if (command.calls > 0)
+      bufferFormat(client->output, "command %s: calls %lu usec %lu usec_per_call %.2f errors %lu\n",
+                   commandTable[i].name, command.calls, command.usec,
+                   (double) command.usec / command.calls, command.errors);
+  }
+}
+
+/*
+ * The latency of every command is merged from each thread's own histograms.
+ *
+ * @return The number of calls and the median, 90th, 99th and 99.9th percentile
+ *         and maximum time in microseconds, for each command that ran.
+ */
+static void serverLatency(Client *client, Arg unused1, Arg unused2, Arg unused3) {
   UNUSED(unused1); UNUSED(unused2); UNUSED(unused3);
-  return notImplemented();
+
+  Histogram *latency = histogramCreate();
+
+  for (int i = 0; i < NUM_COMMANDS; i++) {
+    histogramReset(latency);
+    statsLatency(server.stats, i, latency);
+    if (histogramCount(latency) > 0)
+      bufferFormat(client->output, "command %s: count %lu p50 %lu p90 %lu p99 %lu p99.9 %lu max %lu\n",
+                   commandTable[i].name, histogramCount(latency), histogramPercentile(latency, 50),
+                   histogramPercentile(latency, 90), histogramPercentile(latency, 99),
+                   histogramPercentile(latency, 99.9), histogramMax(latency));
+  }
+
+  histogramFree(latency);
+}
+
+/*
+ * Inspect or empty the slowlog.
+ *
+ * @param subcommand: `get` for every entry, most recent first, `len` for the
+ *                    number of entries, or `reset` to empty it.
+ * @return The entries, the number of entries or the status of the operation.
+ */
+static void serverSlowlog(Client *client, Arg subcommand, Arg unused1, Arg unused2) {
+  assert(subcommand.data != NULL);
+  UNUSED(unused1); UNUSED(unused2);
+
+  SlowlogEntry entry;
+
+  if (!strcmp(subcommand.data, "get")) {
+    if (slowlogLength(server.slowlog) == 0)
+      nil(client);
+    for (unsigned int i = 0; slowlogGet(server.slowlog, i, &entry); i++) {
+      bufferFormat(client->output, "%lu: time %ld usec %lu client %d: %s", entry.id, (long) entry.time,
+                   entry.duration, entry.fd, entry.command);
+      for (unsigned int j = 0; j < entry.argc; j++)
+        bufferFormat(client->output, " %s", entry.argv[j]);
+      reply(client, "\n");
+    }
+  } else if (!strcmp(subcommand.data, "len")) {
+    bufferFormat(client->output, "%u\n", slowlogLength(server.slowlog));
+  } else if (!strcmp(subcommand.data, "reset")) {
+    slowlogReset(server.slowlog);
+    ok(client);
+  } else {
+    client->failed = true;
+    bufferFormat(client->output, "Invalid subcommand %s for slowlog\n", subcommand.data);
+  }
 }
 
 
@@ -373,11 +952,21 @@ static char *serverNumDocuments(char *unused1, char *unused2, char *unused3) {
  *******************************************************************************/
 
 /*
- * @return The list of commands supported by the server.
+ * @return The list of commands supported by the server, each with its number of
+ *         arguments, what it touches and how its cost grows.
  */
-static char *serverGetCommands(char *unused1, char *unused2, char *unused3) {
+static void serverGetCommands(Client *client, Arg unused1, Arg unused2, Arg unused3) {
   UNUSED(unused1); UNUSED(unused2); UNUSED(unused3);
-  return notImplemented();
+
+  static const char *costs[] = {"constant", "document", "server"};
+  Command *comm;
+
+  for (int i = 0; i < NUM_COMMANDS; i++) {
+    comm = &commandTable[i];
+    bufferFormat(client->output, "%s %u %s %s\n", comm->name, comm->argc,
+                 comm->flags & COMMAND_WRITE ? "write" : comm->flags & COMMAND_READ ? "read" : "admin",
+                 costs[comm->cost]);
+  }
 }
 
 
@@ -390,9 +979,9 @@ static char *serverGetCommands(char *unused1, char *unused2, char *unused3) {
  *
  * @return The list of clients.
  */
-static char *serverClientList(char *unused1, char *unused2, char *unused3) {
+static void serverClientList(Client *client, Arg unused1, Arg unused2, Arg unused3) {
   UNUSED(unused1); UNUSED(unused2); UNUSED(unused3);
-  return notImplemented();
+  notImplemented(client);
 }
 
 /*
@@ -402,9 +991,9 @@ static char *serverClientList(char *unused1, char *unused2, char *unused3) {
  * @param The port of the client.
  * @return The status of the operation.
  */
-static char *serverClientKill(char *host, char *port, char *unused) {
+static void serverClientKill(Client *client, Arg host, Arg port, Arg unused) {
   UNUSED(unused);
-  return notImplemented();
+  notImplemented(client);
 }
 
 /*
@@ -412,9 +1001,69 @@ static char *serverClientKill(char *host, char *port, char *unused) {
  *
  * @param The amount of time to pause the server.
  */
-static char *serverPause(char *timeout, char *unused1, char *unused2) {
+static void serverPause(Client *client, Arg timeout, Arg unused1, Arg unused2) {
   UNUSED(unused1); UNUSED(unused2);
-  return notImplemented();
+  notImplemented(client);
+}
+
+
+/********************************************************************************
+ *                              Streaming replies.
+ *
+ * A document is not copied into the output whole for `get`. The client holds a
+ * reference to the document's serialized contents instead, and copies the next
+ * chunk into its output once the previous chunks have been written, so a large
+ * document takes bounded memory per client and a slow reader paces the copying
+ * rather than the other way round. The serialized contents are shared by every
+ * client reading the document, and outlive any change to it.
+ *******************************************************************************/
+
+/*
+ * Start streaming a document as the reply to the current request.
+ *
+ * @param client: The client to reply to.
+ * @param doc: The document to stream.
+ */
+static void clientStreamStart(Client *client, Document *doc) {
+  assert(client->stream == NULL);
+
+  Serialized *contents = documentSerialize(doc, server.epoch);
+  char header[PROTOCOL_HEADER_SIZE];
+
+  if (client->binary)
+    bufferAppend(client->output, header, protocolReplyHeader(header, serializedLength(contents)));
+
+  client->stream = contents;
+  client->streamed = 0;
+}
+
+/*
+ * Copy the next chunk of a streamed reply into the client's output.
+ *
+ * @param client: The client being streamed to.
+ * @param limit: At most how many bytes to copy.
+ */
+static void clientStreamNext(Client *client, size_t limit) {
+  assert(client->stream != NULL);
+
+  size_t length = serializedLength(client->stream) - client->streamed;
+
+  if (length > limit) {
+    bufferAppend(client->output, serializedData(client->stream) + client->streamed, limit);
+    client->streamed += limit;
+    return;
+  }
+  bufferAppend(client->output, serializedData(client->stream) + client->streamed, length);
+
+  /* End the reply like every other, so pipelined replies can be told apart. */
+  if (client->binary)
+    reply(client, "\r\n");
+  else
+    reply(client, "\n");
+
+  serializedFree(client->stream);
+  client->stream = NULL;
+  client->streamed = 0;
 }
 
 
@@ -429,57 +1078,57 @@ static char *serverPause(char *timeout, char *unused1, char *unused2) {
  * @param contents: The initial contents of the document.
  * @return The status code of the action.
  */
-static char *serverAddDocument(char *key, char *contents, char *unused) {
-  assert(key != NULL);
-  assert(contents != NULL);
+static void serverAddDocument(Client *client, Arg key, Arg contents, Arg unused) {
+  assert(key.data != NULL);
+  assert(contents.data != NULL);
   UNUSED(unused);
 
-  char *err = mcalloc(128);
-  Json *json = jsonParse(contents, &err);
+  char error[128] = "", *err = error;
+  Json *json = jsonParse(contents.data, &err);
 
-  if (strlen(err)) {
+  if (json == NULL || strlen(err)) {
     /* The parsing failed. */
-    mfree(err);
-    return nil();
+    nil(client);
+    return;
   }
 
-  Document *doc = documentCreate(key, json);
-  dictSet(server.documents, key, doc);
+  storeSet(server.documents, key.data, documentCreate(key.data, json));
 
-  return ok();
+  ok(client);
 }
 
 /*
  * Retrieve a document from the store.
  *
  * @param key: The identifier of the document to get.
- * @return The matching document if it exists.
+ * @return A reference to the matching document, to release with `documentFree`,
+ *         or NULL if it does not exist.
  */
 static Document *serverGetDocument(char *key) {
-  Document *doc;
-
-  if ((doc = dictGet(server.documents, key)) == NULL)
-    return NULL;
-
-  return doc;
+  return storeGet(server.documents, key);
 }
 
 /*
  * Get the JSON contents of a document.
+ * This is the hottest command, so the document is only borrowed: looking it up
+ * takes no lock and no reference, and the reply holds on to its serialized
+ * contents rather than to the document.
  *
  * @param key: The document to retrieve.
  * @return The contents of the document.
  */
-static char *serverGetDocumentContents(char *key, char *unused1, char *unused2) {
-  assert(key != NULL);
+static void serverGetDocumentContents(Client *client, Arg key, Arg unused1, Arg unused2) {
+  assert(key.data != NULL);
   UNUSED(unused1); UNUSED(unused2);
 
   Document *doc;
 
-  if ((doc = serverGetDocument(key)) == NULL)
-    return nil();
+  if ((doc = storeLookup(server.documents, key.data)) == NULL) {
+    nil(client);
+    return;
+  }
 
-  return jsonStringify(documentGetContents(doc));
+  clientStreamStart(client, doc);
 }
 
 /*
@@ -488,10 +1137,10 @@ static char *serverGetDocumentContents(char *key, char *unused1, char *unused2)
  * @param key: The key to check.
  * @return The status of whether the document exists.
  */
-static char *serverExistsDocument(char *key, char *unused1, char *unused2) {
-  assert(key != NULL);
+static void serverExistsDocument(Client *client, Arg key, Arg unused1, Arg unused2) {
+  assert(key.data != NULL);
   UNUSED(unused1); UNUSED(unused2);
-  return notImplemented();
+  notImplemented(client);
 }
 
 /*
@@ -500,11 +1149,11 @@ static char *serverExistsDocument(char *key, char *unused1, char *unused2) {
  * @param key: The document to remove.
  * @return The status of the operation.
  */
-static char *serverRemoveDocument(char *key, char *unused1, char *unused2) {
-  assert(key != NULL);
+static void serverRemoveDocument(Client *client, Arg key, Arg unused1, Arg unused2) {
+  assert(key.data != NULL);
   UNUSED(unused1); UNUSED(unused2);
-  dictRemove(server.documents, key);
-  return ok();
+  storeRemove(server.documents, key.data);
+  ok(client);
 }
 
 /*
@@ -512,9 +1161,9 @@ static char *serverRemoveDocument(char *key, char *unused1, char *unused2) {
  *
  * @return The list of keys.
  */
-static char *serverGetKeys(char *unused1, char *unused2, char *unused3) {
+static void serverGetKeys(Client *client, Arg unused1, Arg unused2, Arg unused3) {
   UNUSED(unused1); UNUSED(unused2); UNUSED(unused3);
-  return notImplemented();
+  notImplemented(client);
 }
 
 /*
@@ -524,18 +1173,30 @@ static char *serverGetKeys(char *unused1, char *unused2, char *unused3) {
  * @param userId: The id of the user modifying the document.
  * @return The status code of the operation.
  */
-static char *serverAddCollaborator(char *key, char *userId, char *unused) {
-  assert(key != NULL);
-  assert(userId != NULL);
+static void serverAddCollaborator(Client *client, Arg key, Arg userId, Arg unused) {
+  assert(key.data != NULL);
+  assert(userId.data != NULL);
   UNUSED(unused);
 
   Document *doc;
 
-  if ((doc = serverGetDocument(key)) == NULL)
-    return nil();
+  if ((doc = serverGetDocument(key.data)) == NULL) {
+    nil(client);
+    return;
+  }
+
+  uint64_t now = serverNow();
+  Timer *heartbeat;
 
-  documentAddCollaborator(doc, collaboratorCreate(userId));
-  return ok();
+  /* The first collaborator starts the heartbeat that ends quiet sessions. */
+  if (documentAddCollaborator(doc, collaboratorCreate(userId.data), now) && server.sessionTimeout > 0 &&
+      client->shard != NULL) {
+    heartbeat = mmalloc(sizeof(Timer));
+    timerInit(heartbeat, &documentHeartbeat, documentRetain(doc));
+    timerWheelAdd(client->shard->timers, heartbeat, now + server.sessionTimeout);
+  }
+  documentFree(doc);
+  ok(client);
 }
 
 /*
@@ -545,22 +1206,32 @@ static char *serverAddCollaborator(char *key, char *userId, char *unused) {
  * @param userId: The id of the user to remove.
  * @return The status code of the operation.
  */
-static char *serverRemoveCollaborator(char *key, char *userId, char *unused) {
-  assert(key != NULL);
-  assert(userId != NULL);
+static void serverRemoveCollaborator(Client *client, Arg key, Arg userId, Arg unused) {
+  assert(key.data != NULL);
+  assert(userId.data != NULL);
   UNUSED(unused);
 
   Document *doc;
 
-  if ((doc = serverGetDocument(key)) == NULL)
-    return nil();
+  if ((doc = serverGetDocument(key.data)) == NULL) {
+    nil(client);
+    return;
+  }
 
-  documentRemoveCollaborator(doc, userId);
-  return ok();
+  documentRemoveCollaborator(doc, userId.data);
+  documentFree(doc);
+  ok(client);
 }
 
-static char *serverModifyDocument(char *key, char *userId, char *change) {
-  return notImplemented();
+static void serverModifyDocument(Client *client, Arg key, Arg userId, Arg change) {
+  Document *doc;
+
+  /* Any op keeps the collaborator's session alive. */
+  if ((doc = serverGetDocument(key.data)) != NULL) {
+    documentTouchCollaborator(doc, userId.data, serverNow());
+    documentFree(doc);
+  }
+  notImplemented(client);
 }
 
 
@@ -568,27 +1239,98 @@ static char *serverModifyDocument(char *key, char *userId, char *change) {
  *                           Run the server instance.
  *******************************************************************************/
 
-/* All commands supported by the server. */
-Command commandTable[] = {
-  {"add", 2, &serverAddDocument},
-  {"commands", 0, &serverGetCommands},
-  {"client-list", 0, &serverClientList},
-  {"client-kill", 2, &serverClientKill},
-  {"end", 2, &serverRemoveCollaborator},
-  {"exists", 1, &serverExistsDocument},
-  {"get", 1, &serverGetDocumentContents},
-  {"keys", 0, &serverGetKeys},
-  {"modify", 3, &serverModifyDocument},
-  {"pause", 0, &serverPause},
-  {"ping", 0, &serverPing},
-  {"remove", 1, &serverRemoveDocument},
-  {"size", 0, &serverNumDocuments},
-  {"start", 2, &serverAddCollaborator},
-  {"save", 0, &serverSave},
-  {"update", 2, &serverModifyDocument}
+/* All commands supported by the server, in the order of their ids. */
+Command commandTable[NUM_COMMANDS] = {
+  [COMMAND_ADD]         = {"add", 2, COMMAND_WRITE, COMMAND_COST_DOCUMENT, &serverAddDocument},
+  [COMMAND_COMMANDS]    = {"commands", 0, COMMAND_ADMIN, COMMAND_COST_CONSTANT, &serverGetCommands},
+  [COMMAND_CLIENT_LIST] = {"client-list", 0, COMMAND_ADMIN, COMMAND_COST_SERVER, &serverClientList},
+  [COMMAND_CLIENT_KILL] = {"client-kill", 2, COMMAND_ADMIN, COMMAND_COST_SERVER, &serverClientKill},
+  [COMMAND_END]         = {"end", 2, COMMAND_WRITE, COMMAND_COST_CONSTANT, &serverRemoveCollaborator},
+  [COMMAND_EXISTS]      = {"exists", 1, COMMAND_READ, COMMAND_COST_CONSTANT, &serverExistsDocument},
+  [COMMAND_GET]         = {"get", 1, COMMAND_READ, COMMAND_COST_DOCUMENT, &serverGetDocumentContents},
+  [COMMAND_INFO]        = {"info", 0, COMMAND_ADMIN, COMMAND_COST_CONSTANT, &serverInfo},
+  [COMMAND_KEYS]        = {"keys", 0, COMMAND_READ, COMMAND_COST_SERVER, &serverGetKeys},
+  [COMMAND_LATENCY]     = {"latency", 0, COMMAND_ADMIN, COMMAND_COST_CONSTANT, &serverLatency},
+  [COMMAND_MODIFY]      = {"modify", 3, COMMAND_WRITE, COMMAND_COST_DOCUMENT, &serverModifyDocument},
+  [COMMAND_PAUSE]       = {"pause", 0, COMMAND_ADMIN, COMMAND_COST_CONSTANT, &serverPause},
+  [COMMAND_PING]        = {"ping", 0, COMMAND_ADMIN, COMMAND_COST_CONSTANT, &serverPing},
+  [COMMAND_REMOVE]      = {"remove", 1, COMMAND_WRITE, COMMAND_COST_DOCUMENT, &serverRemoveDocument},
+  [COMMAND_SHARDS]      = {"shards", 0, COMMAND_ADMIN, COMMAND_COST_SERVER, &serverShardList},
+  [COMMAND_SIZE]        = {"size", 0, COMMAND_READ, COMMAND_COST_CONSTANT, &serverNumDocuments},
+  [COMMAND_SLOWLOG]     = {"slowlog", 1, COMMAND_ADMIN, COMMAND_COST_CONSTANT, &serverSlowlog},
+  [COMMAND_START]       = {"start", 2, COMMAND_WRITE, COMMAND_COST_CONSTANT, &serverAddCollaborator},
+  [COMMAND_SAVE]        = {"save", 0, COMMAND_ADMIN, COMMAND_COST_SERVER, &serverSave},
+  [COMMAND_UPDATE]      = {"update", 2, COMMAND_WRITE, COMMAND_COST_DOCUMENT, &serverModifyDocument},
+  [COMMAND_WORKERS]     = {"workers", 0, COMMAND_ADMIN, COMMAND_COST_SERVER, &serverWorkerList}
 };
 
-#define NUM_COMMANDS    (sizeof(commandTable) / sizeof(commandTable[0]))
+/*
+ * Find the command with exactly the given name.
+ * The candidate is picked by a switch on the length of the name and then on a
+ * character that tells apart the commands of that length, so only one name is
+ * ever compared. Keep this in step with the command table when adding a command.
+ *
+ * @param name: The name of the command; it does not need to be null terminated.
+ * @param length: The length of the name.
+ * @return The command, or NULL if there is none with that name.
+ */
+static Command *commandLookup(const char *name, size_t length) {
+  int id = -1;
+
+  switch (length) {
+    case 3:
+      switch (name[0]) {
+        case 'a': id = COMMAND_ADD; break;
+        case 'e': id = COMMAND_END; break;
+        case 'g': id = COMMAND_GET; break;
+      }
+      break;
+    case 4:
+      switch (name[2]) {
+        case 'f': id = COMMAND_INFO; break;
+        case 'y': id = COMMAND_KEYS; break;
+        case 'n': id = COMMAND_PING; break;
+        case 'z': id = COMMAND_SIZE; break;
+        case 'v': id = COMMAND_SAVE; break;
+      }
+      break;
+    case 5:
+      switch (name[0]) {
+        case 'p': id = COMMAND_PAUSE; break;
+        case 's': id = COMMAND_START; break;
+      }
+      break;
+    case 6:
+      switch (name[0]) {
+        case 'e': id = COMMAND_EXISTS; break;
+        case 'm': id = COMMAND_MODIFY; break;
+        case 'r': id = COMMAND_REMOVE; break;
+        case 's': id = COMMAND_SHARDS; break;
+        case 'u': id = COMMAND_UPDATE; break;
+      }
+      break;
+    case 7:
+      switch (name[0]) {
+        case 'l': id = COMMAND_LATENCY; break;
+        case 's': id = COMMAND_SLOWLOG; break;
+        case 'w': id = COMMAND_WORKERS; break;
+      }
+      break;
+    case 8:
+      id = COMMAND_COMMANDS;
+      break;
+    case 11:
+      switch (name[7]) {
+        case 'l': id = COMMAND_CLIENT_LIST; break;
+        case 'k': id = COMMAND_CLIENT_KILL; break;
+      }
+      break;
+  }
+
+  if (id < 0 || memcmp(name, commandTable[id].name, length))
+    return NULL;
+  return &commandTable[id];
+}
 
 
 /*
@@ -600,137 +1342,1045 @@ static void interruptHandler(int signal) {
 }
 
 /*
- * Read bytes from a given client.
+ * Read whatever a client has sent onto the back of its input.
+ * The read grows with the input, so a large request takes few reads.
  *
- * @param fd: The file descriptor of the client.
- * @param buffer: The buffer to read into.
+ * @param client: The client to read from.
  * @return The number of bytes read.
  */
-static int serverRead(int fd, char *buffer) {
-  assert(buffer != NULL);
-  memset(buffer, 0, BUFFER_SIZE);
-  return read(fd, buffer, BUFFER_SIZE);
+static int serverRead(Client *client) {
+  assert(client != NULL);
+
+  size_t length = bufferLength(client->input) > BUFFER_SIZE ? bufferLength(client->input) : BUFFER_SIZE;
+  int n = read(client->fd, bufferReserve(client->input, length), length);
+
+  if (n > 0) {
+    bufferCommit(client->input, n);
+    statsRecordBytesIn(server.stats, n);
+  }
+  return n;
 }
 
 /*
- * Write bytes to a given client and clear the buffer.
+ * Write as many pending replies to a client as its socket takes, without waiting for room.
  *
- * @param fd: The file descriptor of the client.
- * @param message: The message to write.
- * @return The number of bytes written.
+ * @param client: The client to write to.
+ * @return FLUSH_DONE once every reply is written, FLUSH_BLOCKED if the socket is full,
+ *         or FLUSH_ERROR on error.
  */
-static int serverWrite(int fd, char *message) {
-  assert(message != NULL);
-  return write(fd, message, strlen(message));
+static int serverFlush(Client *client) {
+  assert(client != NULL);
+
+  ssize_t n;
+
+  while (bufferLength(client->output) > 0) {
+    if ((n = write(client->fd, bufferData(client->output), bufferLength(client->output))) > 0) {
+      bufferConsume(client->output, n);
+      statsRecordBytesOut(server.stats, n);
+      trace2(reply__write, client->fd, n);
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return FLUSH_BLOCKED;
+    else if (n == 0 || errno != EINTR)
+      return FLUSH_ERROR;
+  }
+
+  return FLUSH_DONE;
 }
 
 /*
- * Parse the arguments from a command.
+ * Split the arguments of a text command, in place.
+ * Every argument but the last ends at the next whitespace, which is overwritten
+ * with a null byte; the last one takes the rest of the command. Nothing is copied.
  *
- * @param command: The command string to parse.
+ * @param command: The command string to parse, past the command name.
  * @param argc: The number of arguments to parse.
  * @param argv: The array of arguments to fill.
  */
-static void parseArgs(char *command, int argc, char **argv) {
+static void parseArgs(char *command, int argc, Arg *argv) {
   assert(command != NULL);
 
-  int argLength;
+  char *end;
 
   for (int i = 0; i < argc; i++) {
     command = skip(command);
-    if (i == argc - 1)
-      argLength = strlen(command);
-    else
-      argLength = jump(command) - command;
-    argv[i] = mmalloc(argLength + 1);
-    strncpy(argv[i], command, argLength);
-    serverLog(LOG_LEVEL_DEBUG, "%s\n", argv[i]);
-    command = jump(command);
+    end = i == argc - 1 ? command + strlen(command) : jump(command);
+    argv[i].data = command;
+    argv[i].length = end - command;
+    serverLog(LOG_LEVEL_DEBUG, "%s\n", argv[i].data);
+    if (*end != '\0')
+      *end++ = '\0';
+    command = end;
   }
 }
 
 /*
- * Free up to i arguments in the array.
+ * Run a command, timing it and counting it in the calling thread's statistics.
+ * A command slower than the threshold is also recorded in the slowlog.
  *
- * @param argv: The array of arguments.
- * @param i: The number of args to free.
+ * @param client: The client to reply to.
+ * @param comm: The command to run.
+ * @param a1, a2, a3: The arguments of the command.
  */
-static void freeArgs(char **argv, int i) {
-  for (int j = 0; j < i; j++)
-    mfree(argv[j]);
+static void serverCall(Client *client, Command *comm, Arg a1, Arg a2, Arg a3) {
+  uint64_t start = serverMicros(), duration;
+
+  trace2(command__start, comm->name, client->fd);
+  client->failed = false;
+  comm->fn(client, a1, a2, a3);
+  duration = serverMicros() - start;
+  trace3(command__done, comm->name, client->fd, duration);
+
+  statsRecordCommand(server.stats, comm - commandTable, duration, client->failed);
+  if (server.slowlogThreshold > 0 && duration > server.slowlogThreshold)
+    slowlogRecord(server.slowlog, comm->name, comm->argc, (Arg[]) {a1, a2, a3}, duration, client->fd);
 }
 
 /*
- * Run a command.
+ * Run a text command.
+ * The name has to match a command exactly, and the arguments are split in place,
+ * so the command is modified.
  *
+ * @param client: The client to reply to.
  * @param command: The command along with its arguments.
- * @return The output of the command.
  */
-char *serverRunCommand(char *command) {
+static void serverRunText(Client *client, char *command) {
   assert(command != NULL);
 
-  int length;
-  char *output;
-  Command comm;
+  Arg name = { command, jump(command) - command }, argv[3] = {{0}};
+  Command *comm;
 
+  if ((comm = commandLookup(name.data, name.length)) == NULL) {
+    serverInvalidCommand(client, name);
+    return;
+  }
+
+  parseArgs(command + name.length, comm->argc, argv);
+  serverCall(client, comm, argv[0], argv[1], argv[2]);
+}
+
+/*
+ * Run a command, outside of any connection.
+ *
+ * @param command: The command along with its arguments; it is modified.
+ * @return The output of the command, which the caller frees.
+ */
+char *serverRunCommand(char *command) {
+  Client client = { .fd = -1, .output = bufferCreate(BUFFER_SIZE) };
+
+  epochOnline(server.epoch);
+  serverRunText(&client, command);
+  while (client.stream != NULL)
+    clientStreamNext(&client, OUTPUT_BATCH_SIZE);
+  epochOffline(server.epoch);
+
+  char *result = mmalloc(bufferLength(client.output) + 1);
+  memcpy(result, bufferData(client.output), bufferLength(client.output));
+  result[bufferLength(client.output)] = '\0';
+
+  bufferFree(client.output);
+  return result;
+}
+
+/*
+ * Run a command sent with the binary protocol, whose arguments are already split apart.
+ * The command name has to match exactly, and the command has to get exactly its arguments.
+ *
+ * @param client: The client to reply to.
+ * @param request: The command and its arguments.
+ */
+static void serverRunArgs(Client *client, Request *request) {
+  assert(request->argc > 0);
+
+  Arg *argv = request->argv;
+  Command *comm;
+
+  /* End each argument where its "\r\n" starts, so it can also be used as a string. */
+  for (int i = 0; i < PROTOCOL_MAX_ARGS; i++)
+    if (i < request->argc)
+      argv[i].data[argv[i].length] = '\0';
+    else
+      argv[i] = (Arg) { NULL, 0 };
+
+  if ((comm = commandLookup(argv[0].data, argv[0].length)) == NULL)
+    serverInvalidCommand(client, argv[0]);
+  else if (request->argc - 1 != comm->argc)
+    serverWrongArguments(client, comm);
+  else
+    serverCall(client, comm, argv[1], argv[2], argv[3]);
+}
+
+
+/********************************************************************************
+ *                              Request framing.
+ *
+ * Every client has a growable input buffer. Text requests end with a newline;
+ * binary requests start with '*' and are framed by length prefixes (protocol.h),
+ * and a client may mix both. Several pipelined requests may arrive in one read,
+ * and one request may take many reads. A worker runs the complete requests in
+ * the buffer, and commands append their replies to the client's output buffer,
+ * which is written out once a batch of requests has run.
+ *******************************************************************************/
+
+#define INPUT_IDLE_CAPACITY     (16 * BUFFER_SIZE)
+
+/*
+ * Find the first complete request in a client's input.
+ * A binary request is measured from its length prefixes, without looking at its
+ * arguments. For a text request, only the bytes that arrived since the last search
+ * are scanned for the newline, so a request that arrives in many pieces is only
+ * scanned once.
+ *
+ * @param client: The client whose input to search.
+ * @param request: Filled with the arguments of a binary request.
+ * @return The length of the request, 0 if it has not fully arrived, or -1 if it is malformed.
+ */
+static long clientRequestLength(Client *client, Request *request) {
+  char *data = bufferData(client->input), *end;
+  size_t length = bufferLength(client->input);
+
+  if (protocolIsBinary(data, length))
+    return protocolParse(data, length, request);
+
+  if ((end = memchr(data + client->scanned, '\n', length - client->scanned)) == NULL) {
+    client->scanned = length;
+    return 0;
+  }
+  return end - data + 1;
+}
+
+/*
+ * @param client: The client to check.
+ * @return Whether a complete request is waiting in the client's input.
+ */
+static bool clientRequestReady(Client *client) {
+  Request request;
+  return clientRequestLength(client, &request) > 0;
+}
+
+/*
+ * @param client: The client that sent more input.
+ * @return Whether the client's partial request is malformed or has grown beyond the limit.
+ */
+static bool clientRequestInvalid(Client *client) {
+  Request request;
+
+  if (clientRequestLength(client, &request) < 0)
+    serverLog(LOG_LEVEL_WARNING, "Malformed request from client %d.\n", client->fd);
+  else if (bufferLength(client->input) > MAX_REQUEST_SIZE)
+    serverLog(LOG_LEVEL_WARNING, "Request too large from client %d.\n", client->fd);
+  else
+    return false;
+  return true;
+}
+
+/*
+ * @param client: The client to check.
+ * @return Whether the client has a reply left to stream or a complete request waiting.
+ */
+static bool clientHasWork(Client *client) {
+  return client->stream != NULL || clientRequestReady(client);
+}
+
+/*
+ * Put a binary reply's length prefix in front of it, once the command has written it.
+ * The newline ending the reply becomes the "\r\n" ending the binary reply.
+ *
+ * @param output: The output the reply was written to.
+ * @param start: Where in the output the reply starts.
+ */
+static void replyFrame(Buffer *output, size_t start) {
+  char header[PROTOCOL_HEADER_SIZE], *reply;
+  size_t length = bufferLength(output) - start, extra;
+  int headerLength;
+
+  if (length > 0 && bufferData(output)[start + length - 1] == '\n')
+    length--;
+  headerLength = protocolReplyHeader(header, length);
+  extra = start + headerLength + length + 2 - bufferLength(output);
+
+  /* Make room for the header and the "\r\n", then slide the reply over. */
+  bufferReserve(output, extra);
+  reply = bufferData(output) + start;
+  memmove(reply + headerLength, reply, length);
+  memcpy(reply, header, headerLength);
+  memcpy(reply + headerLength + length, "\r\n", 2);
+  bufferCommit(output, extra);
+}
+
+/*
+ * Run the complete requests in a client's input, until a batch of replies is waiting.
+ * The batch ends after REPLY_BATCH requests or once OUTPUT_BATCH_SIZE bytes of replies
+ * are waiting, whichever comes first. A reply being streamed is continued first, and
+ * each of its chunks counts as a request, so a large reply cannot hold up the worker.
+ *
+ * @param client: The client whose requests to run.
+ */
+static void clientRunRequests(Client *client) {
+  Request request;
+  char *data, *end;
+  unsigned int run = 0;
+  size_t start;
+  long length;
+
+  bufferShrink(client->output, OUTPUT_BATCH_SIZE);
+
+  while (run++ < REPLY_BATCH && bufferLength(client->output) < OUTPUT_BATCH_SIZE) {
+    if (client->stream != NULL) {
+      clientStreamNext(client, OUTPUT_BATCH_SIZE - bufferLength(client->output));
+      continue;
+    }
+
+    trace1(request__parse__start, client->fd);
+    length = clientRequestLength(client, &request);
+    trace2(request__parse__done, client->fd, length);
+    if (length <= 0)
+      break;
+    data = bufferData(client->input);
+
+    if ((client->binary = protocolIsBinary(data, length))) {
+      serverLog(LOG_LEVEL_DEBUG, "%.*s\n", (int) request.argv[0].length, request.argv[0].data);
+      start = bufferLength(client->output);
+      serverRunArgs(client, &request);
+      if (client->stream == NULL)
+        replyFrame(client->output, start);
+    } else {
+      /* Terminate the request in place, dropping a carriage return before the newline. */
+      end = data + length - 1;
+      *end = '\0';
+      if (end > data && end[-1] == '\r')
+        end[-1] = '\0';
+
+      serverLog(LOG_LEVEL_DEBUG, "%s\n", data);
+      serverRunText(client, skip(data));
+    }
+
+    bufferConsume(client->input, length);
+    client->scanned = 0;
+  }
+
+  /* Do not hold on to the memory of an unusually large request. */
+  bufferShrink(client->input, INPUT_IDLE_CAPACITY);
+}
+
+/********************************************************************************
+ *                           Epoll connection engine.
+ *******************************************************************************/
+
+/*
+ * Get the next client request.
+ *
+ * @param shard: The shard whose listener to accept from.
+ * @return The status code of accepting the client.
+ */
+static int getClient(Shard *shard) {
+  return accept(shard->fd, NULL, NULL);
+}
+
+/*
+ * Accept every pending connection on a shard's listener.
+ * The listener is edge-triggered, so keep accepting until it would block.
+ *
+ * @param shard: The shard whose listener is readable.
+ */
+static void serverAcceptClients(Shard *shard) {
+  int fd;
+  Client *client;
+
+  while ((fd = getClient(shard)) >= 0) {
+    if (!serverAdmit(shard, fd))
+      continue;
+    trace1(client__accept, fd);
+    serverLog(LOG_LEVEL_DEBUG, "Client connected: %d\n", fd);
+    client = clientCreate(fd, shard);
+    if (setNonBlocking(fd) < 0 ||
+        eventLoopAdd(shard->loop, fd, EVENT_READABLE | EVENT_ONESHOT, client) < 0) {
+      serverLog(LOG_LEVEL_ERROR, "Error registering client %d.\n", fd);
+      clientClose(client);
+    }
+  }
+
+  if (errno != EAGAIN && errno != EWOULDBLOCK)
+    serverLog(LOG_LEVEL_ERROR, "Error accepting client.\n");
+}
+
+/*
+ * Read more input from a client whose socket became readable, and hand the client
+ * to a worker once a complete request has arrived.
+ * The client is registered one-shot, so the loop will not report it again until
+ * it is rearmed, either here or once its replies have been written.
+ *
+ * @param client: The readable client.
+ */
+static void serverReadClient(Client *client) {
+  assert(client != NULL);
+
+  int n;
+
+  if ((n = serverRead(client)) > 0) {
+    if (clientRequestReady(client)) {
+      clientBusy(client);
+      workQueuePush(client);
+    } else if (clientRequestInvalid(client)) {
+      clientClose(client);
+    } else {
+      clientIdle(client);
+      eventLoopRearm(client->shard->loop, client->fd, EVENT_READABLE | EVENT_ONESHOT, client);
+    }
+  } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+    eventLoopRearm(client->shard->loop, client->fd, EVENT_READABLE | EVENT_ONESHOT, client);
+  } else {
+    serverLog(LOG_LEVEL_INFO, "Client disconnected: %d.\n", client->fd);
+    clientClose(client);
+  }
+}
+
+/*
+ * Write a client's replies, then decide what the client waits for next.
+ * If the socket is full, the client waits until it is writable again, so a slow
+ * reader holds no thread. Otherwise a client with more work goes to the back of
+ * the work queue rather than keeping its worker, and any other client is rearmed
+ * for input, unless what is left of its input is malformed.
+ * Runs on a worker once it has run a batch, or on the loop once the socket is writable.
+ *
+ * @param client: The client to reply to.
+ */
+static void epollContinue(Client *client) {
+  switch (serverFlush(client)) {
+  case FLUSH_ERROR:
+    serverLog(LOG_LEVEL_INFO, "Client disconnected: %d.\n", client->fd);
+    clientClose(client);
+    return;
+  case FLUSH_BLOCKED:
+    eventLoopRearm(client->shard->loop, client->fd, EVENT_WRITABLE | EVENT_ONESHOT, client);
+    return;
+  }
+
+  if (clientHasWork(client)) {
+    if (client->stream == NULL)
+      clientBusy(client);
+    workQueuePush(client);
+  } else if (clientRequestInvalid(client)) {
+    clientClose(client);
+  } else {
+    clientIdle(client);
+    eventLoopRearm(client->shard->loop, client->fd, EVENT_READABLE | EVENT_ONESHOT, client);
+  }
+}
+
+/*
+ * Consume the ticks of a shard's timer descriptor, and run the timers that expired.
+ *
+ * @param shard: The shard whose timer descriptor is readable.
+ */
+static void epollTick(Shard *shard) {
+  if (read(shard->timerFd, &shard->timerTicks, sizeof(shard->timerTicks)) > 0)
+    serverTick(shard);
+}
+
+/*
+ * Dispatch a shard's readiness events until the server exits.
+ *
+ * @param shard: The shard to run.
+ */
+static void epollServe(Shard *shard) {
+  int fired;
+  void *data;
+
+  /* Watch the listener for new connections. */
+  if ((shard->loop = eventLoopCreate(MAX_EVENTS)) == NULL ||
+      setNonBlocking(shard->fd) < 0 ||
+      eventLoopAdd(shard->loop, shard->fd, EVENT_READABLE, shard) < 0 ||
+      (shard->timers != NULL && eventLoopAdd(shard->loop, shard->timerFd, EVENT_READABLE, shard->timers) < 0)) {
+    fprintf(stderr, "Could not create event loop.\n");
+    abort();
+  }
+
+  while (true) {
+    if ((fired = eventLoopWait(shard->loop, -1)) < 0) {
+      serverLog(LOG_LEVEL_ERROR, "Error waiting for events.\n");
+      continue;
+    }
+    for (int i = 0; i < fired; i++) {
+      if ((data = eventLoopFiredData(shard->loop, i)) == shard)
+        serverAcceptClients(shard);
+      else if (data == shard->timers)
+        epollTick(shard);
+      else if (eventLoopFiredMask(shard->loop, i) & EVENT_WRITABLE)
+        epollContinue(data);
+      else
+        serverReadClient(data);
+    }
+  }
+}
+
+
+/********************************************************************************
+ *                          io_uring connection engine.
+ *
+ * Each shard's loop thread owns its ring. Every client has exactly one receive or
+ * send in flight while it is owned by the loop. Receives land in a pool of
+ * provided buffers, so idle clients pin no memory, and workers hand their replies
+ * back to the loop so that sends for many clients go out in a single submission.
+ *******************************************************************************/
+
+/*
+ * Free a shard's io_uring engine.
+ *
+ * @param shard: The shard whose engine to free.
+ */
+static void ringEngineFree(Shard *shard) {
+  assert(shard->ring != NULL);
+
+  RingEngine *engine = shard->ring;
+  ringFree(engine->ring);
+  close(engine->wakeFd);
+  listFree(engine->replies);
+  mfree(engine->buffers);
+  mfree(engine);
+  shard->ring = NULL;
+}
+
+/*
+ * Set up a shard's io_uring engine.
+ *
+ * @param shard: The shard to serve with io_uring.
+ * @return Whether the kernel supports everything the engine needs.
+ */
+static bool ringEngineCreate(Shard *shard) {
+  Ring *ring;
+
+  if ((ring = ringCreate(RING_ENTRIES)) == NULL)
+    return false;
+
+  RingEngine *engine = mcalloc(sizeof(RingEngine));
+  engine->ring = ring;
+  engine->buffers = mmalloc(RING_BUFFERS * BUFFER_SIZE);
+  engine->wakeFd = eventfd(0, EFD_CLOEXEC);
+  engine->replies = listCreate(LIST_TYPE_LINKED, &clientBorrowed);
+  mutexInit(&engine->mutex, NULL);
+  shard->ring = engine;
+
+  if (engine->wakeFd < 0 ||
+      !ringProvideBuffers(ring, engine->buffers, BUFFER_SIZE, RING_BUFFERS, RING_BUFFER_GROUP, 0) ||
+      !ringRead(ring, engine->wakeFd, &engine->wakeCount, sizeof(engine->wakeCount), engine) ||
+      (shard->timers != NULL &&
+       !ringRead(ring, shard->timerFd, &shard->timerTicks, sizeof(shard->timerTicks), shard->timers)) ||
+      !ringAccept(ring, shard->fd, shard)) {
+    ringEngineFree(shard);
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Queue a receive for a client.
+ *
+ * @param client: The client to receive from.
+ */
+static void ringReceive(Client *client) {
+  client->sending = false;
+  if (!ringRecv(client->shard->ring->ring, client->fd, BUFFER_SIZE, RING_BUFFER_GROUP, client)) {
+    serverLog(LOG_LEVEL_ERROR, "Submission queue full, dropping client %d.\n", client->fd);
+    clientClose(client);
+  }
+}
+
+/*
+ * Queue a send of every pending reply to a client.
+ *
+ * @param client: The client to send to.
+ */
+static void ringSendReplies(Client *client) {
+  client->sending = true;
+  if (!ringSend(client->shard->ring->ring, client->fd, bufferData(client->output),
+                bufferLength(client->output), client)) {
+    serverLog(LOG_LEVEL_ERROR, "Submission queue full, dropping client %d.\n", client->fd);
+    clientClose(client);
+  }
+}
+
+/*
+ * Once a client's replies are sent, run its next requests if they already
+ * arrived or continue the reply being streamed, or wait for more input.
+ *
+ * @param client: The client whose replies were sent.
+ */
+static void ringContinue(Client *client) {
+  if (clientHasWork(client)) {
+    if (client->stream == NULL)
+      clientBusy(client);
+    workQueuePush(client);
+  } else if (clientRequestInvalid(client)) {
+    clientClose(client);
+  } else {
+    clientIdle(client);
+    ringReceive(client);
+  }
+}
+
+/*
+ * Hand a client's replies from a worker to the shard's loop thread, which owns the ring.
+ * The loop is only woken if it has not already been asked to flush replies.
+ *
+ * @param client: The client to reply to.
+ */
+static void ringReply(Client *client) {
+  RingEngine *engine = client->shard->ring;
+  uint64_t one = 1;
+  bool wake;
+
+  mutexLock(&engine->mutex);
+  wake = listLength(engine->replies) == 0;
+  listAppend(engine->replies, client);
+  mutexUnlock(&engine->mutex);
+
+  if (wake && write(engine->wakeFd, &one, sizeof(one)) < 0)
+    serverLog(LOG_LEVEL_ERROR, "Error waking the io_uring loop.\n");
+}
+
+/*
+ * Queue sends for every client whose requests the workers have finished.
+ *
+ * @param engine: The engine whose replies to send.
+ */
+static void ringFlushReplies(RingEngine *engine) {
+  Client *client;
+
+  mutexLock(&engine->mutex);
+  while (listLength(engine->replies) > 0) {
+    client = listGet(engine->replies, 0);
+    listRemove(engine->replies, 0);
+    if (bufferLength(client->output) > 0)
+      ringSendReplies(client);
+    else
+      ringContinue(client);
+  }
+  mutexUnlock(&engine->mutex);
+}
+
+/*
+ * A connection was accepted, or the multishot accept ended.
+ *
+ * @param shard: The shard that accepted the connection.
+ * @param event: The accept completion.
+ * @return False if the kernel does not support multishot accept.
+ */
+static bool ringAccepted(Shard *shard, RingEvent *event) {
+  if (event->result >= 0) {
+    if (serverAdmit(shard, event->result)) {
+      trace1(client__accept, event->result);
+      serverLog(LOG_LEVEL_DEBUG, "Client connected: %d\n", event->result);
+      ringReceive(clientCreate(event->result, shard));
+    }
+  } else if (event->result == -EINVAL) {
+    return false;
+  } else {
+    serverLog(LOG_LEVEL_ERROR, "Error accepting client.\n");
+  }
+
+  /* The kernel may end a multishot accept at any time; start another one. */
+  if (!ringEventMore(event))
+    ringAccept(shard->ring->ring, shard->fd, shard);
+  return true;
+}
+
+/*
+ * A receive for a client completed: append the bytes to the client's input, return
+ * the provided buffer to the kernel, and queue the client for a worker once a
+ * complete request has arrived.
+ *
+ * @param client: The client that was read.
+ * @param event: The receive completion.
+ */
+static void ringReceived(Client *client, RingEvent *event) {
+  RingEngine *engine = client->shard->ring;
+  int id = ringEventBuffer(event);
+  char *buffer = id >= 0 ? engine->buffers + id * BUFFER_SIZE : NULL;
+
+  if (event->result > 0) {
+    bufferAppend(client->input, buffer, event->result);
+    statsRecordBytesIn(server.stats, event->result);
+  }
+  if (buffer != NULL)
+    ringProvideBuffers(engine->ring, buffer, BUFFER_SIZE, 1, RING_BUFFER_GROUP, id);
+
+  if (event->result > 0) {
+    if (clientRequestReady(client)) {
+      clientBusy(client);
+      workQueuePush(client);
+    } else if (clientRequestInvalid(client)) {
+      clientClose(client);
+    } else {
+      clientIdle(client);
+      ringReceive(client);
+    }
+  } else if (event->result == -ENOBUFS || event->result == -EINTR) {
+    ringReceive(client);
+  } else {
+    serverLog(LOG_LEVEL_INFO, "Client disconnected: %d.\n", client->fd);
+    clientClose(client);
+  }
+}
+
+/*
+ * A send for a client completed: send the rest of the replies, or move on.
+ *
+ * @param client: The client that was written.
+ * @param event: The send completion.
+ */
+static void ringSent(Client *client, RingEvent *event) {
+  if (event->result <= 0) {
+    serverLog(LOG_LEVEL_INFO, "Client disconnected: %d.\n", client->fd);
+    clientClose(client);
+    return;
+  }
+
+  bufferConsume(client->output, event->result);
+  statsRecordBytesOut(server.stats, event->result);
+  trace2(reply__write, client->fd, event->result);
+  if (bufferLength(client->output) > 0)
+    ringSendReplies(client);
+  else
+    ringContinue(client);
+}
+
+/*
+ * Run a shard's io_uring loop until the server exits.
+ *
+ * @param shard: The shard to run.
+ * @return False if the kernel turned out not to support the engine, before any client connected.
+ */
+static bool ringServe(Shard *shard) {
+  RingEngine *engine = shard->ring;
+  RingEvent events[MAX_EVENTS];
+  unsigned int reaped;
+  void *data;
+
+  while (true) {
+    if (ringSubmit(engine->ring, 1) < 0 && errno != EBUSY) {
+      serverLog(LOG_LEVEL_ERROR, "Error submitting to io_uring.\n");
+      continue;
+    }
+
+    while ((reaped = ringReap(engine->ring, events, MAX_EVENTS)) > 0) {
+      for (int i = 0; i < reaped; i++) {
+        if ((data = events[i].data) == NULL) {
+          /* Provided buffers were returned. */
+        } else if (data == shard) {
+          if (!ringAccepted(shard, &events[i]))
+            return false;
+        } else if (data == engine) {
+          ringRead(engine->ring, engine->wakeFd, &engine->wakeCount, sizeof(engine->wakeCount), engine);
+        } else if (data == shard->timers) {
+          serverTick(shard);
+          ringRead(engine->ring, shard->timerFd, &shard->timerTicks, sizeof(shard->timerTicks), shard->timers);
+        } else if (((Client*) data)->sending) {
+          ringSent(data, &events[i]);
+        } else {
+          ringReceived(data, &events[i]);
+        }
+      }
+    }
+
+    ringFlushReplies(engine);
+  }
+}
+
+
+/********************************************************************************
+ *                              Metrics endpoint.
+ *
+ * A scrape is rare and cheap next to the commands being served, so a single
+ * thread answers them one at a time with blocking calls, outside of the shards'
+ * loops. Every counter is read the way `info` reads it, so a scrape never slows
+ * down the threads running commands.
+ *******************************************************************************/
+
+#define METRICS_OK          "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+#define METRICS_NOT_FOUND   "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n"
+
+/* The upper bounds of the exported latency buckets, in microseconds. */
+static const uint64_t metricsBuckets[] = {
+  10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+  1000000, 2500000, 5000000, 10000000
+};
+
+#define NUM_METRICS_BUCKETS (sizeof(metricsBuckets) / sizeof(metricsBuckets[0]))
+
+/*
+ * Write the server's metrics in the Prometheus text format.
+ *
+ * @param output: Where to write the metrics.
+ */
+static void serverMetrics(Buffer *output) {
+  Histogram *latency = histogramCreate();
+  CommandStats command;
+  const char *name;
+
+  bufferFormat(output, "# HELP rtdoc_uptime_seconds Time since the server started.\n"
+                       "# TYPE rtdoc_uptime_seconds gauge\n"
+                       "rtdoc_uptime_seconds %lu\n", (serverNow() - server.started) / 1000);
+  bufferFormat(output, "# HELP rtdoc_connected_clients Clients currently connected.\n"
+                       "# TYPE rtdoc_connected_clients gauge\n"
+                       "rtdoc_connected_clients %lu\n", atomicGet(&server.connections));
+  bufferFormat(output, "# HELP rtdoc_documents Documents in the store.\n"
+                       "# TYPE rtdoc_documents gauge\n"
+                       "rtdoc_documents %u\n", storeSize(server.documents));
+  bufferFormat(output, "# HELP rtdoc_memory_bytes Memory allocated by the server.\n"
+                       "# TYPE rtdoc_memory_bytes gauge\n"
+                       "rtdoc_memory_bytes %zu\n", memoryUsage());
+  bufferFormat(output, "# HELP rtdoc_network_bytes_total Bytes read from and written to clients.\n"
+                       "# TYPE rtdoc_network_bytes_total counter\n"
+                       "rtdoc_network_bytes_total{direction=\"in\"} %lu\n"
+                       "rtdoc_network_bytes_total{direction=\"out\"} %lu\n",
+                       statsBytesIn(server.stats), statsBytesOut(server.stats));
+
+  bufferFormat(output, "# HELP rtdoc_command_errors_total Commands that replied with a failure.\n"
+                       "# TYPE rtdoc_command_errors_total counter\n");
   for (int i = 0; i < NUM_COMMANDS; i++) {
-    comm = commandTable[i];
-    length = strlen(comm.name);
-    if (!strncmp(command, comm.name, length)) {
-      char *argv[3];
-      memset(argv, 0, sizeof(argv));
-      parseArgs(command + length, comm.argc, argv);
-      output = comm.fn(argv[0], argv[1], argv[2]);
-      freeArgs(argv, comm.argc);
-      return output;
+    statsCommand(server.stats, i, &command);
+    if (command.calls > 0)
+      bufferFormat(output, "rtdoc_command_errors_total{command=\"%s\"} %lu\n", commandTable[i].name,
+                   command.errors);
+  }
+
+  bufferFormat(output, "# HELP rtdoc_command_duration_seconds Time taken to run each command.\n"
+                       "# TYPE rtdoc_command_duration_seconds histogram\n");
+  for (int i = 0; i < NUM_COMMANDS; i++) {
+    histogramReset(latency);
+    statsLatency(server.stats, i, latency);
+    if (histogramCount(latency) == 0)
+      continue;
+
+    name = commandTable[i].name;
+    for (int j = 0; j < NUM_METRICS_BUCKETS; j++)
+      bufferFormat(output, "rtdoc_command_duration_seconds_bucket{command=\"%s\",le=\"%g\"} %lu\n", name,
+                   metricsBuckets[j] / 1e6, histogramCountAtMost(latency, metricsBuckets[j]));
+    bufferFormat(output, "rtdoc_command_duration_seconds_bucket{command=\"%s\",le=\"+Inf\"} %lu\n"
+                         "rtdoc_command_duration_seconds_sum{command=\"%s\"} %g\n"
+                         "rtdoc_command_duration_seconds_count{command=\"%s\"} %lu\n",
+                 name, histogramCount(latency), name, histogramSum(latency) / 1e6, name,
+                 histogramCount(latency));
+  }
+
+  histogramFree(latency);
+}
+
+/*
+ * Write all of a reply to a scraper, waiting for room as needed.
+ *
+ * @param fd: The scraper's connection.
+ * @param data: The bytes to write.
+ * @param length: The number of bytes.
+ * @return Whether everything was written.
+ */
+static bool metricsWrite(int fd, const char *data, size_t length) {
+  ssize_t n;
+
+  while (length > 0) {
+    if ((n = send(fd, data, length, MSG_NOSIGNAL)) > 0) {
+      data += n;
+      length -= n;
+    } else if (n == 0 || errno != EINTR) {
+      return false;
     }
   }
-  return serverInvalidCommand(command, NULL, NULL);
+  return true;
+}
+
+/*
+ * Answer one scrape: the metrics for `GET /metrics` (or `GET /`), and 404 otherwise.
+ *
+ * @param fd: The scraper's connection.
+ * @param output: Where to build the reply.
+ */
+static void metricsReply(int fd, Buffer *output) {
+  char request[METRICS_REQUEST_SIZE];
+  size_t length = 0;
+  ssize_t n;
+  bool found;
+
+  /* Only the request line matters, but wait for the headers so the scraper is not reset. */
+  request[0] = '\0';
+  while (length < sizeof(request) - 1 && strstr(request, "\r\n\r\n") == NULL &&
+         (n = recv(fd, request + length, sizeof(request) - 1 - length, 0)) > 0)
+    request[length += n] = '\0';
+
+  found = !strncmp(request, "GET /metrics ", 13) || !strncmp(request, "GET / ", 6);
+  bufferClear(output);
+  if (found)
+    serverMetrics(output);
+  else
+    bufferFormat(output, "Not found\n");
+
+  if (found ? metricsWrite(fd, METRICS_OK, sizeof(METRICS_OK) - 1)
+            : metricsWrite(fd, METRICS_NOT_FOUND, sizeof(METRICS_NOT_FOUND) - 1)) {
+    dprintf(fd, "Content-Length: %zu\r\nConnection: close\r\n\r\n", bufferLength(output));
+    metricsWrite(fd, bufferData(output), bufferLength(output));
+  }
+}
+
+/*
+ * The procedure the metrics thread runs: answer scrapes one at a time until the server exits.
+ */
+static void *serverMetricsJob(void *arg) {
+  UNUSED(arg);
+
+  struct timeval timeout = { .tv_sec = METRICS_READ_TIMEOUT };
+  Buffer *output = bufferCreate(BUFFER_SIZE);
+  int fd;
+
+  while (true) {
+    if ((fd = accept(server.metricsFd, NULL, NULL)) < 0)
+      continue;
+    /* A scraper that never sends its request must not hold up the next one. */
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    metricsReply(fd, output);
+    close(fd);
+  }
+
+  bufferFree(output);
+  return NULL;
+}
+
+/*
+ * Open the metrics port and start answering scrapes on it.
+ * Metrics are not worth failing the server over: if the port cannot be opened,
+ * the error is logged and the server runs without them.
+ */
+static void serverMetricsStart(void) {
+  SockAddr addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY),
+                    .sin_port = htons(server.metricsPort) };
+  int on = 1;
+
+  if ((server.metricsFd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      setsockopt(server.metricsFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+      bind(server.metricsFd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+      listen(server.metricsFd, server.backlog) < 0) {
+    serverLog(LOG_LEVEL_ERROR, "Could not serve metrics on port %u.\n", server.metricsPort);
+    if (server.metricsFd >= 0)
+      close(server.metricsFd);
+    server.metricsPort = 0;
+    return;
+  }
+
+  threadCreate(&server.metricsThread, &serverMetricsJob, NULL);
+  serverLog(LOG_LEVEL_INFO, "Serving metrics on port %u\n", server.metricsPort);
+}
+
+
+/********************************************************************************
+ *                              Worker pool.
+ *******************************************************************************/
+
+/*
+ * Send a client's replies through whichever engine is serving the client.
+ *
+ * @param client: The client to reply to.
+ */
+static void serverReply(Client *client) {
+  if (client->shard->engine == IO_ENGINE_URING)
+    ringReply(client);
+  else
+    epollContinue(client);
 }
 
 /*
- * Handle a single client.
+ * Run a batch of the requests a client sent, and hand the client back to the event loop.
  *
- * @param client: The request to handle.
+ * @param client: The client whose requests to run.
  */
 static void handleClientRequest(Client *client) {
   assert(client != NULL);
 
-  char buffer[BUFFER_SIZE], *output;
+  clientRunRequests(client);
+  serverReply(client);
+}
 
-  /* Accept requests in a loop. */
-  while (serverRead(client->fd, buffer) > 0) {
-    serverLog(LOG_LEVEL_DEBUG, buffer);
-    output = serverRunCommand(skip(buffer));
-    if (serverWrite(client->fd, output) <= 0) {
-      serverLog(LOG_LEVEL_INFO, "Client disconnected: %d.\n", client->fd);
-      mfree(output);
-      clientFree(client);
-      break;
+/*
+ * Report where the worker and shard threads will run, and let the scheduler know
+ * which node each worker is on.
+ */
+static void serverPlaceThreads(void) {
+  int cpu;
+
+  if (server.workerCpus != NULL) {
+    for (unsigned int i = 0; i < server.workers; i++) {
+      cpu = cpuListGet(server.workerCpus, i);
+      schedulerSetNode(server.scheduler, i, affinityNode(cpu));
+      serverLog(LOG_LEVEL_INFO, "Worker %u on CPU %d, node %d\n", i, cpu, affinityNode(cpu));
     }
-    mfree(output);
   }
-  close(client->fd);
-  clientFree(client);
+  if (server.shardCpus != NULL) {
+    for (unsigned int i = 0; i < server.numShards; i++) {
+      cpu = cpuListGet(server.shardCpus, i);
+      serverLog(LOG_LEVEL_INFO, "Shard %u on CPU %d, node %d\n", i, cpu, affinityNode(cpu));
+    }
+  }
+  if (server.workerCpus == NULL || server.shardCpus == NULL)
+    serverLog(LOG_LEVEL_INFO, "%s not pinned, on %u NUMA node(s)\n",
+              server.workerCpus != NULL ? "Shards" : server.shardCpus != NULL ? "Workers" : "Threads",
+              affinityNodes());
 }
 
 /*
- * The procedure each thread will run.
- * Continuously pop clients from the queue and run the operations.
+ * Pin the calling thread to its CPU, if it was given a list of them.
+ *
+ * @param cpus: The CPUs of the thread's kind, or NULL.
+ * @param kind: What the thread is, for the log.
+ * @param index: The index of the thread among its kind.
  */
-static void *serverThreadJob(void *unused) {
-  UNUSED(unused);
-  while (true)
-    handleClientRequest(workQueuePop());
+static void serverPinThread(CpuList *cpus, const char *kind, unsigned int index) {
+  if (cpus != NULL && !affinityPin(cpuListGet(cpus, index)))
+    serverLog(LOG_LEVEL_WARNING, "Could not pin %s %u to CPU %d\n", kind, index, cpuListGet(cpus, index));
 }
 
 /*
- * Get the next client request.
+ * The procedure each worker thread will run.
+ * Continuously take clients with a pending request from the scheduler and run them.
+ * A worker is only online in the epoch while it runs a batch, so one waiting for
+ * work never holds up reclamation; it frees what became safe on its way out.
  *
- * @return The status code of accepting the client.
+ * @param arg: The index of the worker.
+ */
+static void *serverThreadJob(void *arg) {
+  unsigned int worker = (uintptr_t) arg;
+  Client *client;
+
+  serverPinThread(server.workerCpus, "worker", worker);
+  while (true) {
+    client = workQueuePop(worker);
+    epochOnline(server.epoch);
+    handleClientRequest(client);
+    epochOffline(server.epoch);
+    if (epochPending(server.epoch) > 0)
+      epochReclaim(server.epoch);
+  }
+  return NULL;
+}
+
+/*
+ * The procedure each shard's loop thread will run.
+ * Serve the shard with io_uring if it was asked for and the kernel supports it.
  */
-static int getClient(void) {
-  return accept(server.fd, NULL, NULL);
+static void *serverShardJob(void *arg) {
+  Shard *shard = (Shard*) arg;
+
+  serverPinThread(server.shardCpus, "shard", shard->id);
+  if (shard->engine == IO_ENGINE_URING) {
+    if (ringEngineCreate(shard)) {
+      serverLog(LOG_LEVEL_INFO, "Shard %u using the io_uring engine\n", shard->id);
+      ringServe(shard);
+      ringEngineFree(shard);
+    }
+    serverLog(LOG_LEVEL_WARNING, "io_uring is not supported, shard %u falling back to epoll\n", shard->id);
+  }
+
+  shard->engine = IO_ENGINE_EPOLL;
+  epollServe(shard);
+  return NULL;
 }
 
 /*
@@ -739,29 +2389,45 @@ static int getClient(void) {
  * @param port: The port to run the server on.
  * @param verbosity: The level of output to the log.
  * @param logFile: The file descriptor to output activity to.
- * @param maxClients: The maximum concurrent clients.
+ * @param workers: The number of worker threads to run requests on.
+ * @param maxConnections: The maximum number of clients connected at once; more are turned away.
+ * @param backlog: The length of each listener's queue of connections not yet accepted.
+ * @param engine: How to accept, read from and write to clients.
+ * @param shards: The number of listeners, each with its own socket and loop thread (0 for one per core).
  */
-void serverStart(unsigned int port, LogLevel verbosity, char *logFile, unsigned int maxClients) {
-  int client;
-  serverCreate(port, verbosity, logFile, maxClients);
+void serverStart(unsigned int port, LogLevel verbosity, char *logFile, unsigned int workers,
+                 unsigned int maxConnections, unsigned int backlog, IoEngine engine, unsigned int shards) {
+  serverCreate(port, verbosity, logFile, workers, maxConnections);
+  server.backlog = backlog;
+
+  /* Open the listeners. */
+  server.numShards = shards > 0 ? shards : sysconf(_SC_NPROCESSORS_ONLN);
+  server.shards = mmalloc(sizeof(Shard) * server.numShards);
+  for (int i = 0; i < server.numShards; i++) {
+    shardCreate(&server.shards[i], i);
+    server.shards[i].engine = engine;
+  }
+  serverLog(LOG_LEVEL_DEBUG, "Listener shards: %u\n", server.numShards);
+
+  /* Serve metrics on their own port, if asked to. */
+  if (server.metricsPort > 0)
+    serverMetricsStart();
 
-  /* Create threading system. */
-  Thread threads[server.maxClients];
-  for (int i = 0; i < server.maxClients; i++)
-    threadCreate(&threads[i], serverThreadJob);
+  /* Create the worker pool. */
+  serverPlaceThreads();
+  Thread threads[server.workers];
+  for (int i = 0; i < server.workers; i++)
+    threadCreate(&threads[i], serverThreadJob, (void*) (uintptr_t) i);
 
-  /* Catch interrupts for cleanup. */
+  /* Catch interrupts for cleanup, and report clients that hung up as write errors. */
   signal(SIGINT, interruptHandler);
+  signal(SIGPIPE, SIG_IGN);
 
-  /* Accept requests in a loop. */
-  while (true) {
-    if ((client = getClient()) < 0) {
-      serverLog(LOG_LEVEL_ERROR, "Error accepting client.\n");
-      continue;
-    }
-    serverLog(LOG_LEVEL_DEBUG, "Client connected: %d\n", client);
-    workQueuePush(clientCreate(client));
-  }
+  /* Run every shard's loop on its own thread. */
+  for (int i = 0; i < server.numShards; i++)
+    threadCreate(&server.shards[i].thread, &serverShardJob, &server.shards[i]);
+  for (int i = 0; i < server.numShards; i++)
+    threadJoin(server.shards[i].thread);
 
   serverFree();
 }
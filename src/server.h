@@ -18,8 +18,19 @@ typedef enum LogLevel {
   LOG_LEVEL_DEBUG
 } LogLevel;
 
-void serverCreate(unsigned int port, LogLevel verbosity, char *logFile, unsigned int maxClients);
-void serverStart(unsigned int port, LogLevel verbosity, char *logFile, unsigned int maxClients);
+typedef enum IoEngine {
+  IO_ENGINE_EPOLL,
+  IO_ENGINE_URING
+} IoEngine;
+
+void serverCreate(unsigned int port, LogLevel verbosity, char *logFile, unsigned int workers,
+                  unsigned int maxConnections);
+void serverStart(unsigned int port, LogLevel verbosity, char *logFile, unsigned int workers,
+                 unsigned int maxConnections, unsigned int backlog, IoEngine engine, unsigned int shards);
+void serverSetTimeouts(unsigned int idle, unsigned int session, unsigned int command);
+void serverSetSlowlog(unsigned int threshold);
+void serverSetMetricsPort(unsigned int port);
+bool serverSetAffinity(const char *workers, const char *shards);
 char *serverRunCommand(char *command);
 void serverFree(void);
 
@@ -0,0 +1,173 @@
+#include "mmalloc.h"
+#include "slowlog.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+
+#define TRUNCATED             "..."
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+struct Slowlog {
+  SlowlogEntry *entries;                      /* The ring of entries. */
+  unsigned int size;                          /* The number of entries the ring holds. */
+  unsigned int length;                        /* The number of entries recorded, up to the size. */
+  unsigned int next;                          /* Where the next entry goes. */
+  unsigned long ids;                          /* The id of the most recent entry. */
+  pthread_mutex_t mutex;                      /* Lock to access the ring. */
+};
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Create a new, empty slowlog.
+ *
+ * @param size: The number of entries to keep.
+ * @return The newly created slowlog.
+ */
+Slowlog *slowlogCreate(unsigned int size) {
+  assert(size > 0);
+
+  Slowlog *slowlog = mcalloc(sizeof(Slowlog));
+  slowlog->entries = mcalloc(size * sizeof(SlowlogEntry));
+  slowlog->size = size;
+  pthread_mutex_init(&slowlog->mutex, NULL);
+  return slowlog;
+}
+
+/*
+ * Free an existing slowlog.
+ *
+ * @param slowlog: The slowlog to free.
+ */
+void slowlogFree(Slowlog *slowlog) {
+  assert(slowlog != NULL);
+  pthread_mutex_destroy(&slowlog->mutex);
+  mfree(slowlog->entries);
+  mfree(slowlog);
+}
+
+
+/**********************************************************************
+ *                        Slowlog information.
+ **********************************************************************/
+
+/*
+ * @param slowlog: The slowlog to examine.
+ * @return The number of entries in the slowlog.
+ */
+unsigned int slowlogLength(Slowlog *slowlog) {
+  assert(slowlog != NULL);
+
+  unsigned int length;
+
+  pthread_mutex_lock(&slowlog->mutex);
+  length = slowlog->length;
+  pthread_mutex_unlock(&slowlog->mutex);
+
+  return length;
+}
+
+/*
+ * Copy out an entry of the slowlog.
+ *
+ * @param slowlog: The slowlog to read.
+ * @param index: Which entry, from 0 for the most recent.
+ * @param entry: Filled with the entry.
+ * @return Whether there is an entry at that index.
+ */
+bool slowlogGet(Slowlog *slowlog, unsigned int index, SlowlogEntry *entry) {
+  assert(slowlog != NULL);
+  assert(entry != NULL);
+
+  bool found;
+
+  pthread_mutex_lock(&slowlog->mutex);
+  if ((found = index < slowlog->length))
+    *entry = slowlog->entries[(slowlog->next + slowlog->size - 1 - index) % slowlog->size];
+  pthread_mutex_unlock(&slowlog->mutex);
+
+  return found;
+}
+
+
+/**********************************************************************
+ *                          Slowlog methods.
+ **********************************************************************/
+
+/*
+ * Copy an argument into an entry, truncated to fit, with every byte that is not
+ * printable ASCII replaced, so that the entry prints on one line.
+ *
+ * @param dest: Where to copy the argument.
+ * @param arg: The argument.
+ */
+static void copyArg(char *dest, Arg arg) {
+  size_t length = arg.length;
+
+  if (length >= SLOWLOG_ARG_SIZE)
+    length = SLOWLOG_ARG_SIZE - sizeof(TRUNCATED);
+
+  for (size_t i = 0; i < length; i++)
+    dest[i] = arg.data[i] >= ' ' && arg.data[i] < 0x7f ? arg.data[i] : '?';
+  if (length < arg.length)
+    strcpy(dest + length, TRUNCATED);
+  else
+    dest[length] = '\0';
+}
+
+/*
+ * Record a slow command, over the oldest entry once the slowlog is full.
+ *
+ * @param slowlog: The slowlog to record into.
+ * @param command: The name of the command; it must outlive the slowlog.
+ * @param argc: The number of arguments; only the first SLOWLOG_MAX_ARGS are kept.
+ * @param argv: The arguments.
+ * @param duration: How long the command took, in microseconds.
+ * @param fd: The client that sent the command, or -1.
+ */
+void slowlogRecord(Slowlog *slowlog, const char *command, unsigned int argc, const Arg *argv,
+                   uint64_t duration, int fd) {
+  assert(slowlog != NULL);
+  assert(command != NULL);
+
+  SlowlogEntry *entry;
+
+  pthread_mutex_lock(&slowlog->mutex);
+  entry = &slowlog->entries[slowlog->next];
+  slowlog->next = (slowlog->next + 1) % slowlog->size;
+  if (slowlog->length < slowlog->size)
+    slowlog->length++;
+
+  entry->id = ++slowlog->ids;
+  entry->time = time(NULL);
+  entry->duration = duration;
+  entry->command = command;
+  entry->argc = argc < SLOWLOG_MAX_ARGS ? argc : SLOWLOG_MAX_ARGS;
+  for (unsigned int i = 0; i < entry->argc; i++)
+    copyArg(entry->argv[i], argv[i]);
+  entry->fd = fd;
+  pthread_mutex_unlock(&slowlog->mutex);
+}
+
+/*
+ * Forget every entry. Ids keep increasing.
+ *
+ * @param slowlog: The slowlog to empty.
+ */
+void slowlogReset(Slowlog *slowlog) {
+  assert(slowlog != NULL);
+
+  pthread_mutex_lock(&slowlog->mutex);
+  slowlog->length = 0;
+  slowlog->next = 0;
+  pthread_mutex_unlock(&slowlog->mutex);
+}
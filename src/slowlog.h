@@ -0,0 +1,47 @@
+#ifndef __SLOWLOG_H__
+#define __SLOWLOG_H__
+
+#include "protocol.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+
+#define SLOWLOG_MAX_ARGS      3
+#define SLOWLOG_ARG_SIZE      64
+
+/*
+ * A fixed-size log of the most recent slow commands.
+ *
+ * Deciding whether a command was slow is left to the caller, so a command that
+ * was not costs nothing here. A slow command is copied into the oldest entry of
+ * the ring, with its arguments truncated, so recording never allocates.
+ */
+
+typedef struct Slowlog Slowlog;
+
+typedef struct SlowlogEntry {
+  unsigned long id;                           /* Increases with every entry recorded. */
+  time_t time;                                /* When the command ran. */
+  uint64_t duration;                          /* How long the command took, in microseconds. */
+  const char *command;                        /* The name of the command. */
+  unsigned int argc;                          /* The number of arguments kept. */
+  char argv[SLOWLOG_MAX_ARGS][SLOWLOG_ARG_SIZE];  /* The arguments, truncated and made printable. */
+  int fd;                                     /* The client that sent the command, or -1. */
+} SlowlogEntry;
+
+/* Memory management. */
+Slowlog *slowlogCreate(unsigned int size);
+void slowlogFree(Slowlog *slowlog);
+
+/* Slowlog information. */
+unsigned int slowlogLength(Slowlog *slowlog);
+bool slowlogGet(Slowlog *slowlog, unsigned int index, SlowlogEntry *entry);
+
+/* Slowlog methods. */
+void slowlogRecord(Slowlog *slowlog, const char *command, unsigned int argc, const Arg *argv,
+                   uint64_t duration, int fd);
+void slowlogReset(Slowlog *slowlog);
+
+#endif
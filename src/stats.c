@@ -0,0 +1,273 @@
+#include "histogram.h"
+#include "mmalloc.h"
+#include "stats.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+
+#define CACHE_LINE            64
+
+#define loadRelaxed(p)        (__atomic_load_n(p, __ATOMIC_RELAXED))
+#define loadAcquire(p)        (__atomic_load_n(p, __ATOMIC_ACQUIRE))
+#define storeRelaxed(p,v)     (__atomic_store_n(p, v, __ATOMIC_RELAXED))
+#define storeRelease(p,v)     (__atomic_store_n(p, v, __ATOMIC_RELEASE))
+#define fetchAdd(p,v)         (__atomic_fetch_add(p, v, __ATOMIC_RELAXED))
+
+/* Only the owning thread writes a counter, so a plain load and store is enough. */
+#define counterAdd(p,v)       (storeRelaxed(p, loadRelaxed(p) + (v)))
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+/*
+ * What one thread counted about a command.
+ */
+typedef struct StatsCommand {
+  CommandStats counters;                      /* The calls, time and failures. */
+  Histogram *latency;                         /* The time of each call, created on the first one. */
+} StatsCommand;
+
+/*
+ * The counters of one thread. The command counters follow the struct, and are
+ * followed by another cache line of padding, so that no other allocation shares
+ * a cache line with them.
+ */
+typedef struct StatsBlock {
+  pthread_t owner;                            /* The thread that counts into the block. */
+  struct StatsBlock *next;                    /* The next block of the same statistics. */
+  char pad1[CACHE_LINE];
+  uint64_t bytesIn;                           /* The number of bytes read from clients. */
+  uint64_t bytesOut;                          /* The number of bytes written to clients. */
+  StatsCommand commands[];                    /* The counters of each command. */
+} StatsBlock;
+
+struct Stats {
+  unsigned long id;                           /* Tells statistics apart in each thread's cached block. */
+  unsigned int commands;                      /* The number of commands counted. */
+  StatsBlock *blocks;                         /* Every thread's block, newest first. */
+  pthread_mutex_t mutex;                      /* Lock to add a block. */
+};
+
+static unsigned long statsIds;                /* The id of the most recent statistics. */
+static __thread unsigned long localStats;     /* The statistics the calling thread last counted into. */
+static __thread StatsBlock *localBlock;       /* The calling thread's block in those statistics. */
+
+
+/**********************************************************************
+ *                           Thread blocks.
+ **********************************************************************/
+
+/*
+ * Find the calling thread's block, creating it the first time the thread counts.
+ * Only this slow path takes the lock; afterwards the block is cached in the thread.
+ *
+ * @param stats: The statistics being counted into.
+ * @return The calling thread's block.
+ */
+static StatsBlock *statsBlock(Stats *stats) {
+  pthread_t self = pthread_self();
+  StatsBlock *block;
+
+  if (localStats == stats->id)
+    return localBlock;
+
+  pthread_mutex_lock(&stats->mutex);
+  for (block = stats->blocks; block != NULL && !pthread_equal(block->owner, self); block = block->next);
+
+  if (block == NULL) {
+    block = mcalloc(sizeof(StatsBlock) + stats->commands * sizeof(StatsCommand) + CACHE_LINE);
+    block->owner = self;
+    block->next = stats->blocks;
+    storeRelease(&stats->blocks, block);
+  }
+  pthread_mutex_unlock(&stats->mutex);
+
+  localStats = stats->id;
+  localBlock = block;
+  return block;
+}
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Create new statistics, with every counter at zero.
+ *
+ * @param commands: The number of commands to count.
+ * @return The newly created statistics.
+ */
+Stats *statsCreate(unsigned int commands) {
+  Stats *stats = mmalloc(sizeof(Stats));
+  stats->id = fetchAdd(&statsIds, 1) + 1;
+  stats->commands = commands;
+  stats->blocks = NULL;
+  pthread_mutex_init(&stats->mutex, NULL);
+  return stats;
+}
+
+/*
+ * Free existing statistics. No thread may be counting into them.
+ *
+ * @param stats: The statistics to free.
+ */
+void statsFree(Stats *stats) {
+  assert(stats != NULL);
+
+  StatsBlock *block, *next;
+
+  for (block = stats->blocks; block != NULL; block = next) {
+    next = block->next;
+    for (unsigned int i = 0; i < stats->commands; i++)
+      if (block->commands[i].latency != NULL)
+        histogramFree(block->commands[i].latency);
+    mfree(block);
+  }
+  pthread_mutex_destroy(&stats->mutex);
+  mfree(stats);
+}
+
+
+/**********************************************************************
+ *                      Statistics information.
+ **********************************************************************/
+
+/*
+ * Add up the counters of a command across every thread.
+ *
+ * @param stats: The statistics to read.
+ * @param command: The index of the command.
+ * @param total: Filled with the totals.
+ */
+void statsCommand(Stats *stats, unsigned int command, CommandStats *total) {
+  assert(stats != NULL);
+  assert(command < stats->commands);
+  assert(total != NULL);
+
+  memset(total, 0, sizeof(CommandStats));
+  for (StatsBlock *block = loadAcquire(&stats->blocks); block != NULL; block = block->next) {
+    total->calls += loadRelaxed(&block->commands[command].counters.calls);
+    total->usec += loadRelaxed(&block->commands[command].counters.usec);
+    total->errors += loadRelaxed(&block->commands[command].counters.errors);
+  }
+}
+
+/*
+ * Merge the latency of a command across every thread.
+ * Each thread's histogram is read while it may be recording, so the merged one is
+ * a close snapshot rather than an exact one.
+ *
+ * @param stats: The statistics to read.
+ * @param command: The index of the command.
+ * @param latency: The histogram to add the command's latency to, in microseconds.
+ */
+void statsLatency(Stats *stats, unsigned int command, Histogram *latency) {
+  assert(stats != NULL);
+  assert(command < stats->commands);
+  assert(latency != NULL);
+
+  Histogram *local;
+
+  for (StatsBlock *block = loadAcquire(&stats->blocks); block != NULL; block = block->next)
+    if ((local = loadAcquire(&block->commands[command].latency)) != NULL)
+      histogramMerge(latency, local);
+}
+
+/*
+ * @param stats: The statistics to read.
+ * @return The number of commands run, across every command and thread.
+ */
+uint64_t statsCalls(Stats *stats) {
+  assert(stats != NULL);
+
+  uint64_t calls = 0;
+
+  for (StatsBlock *block = loadAcquire(&stats->blocks); block != NULL; block = block->next)
+    for (unsigned int i = 0; i < stats->commands; i++)
+      calls += loadRelaxed(&block->commands[i].counters.calls);
+  return calls;
+}
+
+/*
+ * @param stats: The statistics to read.
+ * @return The number of bytes read from clients, across every thread.
+ */
+uint64_t statsBytesIn(Stats *stats) {
+  assert(stats != NULL);
+
+  uint64_t bytes = 0;
+
+  for (StatsBlock *block = loadAcquire(&stats->blocks); block != NULL; block = block->next)
+    bytes += loadRelaxed(&block->bytesIn);
+  return bytes;
+}
+
+/*
+ * @param stats: The statistics to read.
+ * @return The number of bytes written to clients, across every thread.
+ */
+uint64_t statsBytesOut(Stats *stats) {
+  assert(stats != NULL);
+
+  uint64_t bytes = 0;
+
+  for (StatsBlock *block = loadAcquire(&stats->blocks); block != NULL; block = block->next)
+    bytes += loadRelaxed(&block->bytesOut);
+  return bytes;
+}
+
+
+/**********************************************************************
+ *                        Statistics methods.
+ **********************************************************************/
+
+/*
+ * Count a run of a command on the calling thread, and record how long it took.
+ *
+ * @param stats: The statistics to count into.
+ * @param command: The index of the command.
+ * @param usec: How long the command took, in microseconds.
+ * @param error: Whether the command failed.
+ */
+void statsRecordCommand(Stats *stats, unsigned int command, uint64_t usec, bool error) {
+  assert(stats != NULL);
+  assert(command < stats->commands);
+
+  StatsCommand *local = &statsBlock(stats)->commands[command];
+
+  counterAdd(&local->counters.calls, 1);
+  counterAdd(&local->counters.usec, usec);
+  if (error)
+    counterAdd(&local->counters.errors, 1);
+
+  if (local->latency == NULL)
+    storeRelease(&local->latency, histogramCreate());
+  histogramRecord(local->latency, usec);
+}
+
+/*
+ * Count bytes read from a client on the calling thread.
+ *
+ * @param stats: The statistics to count into.
+ * @param bytes: The number of bytes read.
+ */
+void statsRecordBytesIn(Stats *stats, size_t bytes) {
+  assert(stats != NULL);
+  counterAdd(&statsBlock(stats)->bytesIn, bytes);
+}
+
+/*
+ * Count bytes written to a client on the calling thread.
+ *
+ * @param stats: The statistics to count into.
+ * @param bytes: The number of bytes written.
+ */
+void statsRecordBytesOut(Stats *stats, size_t bytes) {
+  assert(stats != NULL);
+  counterAdd(&statsBlock(stats)->bytesOut, bytes);
+}
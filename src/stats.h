@@ -0,0 +1,45 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "histogram.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * Server statistics, counted per thread.
+ *
+ * Every thread that counts gets its own block of counters, padded onto its own
+ * cache lines, which only that thread writes: counting takes no lock and no
+ * atomic read-modify-write. Readers add up every thread's block, so a total is
+ * a snapshot of counters that may be moving. The latency of each command is kept
+ * the same way, in a histogram per thread that readers merge.
+ */
+
+typedef struct Stats Stats;
+
+typedef struct CommandStats {
+  uint64_t calls;                             /* The number of times the command ran. */
+  uint64_t usec;                              /* The total time spent running it, in microseconds. */
+  uint64_t errors;                            /* The number of times it failed. */
+} CommandStats;
+
+/* Memory management. */
+Stats *statsCreate(unsigned int commands);
+void statsFree(Stats *stats);
+
+/* Statistics information. */
+void statsCommand(Stats *stats, unsigned int command, CommandStats *total);
+void statsLatency(Stats *stats, unsigned int command, Histogram *latency);
+uint64_t statsCalls(Stats *stats);
+uint64_t statsBytesIn(Stats *stats);
+uint64_t statsBytesOut(Stats *stats);
+
+/* Statistics methods. */
+void statsRecordCommand(Stats *stats, unsigned int command, uint64_t usec, bool error);
+void statsRecordBytesIn(Stats *stats, size_t bytes);
+void statsRecordBytesOut(Stats *stats, size_t bytes);
+
+#endif
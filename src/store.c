@@ -0,0 +1,410 @@
+#include "doc.h"
+#include "epoch.h"
+#include "mmalloc.h"
+#include "store.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+
+#define CACHE_LINE            64
+#define STORE_BUCKETS         16
+#define STORE_LOAD_FACTOR     0.75
+
+#define loadRelaxed(p)        (__atomic_load_n(p, __ATOMIC_RELAXED))
+#define loadAcquire(p)        (__atomic_load_n(p, __ATOMIC_ACQUIRE))
+#define storeRelaxed(p,v)     (__atomic_store_n(p, v, __ATOMIC_RELAXED))
+#define storeRelease(p,v)     (__atomic_store_n(p, v, __ATOMIC_RELEASE))
+
+#define mutexLock(x)          (pthread_mutex_lock(x))
+#define mutexUnlock(x)        (pthread_mutex_unlock(x))
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+/*
+ * A document in a bucket's chain, with a copy of its key.
+ */
+typedef struct StoreEntry {
+  struct StoreEntry *next;                    /* The next entry in the same bucket. */
+  uint64_t hash;                              /* The hash of the key. */
+  Document *doc;                              /* The document, which the store holds a reference to. */
+  char key[];                                 /* The key of the document. */
+} StoreEntry;
+
+/*
+ * The buckets of a shard. A shard that fills up gets a new table twice the size,
+ * with copies of the entries, rather than relinking entries readers may be on.
+ */
+typedef struct StoreTable {
+  unsigned int numBuckets;                    /* The number of buckets, a power of two. */
+  StoreEntry *buckets[];                      /* The chains of entries, by hash. */
+} StoreTable;
+
+/*
+ * One shard of the store. Writers take the shard's lock, and publish every change
+ * with a single release store: a new entry once it is filled in, a link past an
+ * entry they remove, a new document or a new table. Readers take no lock, and what
+ * they may still be looking at is retired into the epoch rather than freed. Each
+ * shard sits on its own cache lines, so writers to different shards do not slow
+ * each other down.
+ */
+typedef struct StoreShard {
+  pthread_mutex_t mutex;                      /* Lock to change the shard. */
+  StoreTable *table;                          /* The buckets. */
+  unsigned int size;                          /* The number of documents in the shard. */
+} __attribute__((aligned(CACHE_LINE))) StoreShard;
+
+struct Store {
+  Epoch *epoch;                               /* Where removed entries and replaced tables wait for readers. */
+  StoreShard *shards;                         /* The shards, by the top bits of the hash. */
+  unsigned int numShards;                     /* The number of shards, a power of two. */
+  unsigned int shift;                         /* How far to shift a hash to get its shard. */
+};
+
+
+/**********************************************************************
+ *                        Entries and tables.
+ **********************************************************************/
+
+/*
+ * @param key: The key of the document.
+ * @param hash: The hash of the key.
+ * @param doc: The document.
+ * @return A new entry, in no chain yet.
+ */
+static StoreEntry *entryCreate(const char *key, uint64_t hash, Document *doc) {
+  StoreEntry *entry = mmalloc(sizeof(StoreEntry) + strlen(key) + 1);
+  entry->next = NULL;
+  entry->hash = hash;
+  entry->doc = doc;
+  strcpy(entry->key, key);
+  return entry;
+}
+
+/*
+ * Free a removed entry, with the store's reference to its document.
+ *
+ * @param entry: The entry.
+ */
+static void entryFree(void *entry) {
+  documentFree(((StoreEntry*) entry)->doc);
+  mfree(entry);
+}
+
+/*
+ * @param numBuckets: The number of buckets, a power of two.
+ * @return A new table with every bucket empty.
+ */
+static StoreTable *tableCreate(unsigned int numBuckets) {
+  StoreTable *table = mcalloc(sizeof(StoreTable) + sizeof(StoreEntry*) * numBuckets);
+  table->numBuckets = numBuckets;
+  return table;
+}
+
+/*
+ * Free a table and its entries.
+ *
+ * @param table: The table.
+ * @param documents: Whether to release the store's references to the documents too,
+ *                   or leave them to the entries that replaced these.
+ */
+static void tableFreeEntries(StoreTable *table, bool documents) {
+  StoreEntry *entry, *next;
+
+  for (unsigned int i = 0; i < table->numBuckets; i++) {
+    for (entry = table->buckets[i]; entry != NULL; entry = next) {
+      next = entry->next;
+      if (documents)
+        documentFree(entry->doc);
+      mfree(entry);
+    }
+  }
+  mfree(table);
+}
+
+/*
+ * Free a table that was replaced by a larger one, whose entries now hold the documents.
+ *
+ * @param table: The table.
+ */
+static void tableFree(void *table) {
+  tableFreeEntries(table, false);
+}
+
+
+/**********************************************************************
+ *                               Hashing.
+ **********************************************************************/
+
+/*
+ * Hash a key (FNV-1a).
+ * Shards are picked by the top bits of the hash and buckets by the bottom ones,
+ * so the keys of a shard still spread over all of its buckets.
+ *
+ * @param key: The key to hash.
+ * @return The hash of the key.
+ */
+static uint64_t storeHash(const char *key) {
+  uint64_t hash = 14695981039346656037ULL;
+
+  for (; *key != '\0'; key++)
+    hash = (hash ^ (unsigned char) *key) * 1099511628211ULL;
+  return hash;
+}
+
+/*
+ * @param store: The store.
+ * @param hash: The hash of a key.
+ * @return The shard the key belongs to.
+ */
+static StoreShard *storeShard(Store *store, uint64_t hash) {
+  return &store->shards[store->shift < 64 ? hash >> store->shift : 0];
+}
+
+/*
+ * Find the link that points to the entry of a key in a shard, or that would.
+ *
+ * @param shard: The shard to search, which must be locked.
+ * @param hash: The hash of the key.
+ * @param key: The key.
+ * @return The link to the entry, which points to NULL if the key is not in the shard.
+ */
+static StoreEntry **shardFind(StoreShard *shard, uint64_t hash, const char *key) {
+  StoreEntry **link = &shard->table->buckets[hash & (shard->table->numBuckets - 1)];
+
+  while (*link != NULL && ((*link)->hash != hash || strcmp((*link)->key, key) != 0))
+    link = &(*link)->next;
+  return link;
+}
+
+/*
+ * Double the number of buckets of a shard, copying every entry into a new table.
+ *
+ * @param shard: The shard to grow, which must be locked.
+ * @return The table that was replaced, to retire once the shard is unlocked.
+ */
+static StoreTable *shardGrow(StoreShard *shard) {
+  StoreTable *old = shard->table, *table = tableCreate(old->numBuckets * 2);
+  StoreEntry *entry, *copy, **bucket;
+
+  for (unsigned int i = 0; i < old->numBuckets; i++) {
+    for (entry = old->buckets[i]; entry != NULL; entry = entry->next) {
+      copy = entryCreate(entry->key, entry->hash, entry->doc);
+      bucket = &table->buckets[entry->hash & (table->numBuckets - 1)];
+      copy->next = *bucket;
+      *bucket = copy;
+    }
+  }
+
+  storeRelease(&shard->table, table);
+  return old;
+}
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Create a new, empty store.
+ *
+ * @param shards: The number of shards, rounded up to a power of two.
+ * @param epoch: The epoch lookups are made in, which must outlive the store.
+ * @return The newly created store.
+ */
+Store *storeCreate(unsigned int shards, Epoch *epoch) {
+  assert(shards > 0);
+  assert(epoch != NULL);
+
+  Store *store = mmalloc(sizeof(Store));
+  store->epoch = epoch;
+  store->numShards = 1;
+  store->shift = 64;
+  while (store->numShards < shards) {
+    store->numShards *= 2;
+    store->shift--;
+  }
+
+  store->shards = mmalloc(sizeof(StoreShard) * store->numShards);
+  for (unsigned int i = 0; i < store->numShards; i++) {
+    pthread_mutex_init(&store->shards[i].mutex, NULL);
+    store->shards[i].table = tableCreate(STORE_BUCKETS);
+    store->shards[i].size = 0;
+  }
+
+  return store;
+}
+
+/*
+ * Free an existing store, releasing its reference to every document.
+ * What it retired is freed with its epoch.
+ *
+ * @param store: The store to free.
+ */
+void storeFree(Store *store) {
+  assert(store != NULL);
+
+  for (unsigned int i = 0; i < store->numShards; i++) {
+    tableFreeEntries(store->shards[i].table, true);
+    pthread_mutex_destroy(&store->shards[i].mutex);
+  }
+
+  mfree(store->shards);
+  mfree(store);
+}
+
+
+/**********************************************************************
+ *                         Store information.
+ **********************************************************************/
+
+/*
+ * @param store: The store to examine.
+ * @return The number of shards.
+ */
+unsigned int storeShards(const Store *store) {
+  assert(store != NULL);
+  return store->numShards;
+}
+
+/*
+ * Count the documents in the store. Shards are counted one after the other, so
+ * the total may be off by documents added or removed meanwhile.
+ *
+ * @param store: The store to examine.
+ * @return The number of documents.
+ */
+unsigned int storeSize(Store *store) {
+  assert(store != NULL);
+
+  unsigned int size = 0;
+
+  for (unsigned int i = 0; i < store->numShards; i++)
+    size += loadRelaxed(&store->shards[i].size);
+  return size;
+}
+
+
+/**********************************************************************
+ *                           Store methods.
+ **********************************************************************/
+
+/*
+ * Look up a document without taking a reference to it: no lock, no atomic
+ * read-modify-write. The calling thread must be online in the store's epoch, and
+ * the document is only valid until the thread's next quiescent state.
+ *
+ * @param store: The store to search.
+ * @param key: The key of the document.
+ * @return The document, or NULL if there is none.
+ */
+Document *storeLookup(Store *store, const char *key) {
+  assert(store != NULL);
+  assert(key != NULL);
+
+  uint64_t hash = storeHash(key);
+  StoreTable *table = loadAcquire(&storeShard(store, hash)->table);
+  StoreEntry *entry = loadAcquire(&table->buckets[hash & (table->numBuckets - 1)]);
+
+  for (; entry != NULL; entry = loadAcquire(&entry->next))
+    if (entry->hash == hash && strcmp(entry->key, key) == 0)
+      return loadAcquire(&entry->doc);
+  return NULL;
+}
+
+/*
+ * Look up a document, and take a reference to it. This takes the shard's lock, so
+ * the calling thread does not need to be online.
+ *
+ * @param store: The store to search.
+ * @param key: The key of the document.
+ * @return A new reference to the document, to release with `documentFree`, or NULL if there is none.
+ */
+Document *storeGet(Store *store, const char *key) {
+  assert(store != NULL);
+  assert(key != NULL);
+
+  uint64_t hash = storeHash(key);
+  StoreShard *shard = storeShard(store, hash);
+  StoreEntry *entry;
+  Document *doc = NULL;
+
+  mutexLock(&shard->mutex);
+  if ((entry = *shardFind(shard, hash, key)) != NULL)
+    doc = documentRetain(entry->doc);
+  mutexUnlock(&shard->mutex);
+
+  return doc;
+}
+
+/*
+ * Map a key to a document, replacing the document it mapped to, if any.
+ *
+ * @param store: The store to add to.
+ * @param key: The key of the document.
+ * @param doc: The document; the store takes over the caller's reference.
+ */
+void storeSet(Store *store, const char *key, Document *doc) {
+  assert(store != NULL);
+  assert(key != NULL);
+  assert(doc != NULL);
+
+  uint64_t hash = storeHash(key);
+  StoreShard *shard = storeShard(store, hash);
+  StoreEntry **link, *entry;
+  StoreTable *replacedTable = NULL;
+  Document *replaced = NULL;
+
+  mutexLock(&shard->mutex);
+  link = shardFind(shard, hash, key);
+  if ((entry = *link) != NULL) {
+    replaced = entry->doc;
+    storeRelease(&entry->doc, doc);
+  } else {
+    storeRelease(link, entryCreate(key, hash, doc));
+    storeRelaxed(&shard->size, shard->size + 1);
+    if (shard->size > shard->table->numBuckets * STORE_LOAD_FACTOR)
+      replacedTable = shardGrow(shard);
+  }
+  mutexUnlock(&shard->mutex);
+
+  /* Readers may still be looking at what was replaced. */
+  if (replaced != NULL)
+    epochRetire(store->epoch, replaced, &documentFree);
+  if (replacedTable != NULL)
+    epochRetire(store->epoch, replacedTable, &tableFree);
+}
+
+/*
+ * Remove a document from the store.
+ *
+ * @param store: The store to remove from.
+ * @param key: The key of the document.
+ * @return Whether there was a document with the key.
+ */
+bool storeRemove(Store *store, const char *key) {
+  assert(store != NULL);
+  assert(key != NULL);
+
+  uint64_t hash = storeHash(key);
+  StoreShard *shard = storeShard(store, hash);
+  StoreEntry **link, *entry;
+
+  mutexLock(&shard->mutex);
+  link = shardFind(shard, hash, key);
+  if ((entry = *link) != NULL) {
+    storeRelease(link, entry->next);
+    storeRelaxed(&shard->size, shard->size - 1);
+  }
+  mutexUnlock(&shard->mutex);
+
+  /* Readers may still be on the entry, or hold its document. */
+  if (entry != NULL)
+    epochRetire(store->epoch, entry, &entryFree);
+  return entry != NULL;
+}
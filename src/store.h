@@ -0,0 +1,40 @@
+#ifndef __STORE_H__
+#define __STORE_H__
+
+#include "doc.h"
+#include "epoch.h"
+
+#include <stdbool.h>
+
+
+/*
+ * A concurrent map of keys to documents.
+ *
+ * Keys are spread by hash over a power-of-two number of shards, each a hash table
+ * of its own with its own lock for writers, so writers to different shards never
+ * wait for each other. Readers take no lock at all: what a writer removes or
+ * replaces is retired into an epoch, and only freed once every reader moved on.
+ *
+ * The store holds a reference to each document it maps. `storeLookup` borrows the
+ * document for as long as the calling thread stays online in the epoch, while
+ * `storeGet` hands out a reference of its own, which stays valid for as long as the
+ * caller needs it, even if the document is removed or replaced meanwhile.
+ */
+
+typedef struct Store Store;
+
+/* Memory management. */
+Store *storeCreate(unsigned int shards, Epoch *epoch);
+void storeFree(Store *store);
+
+/* Store information. */
+unsigned int storeShards(const Store *store);
+unsigned int storeSize(Store *store);
+
+/* Store methods. */
+Document *storeLookup(Store *store, const char *key);
+Document *storeGet(Store *store, const char *key);
+void storeSet(Store *store, const char *key, Document *doc);
+bool storeRemove(Store *store, const char *key);
+
+#endif
@@ -0,0 +1,283 @@
+#include "mmalloc.h"
+#include "timer.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+
+#define LEVELS                4
+#define SLOT_BITS             6
+#define SLOTS                 (1 << SLOT_BITS)
+#define SLOT_MASK             (SLOTS - 1)
+#define MAX_DELTA             (((uint64_t) 1 << (LEVELS * SLOT_BITS)) - 1)
+
+#define levelSpan(l)          ((uint64_t) 1 << ((l) * SLOT_BITS))
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+/*
+ * Time is counted in ticks. Level 0 has a slot for each of the next SLOTS ticks,
+ * and each slot of level `l` spans SLOTS^l ticks. A timer goes in the lowest
+ * level whose range reaches it. Whenever the ticks wrap around a level, the
+ * next slot of the level above is emptied into the levels below, so a timer
+ * moves down at most LEVELS - 1 times before it fires.
+ *
+ * Each slot is a circular list with the slot itself as its sentinel.
+ */
+struct TimerWheel {
+  unsigned int tick;                          /* The length of a tick. */
+  uint64_t current;                           /* The last tick whose timers have run. */
+  unsigned int size;                          /* The number of timers in the wheel. */
+  Timer slots[LEVELS][SLOTS];                 /* The timers waiting in each slot. */
+  pthread_mutex_t mutex;                      /* Lock to access the wheel. */
+};
+
+
+/**********************************************************************
+ *                               Slots.
+ **********************************************************************/
+
+/*
+ * Take a timer out of its slot.
+ *
+ * @param timer: The timer, which must be in a slot.
+ */
+static void timerUnlink(Timer *timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = timer->prev = NULL;
+}
+
+/*
+ * Put a timer in the slot its expiry falls in.
+ * A timer that already expired goes in the next tick's slot, and one beyond the
+ * range of the wheel waits in the last level until it comes within range.
+ *
+ * @param wheel: The wheel to add to.
+ * @param timer: The timer, which must not be in a slot.
+ */
+static void wheelInsert(TimerWheel *wheel, Timer *timer) {
+  uint64_t expires = timer->expires > wheel->current ? timer->expires : wheel->current + 1;
+  uint64_t delta = expires - wheel->current;
+  unsigned int level = 0;
+  Timer *slot;
+
+  if (delta > MAX_DELTA)
+    expires = wheel->current + (delta = MAX_DELTA);
+  while (level < LEVELS - 1 && delta >= levelSpan(level + 1))
+    level++;
+
+  slot = &wheel->slots[level][(expires >> (level * SLOT_BITS)) & SLOT_MASK];
+  timer->next = slot;
+  timer->prev = slot->prev;
+  slot->prev->next = timer;
+  slot->prev = timer;
+}
+
+/*
+ * Move every timer in a slot of a higher level into the levels below.
+ *
+ * @param wheel: The wheel whose ticks wrapped around.
+ * @param level: The level to cascade from.
+ * @param index: The slot to empty.
+ */
+static void wheelCascade(TimerWheel *wheel, unsigned int level, unsigned int index) {
+  Timer *slot = &wheel->slots[level][index], *timer;
+
+  while ((timer = slot->next) != slot) {
+    timerUnlink(timer);
+    wheelInsert(wheel, timer);
+  }
+}
+
+/*
+ * @param wheel: The wheel.
+ * @param time: A time.
+ * @return The first tick at or after the time.
+ */
+static uint64_t wheelTicks(const TimerWheel *wheel, uint64_t time) {
+  return (time + wheel->tick - 1) / wheel->tick;
+}
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Create a new, empty wheel.
+ *
+ * @param now: The current time.
+ * @param tick: The resolution of the wheel, in the same unit as the time.
+ * @return The newly created wheel.
+ */
+TimerWheel *timerWheelCreate(uint64_t now, unsigned int tick) {
+  assert(tick > 0);
+
+  TimerWheel *wheel = mmalloc(sizeof(TimerWheel));
+  wheel->tick = tick;
+  wheel->current = now / tick;
+  wheel->size = 0;
+  pthread_mutex_init(&wheel->mutex, NULL);
+
+  for (int level = 0; level < LEVELS; level++)
+    for (int i = 0; i < SLOTS; i++)
+      wheel->slots[level][i].next = wheel->slots[level][i].prev = &wheel->slots[level][i];
+
+  return wheel;
+}
+
+/*
+ * Free an existing wheel. The timers still in it are only forgotten.
+ *
+ * @param wheel: The wheel to free.
+ */
+void timerWheelFree(TimerWheel *wheel) {
+  assert(wheel != NULL);
+  pthread_mutex_destroy(&wheel->mutex);
+  mfree(wheel);
+}
+
+/*
+ * Prepare a timer before its first use.
+ *
+ * @param timer: The timer.
+ * @param callback: What to run when the timer expires.
+ * @param data: Whatever the timer times, for the callback.
+ */
+void timerInit(Timer *timer, TimerCallback callback, void *data) {
+  assert(timer != NULL);
+  assert(callback != NULL);
+
+  timer->next = timer->prev = NULL;
+  timer->expires = 0;
+  timer->callback = callback;
+  timer->data = data;
+}
+
+
+/**********************************************************************
+ *                         Timer information.
+ **********************************************************************/
+
+/*
+ * @param wheel: The wheel to examine.
+ * @return The number of timers in the wheel.
+ */
+unsigned int timerWheelSize(TimerWheel *wheel) {
+  assert(wheel != NULL);
+
+  unsigned int size;
+
+  pthread_mutex_lock(&wheel->mutex);
+  size = wheel->size;
+  pthread_mutex_unlock(&wheel->mutex);
+
+  return size;
+}
+
+/*
+ * @param timer: The timer to examine.
+ * @return Whether the timer is waiting in a wheel.
+ */
+bool timerPending(const Timer *timer) {
+  assert(timer != NULL);
+  return timer->next != NULL;
+}
+
+
+/**********************************************************************
+ *                           Timer methods.
+ **********************************************************************/
+
+/*
+ * Start a timer, or move it if it is already running.
+ *
+ * @param wheel: The wheel to add to.
+ * @param timer: The timer.
+ * @param expires: When the timer should run; it runs on the first tick at or after it.
+ */
+void timerWheelAdd(TimerWheel *wheel, Timer *timer, uint64_t expires) {
+  assert(wheel != NULL);
+  assert(timer != NULL);
+
+  pthread_mutex_lock(&wheel->mutex);
+  if (timer->next != NULL)
+    timerUnlink(timer);
+  else
+    wheel->size++;
+  timer->expires = wheelTicks(wheel, expires);
+  wheelInsert(wheel, timer);
+  pthread_mutex_unlock(&wheel->mutex);
+}
+
+/*
+ * Stop a timer, if it is running.
+ * Once this returns, the timer's callback is not running and will not run.
+ *
+ * @param wheel: The wheel the timer was added to.
+ * @param timer: The timer.
+ */
+void timerWheelRemove(TimerWheel *wheel, Timer *timer) {
+  assert(wheel != NULL);
+  assert(timer != NULL);
+
+  pthread_mutex_lock(&wheel->mutex);
+  if (timer->next != NULL) {
+    timerUnlink(timer);
+    wheel->size--;
+  }
+  pthread_mutex_unlock(&wheel->mutex);
+}
+
+/*
+ * Run every timer that expired by the given time, tick by tick.
+ *
+ * @param wheel: The wheel to advance.
+ * @param now: The current time.
+ * @return The number of timers that ran.
+ */
+unsigned int timerWheelAdvance(TimerWheel *wheel, uint64_t now) {
+  assert(wheel != NULL);
+
+  uint64_t target = now / wheel->tick, next;
+  unsigned int ran = 0, level;
+  Timer *slot, *timer;
+
+  pthread_mutex_lock(&wheel->mutex);
+
+  if (wheel->size == 0 && target > wheel->current)
+    wheel->current = target;
+
+  while (wheel->current < target) {
+    wheel->current++;
+
+    for (level = 1; level < LEVELS && (wheel->current & (levelSpan(level) - 1)) == 0; level++)
+      wheelCascade(wheel, level, (wheel->current >> (level * SLOT_BITS)) & SLOT_MASK);
+
+    slot = &wheel->slots[0][wheel->current & SLOT_MASK];
+    while ((timer = slot->next) != slot) {
+      timerUnlink(timer);
+
+      /* A timer beyond the range of the wheel may still have a way to go. */
+      if (timer->expires > wheel->current) {
+        wheelInsert(wheel, timer);
+        continue;
+      }
+
+      wheel->size--;
+      ran++;
+      if ((next = timer->callback(timer, now)) != 0) {
+        timer->expires = wheelTicks(wheel, next);
+        wheelInsert(wheel, timer);
+        wheel->size++;
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&wheel->mutex);
+  return ran;
+}
@@ -0,0 +1,55 @@
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * A hierarchical timer wheel.
+ *
+ * Adding, moving and removing a timer take constant time, whatever the number
+ * of timers, and advancing the wheel only looks at the slots whose time came.
+ * Timers are embedded in whatever they time, so arming one never allocates.
+ *
+ * Every method takes the wheel's lock, so timers may be added and removed from
+ * any thread. Callbacks run on the thread advancing the wheel with the lock
+ * held: rather than calling back into the wheel, a callback returns when it
+ * should run next.
+ */
+
+typedef struct Timer Timer;
+typedef struct TimerWheel TimerWheel;
+
+/*
+ * Called once a timer expires.
+ *
+ * @param timer: The timer that expired, which is no longer in the wheel.
+ * @param now: The current time.
+ * @return When to run the timer again, or 0 to leave it stopped; only then may the callback free it.
+ */
+typedef uint64_t (*TimerCallback)(Timer *timer, uint64_t now);
+
+struct Timer {
+  Timer *next;                                /* The next timer in the same slot. */
+  Timer *prev;                                /* The previous timer in the same slot. */
+  uint64_t expires;                           /* The tick the timer expires at. */
+  TimerCallback callback;                     /* What to run when the timer expires. */
+  void *data;                                 /* Whatever the timer times. */
+};
+
+/* Memory management. */
+TimerWheel *timerWheelCreate(uint64_t now, unsigned int tick);
+void timerWheelFree(TimerWheel *wheel);
+void timerInit(Timer *timer, TimerCallback callback, void *data);
+
+/* Timer information. */
+unsigned int timerWheelSize(TimerWheel *wheel);
+bool timerPending(const Timer *timer);
+
+/* Timer methods. */
+void timerWheelAdd(TimerWheel *wheel, Timer *timer, uint64_t expires);
+void timerWheelRemove(TimerWheel *wheel, Timer *timer);
+unsigned int timerWheelAdvance(TimerWheel *wheel, uint64_t now);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+
+/*
+ * Static tracepoints on the request path.
+ *
+ * Built with `make trace`, every probe is a USDT probe: a single nop in the code,
+ * with its name and where to find its arguments recorded in a note of the binary.
+ * bpftrace, perf and systemtap attach to them on a running server, for instance
+ *
+ *   bpftrace -e 'usdt:./rtdoc:rtdoc:command__done { @[str(arg0)] = hist(arg2); }'
+ *
+ * In every other build the probes expand to nothing and their arguments are never
+ * evaluated, so they cost nothing.
+ *
+ * Probes, with their arguments:
+ *   client__accept          fd
+ *   request__parse__start   fd
+ *   request__parse__done    fd, length of the request, or 0 if incomplete, or -1 if invalid
+ *   command__start          command name, fd
+ *   command__done           command name, fd, duration in microseconds
+ *   json__parse__start      string
+ *   json__parse__done       parsed object, or NULL on error
+ *   json__stringify__start  object
+ *   json__stringify__done   object, length of the string
+ *   json__write__start      writer
+ *   json__write__done       writer, bytes written
+ *   doc__lock__wait         document mutex
+ *   doc__lock__acquire      document mutex
+ *   doc__lock__release      document mutex
+ *   reply__write            fd, bytes written
+ */
+
+#ifdef TRACE
+
+#if defined(__has_include) && !__has_include(<sys/sdt.h>)
+#error "Tracing needs <sys/sdt.h>, from the systemtap-sdt-dev(el) package."
+#endif
+
+#include <sys/sdt.h>
+
+#define trace1(name,a)              DTRACE_PROBE1(rtdoc, name, a)
+#define trace2(name,a,b)            DTRACE_PROBE2(rtdoc, name, a, b)
+#define trace3(name,a,b,c)          DTRACE_PROBE3(rtdoc, name, a, b, c)
+
+#else
+
+#define trace1(name,a)              do {} while (0)
+#define trace2(name,a,b)            do {} while (0)
+#define trace3(name,a,b,c)          do {} while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,424 @@
+#include "mmalloc.h"
+#include "uring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+#define loadAcquire(p)      (__atomic_load_n(p, __ATOMIC_ACQUIRE))
+#define storeRelease(p,v)   (__atomic_store_n(p, v, __ATOMIC_RELEASE))
+
+#define RING_PROBE_OPS      256
+
+
+/**********************************************************************
+ *                         Struct definitions.
+ **********************************************************************/
+
+/*
+ * The submission queue shared with the kernel.
+ */
+typedef struct SubmitQueue {
+  unsigned int *head;           /* Advanced by the kernel as it consumes entries. */
+  unsigned int *tail;           /* Advanced by us as we publish entries. */
+  unsigned int *mask;           /* Mask to turn a position into an index. */
+  unsigned int *array;          /* Indexes into the entry array. */
+  struct io_uring_sqe *entries; /* The submission entries. */
+  unsigned int pending;         /* Our private tail, published on submit. */
+  unsigned int capacity;        /* The number of submission entries. */
+} SubmitQueue;
+
+/*
+ * The completion queue shared with the kernel.
+ */
+typedef struct CompleteQueue {
+  unsigned int *head;           /* Advanced by us as we consume entries. */
+  unsigned int *tail;           /* Advanced by the kernel as it posts entries. */
+  unsigned int *mask;           /* Mask to turn a position into an index. */
+  struct io_uring_cqe *entries; /* The completion entries. */
+} CompleteQueue;
+
+/*
+ * An io_uring instance.
+ *
+ * Submitting is not thread safe: a ring should be driven by a single thread.
+ */
+struct Ring {
+  int fd;                       /* The io_uring file descriptor. */
+  void *ringMap;                /* The mapping holding both queue headers. */
+  size_t ringMapSize;           /* The size of the queue header mapping. */
+  void *entriesMap;             /* The mapping holding the submission entries. */
+  size_t entriesMapSize;        /* The size of the submission entry mapping. */
+  SubmitQueue sq;               /* The submission queue. */
+  CompleteQueue cq;             /* The completion queue. */
+};
+
+
+/**********************************************************************
+ *                         System calls.
+ **********************************************************************/
+
+static int ioUringSetup(unsigned int entries, struct io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int fd, unsigned int submit, unsigned int waitFor, unsigned int flags) {
+  return syscall(__NR_io_uring_enter, fd, submit, waitFor, flags, NULL, 0);
+}
+
+static int ioUringRegister(int fd, unsigned int opcode, void *arg, unsigned int nargs) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+
+/**********************************************************************
+ *                         Memory management.
+ **********************************************************************/
+
+/*
+ * Check that the kernel implements every operation the ring exposes.
+ *
+ * @param fd: The io_uring file descriptor.
+ * @return Whether all operations are supported.
+ */
+static bool ringProbe(int fd) {
+  const int required[] = {
+    IORING_OP_ACCEPT,
+    IORING_OP_RECV,
+    IORING_OP_SEND,
+    IORING_OP_SENDMSG,
+    IORING_OP_READ,
+    IORING_OP_PROVIDE_BUFFERS
+  };
+  size_t size = sizeof(struct io_uring_probe) + RING_PROBE_OPS * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = mcalloc(size);
+  bool supported = ioUringRegister(fd, IORING_REGISTER_PROBE, probe, RING_PROBE_OPS) == 0;
+
+  for (int i = 0; supported && i < sizeof(required) / sizeof(required[0]); i++)
+    supported = required[i] <= probe->last_op &&
+                (probe->ops[required[i]].flags & IO_URING_OP_SUPPORTED);
+
+  mfree(probe);
+  return supported;
+}
+
+/*
+ * Create a new ring.
+ *
+ * @param entries: The number of submission entries.
+ * @return The ring, or NULL if the kernel lacks io_uring or any operation we need.
+ */
+Ring *ringCreate(unsigned int entries) {
+  struct io_uring_params params;
+  Ring *ring;
+  int fd;
+
+  memset(&params, 0, sizeof(params));
+  if ((fd = ioUringSetup(entries, &params)) < 0)
+    return NULL;
+
+  /* Both queue headers live in one mapping, and we need the kernel to never drop completions. */
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_NODROP) ||
+      !ringProbe(fd)) {
+    close(fd);
+    return NULL;
+  }
+
+  ring = mcalloc(sizeof(Ring));
+  ring->fd = fd;
+
+  /* Map the queue headers. */
+  size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int),
+         cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->ringMapSize = sqSize > cqSize ? sqSize : cqSize;
+  ring->ringMap = mmap(NULL, ring->ringMapSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+  /* Map the submission entries. */
+  ring->entriesMapSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->entriesMap = mmap(NULL, ring->entriesMapSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+  if (ring->ringMap == MAP_FAILED || ring->entriesMap == MAP_FAILED) {
+    if (ring->ringMap != MAP_FAILED)
+      munmap(ring->ringMap, ring->ringMapSize);
+    if (ring->entriesMap != MAP_FAILED)
+      munmap(ring->entriesMap, ring->entriesMapSize);
+    close(fd);
+    mfree(ring);
+    return NULL;
+  }
+
+  char *map = ring->ringMap;
+  ring->sq.head = (unsigned int*) (map + params.sq_off.head);
+  ring->sq.tail = (unsigned int*) (map + params.sq_off.tail);
+  ring->sq.mask = (unsigned int*) (map + params.sq_off.ring_mask);
+  ring->sq.array = (unsigned int*) (map + params.sq_off.array);
+  ring->sq.entries = ring->entriesMap;
+  ring->sq.pending = *ring->sq.tail;
+  ring->sq.capacity = params.sq_entries;
+
+  ring->cq.head = (unsigned int*) (map + params.cq_off.head);
+  ring->cq.tail = (unsigned int*) (map + params.cq_off.tail);
+  ring->cq.mask = (unsigned int*) (map + params.cq_off.ring_mask);
+  ring->cq.entries = (struct io_uring_cqe*) (map + params.cq_off.cqes);
+
+  return ring;
+}
+
+/*
+ * Free an existing ring.
+ * Operations still in flight are cancelled by the kernel.
+ *
+ * @param ring: The ring to free.
+ */
+void ringFree(Ring *ring) {
+  assert(ring != NULL);
+  munmap(ring->entriesMap, ring->entriesMapSize);
+  munmap(ring->ringMap, ring->ringMapSize);
+  close(ring->fd);
+  mfree(ring);
+}
+
+
+/**********************************************************************
+ *                        Queueing operations.
+ **********************************************************************/
+
+/*
+ * Get the next free submission entry, submitting what is queued if the queue is full.
+ *
+ * @param ring: The ring to queue on.
+ * @param opcode: The operation the entry will hold.
+ * @param fd: The descriptor the operation targets.
+ * @param data: The value to return with the completion.
+ * @return The zeroed entry, or NULL if the queue is still full.
+ */
+static struct io_uring_sqe *ringNext(Ring *ring, int opcode, int fd, void *data) {
+  SubmitQueue *sq = &ring->sq;
+
+  if (sq->pending - loadAcquire(sq->head) >= sq->capacity) {
+    ringSubmit(ring, 0);
+    if (sq->pending - loadAcquire(sq->head) >= sq->capacity)
+      return NULL;
+  }
+
+  unsigned int index = sq->pending & *sq->mask;
+  struct io_uring_sqe *sqe = &sq->entries[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = (uint64_t) (uintptr_t) data;
+  sq->array[index] = index;
+  sq->pending++;
+
+  return sqe;
+}
+
+/*
+ * Accept connections on a listener until the operation is cancelled.
+ * Every connection posts its own completion with the new descriptor as the result.
+ *
+ * @param ring: The ring to queue on.
+ * @param fd: The listening socket.
+ * @param data: The value to return with each completion.
+ * @return Whether the operation was queued.
+ */
+bool ringAccept(Ring *ring, int fd, void *data) {
+  struct io_uring_sqe *sqe;
+
+  if ((sqe = ringNext(ring, IORING_OP_ACCEPT, fd, data)) == NULL)
+    return false;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  return true;
+}
+
+/*
+ * Receive from a socket into a buffer the kernel picks from a provided group.
+ *
+ * @param ring: The ring to queue on.
+ * @param fd: The socket to read.
+ * @param length: The most bytes to receive.
+ * @param group: The provided buffer group to receive into.
+ * @param data: The value to return with the completion.
+ * @return Whether the operation was queued.
+ */
+bool ringRecv(Ring *ring, int fd, unsigned int length, unsigned short group, void *data) {
+  struct io_uring_sqe *sqe;
+
+  if ((sqe = ringNext(ring, IORING_OP_RECV, fd, data)) == NULL)
+    return false;
+  sqe->len = length;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = group;
+  return true;
+}
+
+/*
+ * Send a buffer to a socket. The buffer must stay valid until the completion.
+ *
+ * @param ring: The ring to queue on.
+ * @param fd: The socket to write.
+ * @param buffer: The bytes to send.
+ * @param length: The number of bytes to send.
+ * @param data: The value to return with the completion.
+ * @return Whether the operation was queued.
+ */
+bool ringSend(Ring *ring, int fd, const void *buffer, unsigned int length, void *data) {
+  struct io_uring_sqe *sqe;
+
+  if ((sqe = ringNext(ring, IORING_OP_SEND, fd, data)) == NULL)
+    return false;
+  sqe->addr = (uint64_t) (uintptr_t) buffer;
+  sqe->len = length;
+  return true;
+}
+
+/*
+ * Send the buffers a message points to, as one write. The message and its buffers
+ * must stay valid until the completion.
+ *
+ * @param ring: The ring to queue on.
+ * @param fd: The socket to write.
+ * @param message: The message, with the buffers to send in its iovec array.
+ * @param data: The value to return with the completion.
+ * @return Whether the operation was queued.
+ */
+bool ringSendmsg(Ring *ring, int fd, const struct msghdr *message, void *data) {
+  struct io_uring_sqe *sqe;
+
+  if ((sqe = ringNext(ring, IORING_OP_SENDMSG, fd, data)) == NULL)
+    return false;
+  sqe->addr = (uint64_t) (uintptr_t) message;
+  sqe->len = 1;
+  return true;
+}
+
+/*
+ * Read from a descriptor into a buffer. The buffer must stay valid until the completion.
+ *
+ * @param ring: The ring to queue on.
+ * @param fd: The descriptor to read.
+ * @param buffer: The buffer to fill.
+ * @param length: The size of the buffer.
+ * @param data: The value to return with the completion.
+ * @return Whether the operation was queued.
+ */
+bool ringRead(Ring *ring, int fd, void *buffer, unsigned int length, void *data) {
+  struct io_uring_sqe *sqe;
+
+  if ((sqe = ringNext(ring, IORING_OP_READ, fd, data)) == NULL)
+    return false;
+  sqe->addr = (uint64_t) (uintptr_t) buffer;
+  sqe->len = length;
+  sqe->off = (uint64_t) -1;
+  return true;
+}
+
+/*
+ * Hand a run of equally sized buffers to the kernel for `ringRecv` to pick from.
+ * The completion carries no data and can be ignored.
+ *
+ * @param ring: The ring to queue on.
+ * @param buffers: The first buffer.
+ * @param length: The size of each buffer.
+ * @param count: The number of contiguous buffers.
+ * @param group: The group to add the buffers to.
+ * @param id: The id of the first buffer; the rest are numbered consecutively.
+ * @return Whether the operation was queued.
+ */
+bool ringProvideBuffers(Ring *ring, void *buffers, unsigned int length, unsigned int count,
+                        unsigned short group, unsigned short id) {
+  struct io_uring_sqe *sqe;
+
+  if ((sqe = ringNext(ring, IORING_OP_PROVIDE_BUFFERS, count, NULL)) == NULL)
+    return false;
+  sqe->addr = (uint64_t) (uintptr_t) buffers;
+  sqe->len = length;
+  sqe->off = id;
+  sqe->buf_group = group;
+  return true;
+}
+
+
+/**********************************************************************
+ *                  Submitting and completing operations.
+ **********************************************************************/
+
+/*
+ * Submit every queued operation with a single system call.
+ *
+ * @param ring: The ring to submit.
+ * @param waitFor: The number of completions to block for.
+ * @return The number of operations submitted, or -1 on error.
+ */
+int ringSubmit(Ring *ring, unsigned int waitFor) {
+  assert(ring != NULL);
+
+  unsigned int submit = ring->sq.pending - *ring->sq.tail;
+  int submitted;
+
+  storeRelease(ring->sq.tail, ring->sq.pending);
+
+  if (submit == 0 && waitFor == 0)
+    return 0;
+
+  do {
+    submitted = ioUringEnter(ring->fd, submit, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0);
+  } while (submitted < 0 && errno == EINTR);
+
+  return submitted;
+}
+
+/*
+ * Consume completed operations.
+ *
+ * @param ring: The ring to consume from.
+ * @param events: The array to fill.
+ * @param maxEvents: The size of the array.
+ * @return The number of events filled.
+ */
+unsigned int ringReap(Ring *ring, RingEvent *events, unsigned int maxEvents) {
+  assert(ring != NULL);
+  assert(events != NULL);
+
+  CompleteQueue *cq = &ring->cq;
+  unsigned int head = *cq->head, tail = loadAcquire(cq->tail), count = 0;
+  struct io_uring_cqe *cqe;
+
+  for (; head != tail && count < maxEvents; head++, count++) {
+    cqe = &cq->entries[head & *cq->mask];
+    events[count].data = (void*) (uintptr_t) cqe->user_data;
+    events[count].result = cqe->res;
+    events[count].flags = cqe->flags;
+  }
+
+  storeRelease(cq->head, head);
+  return count;
+}
+
+/*
+ * @param event: A completed operation.
+ * @return Whether a multishot operation will post further completions.
+ */
+bool ringEventMore(const RingEvent *event) {
+  return event->flags & IORING_CQE_F_MORE;
+}
+
+/*
+ * @param event: A completed receive.
+ * @return The id of the provided buffer the data landed in, or -1 if there is none.
+ */
+int ringEventBuffer(const RingEvent *event) {
+  if (!(event->flags & IORING_CQE_F_BUFFER))
+    return -1;
+  return event->flags >> IORING_CQE_BUFFER_SHIFT;
+}
@@ -0,0 +1,42 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stdbool.h>
+
+
+/*
+ * A minimal io_uring submission and completion queue pair.
+ */
+
+typedef struct Ring Ring;
+struct msghdr;
+
+/*
+ * A single completed operation.
+ */
+typedef struct RingEvent {
+  void *data;             /* The value the operation was submitted with. */
+  int result;             /* The result of the operation (negative errno on failure). */
+  unsigned int flags;     /* Completion flags, see `ringEventMore` and `ringEventBuffer`. */
+} RingEvent;
+
+/* Memory management. */
+Ring *ringCreate(unsigned int entries);
+void ringFree(Ring *ring);
+
+/* Queueing operations. */
+bool ringAccept(Ring *ring, int fd, void *data);
+bool ringRecv(Ring *ring, int fd, unsigned int length, unsigned short group, void *data);
+bool ringSend(Ring *ring, int fd, const void *buffer, unsigned int length, void *data);
+bool ringSendmsg(Ring *ring, int fd, const struct msghdr *message, void *data);
+bool ringRead(Ring *ring, int fd, void *buffer, unsigned int length, void *data);
+bool ringProvideBuffers(Ring *ring, void *buffers, unsigned int length, unsigned int count,
+                        unsigned short group, unsigned short id);
+
+/* Submitting and completing operations. */
+int ringSubmit(Ring *ring, unsigned int waitFor);
+unsigned int ringReap(Ring *ring, RingEvent *events, unsigned int maxEvents);
+bool ringEventMore(const RingEvent *event);
+int ringEventBuffer(const RingEvent *event);
+
+#endif
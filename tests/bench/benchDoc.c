@@ -0,0 +1,209 @@
+#include "../../src/doc.h"
+#include "../../src/epoch.h"
+#include "../../src/json.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+ * Contention benchmark for reading document contents.
+ *
+ * Threads read one shared document as gets do, measuring its serialized length,
+ * and now and then replace its contents. The same mix runs behind a plain mutex,
+ * behind a pthread rwlock, and on the document itself, whose readers take no lock
+ * and announce a quiescent state every batch of operations, as workers do. Usage:
+ *
+ *   build/bench/benchDoc [-o operations per thread] [-w percent writes] [-t max threads]
+ */
+
+#define BENCH_OPERATIONS    200000
+#define BENCH_WRITES        1
+#define BENCH_MAX_THREADS   64
+#define BENCH_BATCH         64
+
+#define BENCH_CONTENTS      "{\"title\":\"benchmark\",\"tags\":[\"a\",\"b\",\"c\"],\"views\":12345," \
+                            "\"body\":[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16],\"draft\":false}"
+
+typedef enum LockKind {
+  LOCK_MUTEX,
+  LOCK_RWLOCK,
+  LOCK_DOCUMENT,
+  NUM_LOCKS
+} LockKind;
+
+static const char *lockNames[NUM_LOCKS] = {"mutex", "rwlock", "document"};
+
+
+/********************************************************************************
+ *                                Benchmark.
+ *******************************************************************************/
+
+typedef struct Shared {
+  LockKind kind;
+  Document *doc;              /* The document, read lock-free. */
+  Epoch *epoch;               /* The epoch its readers are online in. */
+  Json *contents;             /* The same contents, under the mutex or the rwlock. */
+  pthread_mutex_t mutex;
+  pthread_rwlock_t rwlock;
+} Shared;
+
+typedef struct Run {
+  Shared *shared;
+  long operations;
+  int writes;
+  unsigned int seed;
+  long written;               /* The number of writes it made. */
+} Run;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t readShared(Shared *shared) {
+  size_t length;
+
+  switch (shared->kind) {
+    case LOCK_MUTEX:
+      pthread_mutex_lock(&shared->mutex);
+      length = jsonStringifyLength(shared->contents);
+      pthread_mutex_unlock(&shared->mutex);
+      break;
+    case LOCK_RWLOCK:
+      pthread_rwlock_rdlock(&shared->rwlock);
+      length = jsonStringifyLength(shared->contents);
+      pthread_rwlock_unlock(&shared->rwlock);
+      break;
+    default:
+      length = jsonStringifyLength(documentGetContents(shared->doc));
+      break;
+  }
+  return length;
+}
+
+static void writeShared(Shared *shared) {
+  char *err = NULL;
+  Json *contents = jsonParse(BENCH_CONTENTS, &err), *old;
+
+  switch (shared->kind) {
+    case LOCK_MUTEX:
+      pthread_mutex_lock(&shared->mutex);
+      old = shared->contents;
+      shared->contents = contents;
+      pthread_mutex_unlock(&shared->mutex);
+      break;
+    case LOCK_RWLOCK:
+      pthread_rwlock_wrlock(&shared->rwlock);
+      old = shared->contents;
+      shared->contents = contents;
+      pthread_rwlock_unlock(&shared->rwlock);
+      break;
+    default:
+      documentSetContents(shared->doc, contents, shared->epoch);
+      return;
+  }
+  jsonFree(old);
+}
+
+static void *mix(void *arg) {
+  Run *run = arg;
+  volatile size_t length = 0;
+
+  if (run->shared->kind == LOCK_DOCUMENT)
+    epochOnline(run->shared->epoch);
+
+  for (long i = 0; i < run->operations; i++) {
+    if (run->shared->kind == LOCK_DOCUMENT && i % BENCH_BATCH == 0)
+      epochQuiescent(run->shared->epoch);
+    if ((int) (rand_r(&run->seed) % 100) < run->writes) {
+      writeShared(run->shared);
+      run->written++;
+    } else {
+      length = readShared(run->shared);
+    }
+  }
+  (void) length;
+
+  if (run->shared->kind == LOCK_DOCUMENT)
+    epochOffline(run->shared->epoch);
+  return NULL;
+}
+
+/*
+ * Run the mix on a number of threads.
+ *
+ * @param kind: The lock to use.
+ * @param writes: The percentage of operations that replace the contents.
+ * @param writeRate: Set to the number of writes per second, across every thread.
+ * @return Millions of operations per second, across every thread.
+ */
+static double benchDoc(LockKind kind, int threads, long operations, int writes, double *writeRate) {
+  pthread_t ids[threads];
+  Run runs[threads];
+  Shared shared = { .kind = kind };
+  char *err = NULL;
+  double start, elapsed;
+  long written = 0;
+
+  shared.epoch = epochCreate();
+  shared.doc = documentCreate("doc", jsonParse(BENCH_CONTENTS, &err));
+  shared.contents = jsonParse(BENCH_CONTENTS, &err);
+  pthread_mutex_init(&shared.mutex, NULL);
+  pthread_rwlock_init(&shared.rwlock, NULL);
+
+  start = now();
+  for (int i = 0; i < threads; i++) {
+    runs[i] = (Run) { &shared, operations, writes, i + 1, 0 };
+    pthread_create(&ids[i], NULL, &mix, &runs[i]);
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(ids[i], NULL);
+    written += runs[i].written;
+  }
+  elapsed = now() - start;
+
+  documentFree(shared.doc);
+  epochFree(shared.epoch);
+  jsonFree(shared.contents);
+  pthread_mutex_destroy(&shared.mutex);
+  pthread_rwlock_destroy(&shared.rwlock);
+
+  *writeRate = written / elapsed;
+  return threads * operations / elapsed / 1e6;
+}
+
+int main(int argc, char **argv) {
+  long operations = BENCH_OPERATIONS;
+  int writes = BENCH_WRITES, maxThreads = BENCH_MAX_THREADS, opt;
+  double writeRate, rate;
+
+  while ((opt = getopt(argc, argv, "o:t:w:")) != -1) {
+    switch (opt) {
+      case 'o': operations = atol(optarg); break;
+      case 't': maxThreads = atoi(optarg); break;
+      case 'w': writes = atoi(optarg); break;
+    }
+  }
+
+  printf("%d%% writes, %ld operations per thread; total and write rates\n", writes, operations);
+  printf("%-8s", "threads");
+  for (int kind = 0; kind < NUM_LOCKS; kind++)
+    printf(" %26s", lockNames[kind]);
+  printf("\n");
+
+  for (int threads = 1; threads <= maxThreads; threads *= 2) {
+    printf("%-8d", threads);
+    for (int kind = 0; kind < NUM_LOCKS; kind++) {
+      rate = benchDoc(kind, threads, operations, writes, &writeRate);
+      printf(" %8.2f M/s %9.0f w/s", rate, writeRate);
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
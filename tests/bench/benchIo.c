@@ -0,0 +1,160 @@
+#include "../../src/server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+ * Compare the epoll and io_uring connection engines.
+ *
+ * Each engine is started in a child process, then many connections send small
+ * `ping` requests back to back for a fixed time, keeping `depth` requests
+ * pipelined on each connection. Usage:
+ *
+ *   build/bench/benchIo [-c connections] [-d depth] [-s seconds] [-n workers] [-p port]
+ */
+
+#define BENCH_PORT          9877
+#define BENCH_CONNECTIONS   256
+#define BENCH_DEPTH         1
+#define BENCH_SECONDS       5
+#define BENCH_WORKERS       4
+#define BENCH_REQUEST       "ping\n"
+#define BENCH_REPLY_LENGTH  5
+
+
+/*
+ * @return The current monotonic time in seconds.
+ */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Connect to the benchmarked server, retrying while it starts up.
+ *
+ * @param port: The port the server listens on.
+ * @return The connected socket.
+ */
+static int benchConnect(unsigned int port) {
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+  for (int attempt = 0; attempt < 100; attempt++) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0)
+      return fd;
+    close(fd);
+    usleep(10000);
+  }
+
+  fprintf(stderr, "Could not connect to the server.\n");
+  exit(1);
+}
+
+/*
+ * Keep every connection busy with `depth` requests in flight for the given time.
+ *
+ * @return The number of replies received.
+ */
+static long benchRun(unsigned int port, int connections, int depth, int seconds) {
+  int epfd = epoll_create1(0), fds[connections], received[connections];
+  struct epoll_event event, events[connections];
+  char buffer[BENCH_REPLY_LENGTH * 256];
+  long replies = 0;
+  double end;
+
+  for (int i = 0; i < connections; i++) {
+    fds[i] = benchConnect(port);
+    received[i] = 0;
+    event.events = EPOLLIN;
+    event.data.u32 = i;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &event);
+    for (int j = 0; j < depth; j++)
+      write(fds[i], BENCH_REQUEST, strlen(BENCH_REQUEST));
+  }
+
+  end = now() + seconds;
+  while (now() < end) {
+    int fired = epoll_wait(epfd, events, connections, 100);
+    for (int i = 0; i < fired; i++) {
+      int c = events[i].data.u32, n;
+      if ((n = read(fds[c], buffer, sizeof(buffer))) <= 0) {
+        fprintf(stderr, "Server closed connection %d.\n", c);
+        exit(1);
+      }
+      received[c] += n;
+      while (received[c] >= BENCH_REPLY_LENGTH) {
+        received[c] -= BENCH_REPLY_LENGTH;
+        replies++;
+        write(fds[c], BENCH_REQUEST, strlen(BENCH_REQUEST));
+      }
+    }
+  }
+
+  for (int i = 0; i < connections; i++)
+    close(fds[i]);
+  close(epfd);
+
+  return replies;
+}
+
+/*
+ * Benchmark a single engine in a child server process.
+ *
+ * @return The number of requests served per second.
+ */
+static double benchEngine(IoEngine engine, unsigned int port, int connections, int depth,
+                          int seconds, int workers) {
+  pid_t pid;
+  long replies;
+
+  if ((pid = fork()) == 0) {
+    serverStart(port, LOG_LEVEL_OFF, "", workers, connections, connections, engine, 1);
+    exit(0);
+  }
+
+  replies = benchRun(port, connections, depth, seconds);
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+
+  return (double) replies / seconds;
+}
+
+int main(int argc, char **argv) {
+  int connections = BENCH_CONNECTIONS, depth = BENCH_DEPTH, seconds = BENCH_SECONDS,
+      workers = BENCH_WORKERS;
+  unsigned int port = BENCH_PORT;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:d:n:p:s:")) != -1) {
+    switch (opt) {
+      case 'c': connections = atoi(optarg); break;
+      case 'd': depth = atoi(optarg); break;
+      case 'n': workers = atoi(optarg); break;
+      case 'p': port = atoi(optarg); break;
+      case 's': seconds = atoi(optarg); break;
+    }
+  }
+
+  printf("%d connections, %d pipelined, %d workers, %d seconds per engine\n", connections, depth,
+         workers, seconds);
+  printf("epoll:    %12.0f requests/sec\n",
+         benchEngine(IO_ENGINE_EPOLL, port, connections, depth, seconds, workers));
+  printf("io_uring: %12.0f requests/sec\n",
+         benchEngine(IO_ENGINE_URING, port + 1, connections, depth, seconds, workers));
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+
+#include "../../src/affinity.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+ * Benchmark of thread and memory placement across NUMA nodes.
+ *
+ * Every thread sweeps over a buffer of its own, as a worker does over the clients
+ * and documents it handles. Unpinned, the buffers are allocated by the main thread,
+ * as the server allocated every worker's memory before it could pin them, and the
+ * threads run wherever the kernel puts them. Pinned, each thread is pinned to the
+ * next CPU of the list and allocates its own buffer. The share of each thread's
+ * pages that sit on another node than the CPU it ran on is the share of its
+ * memory traffic that crosses sockets. Only the sweeps are timed. Usage:
+ *
+ *   build/bench/benchPlacement [-c CPU list] [-t threads] [-m MB per thread] [-r rounds]
+ */
+
+#define BENCH_CPUS          "all"
+#define BENCH_MEGABYTES     64
+#define BENCH_ROUNDS        8
+#define BENCH_PAGE          4096
+#define BENCH_LINE          64
+
+
+typedef struct Run {
+  bool pinned;
+  int cpu;
+  char *buffer;
+  size_t size;
+  int rounds;
+  pthread_barrier_t *ready;   /* Starts every sweep together, once the buffers are in place. */
+  double elapsed;             /* How long the sweep took. */
+  size_t pages;               /* The number of pages sampled. */
+  size_t remote;              /* The number of those on another node than the thread's CPU. */
+} Run;
+
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *sweep(void *arg) {
+  Run *run = arg;
+  double start;
+  int node;
+
+  if (run->pinned) {
+    affinityPin(run->cpu);
+    run->buffer = malloc(run->size);
+    memset(run->buffer, 0, run->size);
+  }
+  pthread_barrier_wait(run->ready);
+
+  /* Read and write every cache line, as updates to documents do. */
+  start = now();
+  for (int round = 0; round < run->rounds; round++)
+    for (size_t i = 0; i < run->size; i += BENCH_LINE)
+      run->buffer[i]++;
+  run->elapsed = now() - start;
+
+  node = affinityNode(sched_getcpu());
+  for (size_t i = 0; i < run->size; i += BENCH_PAGE) {
+    int page = affinityMemoryNode(run->buffer + i);
+    run->pages++;
+    run->remote += page >= 0 && page != node;
+  }
+
+  return NULL;
+}
+
+/*
+ * Sweep a buffer per thread.
+ *
+ * @param remote: Where to add the share of pages on another node, in percent.
+ * @return Gigabytes swept per second, across every thread.
+ */
+static double benchPlacement(bool pinned, CpuList *cpus, int threads, size_t size, int rounds,
+                             double *remote) {
+  pthread_t ids[threads];
+  Run runs[threads];
+  pthread_barrier_t ready;
+  size_t pages = 0, far = 0;
+  double elapsed = 0;
+
+  pthread_barrier_init(&ready, NULL, threads);
+  for (int i = 0; i < threads; i++) {
+    runs[i] = (Run) { .pinned = pinned, .cpu = cpuListGet(cpus, i), .size = size, .rounds = rounds,
+                      .ready = &ready };
+    if (!pinned) {
+      runs[i].buffer = malloc(size);
+      memset(runs[i].buffer, 0, size);
+    }
+  }
+
+  for (int i = 0; i < threads; i++)
+    pthread_create(&ids[i], NULL, &sweep, &runs[i]);
+  for (int i = 0; i < threads; i++)
+    pthread_join(ids[i], NULL);
+  pthread_barrier_destroy(&ready);
+
+  for (int i = 0; i < threads; i++) {
+    if (runs[i].elapsed > elapsed)
+      elapsed = runs[i].elapsed;
+    pages += runs[i].pages;
+    far += runs[i].remote;
+    free(runs[i].buffer);
+  }
+
+  *remote = pages > 0 ? 100.0 * far / pages : 0;
+  return (double) threads * size * rounds / elapsed / 1e9;
+}
+
+int main(int argc, char **argv) {
+  char *spec = BENCH_CPUS;
+  int threads = 0, megabytes = BENCH_MEGABYTES, rounds = BENCH_ROUNDS, opt;
+  double rate, remote;
+  CpuList *cpus;
+
+  while ((opt = getopt(argc, argv, "c:m:r:t:")) != -1) {
+    switch (opt) {
+      case 'c': spec = optarg; break;
+      case 'm': megabytes = atoi(optarg); break;
+      case 'r': rounds = atoi(optarg); break;
+      case 't': threads = atoi(optarg); break;
+    }
+  }
+
+  if ((cpus = cpuListParse(spec)) == NULL) {
+    fprintf(stderr, "Invalid CPU list %s\n", spec);
+    return 1;
+  }
+  if (threads <= 0)
+    threads = cpuListLength(cpus);
+
+  printf("%u NUMA node(s), %d threads, %d MB each\n", affinityNodes(), threads, megabytes);
+  printf("%-12s %12s %16s\n", "placement", "throughput", "remote pages");
+  rate = benchPlacement(false, cpus, threads, (size_t) megabytes << 20, rounds, &remote);
+  printf("%-12s %8.2f GB/s %15.1f%%\n", "unpinned", rate, remote);
+  rate = benchPlacement(true, cpus, threads, (size_t) megabytes << 20, rounds, &remote);
+  printf("%-12s %8.2f GB/s %15.1f%%\n", "pinned", rate, remote);
+
+  cpuListFree(cpus);
+  return 0;
+}
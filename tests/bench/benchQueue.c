@@ -0,0 +1,158 @@
+#include "../../src/list.h"
+#include "../../src/queue.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+ * Contention benchmark for the server's work queue.
+ *
+ * Compares the lock-free ring against the List + mutex + condition variable queue
+ * it replaced, with equal numbers of producer and consumer threads. Usage:
+ *
+ *   build/bench/benchQueue [-i items per producer] [-t max threads per side]
+ */
+
+#define BENCH_ITEMS         1000000
+#define BENCH_MAX_THREADS   8
+#define BENCH_CAPACITY      65536
+
+
+/********************************************************************************
+ *                         The List based queue it replaced.
+ *******************************************************************************/
+
+typedef struct ListQueue {
+  List *values;
+  pthread_mutex_t mutex;
+  pthread_cond_t cv;
+} ListQueue;
+
+static void borrowed(void *value) {
+}
+
+static ListQueue *listQueueCreate(void) {
+  ListQueue *queue = malloc(sizeof(ListQueue));
+  queue->values = listCreate(LIST_TYPE_LINKED, &borrowed);
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->cv, NULL);
+  return queue;
+}
+
+static void listQueueFree(ListQueue *queue) {
+  listFree(queue->values);
+  free(queue);
+}
+
+static void listQueuePush(ListQueue *queue, void *value) {
+  pthread_mutex_lock(&queue->mutex);
+  listAppend(queue->values, value);
+  pthread_cond_signal(&queue->cv);
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+static void *listQueuePop(ListQueue *queue) {
+  pthread_mutex_lock(&queue->mutex);
+  while (listLength(queue->values) == 0)
+    pthread_cond_wait(&queue->cv, &queue->mutex);
+  void *value = listGet(queue->values, 0);
+  listRemove(queue->values, 0);
+  pthread_mutex_unlock(&queue->mutex);
+  return value;
+}
+
+
+/********************************************************************************
+ *                                Benchmark.
+ *******************************************************************************/
+
+typedef struct Run {
+  bool lockFree;
+  void *queue;
+  long items;
+} Run;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *produce(void *arg) {
+  Run *run = arg;
+  for (long i = 1; i <= run->items; i++) {
+    if (run->lockFree)
+      while (!queuePush(run->queue, (void*) i))
+        sched_yield();
+    else
+      listQueuePush(run->queue, (void*) i);
+  }
+  return NULL;
+}
+
+static void *consume(void *arg) {
+  Run *run = arg;
+  for (long i = 0; i < run->items; i++) {
+    if (run->lockFree)
+      queuePopWait(run->queue);
+    else
+      listQueuePop(run->queue);
+  }
+  return NULL;
+}
+
+/*
+ * Move items through a queue with the given number of threads on each side.
+ *
+ * @return Millions of items moved per second.
+ */
+static double benchQueue(bool lockFree, int threads, long items) {
+  pthread_t producers[threads], consumers[threads];
+  Run run = { .lockFree = lockFree, .items = items };
+  double start;
+
+  run.queue = lockFree ? (void*) queueCreate(BENCH_CAPACITY) : (void*) listQueueCreate();
+
+  start = now();
+  for (int i = 0; i < threads; i++) {
+    pthread_create(&consumers[i], NULL, &consume, &run);
+    pthread_create(&producers[i], NULL, &produce, &run);
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(producers[i], NULL);
+    pthread_join(consumers[i], NULL);
+  }
+  double elapsed = now() - start;
+
+  if (lockFree)
+    queueFree(run.queue);
+  else
+    listQueueFree(run.queue);
+
+  return threads * items / elapsed / 1e6;
+}
+
+int main(int argc, char **argv) {
+  long items = BENCH_ITEMS;
+  int maxThreads = BENCH_MAX_THREADS, opt;
+
+  while ((opt = getopt(argc, argv, "i:t:")) != -1) {
+    switch (opt) {
+      case 'i': items = atol(optarg); break;
+      case 't': maxThreads = atoi(optarg); break;
+    }
+  }
+
+  printf("%-12s %16s %16s\n", "threads", "list+mutex", "lock-free");
+  for (int threads = 1; threads <= maxThreads; threads *= 2)
+    printf("%3d x %-6d %11.2f M/s %11.2f M/s\n", threads, threads,
+           benchQueue(false, threads, items), benchQueue(true, threads, items));
+
+  return 0;
+}
@@ -0,0 +1,210 @@
+#include "../../src/dict.h"
+#include "../../src/doc.h"
+#include "../../src/epoch.h"
+#include "../../src/store.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*
+ * Shard scaling benchmark for the document store.
+ *
+ * Threads run a mix of gets, adds and removes over a fixed set of keys, against
+ * the global Dict the store replaced behind a single mutex, and against stores
+ * with more and more shards. Store gets are lock-free lookups, with each thread
+ * announcing a quiescent state every batch of operations, as workers do. Usage:
+ *
+ *   build/bench/benchStore [-o operations per thread] [-k keys] [-g percent gets] [-t max threads]
+ */
+
+#define BENCH_OPERATIONS    200000
+#define BENCH_KEYS          4096
+#define BENCH_GETS          80
+#define BENCH_MAX_THREADS   64
+#define BENCH_KEY_SIZE      32
+#define BENCH_BATCH         64
+
+static unsigned int shardCounts[] = {1, 8, 64};
+
+
+/********************************************************************************
+ *                          The global Dict it replaced.
+ *******************************************************************************/
+
+typedef struct LockedDict {
+  Dict *dict;
+  pthread_mutex_t mutex;
+} LockedDict;
+
+static LockedDict *lockedDictCreate(void) {
+  LockedDict *locked = malloc(sizeof(LockedDict));
+  locked->dict = dictCreate(&documentFree);
+  pthread_mutex_init(&locked->mutex, NULL);
+  return locked;
+}
+
+static void lockedDictFree(LockedDict *locked) {
+  dictFree(locked->dict);
+  pthread_mutex_destroy(&locked->mutex);
+  free(locked);
+}
+
+static void lockedDictGet(LockedDict *locked, const char *key) {
+  pthread_mutex_lock(&locked->mutex);
+  dictGet(locked->dict, key);
+  pthread_mutex_unlock(&locked->mutex);
+}
+
+static void lockedDictSet(LockedDict *locked, const char *key, Document *doc) {
+  pthread_mutex_lock(&locked->mutex);
+  /* Dict appends rather than replaces. */
+  dictRemove(locked->dict, key);
+  dictSet(locked->dict, key, doc);
+  pthread_mutex_unlock(&locked->mutex);
+}
+
+static void lockedDictRemove(LockedDict *locked, const char *key) {
+  pthread_mutex_lock(&locked->mutex);
+  dictRemove(locked->dict, key);
+  pthread_mutex_unlock(&locked->mutex);
+}
+
+
+/********************************************************************************
+ *                                Benchmark.
+ *******************************************************************************/
+
+typedef struct Run {
+  Store *store;             /* The store, or NULL for the locked Dict. */
+  Epoch *epoch;
+  LockedDict *locked;
+  long operations;
+  int keys;
+  int gets;
+  unsigned int seed;
+} Run;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static Document *createDocument(char *key) {
+  return documentCreate(key, jsonCreateNull());
+}
+
+static void *mix(void *arg) {
+  Run *run = arg;
+  char key[BENCH_KEY_SIZE];
+  Document *doc;
+  int dice;
+
+  if (run->store != NULL)
+    epochOnline(run->epoch);
+
+  for (long i = 0; i < run->operations; i++) {
+    if (run->store != NULL && i % BENCH_BATCH == 0)
+      epochQuiescent(run->epoch);
+    snprintf(key, sizeof(key), "doc:%d", rand_r(&run->seed) % run->keys);
+    dice = rand_r(&run->seed) % 100;
+
+    if (dice < run->gets) {
+      if (run->store == NULL)
+        lockedDictGet(run->locked, key);
+      else if ((doc = storeLookup(run->store, key)) != NULL)
+        documentGetContents(doc);
+    } else if (dice % 2 == 0) {
+      if (run->store == NULL)
+        lockedDictSet(run->locked, key, createDocument(key));
+      else
+        storeSet(run->store, key, createDocument(key));
+    } else {
+      if (run->store == NULL)
+        lockedDictRemove(run->locked, key);
+      else
+        storeRemove(run->store, key);
+    }
+  }
+
+  if (run->store != NULL)
+    epochOffline(run->epoch);
+  return NULL;
+}
+
+/*
+ * Run the mix on a number of threads.
+ *
+ * @param shards: The number of shards of the store, or 0 for the locked Dict.
+ * @return Millions of operations per second, across every thread.
+ */
+static double benchStore(unsigned int shards, int threads, long operations, int keys, int gets) {
+  pthread_t ids[threads];
+  Run runs[threads];
+  Epoch *epoch = epochCreate();
+  Store *store = shards > 0 ? storeCreate(shards, epoch) : NULL;
+  LockedDict *locked = shards > 0 ? NULL : lockedDictCreate();
+  char key[BENCH_KEY_SIZE];
+  double start, elapsed;
+
+  /* Start with half the keys in place. */
+  for (int i = 0; i < keys; i += 2) {
+    snprintf(key, sizeof(key), "doc:%d", i);
+    if (store != NULL)
+      storeSet(store, key, createDocument(key));
+    else
+      lockedDictSet(locked, key, createDocument(key));
+  }
+
+  start = now();
+  for (int i = 0; i < threads; i++) {
+    runs[i] = (Run) { store, epoch, locked, operations, keys, gets, i + 1 };
+    pthread_create(&ids[i], NULL, &mix, &runs[i]);
+  }
+  for (int i = 0; i < threads; i++)
+    pthread_join(ids[i], NULL);
+  elapsed = now() - start;
+
+  if (store != NULL)
+    storeFree(store);
+  else
+    lockedDictFree(locked);
+  epochFree(epoch);
+
+  return threads * operations / elapsed / 1e6;
+}
+
+int main(int argc, char **argv) {
+  long operations = BENCH_OPERATIONS;
+  int keys = BENCH_KEYS, gets = BENCH_GETS, maxThreads = BENCH_MAX_THREADS, opt;
+
+  while ((opt = getopt(argc, argv, "g:k:o:t:")) != -1) {
+    switch (opt) {
+      case 'g': gets = atoi(optarg); break;
+      case 'k': keys = atoi(optarg); break;
+      case 'o': operations = atol(optarg); break;
+      case 't': maxThreads = atoi(optarg); break;
+    }
+  }
+
+  printf("%d%% gets over %d keys, %ld operations per thread\n", gets, keys, operations);
+  printf("%-8s %14s", "threads", "dict+mutex");
+  for (int i = 0; i < sizeof(shardCounts) / sizeof(shardCounts[0]); i++)
+    printf(" %10u shard%s", shardCounts[i], shardCounts[i] > 1 ? "s" : " ");
+  printf("\n");
+
+  for (int threads = 1; threads <= maxThreads; threads *= 2) {
+    printf("%-8d %10.2f M/s", threads, benchStore(0, threads, operations, keys, gets));
+    for (int i = 0; i < sizeof(shardCounts) / sizeof(shardCounts[0]); i++)
+      printf(" %12.2f M/s", benchStore(shardCounts[i], threads, operations, keys, gets));
+    printf("\n");
+  }
+
+  return 0;
+}
@@ -1,11 +1,25 @@
 #include "lib.h"
+#include "unit/testAffinity.h"
+#include "unit/testBuffer.h"
+#include "unit/testDeque.h"
 #include "unit/testDict.h"
 #include "unit/testDoc.h"
+#include "unit/testEpoch.h"
+#include "unit/testEvent.h"
+#include "unit/testHistogram.h"
 #include "unit/testJson.h"
 #include "unit/testList.h"
+#include "unit/testLog.h"
 #include "unit/testMemory.h"
 #include "unit/testOt.h"
+#include "unit/testProtocol.h"
+#include "unit/testQueue.h"
+#include "unit/testScheduler.h"
 #include "unit/testServer.h"
+#include "unit/testSlowlog.h"
+#include "unit/testStats.h"
+#include "unit/testStore.h"
+#include "unit/testTimer.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -51,10 +65,24 @@ int main(int argc, char **argv) {
   TestSuite *suites[] = {
     memoryTestSuite(),
     listTestSuite(),
+    bufferTestSuite(),
+    histogramTestSuite(),
+    timerTestSuite(),
     dictTestSuite(),
     jsonTestSuite(),
     documentTestSuite(),
+    epochTestSuite(),
+    storeTestSuite(),
     otTestSuite(),
+    eventTestSuite(),
+    protocolTestSuite(),
+    queueTestSuite(),
+    dequeTestSuite(),
+    schedulerTestSuite(),
+    affinityTestSuite(),
+    logTestSuite(),
+    statsTestSuite(),
+    slowlogTestSuite(),
     serverTestSuite()
   };
 
@@ -0,0 +1,90 @@
+#define _GNU_SOURCE
+
+#include "../lib.h"
+#include "testAffinity.h"
+#include "../../src/affinity.h"
+#include "../../src/mmalloc.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+static void setup(void) {
+}
+
+static void teardown(void) {
+  assertEqual(0, memoryUsage());
+}
+
+
+static void testCpuListRanges(void) {
+  int expected[] = {0, 1, 2, 3, 8, 10, 11};
+  CpuList *list = cpuListParse("0-3,8,10-11");
+
+  assertEqual(arraySize(expected), cpuListLength(list));
+  for (int i = 0; i < arraySize(expected); i++)
+    assertEqual(expected[i], cpuListGet(list, i));
+
+  /* More threads than CPUs go around the list again. */
+  assertEqual(0, cpuListGet(list, arraySize(expected)));
+  assertEqual(8, cpuListGet(list, arraySize(expected) + 4));
+  cpuListFree(list);
+}
+
+static void testCpuListInvalid(void) {
+  char *invalid[] = {"", "a", "1,", ",1", "3-1", "1-", "1 2", "-1", "99999"};
+
+  for (int i = 0; i < arraySize(invalid); i++)
+    assertNull(cpuListParse(invalid[i]));
+}
+
+static void testCpuListAll(void) {
+  CpuList *list = cpuListParse("all");
+  int previous = -1;
+
+  assertEqual(sysconf(_SC_NPROCESSORS_ONLN), cpuListLength(list));
+
+  /* The CPUs come node by node. */
+  for (int i = 0; i < cpuListLength(list); i++) {
+    assertEqual(true, affinityNode(cpuListGet(list, i)) >= previous);
+    previous = affinityNode(cpuListGet(list, i));
+  }
+  cpuListFree(list);
+}
+
+/*
+ * Pin a thread of its own, so the test runner keeps running anywhere.
+ */
+static void *pinJob(void *arg) {
+  int cpu = sched_getcpu(), node, *page;
+
+  assertEqual(true, affinityPin(cpu));
+  assertEqual(cpu, sched_getcpu());
+
+  /* A page touched from a pinned thread lands on its node, unless the machine has no NUMA support. */
+  page = malloc(sizeof(int));
+  *page = 1;
+  node = affinityMemoryNode(page);
+  assertEqual(true, node == -1 || node == affinityNode(cpu));
+  free(page);
+  return NULL;
+}
+
+static void testAffinityPin(void) {
+  pthread_t thread;
+
+  assertEqual(true, affinityNodes() >= 1);
+  pthread_create(&thread, NULL, &pinJob, NULL);
+  pthread_join(thread, NULL);
+}
+
+TestSuite *affinityTestSuite() {
+  TestSuite *suite = testSuiteCreate("affinity", &setup, &teardown);
+  testSuiteAdd(suite, "cpu list ranges", &testCpuListRanges);
+  testSuiteAdd(suite, "cpu list invalid", &testCpuListInvalid);
+  testSuiteAdd(suite, "cpu list all", &testCpuListAll);
+  testSuiteAdd(suite, "affinity pin", &testAffinityPin);
+  return suite;
+}
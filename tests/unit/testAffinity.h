@@ -0,0 +1,6 @@
+#ifndef __TEST_AFFINITY_H__
+#define __TEST_AFFINITY_H__
+
+TestSuite *affinityTestSuite(void);
+
+#endif
@@ -0,0 +1,126 @@
+#include "../lib.h"
+#include "testBuffer.h"
+#include "../../src/buffer.h"
+#include "../../src/mmalloc.h"
+
+#include <string.h>
+
+
+#define DEFAULT_BUFFER_SIZE  8
+
+static Buffer *buffer;
+
+
+static void setup(void) {
+  buffer = bufferCreate(DEFAULT_BUFFER_SIZE);
+}
+
+static void teardown(void) {
+  bufferFree(buffer);
+  assertEqual(0, memoryUsage());
+}
+
+
+static void testBufferEmpty(void) {
+  assertEqual(0, bufferLength(buffer));
+  assertEqual(DEFAULT_BUFFER_SIZE, bufferCapacity(buffer));
+}
+
+static void testBufferAppend(void) {
+  bufferAppend(buffer, "abc", 3);
+  bufferAppend(buffer, "def", 3);
+  assertEqual(6, bufferLength(buffer));
+  assertTrue(!memcmp("abcdef", bufferData(buffer), 6));
+}
+
+static void testBufferGrow(void) {
+  bufferAppend(buffer, "0123456789", 10);
+  bufferAppend(buffer, "0123456789", 10);
+  assertEqual(20, bufferLength(buffer));
+  assertEqual(32, bufferCapacity(buffer));
+  assertTrue(!memcmp("01234567890123456789", bufferData(buffer), 20));
+}
+
+static void testBufferReserveCommit(void) {
+  char *room = bufferReserve(buffer, 100);
+  memcpy(room, "hello", 5);
+  bufferCommit(buffer, 5);
+  assertEqual(5, bufferLength(buffer));
+  assertTrue(bufferCapacity(buffer) >= 100);
+  assertTrue(!memcmp("hello", bufferData(buffer), 5));
+}
+
+static void testBufferFormat(void) {
+  assertEqual(5, bufferFormat(buffer, "%s %d", "ab", 12));
+  assertEqual(5, bufferLength(buffer));
+  assertTrue(!memcmp("ab 12", bufferData(buffer), 5));
+  /* A string that does not fit in the room left grows the buffer. */
+  assertEqual(20, bufferFormat(buffer, "%020d", 7));
+  assertEqual(25, bufferLength(buffer));
+  assertTrue(!memcmp("ab 1200000000000000000007", bufferData(buffer), 25));
+}
+
+static void testBufferConsume(void) {
+  bufferAppend(buffer, "abcdef", 6);
+  bufferConsume(buffer, 2);
+  assertEqual(4, bufferLength(buffer));
+  assertTrue(!memcmp("cdef", bufferData(buffer), 4));
+  bufferConsume(buffer, 4);
+  assertEqual(0, bufferLength(buffer));
+}
+
+static void testBufferReclaimConsumed(void) {
+  /* Consumed bytes make room again before the storage grows. */
+  bufferAppend(buffer, "abcdef", 6);
+  bufferConsume(buffer, 5);
+  bufferAppend(buffer, "ghijk", 5);
+  assertEqual(DEFAULT_BUFFER_SIZE, bufferCapacity(buffer));
+  assertEqual(6, bufferLength(buffer));
+  assertTrue(!memcmp("fghijk", bufferData(buffer), 6));
+}
+
+static void testBufferShrink(void) {
+  bufferAppend(buffer, "0123456789", 10);
+  /* Only an empty buffer gives back its storage. */
+  bufferShrink(buffer, DEFAULT_BUFFER_SIZE);
+  assertEqual(16, bufferCapacity(buffer));
+  bufferConsume(buffer, 10);
+  bufferShrink(buffer, DEFAULT_BUFFER_SIZE);
+  assertEqual(DEFAULT_BUFFER_SIZE, bufferCapacity(buffer));
+  bufferAppend(buffer, "abc", 3);
+  assertTrue(!memcmp("abc", bufferData(buffer), 3));
+}
+
+static void testBufferClear(void) {
+  bufferAppend(buffer, "0123456789", 10);
+  bufferClear(buffer);
+  assertEqual(0, bufferLength(buffer));
+  assertEqual(16, bufferCapacity(buffer));
+}
+
+static void testBufferRelease(void) {
+  Buffer *released = bufferCreate(8);
+  char *data;
+
+  bufferAppend(released, "abcdef", 7);
+  bufferConsume(released, 2);
+  data = bufferRelease(released);
+  assertStringEqual("cdef", data);
+  mfree(data);
+}
+
+
+TestSuite *bufferTestSuite() {
+  TestSuite *suite = testSuiteCreate("byte buffer", &setup, &teardown);
+  testSuiteAdd(suite, "buffer empty", &testBufferEmpty);
+  testSuiteAdd(suite, "buffer append", &testBufferAppend);
+  testSuiteAdd(suite, "buffer grow", &testBufferGrow);
+  testSuiteAdd(suite, "buffer reserve and commit", &testBufferReserveCommit);
+  testSuiteAdd(suite, "buffer format", &testBufferFormat);
+  testSuiteAdd(suite, "buffer consume", &testBufferConsume);
+  testSuiteAdd(suite, "buffer reclaim consumed", &testBufferReclaimConsumed);
+  testSuiteAdd(suite, "buffer shrink", &testBufferShrink);
+  testSuiteAdd(suite, "buffer clear", &testBufferClear);
+  testSuiteAdd(suite, "buffer release", &testBufferRelease);
+  return suite;
+}
@@ -0,0 +1,6 @@
+#ifndef __TEST_BUFFER_H__
+#define __TEST_BUFFER_H__
+
+TestSuite *bufferTestSuite(void);
+
+#endif
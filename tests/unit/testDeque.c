@@ -0,0 +1,150 @@
+#include "../lib.h"
+#include "testDeque.h"
+#include "../../src/deque.h"
+#include "../../src/mmalloc.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+
+#define DEFAULT_DEQUE_SIZE  64
+#define NUM_THIEVES         3
+#define NUM_VALUES          100000
+
+static Deque *deque;
+static bool ownerDone;
+
+
+static void setup(void) {
+  deque = dequeCreate(DEFAULT_DEQUE_SIZE);
+}
+
+static void teardown(void) {
+  dequeFree(deque);
+  assertEqual(0, memoryUsage());
+}
+
+
+static void testDequeCapacity(void) {
+  Deque *odd = dequeCreate(100);
+  assertEqual(128, dequeCapacity(odd));
+  dequeFree(odd);
+  assertEqual(DEFAULT_DEQUE_SIZE, dequeCapacity(deque));
+}
+
+static void testDequeEmpty(void) {
+  assertEqual(0, dequeLength(deque));
+  assertNull(dequePop(deque));
+  assertNull(dequeSteal(deque));
+}
+
+static void testDequePopLifo(void) {
+  Box *boxes[DEFAULT_DEQUE_SIZE];
+  for (int i = 0; i < DEFAULT_DEQUE_SIZE; i++) {
+    boxes[i] = boxCreate(i);
+    assertTrue(dequePush(deque, boxes[i]));
+  }
+  assertEqual(DEFAULT_DEQUE_SIZE, dequeLength(deque));
+  for (int i = DEFAULT_DEQUE_SIZE - 1; i >= 0; i--) {
+    Box *box = dequePop(deque);
+    assertEqual(i, boxValue(box));
+    boxFree(box);
+  }
+  assertNull(dequePop(deque));
+}
+
+static void testDequeStealFifo(void) {
+  Box *boxes[DEFAULT_DEQUE_SIZE];
+  for (int i = 0; i < DEFAULT_DEQUE_SIZE; i++) {
+    boxes[i] = boxCreate(i);
+    assertTrue(dequePush(deque, boxes[i]));
+  }
+  for (int i = 0; i < DEFAULT_DEQUE_SIZE; i++) {
+    Box *box = dequeSteal(deque);
+    assertEqual(i, boxValue(box));
+    boxFree(box);
+  }
+  assertNull(dequeSteal(deque));
+}
+
+static void testDequeFull(void) {
+  Box *box = boxCreate(0);
+  for (int i = 0; i < DEFAULT_DEQUE_SIZE; i++)
+    assertTrue(dequePush(deque, box));
+  assertFalse(dequePush(deque, box));
+  /* Stealing one value makes room for exactly one more. */
+  assertPointerEqual(box, dequeSteal(deque));
+  assertTrue(dequePush(deque, box));
+  assertFalse(dequePush(deque, box));
+  while (dequePop(deque) != NULL);
+  boxFree(box);
+}
+
+static void testDequeWrapAround(void) {
+  Box *box = boxCreate(0);
+  for (int i = 0; i < DEFAULT_DEQUE_SIZE * 4; i++) {
+    assertTrue(dequePush(deque, box));
+    assertTrue(dequePush(deque, box));
+    assertPointerEqual(box, dequeSteal(deque));
+    assertPointerEqual(box, dequePop(deque));
+  }
+  assertEqual(0, dequeLength(deque));
+  boxFree(box);
+}
+
+static void *steal(void *arg) {
+  long *sum = arg, value;
+  while (!__atomic_load_n(&ownerDone, __ATOMIC_ACQUIRE) || dequeLength(deque) > 0)
+    if ((value = (long) dequeSteal(deque)) != 0)
+      *sum += value;
+    else
+      sched_yield();
+  return NULL;
+}
+
+static void testDequeConcurrent(void) {
+  pthread_t thieves[NUM_THIEVES];
+  long sums[NUM_THIEVES + 1] = {0}, total = 0, stolen = 0, value;
+
+  ownerDone = false;
+  for (int i = 0; i < NUM_THIEVES; i++)
+    pthread_create(&thieves[i], NULL, &steal, &sums[i]);
+
+  /* The owner pushes every value, popping every other one back itself. */
+  for (long i = 1; i <= NUM_VALUES; i++) {
+    while (!dequePush(deque, (void*) i))
+      sched_yield();
+    if (i % 2 == 0 && (value = (long) dequePop(deque)) != 0)
+      sums[NUM_THIEVES] += value;
+    /* Let the thieves run even on a single core. */
+    if (i % DEFAULT_DEQUE_SIZE == 0)
+      sched_yield();
+  }
+  while ((value = (long) dequePop(deque)) != 0)
+    sums[NUM_THIEVES] += value;
+  __atomic_store_n(&ownerDone, true, __ATOMIC_RELEASE);
+
+  for (int i = 0; i < NUM_THIEVES; i++) {
+    pthread_join(thieves[i], NULL);
+    stolen += sums[i];
+  }
+  total = stolen + sums[NUM_THIEVES];
+
+  /* Every value was taken exactly once. */
+  assertTrue(total == (long) NUM_VALUES * (NUM_VALUES + 1) / 2);
+  assertTrue(stolen > 0);
+  assertEqual(0, dequeLength(deque));
+}
+
+
+TestSuite *dequeTestSuite() {
+  TestSuite *suite = testSuiteCreate("work-stealing deque", &setup, &teardown);
+  testSuiteAdd(suite, "deque capacity", &testDequeCapacity);
+  testSuiteAdd(suite, "deque empty", &testDequeEmpty);
+  testSuiteAdd(suite, "deque pop lifo", &testDequePopLifo);
+  testSuiteAdd(suite, "deque steal fifo", &testDequeStealFifo);
+  testSuiteAdd(suite, "deque full", &testDequeFull);
+  testSuiteAdd(suite, "deque wrap around", &testDequeWrapAround);
+  testSuiteAdd(suite, "deque concurrent", &testDequeConcurrent);
+  return suite;
+}
@@ -0,0 +1,6 @@
+#ifndef __TEST_DEQUE_H__
+#define __TEST_DEQUE_H__
+
+TestSuite *dequeTestSuite(void);
+
+#endif
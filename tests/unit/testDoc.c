@@ -3,21 +3,30 @@
 #include "../../src/doc.h"
 #include "../../src/mmalloc.h"
 
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+
+
+#define DOC_READERS   4
+#define DOC_ROUNDS    10000
 
 
 Document *doc;
 Collaborator *user;
 Json *contents;
-char *err;
+static char *err;
+static Epoch *epoch;
 
 
 static void setup(void) {
   err = mmalloc(128);
+  epoch = epochCreate();
 }
 
 static void teardown(void) {
   mfree(err);
+  epochFree(epoch);
   assertEqual(0, memoryUsage());
 }
 
@@ -31,6 +40,126 @@ static void testDocumentGetInfo(void) {
   documentFree(doc);
 }
 
+static void testDocumentRetain(void) {
+  doc = documentCreate("key", jsonParse("[1,2,3]", &err));
+  assertPointerEqual(doc, documentRetain(doc));
+  documentFree(doc);
+  /* Still alive until the last reference is released. */
+  assertEqual(3, listLength(documentGetContents(doc)->arrayValue));
+  documentFree(doc);
+}
+
+static void testDocumentSetContents(void) {
+  doc = documentCreate("key", jsonParse("[1,2,3]", &err));
+  contents = jsonRetain(documentGetContents(doc));
+  documentSetContents(doc, jsonParse("[4,5]", &err), epoch);
+  assertEqual(2, listLength(documentGetContents(doc)->arrayValue));
+
+  /* A reader holding the old version still sees it whole. */
+  assertEqual(3, listLength(contents->arrayValue));
+  jsonFree(contents);
+  documentFree(doc);
+}
+
+static void testDocumentUpdateContents(void) {
+  Json *current;
+
+  doc = documentCreate("key", jsonParse("{\"a\":{\"b\":1},\"c\":[1,2]}", &err));
+  contents = jsonRetain(documentGetContents(doc));
+
+  assertEqual(true, documentUpdateContents(doc, (const char*[]) {"a", "b"}, 2, jsonCreateInt(2), epoch));
+  current = documentGetContents(doc);
+  assertEqual(2, ((Json*) dictGet(((Json*) dictGet(current->objectValue, "a"))->objectValue, "b"))->intValue);
+  assertEqual(1, ((Json*) dictGet(((Json*) dictGet(contents->objectValue, "a"))->objectValue, "b"))->intValue);
+  /* What is off the path is shared. */
+  assertPointerEqual(dictGet(contents->objectValue, "c"), dictGet(current->objectValue, "c"));
+
+  assertEqual(true, documentUpdateContents(doc, (const char*[]) {"c", "2"}, 2, jsonCreateInt(3), epoch));
+  assertEqual(3, listLength(((Json*) dictGet(documentGetContents(doc)->objectValue, "c"))->arrayValue));
+  assertEqual(2, listLength(((Json*) dictGet(contents->objectValue, "c"))->arrayValue));
+
+  /* A path that leads nowhere changes nothing. */
+  current = documentGetContents(doc);
+  Json *value = jsonCreateInt(4);
+  assertEqual(false, documentUpdateContents(doc, (const char*[]) {"c", "x"}, 2, value, epoch));
+  assertEqual(false, documentUpdateContents(doc, (const char*[]) {"a", "b", "c"}, 3, value, epoch));
+  assertPointerEqual(current, documentGetContents(doc));
+  jsonFree(value);
+
+  jsonFree(contents);
+  documentFree(doc);
+}
+
+static void testDocumentSerialize(void) {
+  Serialized *first, *second;
+
+  doc = documentCreate("key", jsonParse("[1, 2, 3]", &err));
+  first = documentSerialize(doc, epoch);
+  assertEqual(7, serializedLength(first));
+  assertEqual(0, memcmp("[1,2,3]", serializedData(first), 7));
+
+  /* Readers share the serialized contents until they change. */
+  second = documentSerialize(doc, epoch);
+  assertPointerEqual(first, second);
+  serializedFree(second);
+
+  /* A change leaves the readers still sending the old contents with them. */
+  documentSetContents(doc, jsonParse("[4]", &err), epoch);
+  second = documentSerialize(doc, epoch);
+  assertEqual(true, first != second);
+  assertEqual(0, memcmp("[4]", serializedData(second), 3));
+  assertEqual(0, memcmp("[1,2,3]", serializedData(first), 7));
+  serializedFree(first);
+  serializedFree(second);
+
+  documentUpdateContents(doc, (const char*[]) {"0"}, 1, jsonCreateInt(7), epoch);
+  first = documentSerialize(doc, epoch);
+  assertEqual(0, memcmp("[7]", serializedData(first), 3));
+
+  /* The serialized contents outlive the document. */
+  documentFree(doc);
+  assertEqual(3, serializedLength(first));
+  serializedFree(first);
+}
+
+static void *readJob(void *arg) {
+  Json *version;
+  int *torn = arg;
+
+  epochOnline(epoch);
+  for (int i = 0; i < DOC_ROUNDS; i++) {
+    /* Every version read is whole: its two halves always cancel out. */
+    version = documentGetContents(doc);
+    if (((Json*) dictGet(version->objectValue, "x"))->intValue +
+        ((Json*) dictGet(version->objectValue, "y"))->intValue != 0)
+      (*torn)++;
+    epochQuiescent(epoch);
+  }
+  epochOffline(epoch);
+  return NULL;
+}
+
+static void testDocumentConcurrentVersions(void) {
+  pthread_t readers[DOC_READERS];
+  int torn[DOC_READERS] = {0};
+  char version[64];
+
+  doc = documentCreate("key", jsonParse("{\"x\":0,\"y\":0}", &err));
+  for (int i = 0; i < DOC_READERS; i++)
+    pthread_create(&readers[i], NULL, &readJob, &torn[i]);
+
+  for (int i = 1; i <= DOC_ROUNDS; i++) {
+    sprintf(version, "{\"x\":%d,\"y\":%d}", i, -i);
+    documentSetContents(doc, jsonParse(version, &err), epoch);
+  }
+
+  for (int i = 0; i < DOC_READERS; i++) {
+    pthread_join(readers[i], NULL);
+    assertEqual(0, torn[i]);
+  }
+  documentFree(doc);
+}
+
 static void testCollaboratorGetInfo(void) {
   char *userId = "0123";
   user = collaboratorCreate(userId);
@@ -44,7 +173,7 @@ static void testDocumentAddCollaborators(void) {
   char key[128];
   for (int i = 0; i < numUsers; i++) {
     sprintf(key, "key%d", i);
-    documentAddCollaborator(doc, collaboratorCreate(key));
+    assertEqual(i == 0, documentAddCollaborator(doc, collaboratorCreate(key), 0));
     assertEqual(i + 1, listLength(documentGetCollaborators(doc)));
   }
   documentFree(doc);
@@ -56,7 +185,7 @@ static void testDocumentRemoveCollaborators(void) {
   char key[128];
   for (int i = 0; i < numUsers; i++) {
     sprintf(key, "key%d", i);
-    documentAddCollaborator(doc, collaboratorCreate(key));
+    documentAddCollaborator(doc, collaboratorCreate(key), 0);
   }
   for (int i = 0; i < numUsers; i++) {
     sprintf(key, "key%d", i);
@@ -66,12 +195,49 @@ static void testDocumentRemoveCollaborators(void) {
   documentFree(doc);
 }
 
+static void testDocumentTouchCollaborators(void) {
+  doc = documentCreate("key", jsonParse("{}", &err));
+  documentAddCollaborator(doc, collaboratorCreate("alice"), 10);
+  assertEqual(true, documentTouchCollaborator(doc, "alice", 20));
+  assertEqual(false, documentTouchCollaborator(doc, "bob", 20));
+  documentFree(doc);
+}
+
+static void testDocumentExpireCollaborators(void) {
+  doc = documentCreate("key", jsonParse("{}", &err));
+  uint64_t oldest;
+  assertEqual(true, documentAddCollaborator(doc, collaboratorCreate("alice"), 10));
+  assertEqual(false, documentAddCollaborator(doc, collaboratorCreate("bob"), 20));
+  assertEqual(false, documentAddCollaborator(doc, collaboratorCreate("carol"), 30));
+  documentTouchCollaborator(doc, "alice", 40);
+
+  /* Nobody quiet yet. */
+  assertEqual(3, documentExpireCollaborators(doc, 19, &oldest));
+  assertEqual(20, oldest);
+
+  assertEqual(2, documentExpireCollaborators(doc, 25, &oldest));
+  assertEqual(30, oldest);
+  assertEqual(false, documentTouchCollaborator(doc, "bob", 50));
+
+  /* The heartbeat stops with the last collaborator, and restarts with the next. */
+  assertEqual(0, documentExpireCollaborators(doc, 50, &oldest));
+  assertEqual(true, documentAddCollaborator(doc, collaboratorCreate("dave"), 60));
+  documentFree(doc);
+}
+
 
 TestSuite *documentTestSuite() {
   TestSuite *suite = testSuiteCreate("documents and collaborators", &setup, &teardown);
   testSuiteAdd(suite, "doc get info", &testDocumentGetInfo);
+  testSuiteAdd(suite, "doc retain", &testDocumentRetain);
+  testSuiteAdd(suite, "doc set contents", &testDocumentSetContents);
+  testSuiteAdd(suite, "doc update contents", &testDocumentUpdateContents);
+  testSuiteAdd(suite, "doc serialize", &testDocumentSerialize);
+  testSuiteAdd(suite, "doc concurrent versions", &testDocumentConcurrentVersions);
   testSuiteAdd(suite, "collaborator get info", &testCollaboratorGetInfo);
   testSuiteAdd(suite, "add collaborators", &testDocumentAddCollaborators);
   testSuiteAdd(suite, "remove collaborators", &testDocumentRemoveCollaborators);
+  testSuiteAdd(suite, "touch collaborators", &testDocumentTouchCollaborators);
+  testSuiteAdd(suite, "expire collaborators", &testDocumentExpireCollaborators);
   return suite;
 }
@@ -0,0 +1,125 @@
+#include "../lib.h"
+#include "testEpoch.h"
+#include "../../src/epoch.h"
+#include "../../src/mmalloc.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+
+#define EPOCH_READERS     4
+#define EPOCH_ROUNDS      20000
+
+static Epoch *epoch;
+static unsigned long freed;
+
+
+static void setup(void) {
+  epoch = epochCreate();
+  freed = 0;
+}
+
+static void teardown(void) {
+  epochFree(epoch);
+  assertEqual(0, memoryUsage());
+}
+
+/*
+ * Count the objects freed, so tests can tell when reclamation happened.
+ */
+static void countFree(void *object) {
+  __atomic_add_fetch(&freed, 1, __ATOMIC_RELAXED);
+  mfree(object);
+}
+
+
+static void testEpochNoReaders(void) {
+  epochRetire(epoch, mmalloc(8), &countFree);
+  assertEqual(1, epochReclaim(epoch));
+  assertEqual(1, freed);
+  assertEqual(0, epochPending(epoch));
+}
+
+static void testEpochReaderHolds(void) {
+  epochOnline(epoch);
+  epochRetire(epoch, mmalloc(8), &countFree);
+  epochRetire(epoch, mmalloc(8), &countFree);
+  assertEqual(0, freed);
+  assertEqual(2, epochPending(epoch));
+
+  /* Once the reader moves on, both can go. */
+  epochQuiescent(epoch);
+  assertEqual(2, epochReclaim(epoch));
+  assertEqual(2, freed);
+
+  /* Only what was retired after the quiescent state waits. */
+  epochRetire(epoch, mmalloc(8), &countFree);
+  assertEqual(1, epochPending(epoch));
+  epochOffline(epoch);
+  assertEqual(1, epochReclaim(epoch));
+  assertEqual(3, freed);
+}
+
+static void testEpochFreePending(void) {
+  epochOnline(epoch);
+  epochRetire(epoch, mmalloc(8), &countFree);
+  epochOffline(epoch);
+
+  /* Freeing the epoch frees what is still waiting. */
+  assertEqual(1, epochPending(epoch));
+}
+
+typedef struct Slot {
+  unsigned long *value;
+  pthread_mutex_t mutex;
+} Slot;
+
+static Slot slot;
+
+static void *readJob(void *arg) {
+  unsigned long *value;
+
+  for (int i = 0; i < EPOCH_ROUNDS; i++) {
+    epochOnline(epoch);
+    value = __atomic_load_n(&slot.value, __ATOMIC_ACQUIRE);
+    /* A value freed under the reader would have been overwritten by the allocator. */
+    assertEqual(true, *value < EPOCH_ROUNDS);
+    epochOffline(epoch);
+  }
+  return NULL;
+}
+
+static void testEpochConcurrent(void) {
+  pthread_t readers[EPOCH_READERS];
+  unsigned long *value, *old;
+
+  slot.value = mmalloc(sizeof(unsigned long));
+  *slot.value = 0;
+
+  for (int i = 0; i < EPOCH_READERS; i++)
+    pthread_create(&readers[i], NULL, &readJob, NULL);
+  for (unsigned long i = 1; i < EPOCH_ROUNDS; i++) {
+    value = mmalloc(sizeof(unsigned long));
+    *value = i;
+    old = __atomic_exchange_n(&slot.value, value, __ATOMIC_ACQ_REL);
+    epochRetire(epoch, old, &countFree);
+  }
+  for (int i = 0; i < EPOCH_READERS; i++)
+    pthread_join(readers[i], NULL);
+
+  /* With every reader offline, everything retired can go. */
+  epochReclaim(epoch);
+  assertEqual(EPOCH_ROUNDS - 1, freed);
+  assertEqual(0, epochPending(epoch));
+  mfree(slot.value);
+}
+
+
+TestSuite *epochTestSuite() {
+  TestSuite *suite = testSuiteCreate("epoch reclamation", &setup, &teardown);
+  testSuiteAdd(suite, "epoch no readers", &testEpochNoReaders);
+  testSuiteAdd(suite, "epoch reader holds", &testEpochReaderHolds);
+  testSuiteAdd(suite, "epoch free pending", &testEpochFreePending);
+  testSuiteAdd(suite, "epoch concurrent", &testEpochConcurrent);
+  return suite;
+}
@@ -0,0 +1,6 @@
+#ifndef __TEST_EPOCH_H__
+#define __TEST_EPOCH_H__
+
+TestSuite *epochTestSuite(void);
+
+#endif
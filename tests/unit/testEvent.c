@@ -0,0 +1,88 @@
+#include "../lib.h"
+#include "testEvent.h"
+#include "../../src/event.h"
+#include "../../src/mmalloc.h"
+
+#include <unistd.h>
+
+
+#define TEST_MAX_EVENTS 8
+
+
+static EventLoop *loop;
+static int fds[2];
+static char data;
+
+
+static void setup(void) {
+  loop = eventLoopCreate(TEST_MAX_EVENTS);
+  pipe(fds);
+  setNonBlocking(fds[0]);
+}
+
+static void teardown(void) {
+  eventLoopFree(loop);
+  close(fds[0]);
+  close(fds[1]);
+  assertEqual(0, memoryUsage());
+}
+
+
+static void testEventNothingReady(void) {
+  assertEqual(0, eventLoopAdd(loop, fds[0], EVENT_READABLE, &data));
+  assertEqual(0, eventLoopWait(loop, 0));
+}
+
+static void testEventReadable(void) {
+  eventLoopAdd(loop, fds[0], EVENT_READABLE, &data);
+  write(fds[1], "x", 1);
+  assertEqual(1, eventLoopWait(loop, 0));
+  assertPointerEqual(&data, eventLoopFiredData(loop, 0));
+  assertTrue(eventLoopFiredMask(loop, 0) & EVENT_READABLE);
+}
+
+static void testEventEdgeTriggered(void) {
+  eventLoopAdd(loop, fds[0], EVENT_READABLE, &data);
+  write(fds[1], "x", 1);
+  assertEqual(1, eventLoopWait(loop, 0));
+  /* The data was never read, but there is no new edge. */
+  assertEqual(0, eventLoopWait(loop, 0));
+}
+
+static void testEventOneshotRearm(void) {
+  eventLoopAdd(loop, fds[0], EVENT_READABLE | EVENT_ONESHOT, &data);
+  write(fds[1], "x", 1);
+  assertEqual(1, eventLoopWait(loop, 0));
+  write(fds[1], "y", 1);
+  assertEqual(0, eventLoopWait(loop, 0));
+  /* Rearming a descriptor that is still readable fires it again. */
+  assertEqual(0, eventLoopRearm(loop, fds[0], EVENT_READABLE | EVENT_ONESHOT, &data));
+  assertEqual(1, eventLoopWait(loop, 0));
+}
+
+static void testEventRemove(void) {
+  eventLoopAdd(loop, fds[0], EVENT_READABLE, &data);
+  assertEqual(0, eventLoopRemove(loop, fds[0]));
+  write(fds[1], "x", 1);
+  assertEqual(0, eventLoopWait(loop, 0));
+}
+
+static void testEventClosed(void) {
+  eventLoopAdd(loop, fds[1], EVENT_WRITABLE, &data);
+  close(fds[0]);
+  fds[0] = dup(fds[1]);
+  assertEqual(1, eventLoopWait(loop, 0));
+  assertTrue(eventLoopFiredMask(loop, 0) & EVENT_CLOSED);
+}
+
+
+TestSuite *eventTestSuite() {
+  TestSuite *suite = testSuiteCreate("event loop", &setup, &teardown);
+  testSuiteAdd(suite, "nothing ready", &testEventNothingReady);
+  testSuiteAdd(suite, "readable", &testEventReadable);
+  testSuiteAdd(suite, "edge triggered", &testEventEdgeTriggered);
+  testSuiteAdd(suite, "oneshot rearm", &testEventOneshotRearm);
+  testSuiteAdd(suite, "remove", &testEventRemove);
+  testSuiteAdd(suite, "closed", &testEventClosed);
+  return suite;
+}
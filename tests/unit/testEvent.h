@@ -0,0 +1,6 @@
+#ifndef __TEST_EVENT_H__
+#define __TEST_EVENT_H__
+
+TestSuite *eventTestSuite(void);
+
+#endif
@@ -0,0 +1,113 @@
+#include "../lib.h"
+#include "testHistogram.h"
+#include "../../src/histogram.h"
+#include "../../src/mmalloc.h"
+
+#include <stdint.h>
+
+
+static Histogram *histogram;
+
+
+static void setup(void) {
+  histogram = histogramCreate();
+}
+
+static void teardown(void) {
+  histogramFree(histogram);
+  assertEqual(0, memoryUsage());
+}
+
+/*
+ * @return Whether a reported value is within the histogram's precision of the true value.
+ */
+static bool closeTo(uint64_t expected, uint64_t value) {
+  return value >= expected && value <= expected + expected * HISTOGRAM_PRECISION;
+}
+
+
+static void testHistogramEmpty(void) {
+  assertTrue(histogramCount(histogram) == 0);
+  assertTrue(histogramMin(histogram) == 0);
+  assertTrue(histogramMax(histogram) == 0);
+  assertTrue(histogramPercentile(histogram, 99) == 0);
+  assertDoubleEqual(0, histogramMean(histogram));
+}
+
+static void testHistogramExact(void) {
+  /* Small values each have their own bucket. */
+  for (int i = 1; i <= 100; i++)
+    histogramRecord(histogram, i);
+
+  assertTrue(histogramCount(histogram) == 100);
+  assertTrue(histogramMin(histogram) == 1);
+  assertTrue(histogramMax(histogram) == 100);
+  assertTrue(histogramPercentile(histogram, 50) == 50);
+  assertTrue(histogramPercentile(histogram, 99) == 99);
+  assertTrue(histogramPercentile(histogram, 100) == 100);
+  assertDoubleEqual(50.5, histogramMean(histogram));
+}
+
+static void testHistogramPercentiles(void) {
+  for (uint64_t i = 1; i <= 100000; i++)
+    histogramRecord(histogram, i * 10);
+
+  assertTrue(closeTo(500000, histogramPercentile(histogram, 50)));
+  assertTrue(closeTo(990000, histogramPercentile(histogram, 99)));
+  assertTrue(closeTo(999000, histogramPercentile(histogram, 99.9)));
+  assertTrue(histogramPercentile(histogram, 100) == 1000000);
+  assertTrue(histogramMax(histogram) == 1000000);
+}
+
+static void testHistogramLarge(void) {
+  histogramRecord(histogram, 1);
+  histogramRecord(histogram, UINT64_MAX);
+
+  assertTrue(histogramPercentile(histogram, 50) == 1);
+  assertTrue(histogramPercentile(histogram, 100) == UINT64_MAX);
+}
+
+static void testHistogramMerge(void) {
+  Histogram *other = histogramCreate();
+
+  histogramRecord(histogram, 1000);
+  histogramRecord(other, 10);
+  histogramRecord(other, 100000);
+  histogramMerge(histogram, other);
+  histogramFree(other);
+
+  assertTrue(histogramCount(histogram) == 3);
+  assertTrue(histogramMin(histogram) == 10);
+  assertTrue(histogramMax(histogram) == 100000);
+  assertTrue(closeTo(1000, histogramPercentile(histogram, 50)));
+
+  histogramReset(histogram);
+  assertTrue(histogramCount(histogram) == 0);
+  assertTrue(histogramMax(histogram) == 0);
+}
+
+static void testHistogramCountAtMost(void) {
+  uint64_t count;
+
+  for (uint64_t i = 1; i <= 1000; i++)
+    histogramRecord(histogram, i);
+
+  assertTrue(histogramCountAtMost(histogram, 0) == 0);
+  assertTrue(histogramCountAtMost(histogram, 100) == 100);
+  assertTrue(histogramCountAtMost(histogram, 1000) == 1000);
+  count = histogramCountAtMost(histogram, 500);
+  assertTrue(count <= 500 && count >= 500 - 500 * HISTOGRAM_PRECISION);
+  assertTrue(histogramSum(histogram) == 500500);
+}
+
+
+TestSuite *histogramTestSuite() {
+  TestSuite *suite = testSuiteCreate("latency histogram", &setup, &teardown);
+  testSuiteAdd(suite, "histogram empty", &testHistogramEmpty);
+  testSuiteAdd(suite, "histogram exact", &testHistogramExact);
+  testSuiteAdd(suite, "histogram percentiles", &testHistogramPercentiles);
+  testSuiteAdd(suite, "histogram large", &testHistogramLarge);
+  testSuiteAdd(suite, "histogram merge", &testHistogramMerge);
+  testSuiteAdd(suite, "histogram count at most", &testHistogramCountAtMost);
+  return suite;
+}
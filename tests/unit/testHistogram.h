@@ -0,0 +1,6 @@
+#ifndef __TEST_HISTOGRAM_H__
+#define __TEST_HISTOGRAM_H__
+
+TestSuite *histogramTestSuite(void);
+
+#endif
@@ -4,13 +4,14 @@
 #include "../../src/mmalloc.h"
 
 #include <stdio.h>
+#include <string.h>
 
 
 #define TEST_OBJECT_SIZE 10
 
 
 Json *json;
-char *err;
+static char *err;
 
 
 static void setup(void) {
@@ -288,6 +289,104 @@ static void testJsonConvertComplex(void) {
   }
 }
 
+static void testJsonWriteInPieces(void) {
+  char *values[] = {
+    "{\"foo\":[0,1,2,3.3,3,\"bar\"],\"baz\":{\"fee\":[{\"abc\":\"cde\"}]}}",
+    "[\"a\",\"b\",false,false,true,null,[null,[false,true]]]",
+    "[[[[[[[[[[[[1]]]]]]]]]]],{}]",
+    "42"
+  };
+  size_t limits[] = {1, 7, 1000};
+  Buffer *buffer = bufferCreate(8);
+  JsonWriter *writer;
+  size_t written;
+
+  for (int i = 0; i < arraySize(values); i++) {
+    json = jsonParse(values[i], &err);
+    assertEqual(strlen(values[i]), jsonStringifyLength(json));
+
+    for (int j = 0; j < arraySize(limits); j++) {
+      writer = jsonWriterCreate(json);
+      /* Every piece but the last reaches the limit. */
+      for (written = 0; jsonWriterNext(writer, buffer, limits[j]); written = bufferLength(buffer))
+        assertTrue(bufferLength(buffer) - written >= limits[j]);
+      assertEqual(strlen(values[i]), bufferLength(buffer));
+      assertTrue(!memcmp(values[i], bufferData(buffer), strlen(values[i])));
+      jsonWriterFree(writer);
+      bufferClear(buffer);
+    }
+
+    /* A writer may be dropped halfway through. */
+    writer = jsonWriterCreate(json);
+    jsonWriterNext(writer, buffer, 3);
+    jsonWriterFree(writer);
+    bufferClear(buffer);
+
+    jsonFree(json);
+  }
+
+  bufferFree(buffer);
+}
+
+static void testJsonRetain(void) {
+  json = jsonParse("[1,[2,3]]", &err);
+  assertPointerEqual(json, jsonRetain(json));
+  jsonFree(json);
+  /* Still alive until the last reference is released. */
+  assertEqual(2, listLength(json->arrayValue));
+  jsonFree(json);
+}
+
+static void testJsonSet(void) {
+  Json *updated, *appended, *value = jsonCreateInt(4);
+  char *string;
+
+  json = jsonParse("[1,[2,3]]", &err);
+  updated = jsonSet(json, (const char*[]) {"1", "0"}, 2, jsonCreateInt(9));
+  string = jsonStringify(updated);
+  assertStringEqual("[1,[9,3]]", string);
+  mfree(string);
+
+  /* The original is untouched, and shares what is off the path. */
+  string = jsonStringify(json);
+  assertStringEqual("[1,[2,3]]", string);
+  mfree(string);
+  assertPointerEqual(listGet(json->arrayValue, 0), listGet(updated->arrayValue, 0));
+
+  appended = jsonSet(updated, (const char*[]) {"2"}, 1, jsonCreateTrue());
+  string = jsonStringify(appended);
+  assertStringEqual("[1,[9,3],true]", string);
+  mfree(string);
+
+  /* Each version can be freed while the others are in use. */
+  jsonFree(updated);
+  jsonFree(json);
+  json = appended;
+
+  /* Paths that lead nowhere. */
+  assertNull(jsonSet(json, (const char*[]) {"4"}, 1, value));
+  assertNull(jsonSet(json, (const char*[]) {"-1"}, 1, value));
+  assertNull(jsonSet(json, (const char*[]) {""}, 1, value));
+  assertNull(jsonSet(json, (const char*[]) {"0", "0"}, 2, value));
+  assertNull(jsonSet(json, (const char*[]) {"3", "0"}, 2, value));
+  jsonFree(json);
+
+  json = jsonParse("{\"a\":{\"b\":1}}", &err);
+  updated = jsonSet(json, (const char*[]) {"a", "c"}, 2, value);
+  assertEqual(2, dictSize(((Json*) dictGet(updated->objectValue, "a"))->objectValue));
+  assertEqual(1, dictSize(((Json*) dictGet(json->objectValue, "a"))->objectValue));
+  assertNull(jsonSet(json, (const char*[]) {"x", "y"}, 2, value));
+  jsonFree(updated);
+  jsonFree(json);
+
+  /* An empty path replaces everything. */
+  value = jsonCreateNull();
+  json = jsonParse("[]", &err);
+  assertPointerEqual(value, jsonSet(json, NULL, 0, value));
+  jsonFree(value);
+  jsonFree(json);
+}
+
 
 TestSuite *jsonTestSuite() {
   TestSuite *suite = testSuiteCreate("JSON", &setup, &teardown);
@@ -304,5 +403,8 @@ TestSuite *jsonTestSuite() {
   testSuiteAdd(suite, "stringify arrays", &testJsonStringifyArrays);
   testSuiteAdd(suite, "stringify objects", &testJsonStringifyObjects);
   testSuiteAdd(suite, "convert complex objects", &testJsonConvertComplex);
+  testSuiteAdd(suite, "write in pieces", &testJsonWriteInPieces);
+  testSuiteAdd(suite, "retain", &testJsonRetain);
+  testSuiteAdd(suite, "persistent set", &testJsonSet);
   return suite;
 }
@@ -0,0 +1,131 @@
+#include "../lib.h"
+#include "testLog.h"
+#include "../../src/log.h"
+#include "../../src/mmalloc.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#define DEFAULT_RING_SIZE   4096
+#define LOG_SIZE            (1024 * 1024)
+#define NUM_THREADS         4
+#define NUM_MESSAGES        1000
+
+static FILE *file;
+static Logger *logger;
+static char contents[LOG_SIZE];
+
+
+static void setup(void) {
+  file = tmpfile();
+  logger = loggerCreate(fileno(file), DEFAULT_RING_SIZE);
+}
+
+static void teardown(void) {
+  loggerFree(logger);
+  fclose(file);
+  assertEqual(0, memoryUsage());
+}
+
+/*
+ * Wait for everything logged so far to be written, and read back the whole log.
+ */
+static char *readLog(void) {
+  size_t length;
+
+  loggerFlush(logger);
+  rewind(file);
+  length = fread(contents, 1, LOG_SIZE - 1, file);
+  contents[length] = '\0';
+  return contents;
+}
+
+
+static void testLogOrder(void) {
+  char expected[LOG_SIZE] = "";
+  char line[32];
+
+  for (int i = 0; i < 100; i++) {
+    assertTrue(loggerPrint(logger, "message %d\n", i));
+    sprintf(line, "message %d\n", i);
+    strcat(expected, line);
+  }
+  assertStringEqual(expected, readLog());
+  assertEqual(0, loggerDropped(logger));
+}
+
+static void testLogTruncated(void) {
+  char message[2000];
+
+  memset(message, 'x', sizeof(message) - 1);
+  message[sizeof(message) - 1] = '\0';
+  assertTrue(loggerPrint(logger, "%s\n", message));
+
+  char *log = readLog();
+  assertEqual(1023, strlen(log));
+  assertStringEqual("xx...\n", log + strlen(log) - 6);
+}
+
+static void testLogDropped(void) {
+  Logger *small = loggerCreate(fileno(file), 64);
+  char message[100];
+
+  memset(message, 'x', sizeof(message) - 1);
+  message[sizeof(message) - 1] = '\0';
+
+  /* The message can never fit in the ring, so it is dropped rather than waited for. */
+  assertFalse(loggerPrint(small, "%s", message));
+  assertFalse(loggerPrint(small, "%s", message));
+  assertTrue(loggerPrint(small, "fits\n"));
+  assertEqual(2, loggerDropped(small));
+
+  loggerFree(small);
+  assertStringEqual("fits\nDropped 2 log messages.\n", readLog());
+}
+
+static void *logMessages(void *arg) {
+  long thread = (long) arg;
+  for (int i = 0; i < NUM_MESSAGES; i++)
+    loggerPrint(logger, "thread %ld message %d\n", thread, i);
+  return NULL;
+}
+
+static void testLogConcurrent(void) {
+  pthread_t threads[NUM_THREADS];
+  int last[NUM_THREADS], lines = 0, thread, message;
+  unsigned long dropped = 0, count;
+
+  for (long i = 0; i < NUM_THREADS; i++) {
+    last[i] = -1;
+    pthread_create(&threads[i], NULL, &logMessages, (void*) i);
+  }
+  for (int i = 0; i < NUM_THREADS; i++)
+    pthread_join(threads[i], NULL);
+
+  /* Messages are never torn, and each thread's messages stay in order. */
+  for (char *line = strtok(readLog(), "\n"); line != NULL; line = strtok(NULL, "\n")) {
+    if (sscanf(line, "Dropped %lu log messages.", &count) == 1) {
+      dropped += count;
+      continue;
+    }
+    assertEqual(2, sscanf(line, "thread %d message %d", &thread, &message));
+    assertTrue(message > last[thread]);
+    last[thread] = message;
+    lines++;
+  }
+
+  assertEqual(loggerDropped(logger), dropped);
+  assertEqual(NUM_THREADS * NUM_MESSAGES, lines + dropped);
+}
+
+
+TestSuite *logTestSuite() {
+  TestSuite *suite = testSuiteCreate("asynchronous logger", &setup, &teardown);
+  testSuiteAdd(suite, "log order", &testLogOrder);
+  testSuiteAdd(suite, "log truncated", &testLogTruncated);
+  testSuiteAdd(suite, "log dropped", &testLogDropped);
+  testSuiteAdd(suite, "log concurrent", &testLogConcurrent);
+  return suite;
+}
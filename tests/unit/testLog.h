@@ -0,0 +1,6 @@
+#ifndef __TEST_LOG_H__
+#define __TEST_LOG_H__
+
+TestSuite *logTestSuite(void);
+
+#endif
@@ -0,0 +1,110 @@
+#include "../lib.h"
+#include "testProtocol.h"
+#include "../../src/protocol.h"
+#include "../../src/mmalloc.h"
+
+#include <string.h>
+
+
+#define GET_REQUEST     "*2\r\n$3\r\nget\r\n$3\r\nkey\r\n"
+
+static Request request;
+
+
+static void setup(void) {
+  memset(&request, 0, sizeof(Request));
+}
+
+static void teardown(void) {
+  assertEqual(0, memoryUsage());
+}
+
+
+static void testProtocolIsBinary(void) {
+  assertTrue(protocolIsBinary(GET_REQUEST, strlen(GET_REQUEST)));
+  assertTrue(protocolIsBinary("*", 1));
+  assertFalse(protocolIsBinary("get key\n", 8));
+  assertFalse(protocolIsBinary("", 0));
+}
+
+static void testProtocolParse(void) {
+  char data[] = GET_REQUEST;
+  assertEqual(strlen(GET_REQUEST), protocolParse(data, strlen(data), &request));
+  assertEqual(2, request.argc);
+  assertPointerEqual(data + 8, request.argv[0].data);
+  assertEqual(3, request.argv[0].length);
+  assertTrue(!memcmp("key", request.argv[1].data, 3));
+  assertEqual(3, request.argv[1].length);
+}
+
+static void testProtocolParseBinaryArgs(void) {
+  char data[] = "*3\r\n$3\r\nadd\r\n$7\r\na b\r\n\0c\r\n$9\r\n{\"k\": 1}\n\r\n";
+  size_t length = sizeof(data) - 1;
+  assertEqual(length, protocolParse(data, length, &request));
+  assertEqual(3, request.argc);
+  assertEqual(7, request.argv[1].length);
+  assertTrue(!memcmp("a b\r\n\0c", request.argv[1].data, 7));
+  assertEqual(9, request.argv[2].length);
+  assertTrue(!memcmp("{\"k\": 1}\n", request.argv[2].data, 9));
+}
+
+static void testProtocolParseEmptyArg(void) {
+  char data[] = "*2\r\n$3\r\nget\r\n$0\r\n\r\n";
+  assertEqual(strlen(data), protocolParse(data, strlen(data), &request));
+  assertEqual(0, request.argv[1].length);
+}
+
+static void testProtocolParseIncomplete(void) {
+  char data[] = GET_REQUEST;
+  for (size_t i = 0; i < strlen(data); i++)
+    assertEqual(0, protocolParse(data, i, &request));
+}
+
+static void testProtocolParsePipelined(void) {
+  char data[] = GET_REQUEST GET_REQUEST "*1\r\n";
+  assertEqual(strlen(GET_REQUEST), protocolParse(data, strlen(data), &request));
+  assertEqual(strlen(GET_REQUEST),
+              protocolParse(data + strlen(GET_REQUEST), strlen(data) - strlen(GET_REQUEST), &request));
+}
+
+static void testProtocolParseMalformed(void) {
+  char *malformed[] = {
+    "*0\r\n",
+    "*9\r\n",
+    "*\r\n",
+    "*x\r\n",
+    "*1\n",
+    "*1\r\r",
+    "*1\r\n:4\r\nping\r\n",
+    "*1\r\n$-1\r\n",
+    "*1\r\n$4\r\npingpong",
+    "*1\r\n$1234567890123\r\n"
+  };
+  char data[64];
+  for (int i = 0; i < arraySize(malformed); i++) {
+    strcpy(data, malformed[i]);
+    assertEqual(-1, protocolParse(data, strlen(data), &request));
+  }
+}
+
+static void testProtocolReplyHeader(void) {
+  char header[PROTOCOL_HEADER_SIZE];
+  assertEqual(4, protocolReplyHeader(header, 0));
+  assertStringEqual("$0\r\n", header);
+  assertEqual(8, protocolReplyHeader(header, 12345));
+  assertStringEqual("$12345\r\n", header);
+}
+
+
+TestSuite *protocolTestSuite() {
+  TestSuite *suite = testSuiteCreate("binary protocol", &setup, &teardown);
+  testSuiteAdd(suite, "protocol detection", &testProtocolIsBinary);
+  testSuiteAdd(suite, "protocol parse", &testProtocolParse);
+  testSuiteAdd(suite, "protocol binary arguments", &testProtocolParseBinaryArgs);
+  testSuiteAdd(suite, "protocol empty argument", &testProtocolParseEmptyArg);
+  testSuiteAdd(suite, "protocol incomplete", &testProtocolParseIncomplete);
+  testSuiteAdd(suite, "protocol pipelined", &testProtocolParsePipelined);
+  testSuiteAdd(suite, "protocol malformed", &testProtocolParseMalformed);
+  testSuiteAdd(suite, "protocol reply header", &testProtocolReplyHeader);
+  return suite;
+}
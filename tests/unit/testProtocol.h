@@ -0,0 +1,6 @@
+#ifndef __TEST_PROTOCOL_H__
+#define __TEST_PROTOCOL_H__
+
+TestSuite *protocolTestSuite(void);
+
+#endif
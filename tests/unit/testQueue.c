@@ -0,0 +1,118 @@
+#include "../lib.h"
+#include "testQueue.h"
+#include "../../src/queue.h"
+#include "../../src/mmalloc.h"
+
+#include <pthread.h>
+
+
+#define DEFAULT_QUEUE_SIZE  64
+#define NUM_THREADS         4
+#define NUM_VALUES          10000
+
+static Queue *queue;
+
+
+static void setup(void) {
+  queue = queueCreate(DEFAULT_QUEUE_SIZE);
+}
+
+static void teardown(void) {
+  queueFree(queue);
+  assertEqual(0, memoryUsage());
+}
+
+
+static void testQueueCapacity(void) {
+  Queue *odd = queueCreate(100);
+  assertEqual(128, queueCapacity(odd));
+  queueFree(odd);
+  assertEqual(DEFAULT_QUEUE_SIZE, queueCapacity(queue));
+}
+
+static void testQueueEmpty(void) {
+  assertEqual(0, queueLength(queue));
+  assertNull(queuePop(queue));
+}
+
+static void testQueueFifo(void) {
+  Box *boxes[DEFAULT_QUEUE_SIZE];
+  for (int i = 0; i < DEFAULT_QUEUE_SIZE; i++) {
+    boxes[i] = boxCreate(i);
+    assertTrue(queuePush(queue, boxes[i]));
+  }
+  assertEqual(DEFAULT_QUEUE_SIZE, queueLength(queue));
+  for (int i = 0; i < DEFAULT_QUEUE_SIZE; i++) {
+    Box *box = queuePop(queue);
+    assertEqual(i, boxValue(box));
+    boxFree(box);
+  }
+  assertNull(queuePop(queue));
+}
+
+static void testQueueFull(void) {
+  Box *box = boxCreate(0);
+  for (int i = 0; i < DEFAULT_QUEUE_SIZE; i++)
+    assertTrue(queuePush(queue, box));
+  assertFalse(queuePush(queue, box));
+  /* Popping one value makes room for exactly one more. */
+  assertPointerEqual(box, queuePop(queue));
+  assertTrue(queuePush(queue, box));
+  assertFalse(queuePush(queue, box));
+  while (queuePop(queue) != NULL);
+  boxFree(box);
+}
+
+static void testQueueWrapAround(void) {
+  Box *box = boxCreate(0);
+  for (int i = 0; i < DEFAULT_QUEUE_SIZE * 4; i++) {
+    assertTrue(queuePush(queue, box));
+    assertPointerEqual(box, queuePop(queue));
+  }
+  assertEqual(0, queueLength(queue));
+  boxFree(box);
+}
+
+static void *produce(void *arg) {
+  for (long i = 1; i <= NUM_VALUES; i++)
+    while (!queuePush(queue, (void*) i));
+  return NULL;
+}
+
+static void *consume(void *arg) {
+  long *sum = arg;
+  for (int i = 0; i < NUM_VALUES; i++)
+    *sum += (long) queuePopWait(queue);
+  return NULL;
+}
+
+static void testQueueConcurrent(void) {
+  pthread_t producers[NUM_THREADS], consumers[NUM_THREADS];
+  long sums[NUM_THREADS] = {0}, total = 0;
+
+  for (int i = 0; i < NUM_THREADS; i++) {
+    pthread_create(&consumers[i], NULL, &consume, &sums[i]);
+    pthread_create(&producers[i], NULL, &produce, NULL);
+  }
+  for (int i = 0; i < NUM_THREADS; i++) {
+    pthread_join(producers[i], NULL);
+    pthread_join(consumers[i], NULL);
+    total += sums[i];
+  }
+
+  /* Every value was consumed exactly once. */
+  assertTrue(total == (long) NUM_THREADS * NUM_VALUES * (NUM_VALUES + 1) / 2);
+  assertNull(queuePop(queue));
+}
+
+
+TestSuite *queueTestSuite() {
+  TestSuite *suite = testSuiteCreate("lock-free queue", &setup, &teardown);
+  testSuiteAdd(suite, "queue capacity", &testQueueCapacity);
+  testSuiteAdd(suite, "queue empty", &testQueueEmpty);
+  testSuiteAdd(suite, "queue fifo", &testQueueFifo);
+  testSuiteAdd(suite, "queue full", &testQueueFull);
+  testSuiteAdd(suite, "queue wrap around", &testQueueWrapAround);
+  testSuiteAdd(suite, "queue concurrent", &testQueueConcurrent);
+  return suite;
+}
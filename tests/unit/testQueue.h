@@ -0,0 +1,6 @@
+#ifndef __TEST_QUEUE_H__
+#define __TEST_QUEUE_H__
+
+TestSuite *queueTestSuite(void);
+
+#endif
@@ -0,0 +1,135 @@
+#include "../lib.h"
+#include "testScheduler.h"
+#include "../../src/scheduler.h"
+#include "../../src/mmalloc.h"
+
+#include <pthread.h>
+
+
+#define DEFAULT_WORKERS     2
+#define DEFAULT_CAPACITY    64
+#define NUM_THREADS         4
+#define NUM_VALUES          100000
+#define STOP                ((void*) -1)
+
+static Scheduler *scheduler;
+
+
+static void setup(void) {
+  scheduler = schedulerCreate(DEFAULT_WORKERS, DEFAULT_CAPACITY);
+}
+
+static void teardown(void) {
+  schedulerFree(scheduler);
+  assertEqual(0, memoryUsage());
+}
+
+
+static void testSchedulerEmpty(void) {
+  assertEqual(DEFAULT_WORKERS, schedulerWorkers(scheduler));
+  assertEqual(0, schedulerPending(scheduler));
+  for (int i = 0; i < DEFAULT_WORKERS; i++) {
+    assertEqual(0, schedulerDepth(scheduler, i));
+    assertTrue(schedulerSteals(scheduler, i) == 0);
+    assertTrue(schedulerRuns(scheduler, i) == 0);
+  }
+}
+
+static void testSchedulerSubmitNext(void) {
+  Box *box = boxCreate(1);
+  assertTrue(schedulerSubmit(scheduler, box));
+  assertEqual(1, schedulerPending(scheduler));
+  assertPointerEqual(box, schedulerNext(scheduler, 0));
+  assertEqual(0, schedulerPending(scheduler));
+  assertTrue(schedulerRuns(scheduler, 0) == 1);
+  boxFree(box);
+}
+
+static void testSchedulerFull(void) {
+  Box *box = boxCreate(0);
+  for (int i = 0; i < DEFAULT_CAPACITY; i++)
+    assertTrue(schedulerSubmit(scheduler, box));
+  assertFalse(schedulerSubmit(scheduler, box));
+  for (int i = 0; i < DEFAULT_CAPACITY; i++)
+    assertPointerEqual(box, schedulerNext(scheduler, i % DEFAULT_WORKERS));
+  assertEqual(0, schedulerPending(scheduler));
+  boxFree(box);
+}
+
+static void testSchedulerSteal(void) {
+  Box *boxes[3];
+  for (int i = 0; i < 3; i++) {
+    boxes[i] = boxCreate(i);
+    schedulerSubmit(scheduler, boxes[i]);
+  }
+
+  /* The first worker takes a task and its fair share of the backlog. */
+  assertPointerEqual(boxes[0], schedulerNext(scheduler, 0));
+  assertEqual(1, schedulerDepth(scheduler, 0));
+  assertEqual(1, schedulerPending(scheduler));
+
+  /* The second worker drains the shared queue, then steals. */
+  assertPointerEqual(boxes[2], schedulerNext(scheduler, 1));
+  assertPointerEqual(boxes[1], schedulerNext(scheduler, 1));
+  assertEqual(0, schedulerDepth(scheduler, 0));
+  assertTrue(schedulerSteals(scheduler, 0) == 0);
+  assertTrue(schedulerSteals(scheduler, 1) == 1);
+  assertTrue(schedulerRuns(scheduler, 1) == 2);
+
+  for (int i = 0; i < 3; i++)
+    boxFree(boxes[i]);
+}
+
+typedef struct Run {
+  Scheduler *scheduler;
+  unsigned int worker;
+  long sum;
+} Run;
+
+static void *work(void *arg) {
+  Run *run = arg;
+  void *task;
+  while ((task = schedulerNext(run->scheduler, run->worker)) != STOP)
+    run->sum += (long) task;
+  return NULL;
+}
+
+static void testSchedulerConcurrent(void) {
+  Scheduler *concurrent = schedulerCreate(NUM_THREADS, DEFAULT_CAPACITY);
+  pthread_t threads[NUM_THREADS];
+  Run runs[NUM_THREADS];
+  long total = 0;
+  unsigned long taken = 0;
+
+  for (int i = 0; i < NUM_THREADS; i++) {
+    runs[i] = (Run) { .scheduler = concurrent, .worker = i, .sum = 0 };
+    pthread_create(&threads[i], NULL, &work, &runs[i]);
+  }
+  for (long i = 1; i <= NUM_VALUES; i++)
+    while (!schedulerSubmit(concurrent, (void*) i));
+  /* Each worker stops after one of these, stealing them from each other if need be. */
+  for (int i = 0; i < NUM_THREADS; i++)
+    while (!schedulerSubmit(concurrent, STOP));
+
+  for (int i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+    total += runs[i].sum;
+    taken += schedulerRuns(concurrent, i);
+  }
+
+  /* Every value was run exactly once. */
+  assertTrue(total == (long) NUM_VALUES * (NUM_VALUES + 1) / 2);
+  assertTrue(taken == NUM_VALUES + NUM_THREADS);
+  schedulerFree(concurrent);
+}
+
+
+TestSuite *schedulerTestSuite() {
+  TestSuite *suite = testSuiteCreate("work-stealing scheduler", &setup, &teardown);
+  testSuiteAdd(suite, "scheduler empty", &testSchedulerEmpty);
+  testSuiteAdd(suite, "scheduler submit and next", &testSchedulerSubmitNext);
+  testSuiteAdd(suite, "scheduler full", &testSchedulerFull);
+  testSuiteAdd(suite, "scheduler steal", &testSchedulerSteal);
+  testSuiteAdd(suite, "scheduler concurrent", &testSchedulerConcurrent);
+  return suite;
+}
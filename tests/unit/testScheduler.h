@@ -0,0 +1,6 @@
+#ifndef __TEST_SCHEDULER_H__
+#define __TEST_SCHEDULER_H__
+
+TestSuite *schedulerTestSuite(void);
+
+#endif
@@ -3,6 +3,9 @@
 #include "../../src/server.h"
 #include "../../src/mmalloc.h"
 
+#include <stdio.h>
+#include <string.h>
+
 
 #define TEST_PORT 9876
 
@@ -11,7 +14,7 @@ char *output;
 
 
 static void setup(void) {
-  serverCreate(TEST_PORT, LOG_LEVEL_OFF, "", 1);
+  serverCreate(TEST_PORT, LOG_LEVEL_OFF, "", 1, 16);
 }
 
 static void teardown(void) {
@@ -31,21 +34,134 @@ static void testServerInvalidCommand(void) {
     "abc",
     "invalid-command",
     "f",
-    "235.2"
+    "235.2",
+    "pings",
+    "ge",
+    "getx key",
+    "client-lisp"
   };
   char error[256];
   for (int i = 0; i < arraySize(invalidCommands); i++) {
-    sprintf(error, "Invalid command %s\n", invalidCommands[i]);
+    sprintf(error, "Invalid command %.*s\n", (int) strcspn(invalidCommands[i], " "), invalidCommands[i]);
     output = serverRunCommand(invalidCommands[i]);
     assertStringEqual(error, output);
     mfree(output);
   }
 }
 
+static void testServerCommands(void) {
+  char *commands = serverRunCommand("commands"), *line, *rest, name[32];
+  int numCommands = 0;
+
+  assertTrue(!strncmp("add 2 write document\n", commands, 21));
+
+  /* Every listed command is found by its exact name. */
+  for (line = strtok_r(commands, "\n", &rest); line != NULL; line = strtok_r(NULL, "\n", &rest)) {
+    sscanf(line, "%31s", name);
+    output = serverRunCommand(name);
+    assertTrue(strncmp("Invalid command", output, 15));
+    mfree(output);
+    numCommands++;
+  }
+
+  assertEqual(21, numCommands);
+  mfree(commands);
+}
+
+static void testServerDocument(void) {
+  /* Arguments are split in place, so the commands have to be writable. */
+  char add[] = "add doc  {\"a b\": [1, 2]}", get[] = "get doc", missing[] = "get other";
+
+  output = serverRunCommand(add);
+  assertStringEqual("ok\n", output);
+  mfree(output);
+
+  output = serverRunCommand(get);
+  assertStringEqual("{\"a b\":[1,2]}\n", output);
+  mfree(output);
+
+  output = serverRunCommand(missing);
+  assertStringEqual("nil\n", output);
+  mfree(output);
+}
+
+static void testServerShardsNotListening(void) {
+  output = serverRunCommand("shards");
+  assertStringEqual("nil\n", output);
+  mfree(output);
+}
+
+static void testServerWorkers(void) {
+  output = serverRunCommand("workers");
+  assertStringEqual("worker 0: depth 0 steals 0 runs 0\npending 0\n", output);
+  mfree(output);
+}
+
+static void testServerInfo(void) {
+  char add[] = "add key [1]", get[] = "get key", missing[] = "get nope";
+  mfree(serverRunCommand(add));
+  mfree(serverRunCommand(get));
+  mfree(serverRunCommand(missing));
+
+  output = serverRunCommand("size");
+  assertStringEqual("1\n", output);
+  mfree(output);
+
+  output = serverRunCommand("info");
+  assertTrue(strstr(output, "documents 1\n") != NULL);
+  assertTrue(strstr(output, "commands_run 4\n") != NULL);
+  assertTrue(strstr(output, "command add: calls 1 ") != NULL);
+  /* The missing document counts as a failed call. */
+  assertTrue(strstr(output, "command get: calls 2 ") != NULL);
+  assertTrue(strstr(strstr(output, "command get: "), "errors 1\n") != NULL);
+  assertTrue(strstr(output, "command ping:") == NULL);
+  mfree(output);
+}
+
+static void testServerSlowlog(void) {
+  char get[] = "slowlog get", len[] = "slowlog len", reset[] = "slowlog reset", bad[] = "slowlog bogus";
+
+  /* Nothing is recorded until a threshold is set. */
+  mfree(serverRunCommand("ping"));
+  output = serverRunCommand(len);
+  assertStringEqual("0\n", output);
+  mfree(output);
+  output = serverRunCommand(get);
+  assertStringEqual("nil\n", output);
+  mfree(output);
+
+  output = serverRunCommand(reset);
+  assertStringEqual("ok\n", output);
+  mfree(output);
+  output = serverRunCommand(bad);
+  assertStringEqual("Invalid subcommand bogus for slowlog\n", output);
+  mfree(output);
+}
+
+static void testServerLatency(void) {
+  output = serverRunCommand("latency");
+  assertStringEqual("", output);
+  mfree(output);
+
+  mfree(serverRunCommand("ping"));
+  mfree(serverRunCommand("ping"));
+  output = serverRunCommand("latency");
+  assertTrue(strstr(output, "command ping: count 2 p50 ") != NULL);
+  assertTrue(strstr(output, "command latency: count 1 p50 ") != NULL);
+  mfree(output);
+}
+
 
 TestSuite *serverTestSuite() {
   TestSuite *suite = testSuiteCreate("server operations", &setup, &teardown);
   testSuiteAdd(suite, "basic ping", &testServerPing);
   testSuiteAdd(suite, "invalid command", &testServerInvalidCommand);
+  testSuiteAdd(suite, "command table", &testServerCommands);
+  testSuiteAdd(suite, "document round trip", &testServerDocument);
+  testSuiteAdd(suite, "shards not listening", &testServerShardsNotListening);
+  testSuiteAdd(suite, "worker statistics", &testServerWorkers);
+  testSuiteAdd(suite, "info", &testServerInfo);
+  testSuiteAdd(suite, "slowlog", &testServerSlowlog);
+  testSuiteAdd(suite, "latency", &testServerLatency);
   return suite;
 }
@@ -0,0 +1,110 @@
+#include "../lib.h"
+#include "testSlowlog.h"
+#include "../../src/mmalloc.h"
+#include "../../src/slowlog.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+
+#define SLOWLOG_SIZE        4
+
+static Slowlog *slowlog;
+static SlowlogEntry entry;
+
+
+static void setup(void) {
+  slowlog = slowlogCreate(SLOWLOG_SIZE);
+}
+
+static void teardown(void) {
+  slowlogFree(slowlog);
+  assertEqual(0, memoryUsage());
+}
+
+/*
+ * Record a command with a single argument.
+ */
+static void record(char *arg, uint64_t duration) {
+  Arg argv[] = {{arg, strlen(arg)}};
+  slowlogRecord(slowlog, "get", 1, argv, duration, 7);
+}
+
+
+static void testSlowlogEmpty(void) {
+  assertEqual(0, slowlogLength(slowlog));
+  assertEqual(false, slowlogGet(slowlog, 0, &entry));
+}
+
+static void testSlowlogRecord(void) {
+  Arg argv[] = {{"key", 3}, {"user", 4}, {"[1]", 3}};
+  slowlogRecord(slowlog, "modify", 3, argv, 1234, 5);
+
+  assertEqual(1, slowlogLength(slowlog));
+  assertEqual(true, slowlogGet(slowlog, 0, &entry));
+  assertEqual(1, entry.id);
+  assertTrue(entry.duration == 1234);
+  assertStringEqual("modify", (char*) entry.command);
+  assertEqual(3, entry.argc);
+  assertStringEqual("key", entry.argv[0]);
+  assertStringEqual("user", entry.argv[1]);
+  assertStringEqual("[1]", entry.argv[2]);
+  assertEqual(5, entry.fd);
+  assertTrue(entry.time > 0);
+}
+
+static void testSlowlogOrder(void) {
+  char key[16];
+
+  /* Only the most recent entries are kept, most recent first. */
+  for (int i = 0; i < SLOWLOG_SIZE + 2; i++) {
+    sprintf(key, "key%d", i);
+    record(key, i);
+  }
+  assertEqual(SLOWLOG_SIZE, slowlogLength(slowlog));
+  for (int i = 0; i < SLOWLOG_SIZE; i++) {
+    sprintf(key, "key%d", SLOWLOG_SIZE + 1 - i);
+    assertEqual(true, slowlogGet(slowlog, i, &entry));
+    assertEqual(SLOWLOG_SIZE + 2 - i, entry.id);
+    assertStringEqual(key, entry.argv[0]);
+  }
+  assertEqual(false, slowlogGet(slowlog, SLOWLOG_SIZE, &entry));
+}
+
+static void testSlowlogTruncate(void) {
+  char arg[SLOWLOG_ARG_SIZE * 2];
+  memset(arg, 'x', sizeof(arg) - 1);
+  arg[sizeof(arg) - 1] = '\0';
+  arg[0] = '\n';
+  record(arg, 1);
+
+  slowlogGet(slowlog, 0, &entry);
+  assertEqual(SLOWLOG_ARG_SIZE - 1, strlen(entry.argv[0]));
+  assertEqual('?', entry.argv[0][0]);
+  assertStringEqual("...", entry.argv[0] + SLOWLOG_ARG_SIZE - 4);
+}
+
+static void testSlowlogReset(void) {
+  record("a", 1);
+  record("b", 1);
+  slowlogReset(slowlog);
+  assertEqual(0, slowlogLength(slowlog));
+
+  /* Ids keep increasing across a reset. */
+  record("c", 1);
+  slowlogGet(slowlog, 0, &entry);
+  assertEqual(3, entry.id);
+  assertStringEqual("c", entry.argv[0]);
+}
+
+
+TestSuite *slowlogTestSuite() {
+  TestSuite *suite = testSuiteCreate("slowlog", &setup, &teardown);
+  testSuiteAdd(suite, "slowlog empty", &testSlowlogEmpty);
+  testSuiteAdd(suite, "slowlog record", &testSlowlogRecord);
+  testSuiteAdd(suite, "slowlog order", &testSlowlogOrder);
+  testSuiteAdd(suite, "slowlog truncate", &testSlowlogTruncate);
+  testSuiteAdd(suite, "slowlog reset", &testSlowlogReset);
+  return suite;
+}
@@ -0,0 +1,6 @@
+#ifndef __TEST_SLOWLOG_H__
+#define __TEST_SLOWLOG_H__
+
+TestSuite *slowlogTestSuite(void);
+
+#endif
@@ -0,0 +1,115 @@
+#include "../lib.h"
+#include "testStats.h"
+#include "../../src/mmalloc.h"
+#include "../../src/stats.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+
+#define NUM_COMMANDS        4
+#define NUM_THREADS         4
+#define NUM_CALLS           10000
+
+static Stats *stats;
+
+
+static void setup(void) {
+  stats = statsCreate(NUM_COMMANDS);
+}
+
+static void teardown(void) {
+  statsFree(stats);
+  assertEqual(0, memoryUsage());
+}
+
+/*
+ * Count calls of every command, failing every tenth one.
+ */
+static void *countCalls(void *arg) {
+  for (int i = 0; i < NUM_CALLS; i++) {
+    statsRecordCommand(stats, i % NUM_COMMANDS, 2, i % 10 == 0);
+    statsRecordBytesIn(stats, 3);
+    statsRecordBytesOut(stats, 5);
+  }
+  return NULL;
+}
+
+
+static void testStatsEmpty(void) {
+  CommandStats command;
+  statsCommand(stats, 0, &command);
+  assertTrue(command.calls == 0 && command.usec == 0 && command.errors == 0);
+  assertTrue(statsCalls(stats) == 0);
+  assertTrue(statsBytesIn(stats) == 0);
+  assertTrue(statsBytesOut(stats) == 0);
+}
+
+static void testStatsRecord(void) {
+  CommandStats command;
+  statsRecordCommand(stats, 1, 10, false);
+  statsRecordCommand(stats, 1, 20, true);
+  statsRecordCommand(stats, 3, 5, false);
+
+  statsCommand(stats, 1, &command);
+  assertTrue(command.calls == 2 && command.usec == 30 && command.errors == 1);
+  statsCommand(stats, 2, &command);
+  assertTrue(command.calls == 0);
+  assertTrue(statsCalls(stats) == 3);
+}
+
+static void testStatsThreads(void) {
+  pthread_t threads[NUM_THREADS];
+  CommandStats command;
+  uint64_t errors = 0;
+
+  for (int i = 0; i < NUM_THREADS; i++)
+    pthread_create(&threads[i], NULL, &countCalls, NULL);
+  countCalls(NULL);
+  for (int i = 0; i < NUM_THREADS; i++)
+    pthread_join(threads[i], NULL);
+
+  /* Every thread's counters are added up. */
+  assertTrue(statsCalls(stats) == (NUM_THREADS + 1) * NUM_CALLS);
+  assertTrue(statsBytesIn(stats) == (NUM_THREADS + 1) * NUM_CALLS * 3);
+  assertTrue(statsBytesOut(stats) == (NUM_THREADS + 1) * NUM_CALLS * 5);
+  statsCommand(stats, 0, &command);
+  assertTrue(command.calls == (NUM_THREADS + 1) * NUM_CALLS / NUM_COMMANDS);
+  assertTrue(command.usec == command.calls * 2);
+  for (int i = 0; i < NUM_COMMANDS; i++) {
+    statsCommand(stats, i, &command);
+    errors += command.errors;
+  }
+  assertTrue(errors == (NUM_THREADS + 1) * NUM_CALLS / 10);
+}
+
+static void testStatsLatency(void) {
+  Histogram *latency = histogramCreate();
+  pthread_t thread;
+
+  statsRecordCommand(stats, 2, 100, false);
+  statsRecordCommand(stats, 2, 300, false);
+  pthread_create(&thread, NULL, &countCalls, NULL);
+  pthread_join(thread, NULL);
+
+  /* Each thread's histogram is merged in. */
+  statsLatency(stats, 2, latency);
+  assertTrue(histogramCount(latency) == 2 + NUM_CALLS / NUM_COMMANDS);
+  assertTrue(histogramMin(latency) == 2);
+  assertTrue(histogramMax(latency) == 300);
+
+  histogramReset(latency);
+  statsLatency(stats, 0, latency);
+  assertTrue(histogramCount(latency) == NUM_CALLS / NUM_COMMANDS);
+  histogramFree(latency);
+}
+
+
+TestSuite *statsTestSuite() {
+  TestSuite *suite = testSuiteCreate("statistics", &setup, &teardown);
+  testSuiteAdd(suite, "stats empty", &testStatsEmpty);
+  testSuiteAdd(suite, "stats record", &testStatsRecord);
+  testSuiteAdd(suite, "stats threads", &testStatsThreads);
+  testSuiteAdd(suite, "stats latency", &testStatsLatency);
+  return suite;
+}
@@ -0,0 +1,6 @@
+#ifndef __TEST_STATS_H__
+#define __TEST_STATS_H__
+
+TestSuite *statsTestSuite(void);
+
+#endif
@@ -0,0 +1,177 @@
+#include "../lib.h"
+#include "testStore.h"
+#include "../../src/doc.h"
+#include "../../src/epoch.h"
+#include "../../src/mmalloc.h"
+#include "../../src/store.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+#define STORE_THREADS     4
+#define STORE_KEYS        64
+#define STORE_ROUNDS      5000
+
+static Epoch *epoch;
+static Store *store;
+
+
+static void setup(void) {
+  epoch = epochCreate();
+  store = storeCreate(4, epoch);
+}
+
+static void teardown(void) {
+  storeFree(store);
+  epochFree(epoch);
+  assertEqual(0, memoryUsage());
+}
+
+static Document *createDocument(char *key, int value) {
+  return documentCreate(key, jsonCreateInt(value));
+}
+
+static int documentValue(Document *doc) {
+  int value = documentGetContents(doc)->intValue;
+  documentFree(doc);
+  return value;
+}
+
+
+static void testStoreShards(void) {
+  Store *other = storeCreate(5, epoch);
+  assertEqual(4, storeShards(store));
+  assertEqual(8, storeShards(other));
+  storeFree(other);
+}
+
+static void testStoreSetGet(void) {
+  assertNull(storeGet(store, "a"));
+  storeSet(store, "a", createDocument("a", 1));
+  storeSet(store, "b", createDocument("b", 2));
+  assertEqual(2, storeSize(store));
+  assertEqual(1, documentValue(storeGet(store, "a")));
+  assertEqual(2, documentValue(storeGet(store, "b")));
+
+  /* Setting a key again replaces its document. */
+  storeSet(store, "a", createDocument("a", 3));
+  assertEqual(2, storeSize(store));
+  assertEqual(3, documentValue(storeGet(store, "a")));
+}
+
+static void testStoreRemove(void) {
+  storeSet(store, "a", createDocument("a", 1));
+  assertEqual(true, storeRemove(store, "a"));
+  assertEqual(false, storeRemove(store, "a"));
+  assertNull(storeGet(store, "a"));
+  assertEqual(0, storeSize(store));
+}
+
+static void testStoreKeepsReference(void) {
+  Document *doc;
+
+  storeSet(store, "a", createDocument("a", 1));
+  doc = storeGet(store, "a");
+  storeRemove(store, "a");
+
+  /* The lookup's reference outlives the removal. */
+  assertEqual(1, documentValue(doc));
+}
+
+static void testStoreLookup(void) {
+  Document *doc;
+
+  epochOnline(epoch);
+  assertNull(storeLookup(store, "a"));
+  storeSet(store, "a", createDocument("a", 1));
+  doc = storeLookup(store, "a");
+  assertPointerEqual(doc, storeLookup(store, "a"));
+
+  /* A borrowed document outlives its removal until the reader moves on. */
+  storeRemove(store, "a");
+  assertNull(storeLookup(store, "a"));
+  assertEqual(1, epochPending(epoch));
+  assertEqual(1, documentGetContents(doc)->intValue);
+
+  epochQuiescent(epoch);
+  assertEqual(1, epochReclaim(epoch));
+  epochOffline(epoch);
+}
+
+static void testStoreGrow(void) {
+  char key[32];
+  int numKeys = 10000;
+
+  for (int i = 0; i < numKeys; i++) {
+    sprintf(key, "key%d", i);
+    storeSet(store, key, createDocument(key, i));
+  }
+  assertEqual(numKeys, storeSize(store));
+
+  for (int i = 0; i < numKeys; i++) {
+    sprintf(key, "key%d", i);
+    assertEqual(i, documentValue(storeGet(store, key)));
+  }
+
+  /* Nobody was reading, so the outgrown tables can all go. */
+  epochReclaim(epoch);
+  assertEqual(0, epochPending(epoch));
+}
+
+static void *storeJob(void *arg) {
+  unsigned int id = (uintptr_t) arg;
+  Document *doc;
+  char key[32];
+
+  for (int i = 0; i < STORE_ROUNDS; i++) {
+    sprintf(key, "key%d", (i * 7 + id) % STORE_KEYS);
+    switch (i % 3) {
+      case 0: storeSet(store, key, createDocument(key, i)); break;
+      case 1:
+        epochOnline(epoch);
+        if ((doc = storeLookup(store, key)) != NULL)
+          assertEqual(true, documentGetContents(doc)->intValue < STORE_ROUNDS);
+        epochOffline(epoch);
+        break;
+      case 2: storeRemove(store, key); break;
+    }
+  }
+  return NULL;
+}
+
+static void testStoreConcurrent(void) {
+  pthread_t threads[STORE_THREADS];
+  char key[32];
+  unsigned int found = 0;
+  Document *doc;
+
+  for (int i = 0; i < STORE_THREADS; i++)
+    pthread_create(&threads[i], NULL, &storeJob, (void*) (uintptr_t) i);
+  for (int i = 0; i < STORE_THREADS; i++)
+    pthread_join(threads[i], NULL);
+
+  /* The size counts exactly the documents left. */
+  for (int i = 0; i < STORE_KEYS; i++) {
+    sprintf(key, "key%d", i);
+    if ((doc = storeGet(store, key)) != NULL) {
+      found++;
+      documentFree(doc);
+    }
+  }
+  assertEqual(found, storeSize(store));
+}
+
+
+TestSuite *storeTestSuite() {
+  TestSuite *suite = testSuiteCreate("document store", &setup, &teardown);
+  testSuiteAdd(suite, "store shards", &testStoreShards);
+  testSuiteAdd(suite, "store set and get", &testStoreSetGet);
+  testSuiteAdd(suite, "store remove", &testStoreRemove);
+  testSuiteAdd(suite, "store keeps reference", &testStoreKeepsReference);
+  testSuiteAdd(suite, "store lookup", &testStoreLookup);
+  testSuiteAdd(suite, "store grow", &testStoreGrow);
+  testSuiteAdd(suite, "store concurrent", &testStoreConcurrent);
+  return suite;
+}
@@ -0,0 +1,6 @@
+#ifndef __TEST_STORE_H__
+#define __TEST_STORE_H__
+
+TestSuite *storeTestSuite(void);
+
+#endif
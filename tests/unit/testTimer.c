@@ -0,0 +1,139 @@
+#include "../lib.h"
+#include "testTimer.h"
+#include "../../src/mmalloc.h"
+#include "../../src/timer.h"
+
+#include <stdint.h>
+
+
+#define TICK        10
+#define START       1000
+
+static TimerWheel *wheel;
+static uint64_t fired[16];
+static unsigned int numFired;
+
+
+static void setup(void) {
+  wheel = timerWheelCreate(START, TICK);
+  numFired = 0;
+}
+
+static void teardown(void) {
+  timerWheelFree(wheel);
+  assertEqual(0, memoryUsage());
+}
+
+/*
+ * Record when the timer ran, and stop it.
+ */
+static uint64_t recordFired(Timer *timer, uint64_t now) {
+  fired[numFired++] = now;
+  return 0;
+}
+
+/*
+ * Record when the timer ran, and run it again as many times as its data says.
+ */
+static uint64_t repeatFired(Timer *timer, uint64_t now) {
+  unsigned int *remaining = timer->data;
+  fired[numFired++] = now;
+  return --*remaining > 0 ? now + 100 : 0;
+}
+
+
+static void testTimerFiresInOrder(void) {
+  Timer timers[3];
+  timerInit(&timers[0], &recordFired, NULL);
+  timerInit(&timers[1], &recordFired, NULL);
+  timerInit(&timers[2], &recordFired, NULL);
+  timerWheelAdd(wheel, &timers[0], START + 50);
+  timerWheelAdd(wheel, &timers[1], START + 25);
+  timerWheelAdd(wheel, &timers[2], START + 500);
+  assertEqual(3, timerWheelSize(wheel));
+  assertEqual(true, timerPending(&timers[0]));
+
+  /* Timers never run early: 25 rounds up to the third tick. */
+  assertEqual(0, timerWheelAdvance(wheel, START + 29));
+  assertEqual(1, timerWheelAdvance(wheel, START + 30));
+  assertEqual(1, timerWheelAdvance(wheel, START + 60));
+  assertEqual(false, timerPending(&timers[0]));
+  assertEqual(1, timerWheelAdvance(wheel, START + 1000));
+  assertEqual(0, timerWheelSize(wheel));
+  assertEqual(3, numFired);
+}
+
+static void testTimerRemove(void) {
+  Timer timer;
+  timerInit(&timer, &recordFired, NULL);
+  timerWheelAdd(wheel, &timer, START + 50);
+  timerWheelRemove(wheel, &timer);
+  assertEqual(false, timerPending(&timer));
+  assertEqual(0, timerWheelSize(wheel));
+  /* Removing again does nothing. */
+  timerWheelRemove(wheel, &timer);
+  assertEqual(0, timerWheelAdvance(wheel, START + 100));
+  assertEqual(0, numFired);
+}
+
+static void testTimerMove(void) {
+  Timer timer;
+  timerInit(&timer, &recordFired, NULL);
+  timerWheelAdd(wheel, &timer, START + 50);
+  timerWheelAdd(wheel, &timer, START + 5000);
+  assertEqual(1, timerWheelSize(wheel));
+  assertEqual(0, timerWheelAdvance(wheel, START + 4990));
+  assertEqual(1, timerWheelAdvance(wheel, START + 5000));
+  assertEqual(START + 5000, fired[0]);
+}
+
+static void testTimerRepeat(void) {
+  Timer timer;
+  unsigned int remaining = 3;
+  timerInit(&timer, &repeatFired, &remaining);
+  timerWheelAdd(wheel, &timer, START + 100);
+
+  assertEqual(1, timerWheelAdvance(wheel, START + 100));
+  assertEqual(true, timerPending(&timer));
+  assertEqual(1, timerWheelAdvance(wheel, START + 200));
+  /* Falling behind runs the timer on the next tick, not once per missed period. */
+  assertEqual(1, timerWheelAdvance(wheel, START + 10000));
+  assertEqual(false, timerPending(&timer));
+  assertEqual(3, numFired);
+}
+
+static void testTimerExpired(void) {
+  Timer timer;
+  timerInit(&timer, &recordFired, NULL);
+  timerWheelAdd(wheel, &timer, START - 500);
+  assertEqual(1, timerWheelAdvance(wheel, START + TICK));
+}
+
+static void testTimerCascade(void) {
+  /* One timer in each level of the wheel, run on exactly the right tick. */
+  uint64_t delays[] = {70, 700, 70000, 7000000, 700000000};
+  Timer timers[arraySize(delays)];
+
+  for (int i = 0; i < arraySize(delays); i++) {
+    timerInit(&timers[i], &recordFired, NULL);
+    timerWheelAdd(wheel, &timers[i], START + delays[i]);
+  }
+
+  for (int i = 0; i < arraySize(delays); i++) {
+    assertEqual(0, timerWheelAdvance(wheel, START + delays[i] - TICK));
+    assertEqual(1, timerWheelAdvance(wheel, START + delays[i]));
+  }
+  assertEqual(0, timerWheelSize(wheel));
+}
+
+
+TestSuite *timerTestSuite() {
+  TestSuite *suite = testSuiteCreate("timer wheel", &setup, &teardown);
+  testSuiteAdd(suite, "timer fires in order", &testTimerFiresInOrder);
+  testSuiteAdd(suite, "timer remove", &testTimerRemove);
+  testSuiteAdd(suite, "timer move", &testTimerMove);
+  testSuiteAdd(suite, "timer repeat", &testTimerRepeat);
+  testSuiteAdd(suite, "timer expired", &testTimerExpired);
+  testSuiteAdd(suite, "timer cascade", &testTimerCascade);
+  return suite;
+}
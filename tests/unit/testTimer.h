@@ -0,0 +1,6 @@
+#ifndef __TEST_TIMER_H__
+#define __TEST_TIMER_H__
+
+TestSuite *timerTestSuite(void);
+
+#endif